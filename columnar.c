@@ -0,0 +1,714 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <standardloop/util.h>
+
+#include "./json.h"
+
+static bool isColumnarScalar(enum JSONValueType);
+static bool columnsReserve(JSONColumns *, u_int32_t);
+static bool columnAdoptType(JSONColumn *, enum JSONValueType, u_int32_t);
+static bool columnAppend(JSONColumn *, JSONValue *, u_int32_t, u_int32_t);
+static bool columnsKeyEquals(JSONColumns *, char *, char *);
+static void freeJSONColumn(JSONColumns *, JSONColumn *);
+
+static bool isColumnarScalar(enum JSONValueType value_type)
+{
+    return value_type == JSONNUMBER_INT_t || value_type == JSONNUMBER_DOUBLE_t || value_type == JSONBOOL_t || value_type == JSONSTRING_t || value_type == JSONNULL_t;
+}
+
+extern bool JSONBitsetGet(u_int8_t *bits, u_int32_t index)
+{
+    return (bits[index >> 3] >> (index & 7)) & 1;
+}
+
+extern void JSONBitsetSet(u_int8_t *bits, u_int32_t index, bool value)
+{
+    if (value)
+    {
+        bits[index >> 3] |= (u_int8_t)(1 << (index & 7));
+    }
+    else
+    {
+        bits[index >> 3] &= (u_int8_t) ~(1 << (index & 7));
+    }
+}
+
+// grows (or creates, when bits is NULL) a bitset, new bits are cleared
+extern u_int8_t *JSONBitsetResize(u_int8_t *bits, u_int32_t old_capacity, u_int32_t new_capacity)
+{
+    size_t old_bytes = bits == NULL ? 0 : (old_capacity + 7) / 8;
+    size_t new_bytes = (new_capacity + 7) / 8;
+    u_int8_t *new_bits = realloc(bits, new_bytes);
+    if (new_bits == NULL)
+    {
+        return NULL;
+    }
+    memset(new_bits + old_bytes, 0, new_bytes - old_bytes);
+    return new_bits;
+}
+
+static bool columnsKeyEquals(JSONColumns *columns, char *column_key, char *key)
+{
+    if (columns->key_table != NULL)
+    {
+        return column_key == key;
+    }
+    return strcmp(column_key, key) == 0;
+}
+
+// Only flat objects (every member a scalar) can become a row.
+extern bool JSONColumnsIsRowCandidate(JSONValue *json_value)
+{
+    if (json_value == NULL || json_value->value_type != JSONOBJ_t || json_value->value == NULL)
+    {
+        return false;
+    }
+    HashMap *map = json_value->value;
+    if (map->size == 0)
+    {
+        return false;
+    }
+    for (u_int32_t i = 0; i < map->entries_used; i++)
+    {
+        if (map->entries[i] != NULL && !isColumnarScalar(map->entries[i]->value_type))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+extern JSONColumns *JSONColumnsInit(HashMap *shape)
+{
+    if (shape == NULL || shape->size == 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    JSONColumns *columns = malloc(sizeof(JSONColumns));
+    if (columns == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    columns->row_count = 0;
+    columns->row_capacity = 0;
+    columns->column_count = 0;
+    columns->key_table = shape->key_table;
+    columns->columns = malloc(sizeof(JSONColumn) * shape->size);
+    if (columns->columns == NULL)
+    {
+        free(columns);
+        errno = ENOMEM;
+        return NULL;
+    }
+    for (u_int32_t i = 0; i < shape->entries_used; i++)
+    {
+        JSONValue *entry = shape->entries[i];
+        if (entry == NULL)
+        {
+            continue;
+        }
+        JSONColumn *column = &columns->columns[columns->column_count];
+        memset(column, 0, sizeof(JSONColumn));
+        column->value_type = JSONNULL_t;
+        column->key = columns->key_table != NULL ? entry->key : strdup(entry->key);
+        if (column->key == NULL)
+        {
+            FreeJSONColumns(columns);
+            errno = ENOMEM;
+            return NULL;
+        }
+        columns->column_count++;
+    }
+    return columns;
+}
+
+static void freeJSONColumn(JSONColumns *columns, JSONColumn *column)
+{
+    if (columns->key_table == NULL)
+    {
+        free(column->key);
+    }
+    free(column->nulls);
+    free(column->ints);
+    free(column->doubles);
+    free(column->bools);
+    free(column->string_offsets);
+    free(column->string_data);
+}
+
+extern void FreeJSONColumns(JSONColumns *columns)
+{
+    if (columns == NULL)
+    {
+        errno = EINVAL;
+        return;
+    }
+    for (u_int32_t i = 0; i < columns->column_count; i++)
+    {
+        freeJSONColumn(columns, &columns->columns[i]);
+    }
+    free(columns->columns);
+    free(columns);
+}
+
+// The row must have the same keys in the same order, and each value must be
+// null or of the column's type (a column holding only nulls takes any type).
+extern bool JSONColumnsRowMatches(JSONColumns *columns, HashMap *row)
+{
+    if (columns == NULL || row == NULL || row->size != columns->column_count)
+    {
+        return false;
+    }
+    if (row->key_table != columns->key_table)
+    {
+        return false;
+    }
+    u_int32_t column_index = 0;
+    for (u_int32_t i = 0; i < row->entries_used; i++)
+    {
+        JSONValue *entry = row->entries[i];
+        if (entry == NULL)
+        {
+            continue;
+        }
+        JSONColumn *column = &columns->columns[column_index];
+        if (!columnsKeyEquals(columns, column->key, entry->key) || !isColumnarScalar(entry->value_type))
+        {
+            return false;
+        }
+        if (entry->value_type != JSONNULL_t && column->value_type != JSONNULL_t && entry->value_type != column->value_type)
+        {
+            return false;
+        }
+        column_index++;
+    }
+    return true;
+}
+
+static bool columnsReserve(JSONColumns *columns, u_int32_t needed)
+{
+    if (needed <= columns->row_capacity)
+    {
+        return true;
+    }
+    u_int32_t new_capacity = columns->row_capacity == 0 ? DEFAULT_DYN_ARR_SIZE : columns->row_capacity;
+    while (new_capacity < needed)
+    {
+        new_capacity *= DEFAULT_DYN_ARR_RESIZE_MULTIPLE;
+    }
+    for (u_int32_t i = 0; i < columns->column_count; i++)
+    {
+        JSONColumn *column = &columns->columns[i];
+        if (column->nulls != NULL)
+        {
+            u_int8_t *nulls = JSONBitsetResize(column->nulls, columns->row_capacity, new_capacity);
+            if (nulls == NULL)
+            {
+                return false;
+            }
+            column->nulls = nulls;
+        }
+        if (column->ints != NULL)
+        {
+            int64_t *ints = realloc(column->ints, sizeof(int64_t) * new_capacity);
+            if (ints == NULL)
+            {
+                return false;
+            }
+            column->ints = ints;
+        }
+        if (column->doubles != NULL)
+        {
+            double *doubles = realloc(column->doubles, sizeof(double) * new_capacity);
+            if (doubles == NULL)
+            {
+                return false;
+            }
+            column->doubles = doubles;
+        }
+        if (column->bools != NULL)
+        {
+            u_int8_t *bools = JSONBitsetResize(column->bools, columns->row_capacity, new_capacity);
+            if (bools == NULL)
+            {
+                return false;
+            }
+            column->bools = bools;
+        }
+        if (column->string_offsets != NULL)
+        {
+            u_int64_t *string_offsets = realloc(column->string_offsets, sizeof(u_int64_t) * new_capacity);
+            if (string_offsets == NULL)
+            {
+                return false;
+            }
+            column->string_offsets = string_offsets;
+        }
+    }
+    columns->row_capacity = new_capacity;
+    return true;
+}
+
+// Called the first time a column sees a non-null value; earlier rows are
+// already marked in the null bitmap.
+static bool columnAdoptType(JSONColumn *column, enum JSONValueType value_type, u_int32_t row_capacity)
+{
+    switch (value_type)
+    {
+    case JSONNUMBER_INT_t:
+        column->ints = calloc(row_capacity, sizeof(int64_t));
+        if (column->ints == NULL)
+        {
+            return false;
+        }
+        break;
+    case JSONNUMBER_DOUBLE_t:
+        column->doubles = calloc(row_capacity, sizeof(double));
+        if (column->doubles == NULL)
+        {
+            return false;
+        }
+        break;
+    case JSONBOOL_t:
+        column->bools = JSONBitsetResize(NULL, 0, row_capacity);
+        if (column->bools == NULL)
+        {
+            return false;
+        }
+        break;
+    case JSONSTRING_t:
+        column->string_offsets = calloc(row_capacity, sizeof(u_int64_t));
+        if (column->string_offsets == NULL)
+        {
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+    column->value_type = value_type;
+    return true;
+}
+
+static bool columnAppend(JSONColumn *column, JSONValue *entry, u_int32_t row, u_int32_t row_capacity)
+{
+    if (entry->value_type == JSONNULL_t)
+    {
+        if (column->nulls == NULL)
+        {
+            column->nulls = JSONBitsetResize(NULL, 0, row_capacity);
+            if (column->nulls == NULL)
+            {
+                return false;
+            }
+        }
+        JSONBitsetSet(column->nulls, row, true);
+        if (column->string_offsets != NULL)
+        {
+            column->string_offsets[row] = 0;
+        }
+        return true;
+    }
+    if (column->value_type == JSONNULL_t && !columnAdoptType(column, entry->value_type, row_capacity))
+    {
+        return false;
+    }
+    switch (column->value_type)
+    {
+    case JSONNUMBER_INT_t:
+        column->ints[row] = *(int64_t *)entry->value;
+        break;
+    case JSONNUMBER_DOUBLE_t:
+        column->doubles[row] = *(double *)entry->value;
+        break;
+    case JSONBOOL_t:
+        JSONBitsetSet(column->bools, row, *(bool *)entry->value);
+        break;
+    case JSONSTRING_t:
+    {
+        u_int64_t len = strlen((char *)entry->value) + 1;
+        if (column->string_data_len + len > column->string_data_capacity)
+        {
+            u_int64_t new_capacity = column->string_data_capacity == 0 ? 256 : column->string_data_capacity;
+            while (column->string_data_len + len > new_capacity)
+            {
+                new_capacity *= DEFAULT_DYN_ARR_RESIZE_MULTIPLE;
+            }
+            char *string_data = realloc(column->string_data, new_capacity);
+            if (string_data == NULL)
+            {
+                return false;
+            }
+            column->string_data = string_data;
+            column->string_data_capacity = new_capacity;
+        }
+        memcpy(column->string_data + column->string_data_len, entry->value, len);
+        column->string_offsets[row] = column->string_data_len;
+        column->string_data_len += len;
+        break;
+    }
+    default:
+        return false;
+    }
+    return true;
+}
+
+// Appends a copy of the row's values; the row itself is left untouched.
+extern bool JSONColumnsAppendRow(JSONColumns *columns, HashMap *row)
+{
+    if (!JSONColumnsRowMatches(columns, row))
+    {
+        return false;
+    }
+    if (!columnsReserve(columns, columns->row_count + 1))
+    {
+        errno = ENOMEM;
+        return false;
+    }
+    u_int32_t column_index = 0;
+    for (u_int32_t i = 0; i < row->entries_used; i++)
+    {
+        if (row->entries[i] == NULL)
+        {
+            continue;
+        }
+        if (!columnAppend(&columns->columns[column_index], row->entries[i], columns->row_count, columns->row_capacity))
+        {
+            errno = ENOMEM;
+            return false;
+        }
+        column_index++;
+    }
+    columns->row_count++;
+    return true;
+}
+
+// Whether a value of value_type under key can go into column column_index,
+// for rows built one cell at a time while parsing.
+extern bool JSONColumnsCellFits(JSONColumns *columns, u_int32_t column_index, char *key, enum JSONValueType value_type)
+{
+    if (columns == NULL || key == NULL || column_index >= columns->column_count || !isColumnarScalar(value_type))
+    {
+        return false;
+    }
+    JSONColumn *column = &columns->columns[column_index];
+    if (strcmp(column->key, key) != 0)
+    {
+        return false;
+    }
+    return value_type == JSONNULL_t || column->value_type == JSONNULL_t || value_type == column->value_type;
+}
+
+// Appends a row given as one cell per column, in column order, each already
+// checked with JSONColumnsCellFits. The cells' keys are not looked at and the
+// cells are left untouched.
+extern bool JSONColumnsAppendCells(JSONColumns *columns, JSONValue *cells)
+{
+    if (columns == NULL || cells == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    if (!columnsReserve(columns, columns->row_count + 1))
+    {
+        errno = ENOMEM;
+        return false;
+    }
+    for (u_int32_t i = 0; i < columns->column_count; i++)
+    {
+        if (!columnAppend(&columns->columns[i], &cells[i], columns->row_count, columns->row_capacity))
+        {
+            errno = ENOMEM;
+            return false;
+        }
+    }
+    columns->row_count++;
+    return true;
+}
+
+extern bool JSONColumnIsNull(JSONColumn *column, u_int32_t row)
+{
+    if (column == NULL)
+    {
+        errno = EINVAL;
+        return true;
+    }
+    if (column->value_type == JSONNULL_t)
+    {
+        return true;
+    }
+    return column->nulls != NULL && JSONBitsetGet(column->nulls, row);
+}
+
+extern bool JSONColumnGetBool(JSONColumn *column, u_int32_t row)
+{
+    if (column == NULL || column->bools == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    return JSONBitsetGet(column->bools, row);
+}
+
+extern char *JSONColumnGetString(JSONColumn *column, u_int32_t row)
+{
+    if (column == NULL || column->string_offsets == NULL || JSONColumnIsNull(column, row))
+    {
+        return NULL;
+    }
+    return column->string_data + column->string_offsets[row];
+}
+
+extern JSONColumn *JSONColumnsGetColumn(JSONColumns *columns, char *key)
+{
+    if (columns == NULL || key == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    for (u_int32_t i = 0; i < columns->column_count; i++)
+    {
+        if (strcmp(columns->columns[i].key, key) == 0)
+        {
+            return &columns->columns[i];
+        }
+    }
+    return NULL;
+}
+
+// Builds the JSONValue a column holds for row, with its own copy of the value.
+extern JSONValue *JSONColumnGetValue(JSONColumns *columns, JSONColumn *column, u_int32_t row)
+{
+    if (columns == NULL || column == NULL || row >= columns->row_count)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    void *value = NULL;
+    enum JSONValueType value_type = JSONNULL_t;
+    if (!JSONColumnIsNull(column, row))
+    {
+        value_type = column->value_type;
+        switch (value_type)
+        {
+        case JSONNUMBER_INT_t:
+            value = malloc(sizeof(int64_t));
+            if (value != NULL)
+            {
+                *(int64_t *)value = column->ints[row];
+            }
+            break;
+        case JSONNUMBER_DOUBLE_t:
+            value = malloc(sizeof(double));
+            if (value != NULL)
+            {
+                *(double *)value = column->doubles[row];
+            }
+            break;
+        case JSONBOOL_t:
+            value = malloc(sizeof(bool));
+            if (value != NULL)
+            {
+                *(bool *)value = JSONBitsetGet(column->bools, row);
+            }
+            break;
+        case JSONSTRING_t:
+            value = strdup(JSONColumnGetString(column, row));
+            break;
+        default:
+            break;
+        }
+        if (value == NULL)
+        {
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+    char *key = columns->key_table != NULL ? column->key : strdup(column->key);
+    JSONValue *json_value = JSONValueInit(value_type, value, key);
+    if (json_value == NULL)
+    {
+        if (columns->key_table == NULL)
+        {
+            free(key);
+        }
+        free(value);
+        errno = ENOMEM;
+    }
+    return json_value;
+}
+
+extern HashMap *JSONColumnsRowToHashMap(JSONColumns *columns, u_int32_t row)
+{
+    if (columns == NULL || row >= columns->row_count)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    u_int32_t capacity = (columns->column_count * 3) / 2 + HASHMAP_MIN_CAPACITY;
+    HashMap *map = NULL;
+    if (columns->key_table != NULL)
+    {
+        map = HashMapInitWithKeyTable(capacity, columns->key_table);
+    }
+    else
+    {
+        map = HashMapInit(capacity, NULL, false);
+    }
+    if (map == NULL)
+    {
+        return NULL;
+    }
+    for (u_int32_t i = 0; i < columns->column_count; i++)
+    {
+        JSONValue *entry = JSONColumnGetValue(columns, &columns->columns[i], row);
+        if (entry == NULL)
+        {
+            FreeHashMap(map);
+            return NULL;
+        }
+        HashMapInsert(map, entry);
+    }
+    return map;
+}
+
+// The column keys of HashMapRehomeKeys.
+extern bool JSONColumnsRehomeKeys(JSONColumns *columns, JSONKeyTable *key_table)
+{
+    if (columns == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    if (columns->key_table == NULL || columns->key_table == key_table)
+    {
+        return true;
+    }
+    char **keys = malloc(sizeof(char *) * (columns->column_count == 0 ? 1 : columns->column_count));
+    if (keys == NULL)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+    for (u_int32_t i = 0; i < columns->column_count; i++)
+    {
+        char *key = columns->columns[i].key;
+        keys[i] = key_table == NULL ? strdup(key) : JSONKeyTableIntern(key_table, key);
+        if (keys[i] == NULL)
+        {
+            while (key_table == NULL && i > 0)
+            {
+                free(keys[--i]);
+            }
+            free(keys);
+            errno = ENOMEM;
+            return false;
+        }
+    }
+    for (u_int32_t i = 0; i < columns->column_count; i++)
+    {
+        columns->columns[i].key = keys[i];
+    }
+    free(keys);
+    columns->key_table = key_table;
+    return true;
+}
+
+extern JSONColumns *JSONColumnsReplicate(JSONColumns *columns)
+{
+    if (columns == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    JSONColumns *deep_clone = malloc(sizeof(JSONColumns));
+    if (deep_clone == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    deep_clone->row_count = columns->row_count;
+    deep_clone->row_capacity = columns->row_count;
+    deep_clone->column_count = 0;
+    deep_clone->key_table = columns->key_table;
+    deep_clone->columns = malloc(sizeof(JSONColumn) * columns->column_count);
+    if (deep_clone->columns == NULL)
+    {
+        free(deep_clone);
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t rows = columns->row_count;
+    for (u_int32_t i = 0; i < columns->column_count; i++)
+    {
+        JSONColumn *column = &columns->columns[i];
+        JSONColumn *column_clone = &deep_clone->columns[i];
+        memset(column_clone, 0, sizeof(JSONColumn));
+        deep_clone->column_count++;
+        column_clone->value_type = column->value_type;
+        column_clone->key = columns->key_table != NULL ? column->key : strdup(column->key);
+        bool ok = column_clone->key != NULL;
+        if (ok && column->nulls != NULL)
+        {
+            column_clone->nulls = JSONBitsetResize(NULL, 0, rows);
+            ok = column_clone->nulls != NULL;
+            if (ok)
+            {
+                memcpy(column_clone->nulls, column->nulls, (rows + 7) / 8);
+            }
+        }
+        if (ok && column->ints != NULL)
+        {
+            column_clone->ints = malloc(sizeof(int64_t) * (rows + 1));
+            ok = column_clone->ints != NULL;
+            if (ok)
+            {
+                memcpy(column_clone->ints, column->ints, sizeof(int64_t) * rows);
+            }
+        }
+        if (ok && column->doubles != NULL)
+        {
+            column_clone->doubles = malloc(sizeof(double) * (rows + 1));
+            ok = column_clone->doubles != NULL;
+            if (ok)
+            {
+                memcpy(column_clone->doubles, column->doubles, sizeof(double) * rows);
+            }
+        }
+        if (ok && column->bools != NULL)
+        {
+            column_clone->bools = JSONBitsetResize(NULL, 0, rows);
+            ok = column_clone->bools != NULL;
+            if (ok)
+            {
+                memcpy(column_clone->bools, column->bools, (rows + 7) / 8);
+            }
+        }
+        if (ok && column->string_offsets != NULL)
+        {
+            column_clone->string_offsets = malloc(sizeof(u_int64_t) * (rows + 1));
+            column_clone->string_data = malloc(column->string_data_len + 1);
+            ok = column_clone->string_offsets != NULL && column_clone->string_data != NULL;
+            if (ok)
+            {
+                memcpy(column_clone->string_offsets, column->string_offsets, sizeof(u_int64_t) * rows);
+                memcpy(column_clone->string_data, column->string_data, column->string_data_len);
+                column_clone->string_data_len = column->string_data_len;
+                column_clone->string_data_capacity = column->string_data_len + 1;
+            }
+        }
+        if (!ok)
+        {
+            FreeJSONColumns(deep_clone);
+            errno = ENOMEM;
+            return NULL;
+        }
+    }
+    return deep_clone;
+}
@@ -4,12 +4,35 @@
 #include <string.h>
 #include <errno.h>
 
+#include <standardloop/util.h>
+
 #include "./json.h"
 
 static inline bool isDynamicArrayFull(DynamicArray *);
 static inline bool isDynamicArrayEmpty(DynamicArray *);
-static void freeDynamicArrayList(JSONValue **, u_int32_t, bool);
-static void dynamicArrayResize(DynamicArray *);
+static inline bool isDynamicArrayWritable(DynamicArray *);
+static void freeDynamicArraySlots(DynamicArray *);
+static inline u_int32_t dynamicArraySlot(DynamicArray *, u_int32_t);
+static inline JSONValue **dynamicArrayElementRef(DynamicArray *, u_int32_t);
+static bool dynamicArrayToSegmented(DynamicArray *, u_int32_t);
+static bool dynamicArraySegmentsGrow(DynamicArray *, u_int32_t);
+static bool dynamicArrayRoomAtFront(DynamicArray *);
+static void dynamicArrayTrimSegments(DynamicArray *);
+static void dynamicArrayMove(DynamicArray *, u_int32_t, u_int32_t, u_int32_t);
+static void dynamicArrayCopyIn(DynamicArray *, u_int32_t, JSONValue **, u_int32_t);
+static bool dynamicArrayGrow(DynamicArray *, u_int32_t);
+static bool dynamicArrayPackedGrow(DynamicArray *, u_int32_t);
+static JSONValue *dynamicArrayDetach(DynamicArray *, u_int32_t);
+static bool dynamicArrayToColumnar(DynamicArray *);
+static bool dynamicArrayUnpack(DynamicArray *);
+static inline bool isPackedStorage(enum DynamicArrayStorage);
+static enum DynamicArrayStorage packedStorageFor(enum JSONValueType);
+static bool dynamicArrayPack(DynamicArray *, enum DynamicArrayStorage);
+static bool dynamicArrayPackedAppend(DynamicArray *, JSONValue *);
+static JSONValue *dynamicArrayPackedElement(DynamicArray *, u_int32_t);
+static JSONValue *dynamicArrayView(DynamicArray *, u_int32_t);
+static JSONValue *arrayIterPackedNext(JSONArrayIter *);
+static void pinRowMembers(HashMap *, bool);
 
 extern DynamicArray *DefaultDynamicArrayInit(void)
 {
@@ -24,8 +47,26 @@ extern DynamicArray *DynamicArrayInit(u_int32_t initial_capacity)
         errno = ENOMEM;
         return NULL;
     }
+    if (initial_capacity == 0)
+    {
+        initial_capacity = 1;
+    }
     dynamic_array->size = 0;
+    dynamic_array->head = 0;
     dynamic_array->capacity = initial_capacity;
+    dynamic_array->storage = DYN_ARR_GENERIC;
+    dynamic_array->uniform_rows = true;
+    dynamic_array->columns = NULL;
+    dynamic_array->ints = NULL;
+    dynamic_array->doubles = NULL;
+    dynamic_array->bools = NULL;
+    dynamic_array->segments = NULL;
+    dynamic_array->segment_count = 0;
+    dynamic_array->views = NULL;
+    dynamic_array->views_capacity = 0;
+    dynamic_array->frozen = false;
+    dynamic_array->ref_count = 1;
+    JSONTextCacheInit(&dynamic_array->text_cache);
     dynamic_array->list = malloc(sizeof(JSONValue *) * initial_capacity);
     if (dynamic_array->list == NULL)
     {
@@ -50,72 +91,799 @@ extern void DynamicArrayAddLast(DynamicArray *dynamic_array, JSONValue *element)
     DynamicArrayAdd(dynamic_array, element, dynamic_array->size);
 }
 
+// Generic storage is a ring buffer: logical index i lives in
+// list[(head + i) % capacity], so both ends take O(1) inserts and removals.
+static inline u_int32_t dynamicArraySlot(DynamicArray *dynamic_array, u_int32_t index)
+{
+    u_int32_t slot = dynamic_array->head + index;
+    if (slot >= dynamic_array->capacity)
+    {
+        slot -= dynamic_array->capacity;
+    }
+    return slot;
+}
+
+// Segmented storage splits the elements over DYN_ARR_SEGMENT_SIZE element
+// blocks: logical index i lives in segments[p / size][p % size] with
+// p = head + i, head being the unused run at the start of the first segment.
+static inline JSONValue **dynamicArrayElementRef(DynamicArray *dynamic_array, u_int32_t index)
+{
+    if (dynamic_array->storage == DYN_ARR_SEGMENTED)
+    {
+        u_int64_t position = (u_int64_t)dynamic_array->head + index;
+        return &dynamic_array->segments[position >> DYN_ARR_SEGMENT_SHIFT][position & (DYN_ARR_SEGMENT_SIZE - 1)];
+    }
+    return &dynamic_array->list[dynamicArraySlot(dynamic_array, index)];
+}
+
+// Moves count elements from logical index src to logical index dest. Ranges
+// may overlap; a single memmove is used unless either range wraps or the
+// array is segmented.
+static void dynamicArrayMove(DynamicArray *dynamic_array, u_int32_t dest, u_int32_t src, u_int32_t count)
+{
+    if (count == 0 || dest == src)
+    {
+        return;
+    }
+    if (dynamic_array->storage == DYN_ARR_GENERIC)
+    {
+        u_int32_t dest_slot = dynamicArraySlot(dynamic_array, dest);
+        u_int32_t src_slot = dynamicArraySlot(dynamic_array, src);
+        if (dest_slot + count <= dynamic_array->capacity && src_slot + count <= dynamic_array->capacity)
+        {
+            memmove(&dynamic_array->list[dest_slot], &dynamic_array->list[src_slot], sizeof(JSONValue *) * count);
+            return;
+        }
+    }
+    if (dest < src)
+    {
+        for (u_int32_t i = 0; i < count; i++)
+        {
+            *dynamicArrayElementRef(dynamic_array, dest + i) = *dynamicArrayElementRef(dynamic_array, src + i);
+        }
+    }
+    else
+    {
+        for (u_int32_t i = count; i > 0; i--)
+        {
+            *dynamicArrayElementRef(dynamic_array, dest + i - 1) = *dynamicArrayElementRef(dynamic_array, src + i - 1);
+        }
+    }
+}
+
+// Copies count element pointers into logical positions starting at index.
+static void dynamicArrayCopyIn(DynamicArray *dynamic_array, u_int32_t index, JSONValue **elements, u_int32_t count)
+{
+    if (dynamic_array->storage == DYN_ARR_SEGMENTED)
+    {
+        for (u_int32_t i = 0; i < count; i++)
+        {
+            *dynamicArrayElementRef(dynamic_array, index + i) = elements[i];
+        }
+        return;
+    }
+    u_int32_t slot = dynamicArraySlot(dynamic_array, index);
+    u_int32_t first_run = dynamic_array->capacity - slot;
+    if (first_run > count)
+    {
+        first_run = count;
+    }
+    memcpy(&dynamic_array->list[slot], elements, sizeof(JSONValue *) * first_run);
+    memcpy(&dynamic_array->list[0], elements + first_run, sizeof(JSONValue *) * (count - first_run));
+}
+
+// Makes room for needed elements. The ring grows with realloc, moving the run
+// from head to the old end to the end of the new block if it wraps. Past
+// DYN_ARR_SEGMENT_THRESHOLD the array switches to segments, after which
+// growing only ever adds segments and never copies elements.
+static bool dynamicArrayGrow(DynamicArray *dynamic_array, u_int32_t needed)
+{
+    if (dynamic_array->storage == DYN_ARR_SEGMENTED)
+    {
+        return dynamicArraySegmentsGrow(dynamic_array, needed);
+    }
+    if (needed <= dynamic_array->capacity)
+    {
+        return true;
+    }
+    u_int32_t old_capacity = dynamic_array->capacity;
+    u_int32_t new_capacity = old_capacity * DEFAULT_DYN_ARR_RESIZE_MULTIPLE;
+    if (new_capacity < needed)
+    {
+        new_capacity = needed;
+    }
+    if (new_capacity > DYN_ARR_SEGMENT_THRESHOLD)
+    {
+        return dynamicArrayToSegmented(dynamic_array, needed);
+    }
+    JSONValue **list = realloc(dynamic_array->list, sizeof(JSONValue *) * new_capacity);
+    if (list == NULL)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+    dynamic_array->list = list;
+    if (dynamic_array->head + dynamic_array->size > old_capacity)
+    {
+        u_int32_t head_run = old_capacity - dynamic_array->head;
+        u_int32_t new_head = new_capacity - head_run;
+        memmove(&list[new_head], &list[dynamic_array->head], sizeof(JSONValue *) * head_run);
+        dynamic_array->head = new_head;
+    }
+    dynamic_array->capacity = new_capacity;
+    return true;
+}
+
+static bool dynamicArraySegmentsGrow(DynamicArray *dynamic_array, u_int32_t needed)
+{
+    u_int64_t needed_positions = (u_int64_t)dynamic_array->head + needed;
+    u_int32_t needed_segments = (u_int32_t)((needed_positions + DYN_ARR_SEGMENT_SIZE - 1) >> DYN_ARR_SEGMENT_SHIFT);
+    if (needed_segments <= dynamic_array->segment_count)
+    {
+        return true;
+    }
+    JSONValue ***segments = realloc(dynamic_array->segments, sizeof(JSONValue **) * needed_segments);
+    if (segments == NULL)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+    dynamic_array->segments = segments;
+    while (dynamic_array->segment_count < needed_segments)
+    {
+        JSONValue **segment = malloc(sizeof(JSONValue *) * DYN_ARR_SEGMENT_SIZE);
+        if (segment == NULL)
+        {
+            errno = ENOMEM;
+            return false;
+        }
+        segments[dynamic_array->segment_count] = segment;
+        dynamic_array->segment_count++;
+        // kept in step, so a failure part way leaves a usable array
+        dynamic_array->capacity = dynamic_array->segment_count * DYN_ARR_SEGMENT_SIZE;
+    }
+    return true;
+}
+
+// The only copy a segmented array ever makes: moving the ring into segments.
+static bool dynamicArrayToSegmented(DynamicArray *dynamic_array, u_int32_t needed)
+{
+    DynamicArray segmented = *dynamic_array;
+    segmented.storage = DYN_ARR_SEGMENTED;
+    segmented.head = 0;
+    segmented.segments = NULL;
+    segmented.segment_count = 0;
+    segmented.list = NULL;
+    if (!dynamicArraySegmentsGrow(&segmented, needed))
+    {
+        freeDynamicArraySlots(&segmented);
+        return false;
+    }
+    for (u_int32_t i = 0; i < dynamic_array->size; i++)
+    {
+        *dynamicArrayElementRef(&segmented, i) = *dynamicArrayElementRef(dynamic_array, i);
+    }
+    free(dynamic_array->list);
+    *dynamic_array = segmented;
+    return true;
+}
+
+// Makes sure a slot exists before logical index 0.
+static bool dynamicArrayRoomAtFront(DynamicArray *dynamic_array)
+{
+    if (dynamic_array->storage != DYN_ARR_SEGMENTED)
+    {
+        if (dynamic_array->size == dynamic_array->capacity && !dynamicArrayGrow(dynamic_array, dynamic_array->size + 1))
+        {
+            return false;
+        }
+        if (dynamic_array->storage != DYN_ARR_SEGMENTED)
+        {
+            dynamic_array->head = dynamic_array->head == 0 ? dynamic_array->capacity - 1 : dynamic_array->head - 1;
+            return true;
+        }
+    }
+    if (dynamic_array->head == 0)
+    {
+        JSONValue **segment = malloc(sizeof(JSONValue *) * DYN_ARR_SEGMENT_SIZE);
+        JSONValue ***segments = realloc(dynamic_array->segments, sizeof(JSONValue **) * (dynamic_array->segment_count + 1));
+        if (segment == NULL || segments == NULL)
+        {
+            free(segment);
+            if (segments != NULL)
+            {
+                dynamic_array->segments = segments;
+            }
+            errno = ENOMEM;
+            return false;
+        }
+        memmove(&segments[1], &segments[0], sizeof(JSONValue **) * dynamic_array->segment_count);
+        segments[0] = segment;
+        dynamic_array->segments = segments;
+        dynamic_array->segment_count++;
+        dynamic_array->capacity = dynamic_array->segment_count * DYN_ARR_SEGMENT_SIZE;
+        dynamic_array->head = DYN_ARR_SEGMENT_SIZE;
+    }
+    dynamic_array->head--;
+    return true;
+}
+
+// Releases segments that no longer hold any element, keeping one spare at
+// the back so a push/pop pattern at the boundary does not thrash malloc.
+static void dynamicArrayTrimSegments(DynamicArray *dynamic_array)
+{
+    if (dynamic_array->storage != DYN_ARR_SEGMENTED)
+    {
+        return;
+    }
+    if (dynamic_array->head >= DYN_ARR_SEGMENT_SIZE)
+    {
+        free(dynamic_array->segments[0]);
+        memmove(&dynamic_array->segments[0], &dynamic_array->segments[1], sizeof(JSONValue **) * (dynamic_array->segment_count - 1));
+        dynamic_array->segment_count--;
+        dynamic_array->head -= DYN_ARR_SEGMENT_SIZE;
+    }
+    u_int64_t used_positions = (u_int64_t)dynamic_array->head + dynamic_array->size;
+    u_int32_t used_segments = (u_int32_t)((used_positions + DYN_ARR_SEGMENT_SIZE - 1) >> DYN_ARR_SEGMENT_SHIFT);
+    while (dynamic_array->segment_count > used_segments + 1)
+    {
+        dynamic_array->segment_count--;
+        free(dynamic_array->segments[dynamic_array->segment_count]);
+    }
+    dynamic_array->capacity = dynamic_array->segment_count * DYN_ARR_SEGMENT_SIZE;
+}
+
+extern bool DynamicArrayReserve(DynamicArray *dynamic_array, u_int32_t capacity)
+{
+    if (dynamic_array == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    if (!isDynamicArrayWritable(dynamic_array))
+    {
+        return false;
+    }
+    if (capacity <= dynamic_array->capacity)
+    {
+        return true;
+    }
+    if (dynamic_array->storage == DYN_ARR_GENERIC || dynamic_array->storage == DYN_ARR_SEGMENTED)
+    {
+        return dynamicArrayGrow(dynamic_array, capacity);
+    }
+    if (isPackedStorage(dynamic_array->storage))
+    {
+        return dynamicArrayPackedGrow(dynamic_array, capacity);
+    }
+    // columns grow on their own as rows are appended
+    return true;
+}
+
 extern void DynamicArrayAdd(DynamicArray *dynamic_array, JSONValue *element, u_int32_t index)
 {
-    if (dynamic_array == NULL || element == NULL)
+    if (dynamic_array == NULL || element == NULL || index > dynamic_array->size || !isDynamicArrayWritable(dynamic_array) || !dynamicArrayUnpack(dynamic_array))
     {
         return;
     }
-    if (isDynamicArrayFull(dynamic_array))
+    // shift whichever side of index is shorter
+    if (index < dynamic_array->size / 2)
     {
-        dynamicArrayResize(dynamic_array);
+        if (!dynamicArrayRoomAtFront(dynamic_array))
+        {
+            return;
+        }
+        dynamicArrayMove(dynamic_array, 0, 1, index);
     }
-    for (u_int32_t i = dynamic_array->size; i > index; i--)
+    else
     {
-        dynamic_array->list[i] = dynamic_array->list[i - 1];
+        if (!dynamicArrayGrow(dynamic_array, dynamic_array->size + 1))
+        {
+            return;
+        }
+        dynamicArrayMove(dynamic_array, index + 1, index, dynamic_array->size - index);
     }
 
-    dynamic_array->list[index] = element;
+    *dynamicArrayElementRef(dynamic_array, index) = element;
     dynamic_array->size++;
+    JSONTextCacheAttach(&dynamic_array->text_cache, element);
+    JSONTextCacheInvalidate(&dynamic_array->text_cache);
 }
 
-static void dynamicArrayResize(DynamicArray *dynamic_array)
+// Takes ownership of the count elements.
+extern void DynamicArrayExtend(DynamicArray *dynamic_array, JSONValue **elements, u_int32_t count)
 {
-    if (dynamic_array == NULL)
+    if (dynamic_array == NULL || (elements == NULL && count != 0))
+    {
+        errno = EINVAL;
+        return;
+    }
+    if (!isDynamicArrayWritable(dynamic_array) || !dynamicArrayUnpack(dynamic_array))
     {
         return;
     }
+    if (!dynamicArrayGrow(dynamic_array, dynamic_array->size + count))
+    {
+        return;
+    }
+    dynamicArrayCopyIn(dynamic_array, dynamic_array->size, elements, count);
+    dynamic_array->size += count;
+    for (u_int32_t i = 0; i < count; i++)
+    {
+        JSONTextCacheAttach(&dynamic_array->text_cache, elements[i]);
+    }
+    JSONTextCacheInvalidate(&dynamic_array->text_cache);
+}
 
-    JSONValue **newList = malloc(sizeof(JSONValue *) * dynamic_array->capacity * DEFAULT_DYN_ARR_RESIZE_MULTIPLE);
-    if (newList == NULL)
+// Frees remove_count elements starting at index and puts the insert_count
+// elements (taking ownership) in their place.
+extern void DynamicArraySplice(DynamicArray *dynamic_array, u_int32_t index, u_int32_t remove_count, JSONValue **elements, u_int32_t insert_count)
+{
+    if (dynamic_array == NULL || index > dynamic_array->size || (elements == NULL && insert_count != 0))
     {
-        printf("Couldn't resize list, not enough memory!\n");
+        errno = EINVAL;
         return;
     }
+    if (!isDynamicArrayWritable(dynamic_array) || !dynamicArrayUnpack(dynamic_array))
+    {
+        return;
+    }
+    if (remove_count > dynamic_array->size - index)
+    {
+        remove_count = dynamic_array->size - index;
+    }
+    if (insert_count > remove_count && !dynamicArrayGrow(dynamic_array, dynamic_array->size - remove_count + insert_count))
+    {
+        return;
+    }
+    for (u_int32_t i = 0; i < remove_count; i++)
+    {
+        FreeJSONValue(*dynamicArrayElementRef(dynamic_array, index + i), true);
+    }
+    u_int32_t tail = dynamic_array->size - index - remove_count;
+    dynamicArrayMove(dynamic_array, index + insert_count, index + remove_count, tail);
+    dynamicArrayCopyIn(dynamic_array, index, elements, insert_count);
+    dynamic_array->size = dynamic_array->size - remove_count + insert_count;
+    dynamicArrayTrimSegments(dynamic_array);
+    for (u_int32_t i = 0; i < insert_count; i++)
+    {
+        JSONTextCacheAttach(&dynamic_array->text_cache, elements[i]);
+    }
+    JSONTextCacheInvalidate(&dynamic_array->text_cache);
+}
+
+// Takes ownership of element. Numbers and bools of a single type are stored
+// packed from the first element on. Flat objects that all share the first
+// one's keys are moved into columns once there are JSON_COLUMNAR_MIN_ROWS of
+// them. The first element that does not fit turns the array back into a list.
+extern void DynamicArrayAddLastCompact(DynamicArray *dynamic_array, JSONValue *element)
+{
+    if (dynamic_array == NULL || element == NULL || !isDynamicArrayWritable(dynamic_array))
+    {
+        return;
+    }
+    if (dynamic_array->size == 0 && dynamic_array->storage == DYN_ARR_GENERIC)
+    {
+        enum DynamicArrayStorage packed_storage = packedStorageFor(element->value_type);
+        if (packed_storage != DYN_ARR_GENERIC)
+        {
+            (void)dynamicArrayPack(dynamic_array, packed_storage);
+        }
+    }
+    if (isPackedStorage(dynamic_array->storage))
+    {
+        if (packedStorageFor(element->value_type) == dynamic_array->storage && dynamicArrayPackedAppend(dynamic_array, element))
+        {
+            JSONTextCacheInvalidate(&dynamic_array->text_cache);
+            FreeJSONValue(element, true);
+            return;
+        }
+        DynamicArrayAddLast(dynamic_array, element);
+        return;
+    }
+    if (dynamic_array->storage == DYN_ARR_COLUMNAR)
+    {
+        if (element->value_type == JSONOBJ_t && JSONColumnsAppendRow(dynamic_array->columns, element->value))
+        {
+            dynamic_array->size++;
+            JSONTextCacheInvalidate(&dynamic_array->text_cache);
+            FreeJSONValue(element, true);
+            return;
+        }
+        dynamic_array->uniform_rows = false;
+        DynamicArrayAddLast(dynamic_array, element);
+        return;
+    }
+
+    if (dynamic_array->uniform_rows)
+    {
+        dynamic_array->uniform_rows = JSONColumnsIsRowCandidate(element);
+        if (dynamic_array->uniform_rows && dynamic_array->size != 0)
+        {
+            HashMap *first_row = (*dynamicArrayElementRef(dynamic_array, 0))->value;
+            dynamic_array->uniform_rows = first_row->size == ((HashMap *)element->value)->size;
+        }
+    }
+    DynamicArrayAddLast(dynamic_array, element);
+    if (dynamic_array->uniform_rows && dynamic_array->size == JSON_COLUMNAR_MIN_ROWS)
+    {
+        dynamic_array->uniform_rows = dynamicArrayToColumnar(dynamic_array);
+    }
+}
 
+static bool dynamicArrayToColumnar(DynamicArray *dynamic_array)
+{
+    if (dynamic_array->size == 0)
+    {
+        return false;
+    }
+    JSONColumns *columns = JSONColumnsInit((*dynamicArrayElementRef(dynamic_array, 0))->value);
+    if (columns == NULL)
+    {
+        return false;
+    }
+    for (u_int32_t i = 0; i < dynamic_array->size; i++)
+    {
+        if (!JSONColumnsAppendRow(columns, (*dynamicArrayElementRef(dynamic_array, i))->value))
+        {
+            FreeJSONColumns(columns);
+            return false;
+        }
+    }
     for (u_int32_t i = 0; i < dynamic_array->size; i++)
     {
-        newList[i] = dynamic_array->list[i];
+        FreeJSONValue(*dynamicArrayElementRef(dynamic_array, i), true);
     }
-    freeDynamicArrayList(dynamic_array->list, dynamic_array->size, false);
-    dynamic_array->list = newList;
-    dynamic_array->capacity *= DEFAULT_DYN_ARR_RESIZE_MULTIPLE;
+    freeDynamicArraySlots(dynamic_array);
+    dynamic_array->columns = columns;
+    dynamic_array->storage = DYN_ARR_COLUMNAR;
+    return true;
 }
 
-static inline bool isDynamicArrayFull(DynamicArray *dynamic_array)
+static inline bool isPackedStorage(enum DynamicArrayStorage storage)
 {
-    return dynamic_array->capacity == dynamic_array->size;
+    return storage == DYN_ARR_PACKED_INT || storage == DYN_ARR_PACKED_DOUBLE || storage == DYN_ARR_PACKED_BOOL;
 }
 
-static inline bool isDynamicArrayEmpty(DynamicArray *dynamic_array)
+static enum DynamicArrayStorage packedStorageFor(enum JSONValueType value_type)
 {
-    return dynamic_array->size == 0;
+    switch (value_type)
+    {
+    case JSONNUMBER_INT_t:
+        return DYN_ARR_PACKED_INT;
+    case JSONNUMBER_DOUBLE_t:
+        return DYN_ARR_PACKED_DOUBLE;
+    case JSONBOOL_t:
+        return DYN_ARR_PACKED_BOOL;
+    default:
+        return DYN_ARR_GENERIC;
+    }
 }
 
-static void freeDynamicArrayList(JSONValue **list, u_int32_t size, bool deep)
+// Only valid on an empty generic array.
+static bool dynamicArrayPack(DynamicArray *dynamic_array, enum DynamicArrayStorage storage)
 {
-    if (list == NULL)
+    u_int32_t capacity = dynamic_array->capacity > 0 ? dynamic_array->capacity : DEFAULT_DYN_ARR_SIZE;
+    switch (storage)
     {
-        return;
+    case DYN_ARR_PACKED_INT:
+        dynamic_array->ints = malloc(sizeof(int64_t) * capacity);
+        if (dynamic_array->ints == NULL)
+        {
+            return false;
+        }
+        break;
+    case DYN_ARR_PACKED_DOUBLE:
+        dynamic_array->doubles = malloc(sizeof(double) * capacity);
+        if (dynamic_array->doubles == NULL)
+        {
+            return false;
+        }
+        break;
+    case DYN_ARR_PACKED_BOOL:
+        dynamic_array->bools = JSONBitsetResize(NULL, 0, capacity);
+        if (dynamic_array->bools == NULL)
+        {
+            return false;
+        }
+        break;
+    default:
+        return false;
+    }
+    freeDynamicArraySlots(dynamic_array);
+    dynamic_array->capacity = capacity;
+    dynamic_array->storage = storage;
+    return true;
+}
+
+static bool dynamicArrayPackedGrow(DynamicArray *dynamic_array, u_int32_t new_capacity)
+{
+    if (dynamic_array->storage == DYN_ARR_PACKED_INT)
+    {
+        int64_t *ints = realloc(dynamic_array->ints, sizeof(int64_t) * new_capacity);
+        if (ints == NULL)
+        {
+            return false;
+        }
+        dynamic_array->ints = ints;
+    }
+    else if (dynamic_array->storage == DYN_ARR_PACKED_DOUBLE)
+    {
+        double *doubles = realloc(dynamic_array->doubles, sizeof(double) * new_capacity);
+        if (doubles == NULL)
+        {
+            return false;
+        }
+        dynamic_array->doubles = doubles;
+    }
+    else
+    {
+        u_int8_t *bools = JSONBitsetResize(dynamic_array->bools, dynamic_array->capacity, new_capacity);
+        if (bools == NULL)
+        {
+            return false;
+        }
+        dynamic_array->bools = bools;
+    }
+    dynamic_array->capacity = new_capacity;
+    return true;
+}
+
+static bool dynamicArrayPackedAppend(DynamicArray *dynamic_array, JSONValue *element)
+{
+    if (isDynamicArrayFull(dynamic_array) && !dynamicArrayPackedGrow(dynamic_array, dynamic_array->capacity * DEFAULT_DYN_ARR_RESIZE_MULTIPLE))
+    {
+        return false;
+    }
+    u_int32_t index = dynamic_array->size;
+    if (dynamic_array->storage == DYN_ARR_PACKED_INT)
+    {
+        dynamic_array->ints[index] = *(int64_t *)element->value;
+    }
+    else if (dynamic_array->storage == DYN_ARR_PACKED_DOUBLE)
+    {
+        dynamic_array->doubles[index] = *(double *)element->value;
+    }
+    else
+    {
+        JSONBitsetSet(dynamic_array->bools, index, *(bool *)element->value);
+    }
+    dynamic_array->size++;
+    return true;
+}
+
+// Boxes one packed element into a new JSONValue owned by the caller.
+static JSONValue *dynamicArrayPackedElement(DynamicArray *dynamic_array, u_int32_t index)
+{
+    void *value = NULL;
+    enum JSONValueType value_type = JSONNULL_t;
+    if (dynamic_array->storage == DYN_ARR_PACKED_INT)
+    {
+        value_type = JSONNUMBER_INT_t;
+        value = malloc(sizeof(int64_t));
+        if (value != NULL)
+        {
+            *(int64_t *)value = dynamic_array->ints[index];
+        }
     }
-    if (deep)
+    else if (dynamic_array->storage == DYN_ARR_PACKED_DOUBLE)
     {
-        for (u_int32_t i = 0; i < size; i++)
+        value_type = JSONNUMBER_DOUBLE_t;
+        value = malloc(sizeof(double));
+        if (value != NULL)
         {
-            FreeJSONValue(list[i], deep);
+            *(double *)value = dynamic_array->doubles[index];
         }
     }
-    free(list);
+    else if (dynamic_array->storage == DYN_ARR_PACKED_BOOL)
+    {
+        value_type = JSONBOOL_t;
+        value = malloc(sizeof(bool));
+        if (value != NULL)
+        {
+            *(bool *)value = JSONBitsetGet(dynamic_array->bools, index);
+        }
+    }
+    if (value == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    JSONValue *element = JSONValueInit(value_type, value, NULL);
+    if (element == NULL)
+    {
+        free(value);
+        errno = ENOMEM;
+    }
+    return element;
+}
+
+// The members of a row view stand in for cells of the columns until the
+// array is unpacked, an edit in place would not reach the columns.
+static void pinRowMembers(HashMap *row, bool pinned)
+{
+    JSONObjectIter iter;
+    JSONObjectIterInit(&iter, row);
+    for (JSONValue *map_entry = NULL; (map_entry = JSONObjectIterNext(&iter)) != NULL;)
+    {
+        map_entry->pinned = pinned;
+    }
+}
+
+// Turns a columnar or packed array back into JSONValues. They are laid out
+// like any generic array, through dynamicArrayGrow and
+// dynamicArrayElementRef, so a large one ends up in segments.
+static bool dynamicArrayUnpack(DynamicArray *dynamic_array)
+{
+    if (dynamic_array->storage == DYN_ARR_GENERIC || dynamic_array->storage == DYN_ARR_SEGMENTED)
+    {
+        return true;
+    }
+    // built on the side, the packed or columnar storage is read until the end
+    DynamicArray unpacked = *dynamic_array;
+    unpacked.storage = DYN_ARR_GENERIC;
+    unpacked.size = 0;
+    unpacked.head = 0;
+    unpacked.capacity = 0;
+    unpacked.list = NULL;
+    unpacked.segments = NULL;
+    unpacked.segment_count = 0;
+    if (!dynamicArrayGrow(&unpacked, dynamic_array->size > DEFAULT_DYN_ARR_SIZE ? dynamic_array->size : DEFAULT_DYN_ARR_SIZE))
+    {
+        freeDynamicArraySlots(&unpacked);
+        return false;
+    }
+    for (u_int32_t i = 0; i < dynamic_array->size; i++)
+    {
+        JSONValue **element = dynamicArrayElementRef(&unpacked, i);
+        if (i < dynamic_array->views_capacity && dynamic_array->views[i] != NULL)
+        {
+            // adopted below, once nothing can fail any more
+            *element = NULL;
+            continue;
+        }
+        if (dynamic_array->storage == DYN_ARR_COLUMNAR)
+        {
+            HashMap *row = JSONColumnsRowToHashMap(dynamic_array->columns, i);
+            *element = row == NULL ? NULL : JSONValueInit(JSONOBJ_t, row, NULL);
+            if (*element == NULL)
+            {
+                FreeHashMap(row);
+            }
+            else
+            {
+                row->text_cache.parent = &dynamic_array->text_cache;
+            }
+        }
+        else
+        {
+            *element = dynamicArrayPackedElement(dynamic_array, i);
+        }
+        if (*element == NULL)
+        {
+            while (i > 0)
+            {
+                FreeJSONValue(*dynamicArrayElementRef(&unpacked, --i), true);
+            }
+            freeDynamicArraySlots(&unpacked);
+            errno = ENOMEM;
+            return false;
+        }
+    }
+    for (u_int32_t i = 0; i < dynamic_array->views_capacity; i++)
+    {
+        JSONValue *view = dynamic_array->views[i];
+        if (view != NULL)
+        {
+            if (view->value_type == JSONOBJ_t)
+            {
+                ((HashMap *)view->value)->row_view_of = NULL;
+                pinRowMembers(view->value, false);
+            }
+            view->pinned = false;
+            *dynamicArrayElementRef(&unpacked, i) = view;
+        }
+    }
+    free(dynamic_array->views);
+    dynamic_array->views = NULL;
+    dynamic_array->views_capacity = 0;
+    if (dynamic_array->columns != NULL)
+    {
+        FreeJSONColumns(dynamic_array->columns);
+    }
+    free(dynamic_array->ints);
+    free(dynamic_array->doubles);
+    free(dynamic_array->bools);
+    dynamic_array->columns = NULL;
+    dynamic_array->ints = NULL;
+    dynamic_array->doubles = NULL;
+    dynamic_array->bools = NULL;
+    dynamic_array->list = unpacked.list;
+    dynamic_array->segments = unpacked.segments;
+    dynamic_array->segment_count = unpacked.segment_count;
+    dynamic_array->head = unpacked.head;
+    dynamic_array->capacity = unpacked.capacity;
+    dynamic_array->storage = unpacked.storage;
+    dynamic_array->uniform_rows = false;
+    return true;
+}
+
+// Turns a columnar or packed array into a generic one, for callers that need
+// every element as a JSONValue that stays put. Elements already handed out
+// by DynamicArrayGetAtIndex keep their address.
+extern bool DynamicArrayUnpack(DynamicArray *dynamic_array)
+{
+    if (dynamic_array == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    return dynamicArrayUnpack(dynamic_array);
+}
+
+// Appends a row parsed straight into cells, see JSONColumnsAppendCells. Only
+// a columnar array takes one.
+extern bool DynamicArrayAddColumnarRow(DynamicArray *dynamic_array, JSONValue *cells)
+{
+    if (dynamic_array == NULL || cells == NULL || dynamic_array->storage != DYN_ARR_COLUMNAR)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    if (!isDynamicArrayWritable(dynamic_array) || !JSONColumnsAppendCells(dynamic_array->columns, cells))
+    {
+        return false;
+    }
+    dynamic_array->size++;
+    JSONTextCacheInvalidate(&dynamic_array->text_cache);
+    return true;
+}
+
+extern JSONColumn *DynamicArrayGetColumn(DynamicArray *dynamic_array, char *key)
+{
+    if (dynamic_array == NULL || key == NULL || dynamic_array->storage != DYN_ARR_COLUMNAR)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    return JSONColumnsGetColumn(dynamic_array->columns, key);
+}
+
+static inline bool isDynamicArrayFull(DynamicArray *dynamic_array)
+{
+    return dynamic_array->capacity == dynamic_array->size;
+}
+
+// Frozen arrays are shared, every mutation is refused with EPERM.
+static inline bool isDynamicArrayWritable(DynamicArray *dynamic_array)
+{
+    if (dynamic_array->frozen)
+    {
+        errno = EPERM;
+        return false;
+    }
+    return true;
+}
+
+static inline bool isDynamicArrayEmpty(DynamicArray *dynamic_array)
+{
+    return dynamic_array->size == 0;
+}
+
+// Frees the ring or the segments, not the elements in them.
+static void freeDynamicArraySlots(DynamicArray *dynamic_array)
+{
+    free(dynamic_array->list);
+    for (u_int32_t i = 0; i < dynamic_array->segment_count; i++)
+    {
+        free(dynamic_array->segments[i]);
+    }
+    free(dynamic_array->segments);
+    dynamic_array->list = NULL;
+    dynamic_array->segments = NULL;
+    dynamic_array->segment_count = 0;
+    dynamic_array->head = 0;
+    dynamic_array->capacity = 0;
 }
 
 extern void FreeDynamicArray(DynamicArray *dynamic_array)
@@ -124,10 +892,32 @@ extern void FreeDynamicArray(DynamicArray *dynamic_array)
     {
         return;
     }
-    if (dynamic_array->list != NULL)
+    // a frozen array goes with its last reference
+    if (dynamic_array->frozen && __atomic_sub_fetch(&dynamic_array->ref_count, 1, __ATOMIC_ACQ_REL) != 0)
+    {
+        return;
+    }
+    if (dynamic_array->list != NULL || dynamic_array->segments != NULL)
     {
-        freeDynamicArrayList(dynamic_array->list, dynamic_array->size, true);
+        for (u_int32_t i = 0; i < dynamic_array->size; i++)
+        {
+            FreeJSONValue(*dynamicArrayElementRef(dynamic_array, i), true);
+        }
     }
+    freeDynamicArraySlots(dynamic_array);
+    for (u_int32_t i = 0; i < dynamic_array->views_capacity; i++)
+    {
+        FreeJSONValue(dynamic_array->views[i], true);
+    }
+    free(dynamic_array->views);
+    if (dynamic_array->columns != NULL)
+    {
+        FreeJSONColumns(dynamic_array->columns);
+    }
+    free(dynamic_array->ints);
+    free(dynamic_array->doubles);
+    free(dynamic_array->bools);
+    FreeJSONTextCache(&dynamic_array->text_cache);
     free(dynamic_array);
 }
 
@@ -140,7 +930,22 @@ extern void PrintDynamicArray(DynamicArray *dynamic_array)
     printf("[");
     for (u_int32_t i = 0; i < dynamic_array->size; i++)
     {
-        PrintJSONValue(dynamic_array->list[i]);
+        if (dynamic_array->storage == DYN_ARR_COLUMNAR)
+        {
+            HashMap *row = JSONColumnsRowToHashMap(dynamic_array->columns, i);
+            PrintHashMap(row);
+            FreeHashMap(row);
+        }
+        else if (isPackedStorage(dynamic_array->storage))
+        {
+            JSONValue *element = dynamicArrayPackedElement(dynamic_array, i);
+            PrintJSONValue(element);
+            FreeJSONValue(element, true);
+        }
+        else
+        {
+            PrintJSONValue(*dynamicArrayElementRef(dynamic_array, i));
+        }
         if (i != dynamic_array->size - 1)
         {
 
@@ -150,20 +955,37 @@ extern void PrintDynamicArray(DynamicArray *dynamic_array)
     printf("]");
 }
 
-extern void DynamicArrayRemove(DynamicArray *dynamic_array, u_int32_t index)
+// Unlinks the element at index without freeing it.
+static JSONValue *dynamicArrayDetach(DynamicArray *dynamic_array, u_int32_t index)
 {
-    if (dynamic_array == NULL || index >= dynamic_array->size || isDynamicArrayEmpty(dynamic_array))
+    JSONValue *element = *dynamicArrayElementRef(dynamic_array, index);
+    if (index < dynamic_array->size / 2)
     {
-        return;
+        dynamicArrayMove(dynamic_array, 1, 0, index);
+        dynamic_array->head = dynamic_array->storage == DYN_ARR_SEGMENTED ? dynamic_array->head + 1 : dynamicArraySlot(dynamic_array, 1);
     }
-    FreeJSONValue(dynamic_array->list[index], true);
-
-    for (u_int32_t i = index + 1; i < dynamic_array->size; i++)
+    else
     {
-        dynamic_array->list[i - 1] = dynamic_array->list[i];
+        dynamicArrayMove(dynamic_array, index, index + 1, dynamic_array->size - index - 1);
     }
-
     dynamic_array->size--;
+    if (dynamic_array->size == 0 && dynamic_array->storage == DYN_ARR_GENERIC)
+    {
+        dynamic_array->head = 0;
+    }
+    dynamicArrayTrimSegments(dynamic_array);
+    JSONTextCacheAttach(NULL, element);
+    JSONTextCacheInvalidate(&dynamic_array->text_cache);
+    return element;
+}
+
+extern void DynamicArrayRemove(DynamicArray *dynamic_array, u_int32_t index)
+{
+    if (dynamic_array == NULL || index >= dynamic_array->size || isDynamicArrayEmpty(dynamic_array) || !isDynamicArrayWritable(dynamic_array) || !dynamicArrayUnpack(dynamic_array))
+    {
+        return;
+    }
+    FreeJSONValue(dynamicArrayDetach(dynamic_array, index), true);
 }
 
 extern void DynamicArrayRemoveFirst(DynamicArray *dynamic_array)
@@ -175,7 +997,7 @@ extern void DynamicArrayRemoveFirst(DynamicArray *dynamic_array)
     DynamicArrayRemove(dynamic_array, 0);
 }
 
-extern void DynamicArrayRemoveLastElement(DynamicArray *dynamic_array)
+extern void DynamicArrayRemoveLast(DynamicArray *dynamic_array)
 {
     if (dynamic_array == NULL)
     {
@@ -184,69 +1006,299 @@ extern void DynamicArrayRemoveLastElement(DynamicArray *dynamic_array)
     DynamicArrayRemove(dynamic_array, dynamic_array->size - 1);
 }
 
+// Like DynamicArrayRemove, but ownership of the element passes to the caller.
+extern JSONValue *DynamicArrayTake(DynamicArray *dynamic_array, u_int32_t index)
+{
+    if (dynamic_array == NULL || index >= dynamic_array->size)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (!isDynamicArrayWritable(dynamic_array) || !dynamicArrayUnpack(dynamic_array))
+    {
+        return NULL;
+    }
+    return dynamicArrayDetach(dynamic_array, index);
+}
+
+extern JSONValue *DynamicArrayTakeFirst(DynamicArray *dynamic_array)
+{
+    return DynamicArrayTake(dynamic_array, 0);
+}
+
+extern JSONValue *DynamicArrayTakeLast(DynamicArray *dynamic_array)
+{
+    if (dynamic_array == NULL || isDynamicArrayEmpty(dynamic_array))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    return DynamicArrayTake(dynamic_array, dynamic_array->size - 1);
+}
+
+// A frozen array is shared rather than copied. A generic or segmented one is
+// copied through dynamicArrayGrow and dynamicArrayElementRef, so the copy of
+// a large array lives in segments as well.
 extern DynamicArray *DynamicArrayReplicate(DynamicArray *dynamic_array)
 {
     if (dynamic_array == NULL)
     {
         return NULL;
     }
-    DynamicArray *deep_clone = DynamicArrayInit(dynamic_array->capacity);
-
+    if (dynamic_array->frozen)
+    {
+        __atomic_add_fetch(&dynamic_array->ref_count, 1, __ATOMIC_RELAXED);
+        return dynamic_array;
+    }
+    if (dynamic_array->storage == DYN_ARR_COLUMNAR)
+    {
+        DynamicArray *deep_clone = DynamicArrayInit(DEFAULT_DYN_ARR_SIZE);
+        if (deep_clone == NULL)
+        {
+            return NULL;
+        }
+        deep_clone->columns = JSONColumnsReplicate(dynamic_array->columns);
+        if (deep_clone->columns == NULL)
+        {
+            FreeDynamicArray(deep_clone);
+            return NULL;
+        }
+        free(deep_clone->list);
+        deep_clone->list = NULL;
+        deep_clone->capacity = 0;
+        deep_clone->size = dynamic_array->size;
+        deep_clone->storage = DYN_ARR_COLUMNAR;
+        return deep_clone;
+    }
+    if (isPackedStorage(dynamic_array->storage))
+    {
+        DynamicArray *deep_clone = DynamicArrayInit(dynamic_array->capacity);
+        if (deep_clone == NULL)
+        {
+            return NULL;
+        }
+        if (!dynamicArrayPack(deep_clone, dynamic_array->storage))
+        {
+            FreeDynamicArray(deep_clone);
+            return NULL;
+        }
+        if (dynamic_array->storage == DYN_ARR_PACKED_INT)
+        {
+            memcpy(deep_clone->ints, dynamic_array->ints, sizeof(int64_t) * dynamic_array->size);
+        }
+        else if (dynamic_array->storage == DYN_ARR_PACKED_DOUBLE)
+        {
+            memcpy(deep_clone->doubles, dynamic_array->doubles, sizeof(double) * dynamic_array->size);
+        }
+        else
+        {
+            memcpy(deep_clone->bools, dynamic_array->bools, (dynamic_array->size + 7) / 8);
+        }
+        deep_clone->size = dynamic_array->size;
+        return deep_clone;
+    }
+    DynamicArray *deep_clone = DefaultDynamicArrayInit();
+    if (deep_clone == NULL)
+    {
+        return NULL;
+    }
+    if (!dynamicArrayGrow(deep_clone, dynamic_array->size))
+    {
+        FreeDynamicArray(deep_clone);
+        return NULL;
+    }
+    deep_clone->uniform_rows = dynamic_array->uniform_rows;
     for (u_int32_t i = 0; i < dynamic_array->size; i++)
     {
-        deep_clone->list[i] = JSONValueReplicate(dynamic_array->list[i]);
-        deep_clone->size++;
+        JSONValue *element_clone = JSONValueReplicate(*dynamicArrayElementRef(dynamic_array, i));
+        if (element_clone == NULL)
+        {
+            FreeDynamicArray(deep_clone);
+            errno = ENOMEM;
+            return NULL;
+        }
+        *dynamicArrayElementRef(deep_clone, i) = element_clone;
+        deep_clone->size = i + 1;
+        JSONTextCacheAttach(&deep_clone->text_cache, element_clone);
     }
+    deep_clone->text_cache.hash_valid = dynamic_array->text_cache.hash_valid;
+    deep_clone->text_cache.hash = dynamic_array->text_cache.hash;
     return deep_clone;
 }
 
+// Builds row index of a columnar array on its own and keeps it in views, so
+// the columns stay as they are and asking again returns the same row. A row
+// view unpacks the array the first time it is changed.
+static JSONValue *dynamicArrayView(DynamicArray *dynamic_array, u_int32_t index)
+{
+    if (index >= dynamic_array->views_capacity)
+    {
+        JSONValue **views = realloc(dynamic_array->views, sizeof(JSONValue *) * dynamic_array->size);
+        if (views == NULL)
+        {
+            errno = ENOMEM;
+            return NULL;
+        }
+        memset(views + dynamic_array->views_capacity, 0, sizeof(JSONValue *) * (dynamic_array->size - dynamic_array->views_capacity));
+        dynamic_array->views = views;
+        dynamic_array->views_capacity = dynamic_array->size;
+    }
+    JSONValue **view = &dynamic_array->views[index];
+    if (*view != NULL)
+    {
+        return *view;
+    }
+    HashMap *row = JSONColumnsRowToHashMap(dynamic_array->columns, index);
+    *view = row == NULL ? NULL : JSONValueInit(JSONOBJ_t, row, NULL);
+    if (*view == NULL)
+    {
+        FreeHashMap(row);
+        errno = ENOMEM;
+        return NULL;
+    }
+    row->row_view_of = dynamic_array;
+    row->text_cache.parent = &dynamic_array->text_cache;
+    pinRowMembers(row, true);
+    return *view;
+}
+
+// The element itself, which may be edited in place. A packed array is
+// unpacked first, since a boxed copy of a scalar would not see the edit; a
+// columnar array builds only the row asked for, see dynamicArrayView. Fails
+// with ENOMEM when that allocation fails.
 extern JSONValue *DynamicArrayGetAtIndex(DynamicArray *dynamic_array, u_int32_t index)
 {
-    if (dynamic_array == NULL || dynamic_array->size < index)
+    if (dynamic_array == NULL || dynamic_array->size <= index)
+    {
+        return NULL;
+    }
+    if (dynamic_array->storage == DYN_ARR_COLUMNAR)
+    {
+        return dynamicArrayView(dynamic_array, index);
+    }
+    if (isPackedStorage(dynamic_array->storage) && !dynamicArrayUnpack(dynamic_array))
     {
         return NULL;
     }
-    return dynamic_array->list[index];
+    return *dynamicArrayElementRef(dynamic_array, index);
 }
 
-extern char *ListToString(DynamicArray *dynamic_array)
+// Columnar arrays are unpacked here, once, since every row has to become a
+// HashMap anyway; that is the only allocation and can fail with ENOMEM.
+// Packed arrays are read in place.
+extern bool JSONArrayIterInit(JSONArrayIter *iter, DynamicArray *dynamic_array)
 {
+    iter->array = dynamic_array;
+    iter->index = 0;
+    iter->run_left = 0;
+    iter->run = NULL;
     if (dynamic_array == NULL)
     {
-        return NULL;
+        errno = EINVAL;
+        return false;
+    }
+    if (dynamic_array->storage == DYN_ARR_COLUMNAR)
+    {
+        return dynamicArrayUnpack(dynamic_array);
     }
-    size_t list_as_string_size = 3; // "[]\0"
-    char *list_as_string = malloc(sizeof(char) * list_as_string_size);
-    list_as_string[0] = BRACKET_OPEN_CHAR;
-    list_as_string[1] = NULL_CHAR;
+    return true;
+}
 
-    size_t chars_written = 2 - 1;
+static JSONValue *arrayIterPackedNext(JSONArrayIter *iter)
+{
+    DynamicArray *dynamic_array = iter->array;
+    u_int32_t index = iter->index++;
+    iter->view.key = NULL;
+    iter->view.pinned = true;
+    iter->view.value = &iter->scalar;
+    if (dynamic_array->storage == DYN_ARR_PACKED_INT)
+    {
+        iter->view.value_type = JSONNUMBER_INT_t;
+        iter->scalar.int_value = dynamic_array->ints[index];
+    }
+    else if (dynamic_array->storage == DYN_ARR_PACKED_DOUBLE)
+    {
+        iter->view.value_type = JSONNUMBER_DOUBLE_t;
+        iter->scalar.double_value = dynamic_array->doubles[index];
+    }
+    else
+    {
+        iter->view.value_type = JSONBOOL_t;
+        iter->scalar.bool_value = JSONBitsetGet(dynamic_array->bools, index);
+    }
+    return &iter->view;
+}
 
-    bool needs_comma = false;
-    for (u_int64_t i = 0; i < dynamic_array->size; i++)
+// Next element, NULL past the last one. An element of a packed array is the
+// iterator's own view, only good until the next call.
+extern JSONValue *JSONArrayIterNext(JSONArrayIter *iter)
+{
+    DynamicArray *dynamic_array = iter->array;
+    if (dynamic_array == NULL || iter->index >= dynamic_array->size)
+    {
+        return NULL;
+    }
+    if (isPackedStorage(dynamic_array->storage))
+    {
+        return arrayIterPackedNext(iter);
+    }
+    if (iter->run_left == 0)
     {
-        char *list_element = JSONValueToString(dynamic_array->list[i]);
-        size_t list_element_len = strlen(list_element);
-        if (i < dynamic_array->size - 1)
+        // the slots up to the end of the list or of the segment follow each
+        // other in memory
+        iter->run = dynamicArrayElementRef(dynamic_array, iter->index);
+        if (dynamic_array->storage == DYN_ARR_SEGMENTED)
         {
-            needs_comma = true;
+            iter->run_left = DYN_ARR_SEGMENT_SIZE - (u_int32_t)(((u_int64_t)dynamic_array->head + iter->index) & (DYN_ARR_SEGMENT_SIZE - 1));
         }
-        list_as_string_size += list_element_len;
-        list_as_string_size += needs_comma;
-        list_as_string = realloc(list_as_string, list_as_string_size);
-
-        CopyStringCanary(list_as_string, list_element, chars_written);
-        chars_written += list_element_len;
-        if (needs_comma)
+        else
+        {
+            iter->run_left = dynamic_array->capacity - dynamicArraySlot(dynamic_array, iter->index);
+        }
+        if (iter->run_left > dynamic_array->size - iter->index)
         {
-            CopyStringCanary(list_as_string, ",", chars_written);
-            chars_written++;
+            iter->run_left = dynamic_array->size - iter->index;
         }
-        needs_comma = false;
-        free(list_element);
     }
+    if (iter->run_left > DYN_ARR_ITER_PREFETCH_DISTANCE)
+    {
+        __builtin_prefetch(iter->run[DYN_ARR_ITER_PREFETCH_DISTANCE]);
+    }
+    JSONValue *element = *iter->run++;
+    iter->run_left--;
+    iter->index++;
+    return element;
+}
 
-    list_as_string[list_as_string_size - 2] = BRACKET_CLOSE_CHAR;
-    list_as_string[list_as_string_size - 1] = NULL_CHAR;
-    return list_as_string;
+// Replaces the element at index with json_value, which is adopted as is
+// and must not have a key. The old element is freed. When this fails
+// json_value still belongs to the caller.
+extern bool JSONArraySet(DynamicArray *dynamic_array, u_int32_t index, JSONValue *json_value)
+{
+    if (dynamic_array == NULL || json_value == NULL || json_value->key != NULL || index >= dynamic_array->size)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    if (!isDynamicArrayWritable(dynamic_array) || !dynamicArrayUnpack(dynamic_array))
+    {
+        return false;
+    }
+    JSONValue **element = dynamicArrayElementRef(dynamic_array, index);
+    FreeJSONValue(*element, true);
+    *element = json_value;
+    JSONTextCacheAttach(&dynamic_array->text_cache, json_value);
+    JSONTextCacheInvalidate(&dynamic_array->text_cache);
+    return true;
+}
+
+extern char *ListToString(DynamicArray *dynamic_array)
+{
+    if (dynamic_array == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    JSONValue list_value = {.key = NULL, .value_type = JSONLIST_t, .value = dynamic_array};
+    return JSONValueToString(&list_value);
 }
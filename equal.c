@@ -0,0 +1,328 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <standardloop/util.h>
+
+#include "./json.h"
+
+static inline u_int64_t hashMix(u_int64_t);
+static inline u_int64_t hashTagged(enum JSONValueType, u_int64_t);
+static u_int64_t hashString(char *);
+static u_int64_t hashInt(int64_t);
+static u_int64_t hashDouble(double);
+static u_int64_t hashBool(bool);
+static u_int64_t hashObject(HashMap *, bool);
+static u_int64_t hashList(DynamicArray *, bool);
+static u_int64_t hashValue(JSONValue *, bool);
+static inline bool isNumber(enum JSONValueType);
+static bool numbersEqual(JSONValue *, JSONValue *);
+static bool objectsEqual(HashMap *, HashMap *);
+static bool packedListsEqual(DynamicArray *, DynamicArray *);
+static bool listsEqual(DynamicArray *, DynamicArray *);
+
+// splitmix64 finalizer
+static inline u_int64_t hashMix(u_int64_t x)
+{
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+// Ints and doubles share a tag, equal numbers hash alike whichever they are.
+static inline u_int64_t hashTagged(enum JSONValueType value_type, u_int64_t payload)
+{
+    if (value_type == JSONNUMBER_DOUBLE_t)
+    {
+        value_type = JSONNUMBER_INT_t;
+    }
+    return hashMix(payload ^ hashMix(JSON_HASH_GOLDEN * ((u_int64_t)value_type + 1)));
+}
+
+static u_int64_t hashString(char *string)
+{
+    u_int64_t hash = JSON_HASH_FNV_OFFSET;
+    for (; *string != NULL_CHAR; string++)
+    {
+        hash = (hash ^ (u_int8_t)*string) * JSON_HASH_FNV_PRIME;
+    }
+    return hash;
+}
+
+static u_int64_t hashInt(int64_t value)
+{
+    return hashTagged(JSONNUMBER_INT_t, (u_int64_t)value);
+}
+
+// Doubles holding an integer hash as that integer, -0.0 included.
+static u_int64_t hashDouble(double value)
+{
+    if (value >= -9223372036854775808.0 && value < 9223372036854775808.0 && value == (double)(int64_t)value)
+    {
+        return hashInt((int64_t)value);
+    }
+    u_int64_t bits = 0;
+    memcpy(&bits, &value, sizeof(double));
+    return hashTagged(JSONNUMBER_DOUBLE_t, bits);
+}
+
+static u_int64_t hashBool(bool value)
+{
+    return hashTagged(JSONBOOL_t, value ? 1 : 0);
+}
+
+// Members are summed so that key order does not matter.
+static u_int64_t hashObject(HashMap *map, bool cache)
+{
+    u_int64_t sum = 0;
+    JSONObjectIter iter;
+    JSONObjectIterInit(&iter, map);
+    for (JSONValue *map_entry = NULL; (map_entry = JSONObjectIterNext(&iter)) != NULL;)
+    {
+        sum += hashMix(hashString(map_entry->key) ^ (hashValue(map_entry, cache) * JSON_HASH_GOLDEN));
+    }
+    return hashTagged(JSONOBJ_t, sum + map->size);
+}
+
+// Packed elements are hashed where they are, the same as their boxed form.
+static u_int64_t hashList(DynamicArray *dynamic_array, bool cache)
+{
+    u_int64_t hash = dynamic_array->size;
+    switch (dynamic_array->storage)
+    {
+    case DYN_ARR_PACKED_INT:
+        for (u_int32_t i = 0; i < dynamic_array->size; i++)
+        {
+            hash = hashMix(hash + hashInt(dynamic_array->ints[i]));
+        }
+        break;
+    case DYN_ARR_PACKED_DOUBLE:
+        for (u_int32_t i = 0; i < dynamic_array->size; i++)
+        {
+            hash = hashMix(hash + hashDouble(dynamic_array->doubles[i]));
+        }
+        break;
+    case DYN_ARR_PACKED_BOOL:
+        for (u_int32_t i = 0; i < dynamic_array->size; i++)
+        {
+            hash = hashMix(hash + hashBool(JSONBitsetGet(dynamic_array->bools, i)));
+        }
+        break;
+    default:
+    {
+        JSONArrayIter iter;
+        if (!JSONArrayIterInit(&iter, dynamic_array))
+        {
+            return 0;
+        }
+        for (JSONValue *element = NULL; (element = JSONArrayIterNext(&iter)) != NULL;)
+        {
+            hash = hashMix(hash + hashValue(element, cache));
+        }
+        break;
+    }
+    }
+    return hashTagged(JSONLIST_t, hash);
+}
+
+static u_int64_t hashValue(JSONValue *json_value, bool cache)
+{
+    JSONTextCache *text_cache = NULL;
+    u_int64_t hash = 0;
+    switch (json_value->value_type)
+    {
+    case JSONOBJ_t:
+    case JSONLIST_t:
+        text_cache = JSONValueTextCache(json_value);
+        if (cache && text_cache != NULL && text_cache->hash_valid)
+        {
+            return text_cache->hash;
+        }
+        hash = json_value->value_type == JSONOBJ_t ? hashObject(json_value->value, cache) : hashList(json_value->value, cache);
+        if (cache && text_cache != NULL)
+        {
+            text_cache->hash = hash;
+            text_cache->hash_valid = true;
+        }
+        return hash;
+    case JSONNUMBER_INT_t:
+        return hashInt(*(int64_t *)json_value->value);
+    case JSONNUMBER_DOUBLE_t:
+        return hashDouble(*(double *)json_value->value);
+    case JSONSTRING_t:
+        return hashTagged(JSONSTRING_t, hashString(json_value->value));
+    case JSONBOOL_t:
+        return hashBool(*(bool *)json_value->value);
+    default:
+        return hashTagged(JSONNULL_t, 0);
+    }
+}
+
+// Structural hash of json_value: equal values (see JSONValueEquals) hash
+// alike, object member order is ignored. Packed and columnar arrays hash
+// like their generic form.
+extern u_int64_t JSONValueHash(JSONValue *json_value)
+{
+    if (json_value == NULL)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+    return hashValue(json_value, false);
+}
+
+// JSONValueHash that keeps the hash of every container it passes in the
+// container's cache, so hashing again only walks what changed since. The
+// caches follow the same invalidation as the text cache, a scalar edited in
+// place needs JSONTextCacheInvalidate on its container.
+extern u_int64_t JSONValueHashCached(JSONValue *json_value)
+{
+    if (json_value == NULL)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+    return hashValue(json_value, true);
+}
+
+static inline bool isNumber(enum JSONValueType value_type)
+{
+    return value_type == JSONNUMBER_INT_t || value_type == JSONNUMBER_DOUBLE_t;
+}
+
+// An int and a double are equal when the double holds exactly that int.
+static bool numbersEqual(JSONValue *a, JSONValue *b)
+{
+    if (a->value_type == JSONNUMBER_INT_t && b->value_type == JSONNUMBER_INT_t)
+    {
+        return *(int64_t *)a->value == *(int64_t *)b->value;
+    }
+    if (a->value_type == JSONNUMBER_DOUBLE_t && b->value_type == JSONNUMBER_DOUBLE_t)
+    {
+        return *(double *)a->value == *(double *)b->value;
+    }
+    int64_t integer = *(int64_t *)(a->value_type == JSONNUMBER_INT_t ? a : b)->value;
+    double number = *(double *)(a->value_type == JSONNUMBER_DOUBLE_t ? a : b)->value;
+    return number >= -9223372036854775808.0 && number < 9223372036854775808.0 && (double)integer == number && (int64_t)number == integer;
+}
+
+static bool objectsEqual(HashMap *a, HashMap *b)
+{
+    if (a->size != b->size)
+    {
+        return false;
+    }
+    JSONObjectIter iter;
+    JSONObjectIterInit(&iter, a);
+    for (JSONValue *map_entry = NULL; (map_entry = JSONObjectIterNext(&iter)) != NULL;)
+    {
+        if (!JSONValueEquals(map_entry, HashMapGet(b, map_entry->key)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Both arrays use the same packed storage.
+static bool packedListsEqual(DynamicArray *a, DynamicArray *b)
+{
+    for (u_int32_t i = 0; i < a->size; i++)
+    {
+        bool equal = true;
+        if (a->storage == DYN_ARR_PACKED_INT)
+        {
+            equal = a->ints[i] == b->ints[i];
+        }
+        else if (a->storage == DYN_ARR_PACKED_DOUBLE)
+        {
+            equal = a->doubles[i] == b->doubles[i];
+        }
+        else
+        {
+            equal = JSONBitsetGet(a->bools, i) == JSONBitsetGet(b->bools, i);
+        }
+        if (!equal)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool listsEqual(DynamicArray *a, DynamicArray *b)
+{
+    if (a->size != b->size)
+    {
+        return false;
+    }
+    if (a->storage == b->storage && (a->storage == DYN_ARR_PACKED_INT || a->storage == DYN_ARR_PACKED_DOUBLE || a->storage == DYN_ARR_PACKED_BOOL))
+    {
+        return packedListsEqual(a, b);
+    }
+    JSONArrayIter iter_a;
+    JSONArrayIter iter_b;
+    if (!JSONArrayIterInit(&iter_a, a) || !JSONArrayIterInit(&iter_b, b))
+    {
+        return false;
+    }
+    for (JSONValue *element = NULL; (element = JSONArrayIterNext(&iter_a)) != NULL;)
+    {
+        if (!JSONValueEquals(element, JSONArrayIterNext(&iter_b)))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Structural equality, ignoring object member order and the keys of a and b
+// themselves. Numbers compare by value, so 1 equals 1.0. Containers whose
+// cached hashes (see JSONValueHashCached) differ are unequal without being
+// walked. Comparing a packed with a generic array unpacks the packed one.
+extern bool JSONValueEquals(JSONValue *a, JSONValue *b)
+{
+    if (a == b)
+    {
+        return true;
+    }
+    if (a == NULL || b == NULL)
+    {
+        return false;
+    }
+    if (isNumber(a->value_type) && isNumber(b->value_type))
+    {
+        return numbersEqual(a, b);
+    }
+    if (a->value_type != b->value_type)
+    {
+        return false;
+    }
+    switch (a->value_type)
+    {
+    case JSONSTRING_t:
+        return strcmp(a->value, b->value) == 0;
+    case JSONBOOL_t:
+        return *(bool *)a->value == *(bool *)b->value;
+    case JSONNULL_t:
+        return true;
+    default:
+        break;
+    }
+    if (a->value == b->value)
+    {
+        return true;
+    }
+    JSONTextCache *cache_a = JSONValueTextCache(a);
+    JSONTextCache *cache_b = JSONValueTextCache(b);
+    if (cache_a != NULL && cache_b != NULL && cache_a->hash_valid && cache_b->hash_valid && cache_a->hash != cache_b->hash)
+    {
+        return false;
+    }
+    return a->value_type == JSONOBJ_t ? objectsEqual(a->value, b->value) : listsEqual(a->value, b->value);
+}
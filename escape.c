@@ -0,0 +1,197 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <standardloop/util.h>
+
+#include "./json.h"
+
+static inline u_int64_t escapeMask(u_int64_t);
+static inline u_int64_t quoteOrBackslashMask(u_int64_t);
+
+static const char hex_digits[17] = "0123456789abcdef";
+
+// SWAR: sets the high bit of every byte of chunk that is a control
+// character, a double quote or a backslash. Bits above the first hit may be
+// false positives, the lowest set bit is always exact.
+static inline u_int64_t escapeMask(u_int64_t chunk)
+{
+    u_int64_t quotes = chunk ^ 0x2222222222222222ULL;
+    u_int64_t backslashes = chunk ^ 0x5C5C5C5C5C5C5C5CULL;
+    u_int64_t controls = (chunk - 0x2020202020202020ULL) & ~chunk;
+    quotes = (quotes - 0x0101010101010101ULL) & ~quotes;
+    backslashes = (backslashes - 0x0101010101010101ULL) & ~backslashes;
+    return (controls | quotes | backslashes) & 0x8080808080808080ULL;
+}
+
+// Returns the index of the first byte of str that has to be escaped, or len
+// when the whole run can be copied as is.
+extern u_int64_t JSONEscapeScan(char *str, u_int64_t len)
+{
+    u_int64_t i = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len - i >= 8)
+    {
+        u_int64_t chunk;
+        memcpy(&chunk, str + i, sizeof(chunk));
+        u_int64_t mask = escapeMask(chunk);
+        if (mask != 0)
+        {
+            return i + (u_int64_t)(__builtin_ctzll(mask) >> 3);
+        }
+        i += 8;
+    }
+#endif
+    for (; i < len; i++)
+    {
+        unsigned char c = (unsigned char)str[i];
+        if (c < 0x20 || c == DOUBLE_QUOTES_CHAR || c == BACKSLASH_CHAR)
+        {
+            return i;
+        }
+    }
+    return len;
+}
+
+// SWAR: as escapeMask, for double quotes and backslashes only.
+static inline u_int64_t quoteOrBackslashMask(u_int64_t chunk)
+{
+    u_int64_t quotes = chunk ^ 0x2222222222222222ULL;
+    u_int64_t backslashes = chunk ^ 0x5C5C5C5C5C5C5C5CULL;
+    quotes = (quotes - 0x0101010101010101ULL) & ~quotes;
+    backslashes = (backslashes - 0x0101010101010101ULL) & ~backslashes;
+    return (quotes | backslashes) & 0x8080808080808080ULL;
+}
+
+// Returns the index of the first double quote or backslash in str, or len.
+// Used to find the end of an encoded string.
+extern u_int64_t JSONScanQuoteOrBackslash(char *str, u_int64_t len)
+{
+    u_int64_t i = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len - i >= 8)
+    {
+        u_int64_t chunk;
+        memcpy(&chunk, str + i, sizeof(chunk));
+        u_int64_t mask = quoteOrBackslashMask(chunk);
+        if (mask != 0)
+        {
+            return i + (u_int64_t)(__builtin_ctzll(mask) >> 3);
+        }
+        i += 8;
+    }
+#endif
+    for (; i < len; i++)
+    {
+        if (str[i] == DOUBLE_QUOTES_CHAR || str[i] == BACKSLASH_CHAR)
+        {
+            return i;
+        }
+    }
+    return len;
+}
+
+// Writes the escape sequence for c into out (at least
+// JSON_ESCAPE_SEQUENCE_MAX bytes) and returns its length.
+extern u_int32_t JSONEscapeChar(char c, char *out)
+{
+    out[0] = BACKSLASH_CHAR;
+    switch (c)
+    {
+    case DOUBLE_QUOTES_CHAR:
+    case BACKSLASH_CHAR:
+        out[1] = c;
+        return 2;
+    case '\b':
+        out[1] = 'b';
+        return 2;
+    case '\f':
+        out[1] = 'f';
+        return 2;
+    case NEWLINE_CHAR:
+        out[1] = 'n';
+        return 2;
+    case CARRIAGE_CHAR:
+        out[1] = 'r';
+        return 2;
+    case TAB_CHAR:
+        out[1] = 't';
+        return 2;
+    default:
+        out[1] = 'u';
+        out[2] = '0';
+        out[3] = '0';
+        out[4] = hex_digits[((unsigned char)c >> 4) & 0xF];
+        out[5] = hex_digits[(unsigned char)c & 0xF];
+        return JSON_ESCAPE_SEQUENCE_MAX;
+    }
+}
+
+extern u_int64_t JSONEscapedLength(char *str, u_int64_t len)
+{
+    u_int64_t escaped_len = 0;
+    char sequence[JSON_ESCAPE_SEQUENCE_MAX];
+    while (ALWAYS)
+    {
+        u_int64_t clean_run = JSONEscapeScan(str, len);
+        escaped_len += clean_run;
+        if (clean_run == len)
+        {
+            return escaped_len;
+        }
+        escaped_len += JSONEscapeChar(str[clean_run], sequence);
+        str += clean_run + 1;
+        len -= clean_run + 1;
+    }
+}
+
+// dest needs JSONEscapedLength bytes, no NUL is written.
+extern u_int64_t JSONEscapeInto(char *dest, char *str, u_int64_t len)
+{
+    u_int64_t written = 0;
+    while (ALWAYS)
+    {
+        u_int64_t clean_run = JSONEscapeScan(str, len);
+        memcpy(dest + written, str, clean_run);
+        written += clean_run;
+        if (clean_run == len)
+        {
+            return written;
+        }
+        written += JSONEscapeChar(str[clean_run], dest + written);
+        str += clean_run + 1;
+        len -= clean_run + 1;
+    }
+}
+
+// Returns str escaped and wrapped in double quotes.
+extern char *JSONQuoteString(char *str)
+{
+    if (str == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    u_int64_t len = strlen(str);
+    u_int64_t escaped_len = JSONEscapedLength(str, len);
+    char *quoted = malloc(sizeof(char) * (escaped_len + 3));
+    if (quoted == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    quoted[0] = DOUBLE_QUOTES_CHAR;
+    if (escaped_len == len)
+    {
+        memcpy(quoted + 1, str, len);
+    }
+    else
+    {
+        (void)JSONEscapeInto(quoted + 1, str, len);
+    }
+    quoted[escaped_len + 1] = DOUBLE_QUOTES_CHAR;
+    quoted[escaped_len + 2] = NULL_CHAR;
+    return quoted;
+}
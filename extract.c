@@ -0,0 +1,351 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <standardloop/util.h>
+
+#include "./json.h"
+
+// buffer is the window of the file starting at window_offset. It holds the
+// token being read and, while a match is open, everything from pin on.
+typedef struct
+{
+    FILE *file;
+    bool file_done;
+    char *buffer;
+    u_int64_t buffer_len;
+    u_int64_t buffer_capacity;
+    u_int64_t window_offset;
+    u_int64_t pin;
+    u_int64_t token_start;
+    u_int64_t token_end;
+    JSONLexer *lexer;
+    JSONPath *path;
+    JSONExtractCallback *callback;
+    void *context;
+    int error;
+} JSONExtractor;
+
+static void freeExtractToken(JSONToken *);
+static bool extractorRefill(JSONExtractor *);
+static JSONToken *extractorLex(JSONExtractor *);
+static bool extractorNextMember(JSONExtractor *, bool, bool, char **, JSONToken **);
+static bool extractorEmit(JSONExtractor *, u_int64_t, u_int64_t);
+static bool extractValue(JSONExtractor *, JSONToken *, u_int64_t);
+
+static void freeExtractToken(JSONToken *token)
+{
+    if (token->type == JSONTokenString || token->type == JSONTokenNumber || token->type == JSONTokenBool || token->type == JSONTokenNULL)
+    {
+        free(token->literal);
+    }
+    FreeJSONToken(token);
+}
+
+// Drops what is no longer needed from the front of the window and reads the
+// next chunk behind the rest. The buffer only grows while a single token or
+// an open match is larger than what it holds.
+static bool extractorRefill(JSONExtractor *extractor)
+{
+    u_int64_t keep_from = extractor->lexer->read_position;
+    if (extractor->pin != JSON_EXTRACT_NO_PIN && extractor->pin - extractor->window_offset < keep_from)
+    {
+        keep_from = extractor->pin - extractor->window_offset;
+    }
+    if (keep_from > 0)
+    {
+        memmove(extractor->buffer, extractor->buffer + keep_from, extractor->buffer_len - keep_from);
+        extractor->buffer_len -= keep_from;
+        extractor->window_offset += keep_from;
+        extractor->lexer->read_position -= keep_from;
+        extractor->lexer->position = extractor->lexer->read_position - 1;
+    }
+    if (extractor->buffer_capacity < extractor->buffer_len + JSON_EXTRACT_CHUNK_SIZE + 1)
+    {
+        u_int64_t new_capacity = extractor->buffer_capacity * 2;
+        // lexer offsets are 32 bit
+        if (new_capacity > UINT32_MAX)
+        {
+            extractor->error = ENOBUFS;
+            return false;
+        }
+        char *buffer = realloc(extractor->buffer, new_capacity);
+        if (buffer == NULL)
+        {
+            extractor->error = ENOMEM;
+            return false;
+        }
+        extractor->buffer = buffer;
+        extractor->buffer_capacity = new_capacity;
+    }
+    size_t read = fread(extractor->buffer + extractor->buffer_len, 1, JSON_EXTRACT_CHUNK_SIZE, extractor->file);
+    if (read < JSON_EXTRACT_CHUNK_SIZE)
+    {
+        if (ferror(extractor->file))
+        {
+            extractor->error = EIO;
+            return false;
+        }
+        extractor->file_done = true;
+    }
+    extractor->buffer_len += read;
+    extractor->buffer[extractor->buffer_len] = NULL_CHAR;
+    extractor->lexer->input = extractor->buffer;
+    extractor->lexer->input_len = extractor->buffer_len;
+    return true;
+}
+
+// Next token, its file offsets going to token_start and token_end. A token
+// touching the end of the window may be cut off, so it is lexed again once
+// the next chunk is in.
+static JSONToken *extractorLex(JSONExtractor *extractor)
+{
+    while (ALWAYS)
+    {
+        JSONLexer saved = *extractor->lexer;
+        JSONToken *token = JSONLex(extractor->lexer);
+        if (token == NULL)
+        {
+            extractor->error = ENOMEM;
+            return NULL;
+        }
+        if (extractor->file_done || token->end < extractor->buffer_len)
+        {
+            extractor->token_start = extractor->window_offset + token->start;
+            extractor->token_end = token->type == JSONTokenNumber ? extractor->token_start + strlen(token->literal) : extractor->window_offset + token->end;
+            return token;
+        }
+        freeExtractToken(token);
+        *extractor->lexer = saved;
+        if (!extractorRefill(extractor))
+        {
+            return NULL;
+        }
+    }
+}
+
+// streamNextMember of jsonpath.c over the window. Once the container closes
+// *value stays NULL and token_end is the offset past it.
+static bool extractorNextMember(JSONExtractor *extractor, bool is_object, bool first, char **key, JSONToken **value)
+{
+    *key = NULL;
+    *value = NULL;
+    JSONToken *token = extractorLex(extractor);
+    if (token == NULL)
+    {
+        return false;
+    }
+    if (token->type == (is_object ? JSONTokenCloseCurlyBrace : JSONTokenCloseBracket))
+    {
+        FreeJSONToken(token);
+        return true;
+    }
+    if (!first)
+    {
+        if (token->type != JSONTokenComma)
+        {
+            freeExtractToken(token);
+            return false;
+        }
+        FreeJSONToken(token);
+        if ((token = extractorLex(extractor)) == NULL)
+        {
+            return false;
+        }
+    }
+    if (is_object)
+    {
+        if (token->type != JSONTokenString)
+        {
+            freeExtractToken(token);
+            return false;
+        }
+        *key = token->literal;
+        FreeJSONToken(token);
+        if ((token = extractorLex(extractor)) == NULL || token->type != JSONTokenColon)
+        {
+            if (token != NULL)
+            {
+                freeExtractToken(token);
+            }
+            free(*key);
+            *key = NULL;
+            return false;
+        }
+        FreeJSONToken(token);
+        if ((token = extractorLex(extractor)) == NULL)
+        {
+            free(*key);
+            *key = NULL;
+            return false;
+        }
+    }
+    if (!IsJSONTokenValueType(token, true))
+    {
+        freeExtractToken(token);
+        free(*key);
+        *key = NULL;
+        return false;
+    }
+    *value = token;
+    return true;
+}
+
+// Hands the text between the file offsets start and end to the callback,
+// NUL terminated for the duration of the call.
+static bool extractorEmit(JSONExtractor *extractor, u_int64_t start, u_int64_t end)
+{
+    char *text = extractor->buffer + (start - extractor->window_offset);
+    u_int64_t len = end - start;
+    char after = text[len];
+    text[len] = NULL_CHAR;
+    bool keep_going = extractor->callback(extractor->context, text, len);
+    text[len] = after;
+    if (!keep_going)
+    {
+        extractor->error = ECANCELED;
+    }
+    return keep_going;
+}
+
+// Consumes the value starting with token, mask holding the program states
+// (by pc) it is in; bit instruction_count marks a match. A matched container
+// is emitted once it closes, its start pinned in the window until then.
+static bool extractValue(JSONExtractor *extractor, JSONToken *token, u_int64_t mask)
+{
+    bool is_result = mask & (1ULL << extractor->path->instruction_count);
+    u_int64_t start = extractor->token_start;
+    enum JSONTokenType type = token->type;
+    freeExtractToken(token);
+    if (type != JSONTokenOpenCurlyBrace && type != JSONTokenOpenBracket)
+    {
+        return !is_result || extractorEmit(extractor, start, extractor->token_end);
+    }
+    bool pinned = false;
+    if (is_result && extractor->pin == JSON_EXTRACT_NO_PIN)
+    {
+        extractor->pin = start;
+        pinned = true;
+    }
+    u_int64_t member_states = mask & ~(1ULL << extractor->path->instruction_count);
+    bool is_object = type == JSONTokenOpenCurlyBrace;
+    for (u_int32_t index = 0;; index++)
+    {
+        char *key = NULL;
+        JSONToken *value = NULL;
+        if (!extractorNextMember(extractor, is_object, index == 0, &key, &value))
+        {
+            return false;
+        }
+        if (value == NULL)
+        {
+            break;
+        }
+        u_int64_t filters = 0;
+        u_int64_t member_mask = member_states == 0 ? 0 : JSONPathNextStates(extractor->path, member_states, key, index, &filters);
+        free(key);
+        if (!extractValue(extractor, value, member_mask))
+        {
+            return false;
+        }
+    }
+    if (is_result && !extractorEmit(extractor, start, extractor->token_end))
+    {
+        return false;
+    }
+    if (pinned)
+    {
+        extractor->pin = JSON_EXTRACT_NO_PIN;
+    }
+    return true;
+}
+
+// Streams the single JSON value in file through path, calling callback with
+// the text of every match. A container is reported after the matches inside
+// it. Only a window of JSON_EXTRACT_CHUNK_SIZE bytes is held, plus the
+// largest token or match. Filters and negative indices need to look at a
+// container before walking it and fail with EINVAL, as does invalid input.
+// ECANCELED means the callback returned false.
+extern bool JSONExtractFromStream(FILE *file, JSONPath *path, JSONExtractCallback *callback, void *context)
+{
+    if (file == NULL || path == NULL || callback == NULL || !path->streamable)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    for (u_int32_t pc = 0; pc < path->instruction_count; pc++)
+    {
+        if (path->instructions[pc].opcode == JSONPathOpFilter)
+        {
+            errno = EINVAL;
+            return false;
+        }
+    }
+    JSONExtractor extractor = {
+        .file = file,
+        .file_done = false,
+        .buffer = malloc(sizeof(char) * JSON_EXTRACT_CHUNK_SIZE * 2),
+        .buffer_len = 0,
+        .buffer_capacity = JSON_EXTRACT_CHUNK_SIZE * 2,
+        .window_offset = 0,
+        .pin = JSON_EXTRACT_NO_PIN,
+        .path = path,
+        .callback = callback,
+        .context = context,
+        .error = EINVAL,
+    };
+    if (extractor.buffer == NULL)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+    extractor.buffer[0] = NULL_CHAR;
+    extractor.lexer = JSONLexerInit(extractor.buffer);
+    if (extractor.lexer == NULL)
+    {
+        free(extractor.buffer);
+        return false;
+    }
+    JSONToken *token = extractorLex(&extractor);
+    bool ok = token != NULL && IsJSONTokenValueType(token, true);
+    if (token != NULL && !ok)
+    {
+        freeExtractToken(token);
+    }
+    ok = ok && extractValue(&extractor, token, 1ULL);
+    if (ok)
+    {
+        token = extractorLex(&extractor);
+        ok = token != NULL && token->type == JSONTokenEOF;
+        if (token != NULL)
+        {
+            freeExtractToken(token);
+        }
+    }
+    FreeJSONLexer(extractor.lexer);
+    free(extractor.buffer);
+    if (!ok)
+    {
+        errno = extractor.error;
+    }
+    return ok;
+}
+
+extern bool JSONExtractFromFile(char *filename, JSONPath *path, JSONExtractCallback *callback, void *context)
+{
+    if (filename == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    FILE *file_ptr = fopen(filename, "rb");
+    if (file_ptr == NULL)
+    {
+        return false;
+    }
+    bool ok = JSONExtractFromStream(file_ptr, path, callback, context);
+    fclose(file_ptr);
+    return ok;
+}
@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <standardloop/util.h>
+
+#include "./json.h"
+
+static bool freezeValue(JSONValue *);
+
+// Children are frozen before their container, so a failure part way leaves
+// frozen subtrees below a container that can still be freed or retried. The
+// members are pinned and the cached hash is filled in last, a frozen
+// container is never written to.
+static bool freezeValue(JSONValue *json_value)
+{
+    if (JSONValueIsFrozen(json_value))
+    {
+        return true;
+    }
+    if (json_value->value_type == JSONOBJ_t)
+    {
+        HashMap *map = json_value->value;
+        JSONObjectIter iter;
+        JSONObjectIterInit(&iter, map);
+        for (JSONValue *map_entry = NULL; (map_entry = JSONObjectIterNext(&iter)) != NULL;)
+        {
+            if (!freezeValue(map_entry))
+            {
+                return false;
+            }
+        }
+        // a frozen map may outlive the key table of its document
+        if (!HashMapRehomeKeys(map, NULL))
+        {
+            return false;
+        }
+        JSONObjectIterInit(&iter, map);
+        for (JSONValue *map_entry = NULL; (map_entry = JSONObjectIterNext(&iter)) != NULL;)
+        {
+            map_entry->pinned = true;
+        }
+        (void)JSONValueHashCached(json_value);
+        map->frozen = true;
+    }
+    else if (json_value->value_type == JSONLIST_t)
+    {
+        // packed and columnar arrays unpack on their first lookup, so they
+        // are unpacked here while that is still allowed
+        DynamicArray *dynamic_array = json_value->value;
+        JSONArrayIter iter;
+        if (!DynamicArrayUnpack(dynamic_array) || !JSONArrayIterInit(&iter, dynamic_array))
+        {
+            return false;
+        }
+        for (JSONValue *element = NULL; (element = JSONArrayIterNext(&iter)) != NULL;)
+        {
+            if (!freezeValue(element))
+            {
+                return false;
+            }
+        }
+        (void)JSONArrayIterInit(&iter, dynamic_array);
+        for (JSONValue *element = NULL; (element = JSONArrayIterNext(&iter)) != NULL;)
+        {
+            element->pinned = true;
+        }
+        (void)JSONValueHashCached(json_value);
+        dynamic_array->frozen = true;
+    }
+    return true;
+}
+
+// Freezes the container held by json_value and everything below it, scalars
+// have nothing to freeze. Fails with ENOMEM, leaving whatever was frozen so
+// far frozen.
+extern bool JSONValueFreeze(JSONValue *json_value)
+{
+    if (json_value == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    return freezeValue(json_value);
+}
+
+extern bool JSONValueIsFrozen(JSONValue *json_value)
+{
+    if (json_value == NULL || json_value->value == NULL)
+    {
+        return false;
+    }
+    if (json_value->value_type == JSONOBJ_t)
+    {
+        return ((HashMap *)json_value->value)->frozen;
+    }
+    if (json_value->value_type == JSONLIST_t)
+    {
+        return ((DynamicArray *)json_value->value)->frozen;
+    }
+    return false;
+}
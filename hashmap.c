@@ -2,28 +2,30 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
-#include <assert.h>
 #include <errno.h>
 
 #include <standardloop/util.h>
 
 #include "./json.h"
 
-static void freeHashMapEntrySingle(JSONValue *, bool);
-static void freeHashMapEntryList(JSONValue *, bool);
-static void freeHashMapEntries(JSONValue **, u_int32_t, bool, bool);
+static void freeHashMapEntrySingle(HashMap *, JSONValue *);
 static void printHashMapEntry(JSONValue *);
 static u_int32_t defaultHashFunction(char *, u_int32_t);
 
-static bool hashMapEntriesInsert(JSONValue **, u_int32_t, JSONValue *);
-
-static JSONValue **hashMapEntriesInit(u_int32_t);
+static u_int32_t *hashMapIndicesInit(u_int32_t);
+static u_int32_t hashMapUsableCapacity(u_int32_t);
+static inline u_int32_t hashMapHomeSlot(HashMap *, char *);
+static u_int32_t hashMapFindSlot(HashMap *, char *, bool *);
+static void hashMapIndicesInsert(HashMap *, char *, u_int32_t);
 
 static inline bool isMapFull(HashMap *);
+static bool isHashMapWritable(HashMap *);
 static void hashMapResize(HashMap *map);
+static JSONValue *hashMapDetach(HashMap *, char *);
+static bool hashMapLookupSlot(HashMap *, char *, u_int32_t *);
 
 // Jenkins's one_at_a_time
-static u_int32_t defaultHashFunction(char *key, u_int32_t capacity)
+extern u_int32_t HashMapKeyHash(char *key)
 {
     u_int32_t len = strlen(key);
     u_int32_t hash = 0;
@@ -37,7 +39,12 @@ static u_int32_t defaultHashFunction(char *key, u_int32_t capacity)
     hash += (hash << 3);
     hash ^= (hash >> 11);
     hash += (hash << 15);
-    return hash % capacity;
+    return hash;
+}
+
+static u_int32_t defaultHashFunction(char *key, u_int32_t capacity)
+{
+    return HashMapKeyHash(key) % capacity;
 }
 
 extern HashMap *DefaultHashMapInit(void)
@@ -45,20 +52,26 @@ extern HashMap *DefaultHashMapInit(void)
     return HashMapInit(DEFAULT_MAP_SIZE, NULL, false);
 }
 
-static JSONValue **hashMapEntriesInit(u_int32_t capacity)
+static u_int32_t *hashMapIndicesInit(u_int32_t capacity)
 {
-    JSONValue **entries = malloc(sizeof(JSONValue *) * capacity);
-    if (entries == NULL)
+    u_int32_t *indices = malloc(sizeof(u_int32_t) * capacity);
+    if (indices == NULL)
     {
         return NULL;
     }
 
     for (u_int32_t i = 0; i < capacity; i++)
     {
-        entries[i] = NULL;
+        indices[i] = HASHMAP_INDEX_EMPTY;
     }
 
-    return entries;
+    return indices;
+}
+
+// the sparse table is kept at most 2/3 full so probe sequences stay short
+static u_int32_t hashMapUsableCapacity(u_int32_t capacity)
+{
+    return (capacity * 2) / 3;
 }
 
 extern HashMap *HashMapInit(u_int32_t initial_capacity, HashFunction *hashFunction, bool force_lowercase)
@@ -69,15 +82,28 @@ extern HashMap *HashMapInit(u_int32_t initial_capacity, HashFunction *hashFuncti
         errno = ENOMEM;
         return NULL;
     }
+    if (initial_capacity < HASHMAP_MIN_CAPACITY)
+    {
+        initial_capacity = HASHMAP_MIN_CAPACITY;
+    }
     map->size = 0;
     map->collision_count = 0;
     map->capacity = initial_capacity;
     map->force_lowercase = force_lowercase;
-    map->entries = hashMapEntriesInit(initial_capacity);
-
-    if (map->entries == NULL)
+    map->key_table = NULL;
+    map->frozen = false;
+    map->ref_count = 1;
+    map->row_view_of = NULL;
+    JSONTextCacheInit(&map->text_cache);
+    map->entries_used = 0;
+    map->entries_capacity = hashMapUsableCapacity(initial_capacity);
+    map->indices = hashMapIndicesInit(initial_capacity);
+    map->entries = malloc(sizeof(JSONValue *) * map->entries_capacity);
+
+    if (map->indices == NULL || map->entries == NULL)
     {
         FreeHashMap(map);
+        errno = ENOMEM;
         return NULL;
     }
 
@@ -85,107 +111,199 @@ extern HashMap *HashMapInit(u_int32_t initial_capacity, HashFunction *hashFuncti
     {
         map->hashFunction = defaultHashFunction;
     }
+    else
+    {
+        map->hashFunction = hashFunction;
+    }
+    return map;
+}
+
+// Keys of a map bound to a key table are canonical pointers owned by the
+// table, so the table's precomputed hash is used and keys compare by pointer.
+extern HashMap *HashMapInitWithKeyTable(u_int32_t initial_capacity, JSONKeyTable *key_table)
+{
+    HashMap *map = HashMapInit(initial_capacity, NULL, false);
+    if (map == NULL)
+    {
+        return NULL;
+    }
+    map->key_table = key_table;
     return map;
 }
 
 static inline bool isMapFull(HashMap *map)
 {
-    return map->capacity == map->size;
+    return map->entries_used == map->entries_capacity;
 }
 
-extern void HashMapInsert(HashMap *map, JSONValue *entry)
+static inline u_int32_t hashMapHomeSlot(HashMap *map, char *key)
 {
-    if (map == NULL || entry->key == NULL || (entry->value == NULL && entry->value_type != JSONNULL_t))
-    {
-        errno = EINVAL;
-        return;
-    }
-    if (isMapFull(map))
+    if (map->key_table != NULL)
     {
-        hashMapResize(map);
+        return JSONInternedKeyHash(key) % map->capacity;
     }
-    if (map->force_lowercase)
+    // a caller's hash function is not trusted to stay below capacity
+    return map->hashFunction(key, map->capacity) % map->capacity;
+}
+
+// Returns the slot in map->indices holding key, or the first empty slot of its
+// probe sequence when key is not present.
+static u_int32_t hashMapFindSlot(HashMap *map, char *key, bool *collision)
+{
+    u_int32_t slot = hashMapHomeSlot(map, key);
+    while (ALWAYS)
     {
-        StringToLower(entry->key);
+        u_int32_t index = map->indices[slot];
+        if (index == HASHMAP_INDEX_EMPTY)
+        {
+            return slot;
+        }
+        if (index != HASHMAP_INDEX_DUMMY)
+        {
+            char *entry_key = map->entries[index]->key;
+            if (entry_key == key || (map->key_table == NULL && strcmp(entry_key, key) == 0))
+            {
+                return slot;
+            }
+        }
+        if (collision != NULL)
+        {
+            *collision = true;
+        }
+        slot++;
+        if (slot == map->capacity)
+        {
+            slot = 0;
+        }
     }
-    u_int32_t index = map->hashFunction(entry->key, map->capacity);
-    assert(index < map->capacity); // TODO
-    bool collision = hashMapEntriesInsert(map->entries, index, entry);
-    if (collision)
+}
+
+// Only used while rebuilding, where every key is known to be unique.
+static void hashMapIndicesInsert(HashMap *map, char *key, u_int32_t index)
+{
+    u_int32_t slot = hashMapHomeSlot(map, key);
+    while (map->indices[slot] != HASHMAP_INDEX_EMPTY)
     {
         map->collision_count++;
+        slot++;
+        if (slot == map->capacity)
+        {
+            slot = 0;
+        }
     }
-    else
+    map->indices[slot] = index;
+}
+
+// Frozen maps refuse every mutation with EPERM. A row view gets its columnar
+// array unpacked first, after which it is an element like any other.
+static bool isHashMapWritable(HashMap *map)
+{
+    if (map->frozen)
     {
-        map->size++;
+        errno = EPERM;
+        return false;
     }
+    return map->row_view_of == NULL || DynamicArrayUnpack(map->row_view_of);
 }
 
-static bool hashMapEntriesInsert(JSONValue **entries, u_int32_t index, JSONValue *entry)
+// Takes ownership of entry and its key. When it fails the entry is not in
+// the map and still belongs to the caller, key included.
+extern bool HashMapInsert(HashMap *map, JSONValue *entry)
 {
-    // FIXME: may have to use enum for return values
-    // collision, no collision, or error
-    if (entries == NULL || entry == NULL || entry->key == NULL)
+    if (map == NULL || entry == NULL || entry->key == NULL || (entry->value == NULL && entry->value_type != JSONNULL_t))
     {
         errno = EINVAL;
         return false;
     }
-    // printf("[JOSH]: %s\n", entry->key);
-    // fflush(stdout);
-    JSONValue *collision = entries[index];
-    if (collision == NULL)
+    if (!isHashMapWritable(map))
     {
-        entry->next = NULL;
-        entries[index] = entry;
         return false;
     }
-    // printf("%s -> %s\n", collision->key, entry->key);
-    // If duplicate key, update (in future could maybe make this a feature flag for the init function)
-    if (collision->key != NULL)
+    char *original_key = entry->key;
+    if (map->key_table != NULL)
     {
-        size_t collision_key_len = strlen(collision->key);
-        size_t entry_key_len = strlen(entry->key);
-        if (collision_key_len == entry_key_len)
+        entry->key = JSONKeyTableIntern(map->key_table, original_key);
+        if (entry->key == NULL)
         {
-            if (strncmp(collision->key, entry->key, entry_key_len) == 0)
-            {
-                entry->next = collision->next;
-                collision->next = NULL;
-                freeHashMapEntrySingle(collision, true);
-                entries[index] = entry;
-                return true;
-            }
+            entry->key = original_key;
+            return false;
         }
     }
-    JSONValue *iterator_prev = collision;
-    JSONValue *iterator = collision->next;
-    while (iterator != NULL)
+    else if (map->force_lowercase)
+    {
+        StringToLower(entry->key);
+    }
+    bool collision = false;
+    u_int32_t slot = hashMapFindSlot(map, entry->key, &collision);
+    u_int32_t index = map->indices[slot];
+    if (index == HASHMAP_INDEX_EMPTY && isMapFull(map))
     {
-        if (iterator->key != NULL && entry->key != NULL)
+        hashMapResize(map);
+        if (isMapFull(map))
         {
-            size_t collision_key_len = strlen(collision->key);
-            size_t entry_key_len = strlen(entry->key);
-            if (collision_key_len == entry_key_len)
-            {
-                if (strncmp(iterator->key, entry->key, collision_key_len) == 0)
-                {
-                    iterator_prev->next = entry;
-                    entry->next = iterator->next;
-                    iterator->next = NULL;
-                    freeHashMapEntrySingle(iterator, true);
-                    return true;
-                }
-            }
+            entry->key = original_key;
+            return false;
         }
-
-        iterator_prev = iterator;
-        iterator = iterator->next;
+        collision = false;
+        slot = hashMapFindSlot(map, entry->key, &collision);
+    }
+    if (entry->key != original_key)
+    {
+        free(original_key);
     }
-    entry->next = NULL;
-    iterator_prev->next = entry;
+    JSONTextCacheAttach(&map->text_cache, entry);
+    JSONTextCacheInvalidate(&map->text_cache);
+    // If duplicate key, update in place so the key keeps its original position
+    if (index != HASHMAP_INDEX_EMPTY)
+    {
+        freeHashMapEntrySingle(map, map->entries[index]);
+        map->entries[index] = entry;
+        return true;
+    }
+    if (collision)
+    {
+        map->collision_count++;
+    }
+    map->indices[slot] = map->entries_used;
+    map->entries[map->entries_used] = entry;
+    map->entries_used++;
+    map->size++;
     return true;
 }
 
+// Finds the slot holding key the way it was inserted: interned in the key
+// table, or lowercased for a force_lowercase map. Returns false when key is
+// not there, or with ENOMEM when the lowercase copy cannot be made.
+static bool hashMapLookupSlot(HashMap *map, char *key, u_int32_t *slot)
+{
+    if (map->key_table != NULL)
+    {
+        key = JSONKeyTableLookup(map->key_table, key);
+        if (key == NULL)
+        {
+            return false;
+        }
+        *slot = hashMapFindSlot(map, key, NULL);
+    }
+    else if (map->force_lowercase)
+    {
+        char *lowercase_key = strdup(key);
+        if (lowercase_key == NULL)
+        {
+            errno = ENOMEM;
+            return false;
+        }
+        StringToLower(lowercase_key);
+        *slot = hashMapFindSlot(map, lowercase_key, NULL);
+        free(lowercase_key);
+    }
+    else
+    {
+        *slot = hashMapFindSlot(map, key, NULL);
+    }
+    return map->indices[*slot] != HASHMAP_INDEX_EMPTY;
+}
+
 extern JSONValue *HashMapGet(HashMap *map, char *key)
 {
     if (map == NULL || key == NULL)
@@ -193,23 +311,51 @@ extern JSONValue *HashMapGet(HashMap *map, char *key)
         errno = EINVAL;
         return NULL;
     }
-    u_int32_t index = map->hashFunction(key, map->capacity);
-    JSONValue *entry = map->entries[index];
-    if (entry == NULL)
+    u_int32_t slot = 0;
+    if (!hashMapLookupSlot(map, key, &slot))
     {
         return NULL;
     }
+    return map->entries[map->indices[slot]];
+}
 
-    JSONValue *iterator = entry;
-    while (iterator != NULL)
+// HashMapGet for a key whose length and HashMapKeyHash are already known,
+// nothing is hashed or interned. Maps with their own hash function or with
+// force_lowercase fall back to HashMapGet.
+extern JSONValue *HashMapGetHashed(HashMap *map, char *key, u_int32_t key_len, u_int32_t hash)
+{
+    if (map == NULL || key == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (map->key_table == NULL && (map->hashFunction != defaultHashFunction || map->force_lowercase))
+    {
+        return HashMapGet(map, key);
+    }
+    u_int32_t slot = hash % map->capacity;
+    while (ALWAYS)
     {
-        if (strcmp(key, iterator->key) == 0)
+        u_int32_t index = map->indices[slot];
+        if (index == HASHMAP_INDEX_EMPTY)
         {
-            return iterator;
+            return NULL;
+        }
+        if (index != HASHMAP_INDEX_DUMMY)
+        {
+            char *entry_key = map->entries[index]->key;
+            // interned keys know their length, so most mismatches skip memcmp
+            if (entry_key == key || (map->key_table != NULL ? JSONInternedKeyLength(entry_key) == key_len && memcmp(entry_key, key, key_len) == 0 : strcmp(entry_key, key) == 0))
+            {
+                return map->entries[index];
+            }
+        }
+        slot++;
+        if (slot == map->capacity)
+        {
+            slot = 0;
         }
-        iterator = iterator->next;
     }
-    return NULL;
 }
 
 extern void *HashMapGetValueDirect(HashMap *map, char *key)
@@ -227,127 +373,229 @@ extern void *HashMapGetValueDirect(HashMap *map, char *key)
     return value_obj->value;
 }
 
-static void freeHashMapEntryList(JSONValue *entry, bool deep)
+static void freeHashMapEntrySingle(HashMap *map, JSONValue *entry)
 {
     if (entry == NULL)
     {
         errno = EINVAL;
         return;
     }
-    JSONValue *temp = NULL;
-    while (entry != NULL)
+    if (entry->key != NULL && map->key_table == NULL)
     {
-        temp = entry;
-        entry = entry->next;
-        if (temp != NULL && temp->key != NULL)
-        {
-            free(temp->key);
-            temp->key = NULL;
-        }
-        if (temp != NULL)
-        {
-            FreeJSONValue(temp, deep);
-        }
+        free(entry->key);
     }
+    entry->key = NULL;
+    FreeJSONValue(entry, true);
 }
 
-static void freeHashMapEntrySingle(JSONValue *entry, bool deep)
+extern void FreeHashMap(HashMap *map)
 {
-    if (entry == NULL)
+    if (map == NULL)
     {
         errno = EINVAL;
         return;
     }
-    if (entry->key != NULL)
+    // a frozen map goes with its last reference
+    if (map->frozen && __atomic_sub_fetch(&map->ref_count, 1, __ATOMIC_ACQ_REL) != 0)
     {
-        free(entry->key);
-        entry->key = NULL;
+        return;
+    }
+    if (map->entries != NULL)
+    {
+        for (u_int32_t i = 0; i < map->entries_used; i++)
+        {
+            if (map->entries[i] != NULL)
+            {
+                freeHashMapEntrySingle(map, map->entries[i]);
+            }
+        }
+        free(map->entries);
+        map->entries = NULL;
+    }
+    if (map->indices != NULL)
+    {
+        free(map->indices);
+        map->indices = NULL;
     }
-    FreeJSONValue(entry, deep);
+    FreeJSONTextCache(&map->text_cache);
+    free(map);
+}
+
+// Unlinks the entry under key without freeing it, NULL when there is none.
+static JSONValue *hashMapDetach(HashMap *map, char *key)
+{
+    u_int32_t slot = 0;
+    if (!hashMapLookupSlot(map, key, &slot))
+    {
+        return NULL;
+    }
+    u_int32_t index = map->indices[slot];
+    JSONTextCacheInvalidate(&map->text_cache);
+    // the dense slot is left as a hole and reclaimed on the next resize
+    JSONValue *entry = map->entries[index];
+    map->entries[index] = NULL;
+    map->indices[slot] = HASHMAP_INDEX_DUMMY;
+    map->size--;
+    JSONTextCacheAttach(NULL, entry);
+    return entry;
 }
 
-static void freeHashMapEntries(JSONValue **entries, u_int32_t size, bool deep, bool entry_values)
+extern void HashMapRemove(HashMap *map, char *key)
 {
-    if (entries == NULL)
+    if (map == NULL || key == NULL)
     {
         errno = EINVAL;
         return;
     }
-    if (deep)
+    if (!isHashMapWritable(map))
     {
-        for (u_int32_t i = 0; i < size; i++)
-        {
-            if (entries[i] != NULL)
-            {
-                freeHashMapEntryList(entries[i], entry_values);
-                entries[i] = NULL;
-            }
-        }
+        return;
+    }
+    JSONValue *entry = hashMapDetach(map, key);
+    if (entry != NULL)
+    {
+        freeHashMapEntrySingle(map, entry);
     }
-    free(entries);
 }
 
-extern void FreeHashMap(HashMap *map)
+// Like HashMapRemove, but the value passes to the caller instead of being
+// freed. It comes back without a key and nothing below it is copied, so the
+// maps below it may still use map's key table. JSONObjectSet moves them to
+// the table of the map it puts the value in; before adding it to an array
+// of a document with another key table, use JSONValueRehomeKeys.
+extern JSONValue *JSONObjectTake(HashMap *map, char *key)
 {
-    if (map == NULL)
+    if (map == NULL || key == NULL)
     {
         errno = EINVAL;
-        return;
+        return NULL;
     }
-    if (map->entries != NULL)
+    if (!isHashMapWritable(map))
     {
-        freeHashMapEntries(map->entries, map->capacity, true, true);
-        map->entries = NULL;
+        return NULL;
     }
-    free(map);
+    JSONValue *entry = hashMapDetach(map, key);
+    if (entry == NULL)
+    {
+        return NULL;
+    }
+    if (map->key_table == NULL)
+    {
+        free(entry->key);
+    }
+    entry->key = NULL;
+    return entry;
 }
 
-extern void HashMapRemove(HashMap *map, char *key)
+// Moves the keys of map into key_table, or gives the map its own copy of
+// each when key_table is NULL, so it stops depending on the table it was
+// built with. The home slots do not move, the table hash and the default
+// hash function agree. A map already owning its keys is left alone. Fails
+// with ENOMEM, leaving the map as it was.
+extern bool HashMapRehomeKeys(HashMap *map, JSONKeyTable *key_table)
 {
     if (map == NULL)
     {
         errno = EINVAL;
-        return;
+        return false;
     }
-    u_int32_t index = map->hashFunction(key, map->capacity);
-    JSONValue *entry = map->entries[index];
-    if (entry == NULL)
+    if (map->key_table == NULL || map->key_table == key_table)
     {
-        return;
+        return true;
     }
-    if (entry->next == NULL)
+    char **keys = malloc(sizeof(char *) * (map->entries_used == 0 ? 1 : map->entries_used));
+    if (keys == NULL)
     {
-        freeHashMapEntrySingle(entry, true);
-        map->entries[index] = NULL;
-        map->size--;
-        return;
+        errno = ENOMEM;
+        return false;
     }
+    for (u_int32_t i = 0; i < map->entries_used; i++)
+    {
+        char *key = map->entries[i] == NULL ? NULL : map->entries[i]->key;
+        keys[i] = key == NULL ? NULL : key_table == NULL ? strdup(key) : JSONKeyTableIntern(key_table, key);
+        if (key != NULL && keys[i] == NULL)
+        {
+            // keys interned so far stay in the table, it owns them
+            while (key_table == NULL && i > 0)
+            {
+                free(keys[--i]);
+            }
+            free(keys);
+            errno = ENOMEM;
+            return false;
+        }
+    }
+    for (u_int32_t i = 0; i < map->entries_used; i++)
+    {
+        if (map->entries[i] != NULL)
+        {
+            map->entries[i]->key = keys[i];
+        }
+    }
+    free(keys);
+    map->key_table = key_table;
+    return true;
+}
 
-    if (strcmp(key, entry->key) == 0)
+// Puts json_value under a copy of key, freeing any value that was there.
+// json_value must not have a key, i.e. not sit in another object; it is
+// adopted as is, apart from the keys below it moving to map's key table
+// (see JSONValueRehomeKeys). When this fails it still belongs to the caller.
+extern bool JSONObjectSet(HashMap *map, char *key, JSONValue *json_value)
+{
+    if (map == NULL || key == NULL || json_value == NULL || json_value->key != NULL)
     {
-        JSONValue *temp = entry;
-        map->entries[index] = entry->next;
-        entry->next = NULL;
-        freeHashMapEntrySingle(temp, true);
-        map->collision_count--;
-        return;
+        errno = EINVAL;
+        return false;
     }
+    if (!JSONValueRehomeKeys(json_value, map->key_table))
+    {
+        return false;
+    }
+    if ((json_value->key = strdup(key)) == NULL)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+    if (!HashMapInsert(map, json_value))
+    {
+        free(json_value->key);
+        json_value->key = NULL;
+        return false;
+    }
+    return true;
+}
 
-    JSONValue *iterator_prev = entry;
-    JSONValue *iterator = entry->next;
-    while (iterator != NULL)
+extern void JSONObjectIterInit(JSONObjectIter *iter, HashMap *map)
+{
+    iter->map = map;
+    iter->position = 0;
+}
+
+// Next live entry, NULL once the map is exhausted. entries is dense, so this
+// never looks at the sparse indices; the entry a few places ahead is
+// prefetched since every one of them is a separate allocation.
+extern JSONValue *JSONObjectIterNext(JSONObjectIter *iter)
+{
+    HashMap *map = iter->map;
+    if (map == NULL)
     {
-        if (strcmp(key, iterator->key) == 0)
+        return NULL;
+    }
+    while (iter->position < map->entries_used)
+    {
+        JSONValue *entry = map->entries[iter->position++];
+        u_int32_t ahead = iter->position + HASHMAP_ITER_PREFETCH_DISTANCE;
+        if (ahead < map->entries_used && map->entries[ahead] != NULL)
         {
-            iterator_prev->next = iterator->next;
-            map->entries[index] = iterator_prev;
-            freeHashMapEntrySingle(iterator, true);
-            map->collision_count--;
-            break;
+            __builtin_prefetch(map->entries[ahead]);
+        }
+        if (entry != NULL)
+        {
+            return entry;
         }
-        iterator_prev = iterator_prev->next;
-        iterator = iterator->next;
     }
+    return NULL;
 }
 
 extern void PrintHashMap(HashMap *map)
@@ -359,7 +607,7 @@ extern void PrintHashMap(HashMap *map)
     }
     printf("{");
     u_int32_t entry_count = 0;
-    for (u_int32_t i = 0; i < map->capacity; i++)
+    for (u_int32_t i = 0; i < map->entries_used; i++)
     {
         JSONValue *entry = map->entries[i];
         if (entry != NULL)
@@ -377,168 +625,139 @@ extern void PrintHashMap(HashMap *map)
 
 static void printHashMapEntry(JSONValue *entry)
 {
-    if (entry == NULL || entry->value == NULL || entry->key == NULL)
+    if (entry == NULL || entry->key == NULL)
     {
         errno = EINVAL;
         return;
     }
-    JSONValue *iterator = entry;
-    while (iterator != NULL)
+    char *quoted_key = JSONQuoteString(entry->key);
+    if (quoted_key == NULL)
     {
-        if (iterator->key != NULL && iterator->value != NULL)
-        {
-            printf("\"%s\": ", iterator->key);
-            PrintJSONValue(iterator);
-        }
-        iterator = iterator->next;
-        if (iterator != NULL)
-        {
-            printf(", ");
-        }
+        return;
     }
+    printf("%s: ", quoted_key);
+    free(quoted_key);
+    PrintJSONValue(entry);
 }
 
-// JOSH
+// Rebuilds the sparse table and compacts the dense entries, dropping the holes
+// left by HashMapRemove. Only grows when the live entries actually need it.
 static void hashMapResize(HashMap *map)
 {
-    // printf("hashMapResize\n");
-    // fflush(stdout);
     if (map == NULL)
     {
         errno = EINVAL;
         return;
     }
 
-    u_int32_t new_capacity = map->capacity * DEFAULT_MAP_RESIZE_MULTIPLE;
-    u_int32_t new_size = 0;
-    u_int32_t new_collision_count = 0;
+    u_int32_t new_capacity = map->capacity;
+    if (map->size >= hashMapUsableCapacity(map->capacity) / 2)
+    {
+        new_capacity = map->capacity * DEFAULT_MAP_RESIZE_MULTIPLE;
+    }
+    u_int32_t new_entries_capacity = hashMapUsableCapacity(new_capacity);
 
-    JSONValue **new_entries = hashMapEntriesInit(new_capacity);
+    u_int32_t *new_indices = hashMapIndicesInit(new_capacity);
+    if (new_indices == NULL)
+    {
+        errno = ENOMEM;
+        return;
+    }
 
+    // the entries only move once nothing can fail, the old indices still
+    // point at them until then
+    JSONValue **new_entries = realloc(map->entries, sizeof(JSONValue *) * new_entries_capacity);
     if (new_entries == NULL)
     {
+        free(new_indices);
+        errno = ENOMEM;
         return;
     }
 
-    for (u_int32_t i = 0; i < map->capacity; i++)
+    u_int32_t live = 0;
+    for (u_int32_t i = 0; i < map->entries_used; i++)
     {
-        JSONValue *entry = map->entries[i];
-        JSONValue *iterator = entry;
-
-        while (iterator != NULL)
+        if (new_entries[i] != NULL)
         {
-            JSONValue *new_entry = JSONValueInit(iterator->value_type, iterator->value, iterator->key);
-            u_int32_t new_index = map->hashFunction(iterator->key, new_capacity);
-            bool collision = hashMapEntriesInsert(new_entries, new_index, new_entry);
-            if (!collision)
-            {
-                new_size++;
-            }
-            else
-            {
-                new_collision_count++;
-            }
-            JSONValue *temp = iterator;
-            iterator = iterator->next;
-            FreeJSONValue(temp, false);
+            new_entries[live] = new_entries[i];
+            live++;
         }
     }
-    freeHashMapEntries(map->entries, map->capacity, false, false);
 
-    map->size = new_size;
-    map->collision_count = new_collision_count;
-    map->capacity = new_capacity;
+    free(map->indices);
+    map->indices = new_indices;
     map->entries = new_entries;
-}
+    map->capacity = new_capacity;
+    map->entries_capacity = new_entries_capacity;
+    map->entries_used = live;
+    map->collision_count = 0;
 
-// FIXME: not complete
-extern HashMap *HashMapReplicate(HashMap *map)
-{
-    if (map == NULL)
+    for (u_int32_t i = 0; i < live; i++)
     {
-        errno = EINVAL;
-        return NULL;
-    }
-    HashMap *deep_clone = HashMapInit(map->capacity, map->hashFunction, map->force_lowercase);
-    deep_clone->collision_count = map->collision_count;
-    deep_clone->size = map->collision_count;
-    for (u_int32_t i = 0; i < map->capacity; i++)
-    {
-        deep_clone->entries[i] = JSONValueReplicate(map->entries[i]);
+        hashMapIndicesInsert(map, map->entries[i]->key, i);
     }
-    return deep_clone;
 }
 
-extern char *ObjToString(HashMap *map)
+// A frozen map is shared rather than copied. Otherwise the index table is
+// copied as is and every entry is cloned into the dense slot it had, so no
+// key is hashed, interned or probed for again; the copy shares map's key
+// table and must not outlive it.
+extern HashMap *HashMapReplicate(HashMap *map)
 {
-    // FIXME map->entries == NULL ?
     if (map == NULL)
     {
         errno = EINVAL;
         return NULL;
     }
-    size_t obj_as_string_size = 3; // "{}\0"
-    char *obj_as_string = malloc(sizeof(char) * obj_as_string_size);
-    if (obj_as_string == NULL)
+    if (map->frozen)
+    {
+        __atomic_add_fetch(&map->ref_count, 1, __ATOMIC_RELAXED);
+        return map;
+    }
+    HashMap *deep_clone = HashMapInit(map->capacity, map->hashFunction, map->force_lowercase);
+    if (deep_clone == NULL)
     {
-        printf("[FATAL]: cannot allocate memory for obj as string\n");
         return NULL;
     }
-    obj_as_string[0] = CURLY_OPEN_CHAR;
-    obj_as_string[1] = NULL_CHAR;
-
-    size_t chars_written = 2 - 1;
-
-    u_int64_t entry_count = 0;
-    for (u_int64_t i = 0; i < map->capacity; i++)
+    deep_clone->key_table = map->key_table;
+    memcpy(deep_clone->indices, map->indices, sizeof(u_int32_t) * map->capacity);
+    for (u_int32_t i = 0; i < map->entries_used; i++)
     {
-        JSONValue *map_entry = map->entries[i];
-        bool needs_comma = false;
-
-        while (map_entry != NULL)
+        JSONValue *entry = map->entries[i];
+        JSONValue *entry_clone = NULL;
+        if (entry != NULL)
         {
-            char *entry_key = map_entry->key;
-            size_t duplicated_key_size = strlen(entry_key);
-            char *duplicated_key = PutQuotesAroundString(entry_key, false);
-            duplicated_key_size += 2;
-
-            char *entry_value = JSONValueToString(map_entry);
-            size_t entry_value_len = strlen(entry_value);
-            if ((map_entry->next == NULL && entry_count < map->size - 1) || map_entry->next != NULL)
-            {
-                needs_comma = true;
-            }
-
-            obj_as_string_size += duplicated_key_size;
-            obj_as_string_size++; // ':'
-            obj_as_string_size += entry_value_len;
-            obj_as_string_size += needs_comma;
-
-            obj_as_string = realloc(obj_as_string, obj_as_string_size);
-
-            CopyStringCanary(obj_as_string, duplicated_key, chars_written);
-            chars_written += duplicated_key_size;
-            CopyStringCanary(obj_as_string, ":", chars_written);
-            chars_written++;
-            CopyStringCanary(obj_as_string, entry_value, chars_written);
-            chars_written += entry_value_len;
-            if (needs_comma)
+            entry_clone = JSONValueReplicate(entry);
+            if (entry_clone != NULL && (entry_clone->key = map->key_table == NULL ? strdup(entry->key) : entry->key) == NULL)
             {
-                CopyStringCanary(obj_as_string, ",", chars_written);
-                chars_written++;
+                FreeJSONValue(entry_clone, true);
+                entry_clone = NULL;
             }
-            free(duplicated_key);
-            free(entry_value);
-            if (map_entry->next == NULL)
+            if (entry_clone == NULL)
             {
-                entry_count++;
+                FreeHashMap(deep_clone);
+                errno = ENOMEM;
+                return NULL;
             }
-            needs_comma = false;
-            map_entry = map_entry->next;
+            JSONTextCacheAttach(&deep_clone->text_cache, entry_clone);
         }
+        deep_clone->entries[i] = entry_clone;
+        deep_clone->entries_used = i + 1;
     }
+    deep_clone->size = map->size;
+    deep_clone->collision_count = map->collision_count;
+    deep_clone->text_cache.hash_valid = map->text_cache.hash_valid;
+    deep_clone->text_cache.hash = map->text_cache.hash;
+    return deep_clone;
+}
 
-    obj_as_string[obj_as_string_size - 2] = CURLY_CLOSE_CHAR;
-    obj_as_string[obj_as_string_size - 1] = NULL_CHAR;
-    return obj_as_string;
+extern char *ObjToString(HashMap *map)
+{
+    if (map == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    JSONValue map_value = {.key = NULL, .value_type = JSONOBJ_t, .value = map};
+    return JSONValueToString(&map_value);
 }
@@ -20,7 +20,9 @@ static void printJSONNULLValue(void);
 static void printJSONListValue(DynamicArray *);
 static void printJSONObjValue(HashMap *);
 
-static char *doubleToString(double);
+static JSON *stringToJSON(char *, JSONKeyTable *);
+static char *readFile(char *);
+static char *valueToString(JSONValue *, u_int32_t);
 
 extern JSON *JSONInit()
 {
@@ -31,10 +33,91 @@ extern JSON *JSONInit()
         return NULL;
     }
     json->root = NULL;
+    json->key_table = NULL;
+    json->owns_key_table = false;
+    json->cache_text = false;
     return json;
 }
 
+// Deep copy of json, e.g. of a template document per request. A key table
+// passed to StringToJSONWithKeyTable is shared with the copy, which is the
+// cheap way to copy a template: no key is interned again. A table json
+// created for itself goes with json, so the copy gets one of its own.
+extern JSON *JSONReplicate(JSON *json)
+{
+    if (json == NULL || json->root == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    JSON *replica = JSONInit();
+    if (replica == NULL)
+    {
+        return NULL;
+    }
+    if (json->owns_key_table && json->key_table != NULL)
+    {
+        replica->key_table = DefaultJSONKeyTableInit();
+        if (replica->key_table == NULL)
+        {
+            free(replica);
+            return NULL;
+        }
+        replica->owns_key_table = true;
+        replica->root = JSONValueReplicateInto(json->root, replica->key_table);
+    }
+    else
+    {
+        replica->key_table = json->key_table;
+        replica->root = JSONValueReplicate(json->root);
+    }
+    if (replica->root == NULL)
+    {
+        FreeJSON(replica);
+        return NULL;
+    }
+    replica->cache_text = json->cache_text;
+    return replica;
+}
+
 extern JSON *StringToJSON(char *input_str)
+{
+    return stringToJSON(input_str, NULL);
+}
+
+// Object keys are interned into key_table. When key_table is NULL a table is
+// created for this document alone and freed with it.
+extern JSON *StringToJSONWithKeyTable(char *input_str, JSONKeyTable *key_table)
+{
+    if (input_str == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    bool owns_key_table = false;
+    if (key_table == NULL)
+    {
+        key_table = DefaultJSONKeyTableInit();
+        if (key_table == NULL)
+        {
+            return NULL;
+        }
+        owns_key_table = true;
+    }
+    JSON *json = stringToJSON(input_str, key_table);
+    if (json == NULL)
+    {
+        if (owns_key_table)
+        {
+            FreeJSONKeyTable(key_table);
+        }
+        return NULL;
+    }
+    json->owns_key_table = owns_key_table;
+    return json;
+}
+
+static JSON *stringToJSON(char *input_str, JSONKeyTable *key_table)
 {
     if (input_str == NULL)
     {
@@ -55,6 +138,7 @@ extern JSON *StringToJSON(char *input_str)
         FreeJSONLexer(lexer);
         return NULL;
     }
+    parser->key_table = key_table;
     JSON *json = ParseJSON(parser);
     if (json == NULL)
     {
@@ -66,7 +150,7 @@ extern JSON *StringToJSON(char *input_str)
     return json;
 }
 
-extern JSON *JSONFromFile(char *filename)
+static char *readFile(char *filename)
 {
     FILE *file_ptr = fopen(filename, "rb");
     if (file_ptr == NULL)
@@ -88,6 +172,16 @@ extern JSON *JSONFromFile(char *filename)
     fread(buffer, 1, length, file_ptr);
     fclose(file_ptr);
     buffer[length] = NULL_CHAR;
+    return buffer;
+}
+
+extern JSON *JSONFromFile(char *filename)
+{
+    char *buffer = readFile(filename);
+    if (buffer == NULL)
+    {
+        return NULL;
+    }
 
     JSON *json_from_string = StringToJSON(buffer);
     free(buffer);
@@ -95,6 +189,20 @@ extern JSON *JSONFromFile(char *filename)
     return json_from_string;
 }
 
+extern JSON *JSONFromFileWithKeyTable(char *filename, JSONKeyTable *key_table)
+{
+    char *buffer = readFile(filename);
+    if (buffer == NULL)
+    {
+        return NULL;
+    }
+
+    JSON *json_from_string = StringToJSONWithKeyTable(buffer, key_table);
+    free(buffer);
+
+    return json_from_string;
+}
+
 extern char *JSONToString(JSON *json, bool free_json)
 {
     if (json == NULL)
@@ -102,7 +210,9 @@ extern char *JSONToString(JSON *json, bool free_json)
         errno = EINVAL;
         return NULL;
     }
-    char *json_as_string = JSONValueToString(json->root);
+    // with cache_text only the containers changed since the last call are
+    // written out again, the rest is copied from their caches
+    char *json_as_string = valueToString(json->root, json->cache_text ? JSON_WRITE_CACHE : JSON_WRITE_DEFAULT);
     if (json_as_string == NULL)
     {
         FreeJSON(json);
@@ -115,63 +225,34 @@ extern char *JSONToString(JSON *json, bool free_json)
     return json_as_string;
 }
 
-#define FLOAT_CHAR_MAX 10
-static char *doubleToString(double num)
+extern char *JSONValueToString(JSONValue *json_value)
 {
-    char *double_as_string = malloc((sizeof(char) * FLOAT_CHAR_MAX) + sizeof(char));
-    if (double_as_string == NULL)
+    if (json_value == NULL)
     {
-        errno = ENOMEM;
+        errno = EINVAL;
         return NULL;
     }
-    (void)gcvt(num, FLOAT_CHAR_MAX, double_as_string);
-    double_as_string[FLOAT_CHAR_MAX] = NULL_CHAR;
-    return double_as_string;
+    return valueToString(json_value, JSON_WRITE_DEFAULT);
 }
 
-extern char *JSONValueToString(JSONValue *json_value)
+// Measures first, then writes into a buffer of exactly the right size.
+static char *valueToString(JSONValue *json_value, u_int32_t flags)
 {
-    if (json_value == NULL)
+    u_int64_t json_value_string_len = JSONValueSerializedLength(json_value, flags);
+    if (json_value_string_len == 0)
     {
-        errno = EINVAL;
         return NULL;
     }
-    char *json_value_string = NULL;
-    switch (json_value->value_type)
+    char *json_value_string = malloc(sizeof(char) * (json_value_string_len + 1));
+    if (json_value_string == NULL)
     {
-    case JSONLIST_t:
-        json_value_string = ListToString((DynamicArray *)json_value->value);
-        break;
-    case JSONOBJ_t:
-        json_value_string = ObjToString((HashMap *)json_value->value);
-        break;
-    case JSONNUMBER_INT_t:
-        json_value_string = Int64ToString(*(int64_t *)json_value->value);
-        break;
-    case JSONNUMBER_DOUBLE_t:
-        json_value_string = doubleToString(*(double *)json_value->value);
-        break;
-    case JSONSTRING_t:
-        json_value_string = PutQuotesAroundString(json_value->value, false);
-        break;
-    case JSONBOOL_t:
-        if (*(bool *)json_value->value == true)
-        {
-            json_value_string = malloc(sizeof(char) * 5);
-            strcpy(json_value_string, JSON_BOOL_TRUE);
-        }
-        else if (*(bool *)json_value->value == false)
-        {
-            json_value_string = malloc(sizeof(char) * 6);
-            strcpy(json_value_string, JSON_BOOL_FALSE);
-        }
-        break;
-    case JSONNULL_t:
-        json_value_string = malloc(sizeof(char) * 5);
-        strcpy(json_value_string, JSON_NULL);
-        break;
-    default:
-        break;
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (JSONValueToStringInto(json_value, json_value_string, json_value_string_len + 1, flags) != json_value_string_len)
+    {
+        free(json_value_string);
+        return NULL;
     }
     return json_value_string;
 }
@@ -185,23 +266,17 @@ extern void FreeJSON(JSON *json)
     }
     if (json->root != NULL)
     {
-        if (json->root->value != NULL)
-        {
-            if (json->root->value_type == JSONLIST_t)
-            {
-                FreeDynamicArray(json->root->value);
-            }
-            else if (json->root->value_type == JSONOBJ_t)
-            {
-                FreeHashMap(json->root->value);
-            }
-        }
-        FreeJSONValue(json->root, false);
+        FreeJSONValue(json->root, true);
+    }
+    if (json->owns_key_table && json->key_table != NULL)
+    {
+        FreeJSONKeyTable(json->key_table);
     }
     free(json);
 }
 
-// Pretty Print can be handled by piping into jq
+// For pretty output use JSONWriteToFd with JSON_WRITE_PRETTY, or any
+// JSONWriter set up with JSONWriterSetPretty
 extern void PrintJSON(JSON *json)
 {
     if (json == NULL || json->root == NULL || json->root->value == NULL)
@@ -221,7 +296,7 @@ extern void PrintJSON(JSON *json)
 
 extern void PrintJSONValue(JSONValue *json_value)
 {
-    if (json_value == NULL || json_value->value == NULL)
+    if (json_value == NULL || (json_value->value == NULL && json_value->value_type != JSONNULL_t))
     {
         errno = EINVAL;
         return;
@@ -261,7 +336,13 @@ static void printJSONStringValue(char *value)
         errno = EINVAL;
         return;
     }
-    printf("\"%s\"", value);
+    char *quoted_value = JSONQuoteString(value);
+    if (quoted_value == NULL)
+    {
+        return;
+    }
+    printf("%s", quoted_value);
+    free(quoted_value);
 }
 
 static void printJSONNumberIntValue(int64_t *value)
@@ -10,6 +10,38 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+// ————————— KEY TABLE START —————————
+#define DEFAULT_KEY_TABLE_SIZE 64
+
+// An interned key; JSONKeyTableIntern hands out pointers to key, the hash is
+// the raw HashMapKeyHash so maps never rehash interned keys.
+typedef struct
+{
+    u_int32_t hash;
+    u_int32_t len;
+    char key[];
+} JSONInternedKey;
+
+// Not synchronized; a table shared between documents must outlive all of them
+// and must not be used from several threads at once.
+typedef struct
+{
+    u_int32_t size;
+    u_int32_t capacity;
+    JSONInternedKey **slots;
+} JSONKeyTable;
+
+extern JSONKeyTable *JSONKeyTableInit(u_int32_t);
+extern JSONKeyTable *DefaultJSONKeyTableInit(void);
+extern void FreeJSONKeyTable(JSONKeyTable *);
+extern char *JSONKeyTableIntern(JSONKeyTable *, char *);
+extern char *JSONKeyTableLookup(JSONKeyTable *, char *);
+extern u_int32_t JSONInternedKeyHash(char *);
+extern u_int32_t JSONInternedKeyLength(char *);
+// ————————— KEY TABLE END —————————
 
 // ————————— JSON START —————————
 #define JSON_BOOL_TRUE "true"
@@ -31,8 +63,11 @@ typedef struct jsonValue
 {
     char *key;
     enum JSONValueType value_type;
+    // a member of a frozen container, a member of a columnar row view or an
+    // iterator's stand-in for a packed element, which JSONValueSwap leaves
+    // alone and nobody edits in place
+    bool pinned;
     void *value;
-    struct jsonValue *next;
 } JSONValue;
 
 extern char *JSONValueToString(JSONValue *);
@@ -40,11 +75,18 @@ extern char *JSONValueToString(JSONValue *);
 typedef struct
 {
     JSONValue *root;
+    JSONKeyTable *key_table;
+    bool owns_key_table;
+    // JSONToString keeps the text of large containers, see TEXT CACHE
+    bool cache_text;
 } JSON;
 
 extern JSON *JSONInit();
+extern JSON *JSONReplicate(JSON *);
 extern JSON *StringToJSON(char *);
+extern JSON *StringToJSONWithKeyTable(char *, JSONKeyTable *);
 extern JSON *JSONFromFile(char *);
+extern JSON *JSONFromFileWithKeyTable(char *, JSONKeyTable *);
 extern char *JSONToString(JSON *, bool);
 
 extern void FreeJSON(JSON *);
@@ -53,45 +95,233 @@ extern void PrintJSON(JSON *);
 extern void PrintJSONValue(JSONValue *);
 // ————————— JSON END —————————
 
+// ————————— TEXT CACHE START —————————
+// containers serializing shorter than this are always written again
+#define JSON_TEXT_CACHE_MIN_LEN 128
+
+// Text shared by a container and the containers written inside it, which
+// point into it. It goes with the last cache using it.
+typedef struct
+{
+    u_int32_t ref_count;
+    char text[];
+} JSONTextBuffer;
+
+// Every HashMap and DynamicArray carries one. text is the container's last
+// compact serialization, valid while dirty is false; a clean container
+// without text is written again. text points into buffer. Mutations mark the
+// container and all of its ancestors dirty through parent, so writing a
+// document again only re-emits the paths that changed. hash is the
+// container's JSONValueHash while hash_valid is set, see EQUALITY.
+typedef struct jsonTextCache
+{
+    char *text;
+    u_int64_t text_len;
+    JSONTextBuffer *buffer;
+    bool dirty;
+    bool hash_valid;
+    u_int64_t hash;
+    struct jsonTextCache *parent;
+} JSONTextCache;
+
+extern void JSONTextCacheInit(JSONTextCache *);
+extern void FreeJSONTextCache(JSONTextCache *);
+extern JSONTextCache *JSONValueTextCache(JSONValue *);
+extern void JSONTextCacheAttach(JSONTextCache *, JSONValue *);
+extern void JSONTextCacheInvalidate(JSONTextCache *);
+extern JSONTextBuffer *JSONTextBufferInit(char *, u_int64_t);
+extern void JSONTextCacheShare(JSONTextCache *, JSONTextBuffer *, u_int64_t, u_int64_t);
+extern bool JSONTextCacheStore(JSONTextCache *, char *, u_int64_t);
+// ————————— TEXT CACHE END —————————
+
+// ————————— NUMBER START —————————
+#define JSON_NUMBER_CHAR_MAX 32
+#define JSON_INT64_MAX_DIGITS 19
+#define JSON_DOUBLE_ROUND_TRIP_DIGITS 17
+// integers past 2^53 are written as doubles in canonical output
+#define JSON_CANONICAL_INT_MAX 9007199254740992LL
+
+extern bool JSONParseInt64(const char *, int64_t *);
+extern bool JSONIsNumberLiteral(const char *);
+extern u_int32_t JSONFormatInt64(int64_t, char *);
+extern u_int32_t JSONFormatDouble(double, char *);
+extern u_int32_t JSONFormatDoubleCanonical(double, char *);
+// ————————— NUMBER END —————————
+
+// ————————— ESCAPE START —————————
+#define JSON_ESCAPE_SEQUENCE_MAX 6
+
+extern u_int64_t JSONEscapeScan(char *, u_int64_t);
+extern u_int64_t JSONScanQuoteOrBackslash(char *, u_int64_t);
+extern u_int32_t JSONEscapeChar(char, char *);
+extern u_int64_t JSONEscapedLength(char *, u_int64_t);
+extern u_int64_t JSONEscapeInto(char *, char *, u_int64_t);
+extern char *JSONQuoteString(char *);
+// ————————— ESCAPE END —————————
+
 // ————————— HASHMAP START —————————
 #define DEFAULT_MAP_SIZE 16
 #define DEFAULT_MAP_RESIZE_MULTIPLE 2
+#define HASHMAP_MIN_CAPACITY 2
+#define HASHMAP_INDEX_EMPTY UINT32_MAX
+#define HASHMAP_INDEX_DUMMY (UINT32_MAX - 1)
+#define HASHMAP_ITER_PREFETCH_DISTANCE 8
 
 typedef u_int32_t(HashFunction)(char *, u_int32_t);
 
+// Compact layout: entries is dense and in insertion order (NULL where a key
+// was removed), indices is the sparse hash table pointing into entries.
 typedef struct
 {
     u_int32_t size;
     u_int32_t capacity;
     u_int32_t collision_count;
+    u_int32_t entries_used;
+    u_int32_t entries_capacity;
+    u_int32_t *indices;
     JSONValue **entries;
     HashFunction *hashFunction;
+    JSONKeyTable *key_table;
     bool force_lowercase;
+    JSONTextCache text_cache;
+    // see FREEZE
+    bool frozen;
+    u_int32_t ref_count;
+    // the columnar array this map is a row view of, see DynamicArrayGetAtIndex
+    struct dynamicArray *row_view_of;
 } HashMap;
 
 extern JSONValue *HashMapGet(HashMap *, char *);
+extern JSONValue *HashMapGetHashed(HashMap *, char *, u_int32_t, u_int32_t);
 extern void *HashMapGetValueDirect(HashMap *, char *);
 
+extern u_int32_t HashMapKeyHash(char *);
 extern HashMap *HashMapInit(u_int32_t, HashFunction *, bool);
+extern HashMap *HashMapInitWithKeyTable(u_int32_t, JSONKeyTable *);
+extern bool HashMapRehomeKeys(HashMap *, JSONKeyTable *);
 extern HashMap *DefaultHashMapInit(void);
 extern HashMap *HashMapReplicate(HashMap *);
 extern void FreeHashMap(HashMap *);
-extern void HashMapInsert(HashMap *, JSONValue *);
+extern bool HashMapInsert(HashMap *, JSONValue *);
 extern void HashMapRemove(HashMap *, char *);
+extern JSONValue *JSONObjectTake(HashMap *, char *);
+extern bool JSONObjectSet(HashMap *, char *, JSONValue *);
 extern void PrintHashMap(HashMap *);
 extern char *ObjToString(HashMap *);
 
+// Walks the live entries in insertion order. Lives on the caller's stack;
+// the map must not be inserted into while iterating, removing the entry
+// just returned is fine.
+typedef struct
+{
+    HashMap *map;
+    u_int32_t position;
+} JSONObjectIter;
+
+extern void JSONObjectIterInit(JSONObjectIter *, HashMap *);
+extern JSONValue *JSONObjectIterNext(JSONObjectIter *);
 // ————————— HASHMAP END —————————
 
+// ————————— COLUMNAR START —————————
+#define JSON_COLUMNAR_MIN_ROWS 1024
+
+// One column per key. value_type is JSONNULL_t until the first non-null value
+// arrives, after which exactly one of ints, doubles, bools (bitset) or
+// string_offsets (into string_data, each string NUL terminated) is in use.
+// nulls is a bitset, NULL when no row of the column is null.
+typedef struct
+{
+    char *key;
+    enum JSONValueType value_type;
+    u_int8_t *nulls;
+    int64_t *ints;
+    double *doubles;
+    u_int8_t *bools;
+    u_int64_t *string_offsets;
+    char *string_data;
+    u_int64_t string_data_len;
+    u_int64_t string_data_capacity;
+} JSONColumn;
+
+typedef struct
+{
+    u_int32_t row_count;
+    u_int32_t row_capacity;
+    u_int32_t column_count;
+    JSONColumn *columns;
+    JSONKeyTable *key_table;
+} JSONColumns;
+
+extern bool JSONColumnsIsRowCandidate(JSONValue *);
+extern JSONColumns *JSONColumnsInit(HashMap *);
+extern JSONColumns *JSONColumnsReplicate(JSONColumns *);
+extern bool JSONColumnsRehomeKeys(JSONColumns *, JSONKeyTable *);
+extern void FreeJSONColumns(JSONColumns *);
+extern bool JSONColumnsRowMatches(JSONColumns *, HashMap *);
+extern bool JSONColumnsAppendRow(JSONColumns *, HashMap *);
+extern bool JSONColumnsCellFits(JSONColumns *, u_int32_t, char *, enum JSONValueType);
+extern bool JSONColumnsAppendCells(JSONColumns *, JSONValue *);
+extern HashMap *JSONColumnsRowToHashMap(JSONColumns *, u_int32_t);
+extern JSONColumn *JSONColumnsGetColumn(JSONColumns *, char *);
+extern JSONValue *JSONColumnGetValue(JSONColumns *, JSONColumn *, u_int32_t);
+extern bool JSONColumnIsNull(JSONColumn *, u_int32_t);
+extern bool JSONColumnGetBool(JSONColumn *, u_int32_t);
+extern char *JSONColumnGetString(JSONColumn *, u_int32_t);
+
+extern bool JSONBitsetGet(u_int8_t *, u_int32_t);
+extern void JSONBitsetSet(u_int8_t *, u_int32_t, bool);
+extern u_int8_t *JSONBitsetResize(u_int8_t *, u_int32_t, u_int32_t);
+// ————————— COLUMNAR END —————————
+
 // ————————— DYN ARRAY START —————————
 #define DEFAULT_DYN_ARR_SIZE 16
 #define DEFAULT_DYN_ARR_RESIZE_MULTIPLE 2
+#define DYN_ARR_SEGMENT_SHIFT 12
+#define DYN_ARR_SEGMENT_SIZE (1u << DYN_ARR_SEGMENT_SHIFT)
+#define DYN_ARR_SEGMENT_THRESHOLD 65536
+#define DYN_ARR_ITER_PREFETCH_DISTANCE 8
 
-typedef struct
+enum DynamicArrayStorage
+{
+    DYN_ARR_GENERIC,
+    DYN_ARR_COLUMNAR,
+    DYN_ARR_PACKED_INT,
+    DYN_ARR_PACKED_DOUBLE,
+    DYN_ARR_PACKED_BOOL,
+    DYN_ARR_SEGMENTED,
+};
+
+// Generic storage is a ring buffer over list starting at head. A columnar
+// array keeps its objects in columns, a packed array keeps its scalars
+// unboxed in ints, doubles or the bools bitset, instead of list. Any call that
+// needs the elements as JSONValues converts it back to generic storage.
+// Past DYN_ARR_SEGMENT_THRESHOLD elements a generic array moves into
+// fixed-size segments so that growing it never copies the elements again;
+// segmented storage behaves as generic storage everywhere else.
+// views holds the rows DynamicArrayGetAtIndex built from columnar storage,
+// NULL where none was asked for yet. A row view can be changed through the
+// HashMap calls, which unpack the array first, but its members are pinned:
+// call DynamicArrayUnpack before editing one of them in place.
+typedef struct dynamicArray
 {
     u_int32_t size;
     u_int32_t capacity;
+    u_int32_t head;
+    enum DynamicArrayStorage storage;
+    bool uniform_rows;
     JSONValue **list;
+    JSONColumns *columns;
+    int64_t *ints;
+    double *doubles;
+    u_int8_t *bools;
+    JSONValue ***segments;
+    u_int32_t segment_count;
+    JSONValue **views;
+    u_int32_t views_capacity;
+    JSONTextCache text_cache;
+    // see FREEZE
+    bool frozen;
+    u_int32_t ref_count;
 } DynamicArray;
 
 extern DynamicArray *DynamicArrayInit(u_int32_t);
@@ -103,15 +333,49 @@ extern char *ListToString(DynamicArray *);
 extern void DynamicArrayAddFirst(DynamicArray *, JSONValue *);
 extern void DynamicArrayAddLast(DynamicArray *, JSONValue *);
 extern void DynamicArrayAdd(DynamicArray *, JSONValue *, u_int32_t);
+extern void DynamicArrayAddLastCompact(DynamicArray *, JSONValue *);
+extern bool DynamicArrayReserve(DynamicArray *, u_int32_t);
+extern void DynamicArrayExtend(DynamicArray *, JSONValue **, u_int32_t);
+extern void DynamicArraySplice(DynamicArray *, u_int32_t, u_int32_t, JSONValue **, u_int32_t);
 
 extern void DynamicArrayRemove(DynamicArray *, u_int32_t);
 extern void DynamicArrayRemoveFirst(DynamicArray *);
 extern void DynamicArrayRemoveLast(DynamicArray *);
+extern JSONValue *DynamicArrayTake(DynamicArray *, u_int32_t);
+extern JSONValue *DynamicArrayTakeFirst(DynamicArray *);
+extern JSONValue *DynamicArrayTakeLast(DynamicArray *);
 
 extern JSONValue *DynamicArrayGetAtIndex(DynamicArray *, u_int32_t);
+extern bool DynamicArrayUnpack(DynamicArray *);
+extern bool DynamicArrayAddColumnarRow(DynamicArray *, JSONValue *);
+extern bool JSONArraySet(DynamicArray *, u_int32_t, JSONValue *);
+extern JSONColumn *DynamicArrayGetColumn(DynamicArray *, char *);
 
 extern void PrintDynamicArray(DynamicArray *);
 extern void FreeDynamicArray(DynamicArray *);
+
+// Walks the elements in order, a contiguous run of the ring buffer or of a
+// segment at a time. Lives on the caller's stack; the array must not be
+// changed while iterating. Packed elements are handed out through view,
+// which Next overwrites, so a caller keeping elements calls
+// DynamicArrayUnpack first. Init unpacks columnar arrays.
+typedef struct
+{
+    DynamicArray *array;
+    u_int32_t index;
+    u_int32_t run_left;
+    JSONValue **run;
+    JSONValue view;
+    union
+    {
+        int64_t int_value;
+        double double_value;
+        bool bool_value;
+    } scalar;
+} JSONArrayIter;
+
+extern bool JSONArrayIterInit(JSONArrayIter *, DynamicArray *);
+extern JSONValue *JSONArrayIterNext(JSONArrayIter *);
 // ————————— DYN ARRAY END —————————
 
 // ————————— LEXER START —————————
@@ -182,6 +446,12 @@ typedef struct
     char *error_message;
     int64_t list_nested;
     int64_t obj_nested;
+    JSONKeyTable *key_table;
+    // scratch for objects parsed straight into a columnar array, one cell
+    // per column; numbers and bools live in row_slots
+    JSONValue *row_cells;
+    u_int64_t *row_slots;
+    u_int32_t row_cells_capacity;
 } JSONParser;
 
 extern JSONParser *JSONParserInit(JSONLexer *);
@@ -191,10 +461,380 @@ extern void PrintJSONParserErrorLine(JSONParser *);
 extern void FreeJSONValue(JSONValue *, bool);
 extern JSON *ParseJSON(JSONParser *);
 extern JSONValue *JSONValueReplicate(JSONValue *);
+extern JSONValue *JSONValueReplicateInto(JSONValue *, JSONKeyTable *);
+extern bool JSONValueSwap(JSONValue *, JSONValue *);
+extern bool JSONValueRehomeKeys(JSONValue *, JSONKeyTable *);
 extern JSONValue *JSONValueInit(enum JSONValueType, void *, char *);
 
 // ————————— PARSER END —————————
 
+// ————————— WRITER START —————————
+#define JSON_WRITER_BUFFER_SIZE 65536
+#define JSON_WRITER_MEMORY_INITIAL_SIZE 256
+#define JSON_WRITER_DEFAULT_DEPTH 16
+#define JSON_WRITER_MAX_IOVECS 64
+#define JSON_WRITER_REFERENCE_MIN 512
+
+// JSONWriteToFd and JSONSerializedLength flags
+#define JSON_WRITE_DEFAULT 0
+#define JSON_WRITE_NEWLINE (1u << 0)
+#define JSON_WRITE_FSYNC (1u << 1)
+#define JSON_WRITE_PRETTY (1u << 2)
+#define JSON_WRITE_SORT_KEYS (1u << 3)
+// RFC 8785, overrides JSON_WRITE_PRETTY
+#define JSON_WRITE_CANONICAL (1u << 4)
+// reuse and refresh container text caches, compact layout only
+#define JSON_WRITE_CACHE (1u << 5)
+
+#define JSON_PRETTY_DEFAULT_INDENT 2
+#define JSON_PRETTY_DEFAULT_INLINE_WIDTH 80
+
+// Receives each flushed block, returns false to abort the write.
+typedef bool(JSONWriterCallback)(void *, char *, u_int64_t);
+
+enum JSONWriterSinkType
+{
+    JSONWriterSinkFile,
+    JSONWriterSinkFd,
+    JSONWriterSinkMemory,
+    JSONWriterSinkCallback,
+    JSONWriterSinkVectoredFd,
+    JSONWriterSinkCount,
+    JSONWriterSinkBuffer,
+};
+
+enum JSONWriterContainer
+{
+    JSONWriterContainerObject,
+    JSONWriterContainerArray,
+};
+
+// a container whose text starts at start in the writer buffer
+typedef struct
+{
+    JSONTextCache *cache;
+    u_int64_t start;
+    u_int64_t len;
+} JSONWriterCachedText;
+
+// Streams JSON into a sink through buffer, flushed in blocks of
+// JSON_WRITER_BUFFER_SIZE; memory sinks grow buffer instead. Calls that would
+// produce invalid JSON fail with EINVAL. After any failure error is set and
+// every later call fails. With indent_width set the output is pretty
+// printed, see JSONWriterSetPretty.
+typedef struct
+{
+    enum JSONWriterSinkType sink_type;
+    FILE *file;
+    int fd;
+    JSONWriterCallback *callback;
+    void *callback_context;
+    char *buffer;
+    u_int64_t buffer_len;
+    u_int64_t buffer_capacity;
+    u_int64_t bytes_written;
+    struct iovec *iovecs;
+    u_int32_t iovec_count;
+    u_int64_t run_start;
+    enum JSONWriterContainer *stack;
+    u_int32_t depth;
+    u_int32_t stack_capacity;
+    bool needs_comma;
+    bool after_key;
+    bool root_written;
+    bool error;
+    u_int32_t indent_width;
+    u_int32_t max_inline_width;
+    // width of the `"key": ` just written, see writerInlineLimit
+    u_int64_t key_width;
+    bool sort_keys;
+    u_int32_t inline_depth;
+    bool pending_inline;
+    bool canonical;
+    // layout to go back to when canonical output is turned off
+    u_int32_t saved_indent_width;
+    bool saved_sort_keys;
+    bool cache_text;
+    // containers written inside the outermost cached one, which all share
+    // its text once it is done, see writerCachedContainer
+    JSONWriterCachedText *cached_texts;
+    u_int32_t cached_text_count;
+    u_int32_t cached_text_capacity;
+    u_int32_t cache_depth;
+} JSONWriter;
+
+extern JSONWriter *JSONWriterInitFile(FILE *);
+extern JSONWriter *JSONWriterInitFd(int);
+extern JSONWriter *JSONWriterInitMemory(void);
+extern JSONWriter *JSONWriterInitCallback(JSONWriterCallback *, void *);
+extern JSONWriter *JSONWriterInitCount(void);
+extern JSONWriter *JSONWriterInitBuffer(char *, u_int64_t);
+extern void FreeJSONWriter(JSONWriter *);
+extern bool JSONWriterFlush(JSONWriter *);
+extern char *JSONWriterTakeString(JSONWriter *);
+extern bool JSONWriterSetPretty(JSONWriter *, u_int32_t, bool, u_int32_t);
+extern bool JSONWriterSetCanonical(JSONWriter *, bool);
+
+extern bool JSONWriterBeginObject(JSONWriter *);
+extern bool JSONWriterEndObject(JSONWriter *);
+extern bool JSONWriterBeginArray(JSONWriter *);
+extern bool JSONWriterEndArray(JSONWriter *);
+extern bool JSONWriterKey(JSONWriter *, char *);
+extern bool JSONWriterString(JSONWriter *, char *);
+extern bool JSONWriterInt(JSONWriter *, int64_t);
+extern bool JSONWriterDouble(JSONWriter *, double);
+extern bool JSONWriterNumberLiteral(JSONWriter *, char *);
+extern bool JSONWriterBool(JSONWriter *, bool);
+extern bool JSONWriterNull(JSONWriter *);
+extern bool JSONWriterValue(JSONWriter *, JSONValue *);
+
+extern bool JSONWriteToFd(JSON *, int, u_int32_t);
+extern u_int64_t JSONSerializedLength(JSON *, u_int32_t);
+extern u_int64_t JSONValueSerializedLength(JSONValue *, u_int32_t);
+extern u_int64_t JSONToStringInto(JSON *, char *, u_int64_t);
+extern u_int64_t JSONValueToStringInto(JSONValue *, char *, u_int64_t, u_int32_t);
+// ————————— WRITER END —————————
+
+// ————————— MINIFY START —————————
+extern u_int64_t JSONMinify(char *, u_int64_t, char *);
+extern bool JSONReformat(char *, JSONWriter *);
+// ————————— MINIFY END —————————
+
+// ————————— POINTER START —————————
+#define JSON_POINTER_NO_INDEX -1
+// the "-" segment, one past the last array element
+#define JSON_POINTER_END_INDEX -2
+#define JSON_POINTER_INDEX_MAX_DIGITS 10
+
+// key is unescaped and NUL terminated, hash is its HashMapKeyHash. index is
+// the segment read as an array index, or one of the values above.
+typedef struct
+{
+    char *key;
+    u_int32_t key_len;
+    u_int32_t hash;
+    int64_t index;
+} JSONPointerSegment;
+
+typedef struct
+{
+    u_int32_t segment_count;
+    JSONPointerSegment *segments;
+    char *keys;
+} JSONPointer;
+
+extern JSONPointer *JSONPointerCompile(char *);
+extern void FreeJSONPointer(JSONPointer *);
+extern JSONValue *JSONPointerGet(JSON *, JSONPointer *);
+extern JSONValue *JSONPointerGetFrom(JSONValue *, JSONPointer *);
+// ————————— POINTER END —————————
+
+// ————————— JSONPATH START —————————
+// states are bits of a u_int64_t while streaming, one is the match state
+#define JSON_PATH_MAX_INSTRUCTIONS 63
+#define JSON_PATH_RESULTS_INITIAL_SIZE 8
+
+enum JSONPathOpcode
+{
+    JSONPathOpChild,
+    JSONPathOpWildcard,
+    JSONPathOpIndex,
+    JSONPathOpSlice,
+    JSONPathOpFilter,
+    // a JSON Pointer segment: member by key, or element by index
+    JSONPathOpSegment,
+};
+
+enum JSONPathCompare
+{
+    JSONPathCompareExists,
+    JSONPathCompareEqual,
+    JSONPathCompareNotEqual,
+    JSONPathCompareLess,
+    JSONPathCompareLessEqual,
+    JSONPathCompareGreater,
+    JSONPathCompareGreaterEqual,
+};
+
+// @.keys[0].keys[1]... compared against the literal, number literals are
+// doubles.
+typedef struct
+{
+    enum JSONPathCompare compare;
+    u_int32_t key_count;
+    char **keys;
+    enum JSONValueType literal_type;
+    double number;
+    char *string;
+    bool boolean;
+} JSONPathFilter;
+
+// One step of a compiled path. An index is kept in start. descendant marks
+// a step preceded by "..".
+typedef struct
+{
+    enum JSONPathOpcode opcode;
+    bool descendant;
+    char *key;
+    u_int32_t key_len;
+    u_int32_t hash;
+    int64_t start;
+    int64_t end;
+    int64_t step;
+    bool has_start;
+    bool has_end;
+    JSONPathFilter filter;
+} JSONPathInstruction;
+
+typedef struct
+{
+    u_int32_t instruction_count;
+    JSONPathInstruction *instructions;
+    bool streamable;
+} JSONPath;
+
+typedef struct
+{
+    u_int64_t start;
+    u_int64_t len;
+} JSONSpan;
+
+// values for JSONPathQuery, spans into the input for JSONPathQueryText.
+typedef struct
+{
+    u_int32_t count;
+    u_int32_t capacity;
+    JSONValue **values;
+    JSONSpan *spans;
+} JSONPathResults;
+
+extern JSONPath *JSONPathCompile(char *);
+extern JSONPath *JSONPathFromPointer(JSONPointer *);
+extern void FreeJSONPath(JSONPath *);
+extern u_int64_t JSONPathNextStates(JSONPath *, u_int64_t, char *, u_int32_t, u_int64_t *);
+extern JSONPathResults *JSONPathQuery(JSONPath *, JSONValue *);
+extern JSONPathResults *JSONPathQueryText(JSONPath *, char *);
+extern void FreeJSONPathResults(JSONPathResults *);
+// ————————— JSONPATH END —————————
+
+// ————————— FREEZE START —————————
+// A frozen container and everything below it is immutable: mutations fail
+// with EPERM, and arrays are kept in generic storage and hashes are filled
+// in up front so that reads never write. Replicating a frozen container
+// only takes a reference (ref_count), the last Free releases it. Frozen
+// subtrees can be shared between documents and threads, their objects own
+// their keys rather than using a key table.
+extern bool JSONValueFreeze(JSONValue *);
+extern bool JSONValueIsFrozen(JSONValue *);
+// ————————— FREEZE END —————————
+
+// ————————— PERSISTENT START —————————
+#define JSON_PERSISTENT_BITS 5
+#define JSON_PERSISTENT_WIDTH 32 // 1 << JSON_PERSISTENT_BITS
+#define JSON_PERSISTENT_MASK 31
+#define JSON_PERSISTENT_MAX_DEPTH 8 // seven levels of a 32 bit hash, then a collision node
+
+// Nodes are shared between versions and never change once built. A leaf
+// holds value and no children, in a map its value carries the key and hash
+// is the key's HashMapKeyHash. Map nodes hold one child per bit set in
+// bitmap, vector nodes fill their children from the left.
+typedef struct JSONPersistentNode
+{
+    u_int32_t ref_count;
+    u_int32_t hash;
+    u_int32_t bitmap;
+    u_int32_t count;
+    JSONValue *value;
+    struct JSONPersistentNode *children[];
+} JSONPersistentNode;
+
+// Every version is a handle of its own and is freed on its own. Changing a
+// version makes a new one that copies the O(log n) nodes on the way to the
+// change and shares everything else; the old version stays as it was.
+// Values are frozen (see FREEZE) when they go in.
+typedef struct
+{
+    JSONPersistentNode *root;
+    u_int32_t size;
+} JSONPersistentMap;
+
+// Hash array mapped trie, walked with an explicit stack.
+typedef struct
+{
+    JSONPersistentNode *nodes[JSON_PERSISTENT_MAX_DEPTH];
+    u_int32_t positions[JSON_PERSISTENT_MAX_DEPTH];
+    u_int32_t depth;
+} JSONPersistentMapIter;
+
+// 32 way trie of chunks plus a tail chunk that appends go to, so pushing
+// copies a single chunk most of the time.
+typedef struct
+{
+    JSONPersistentNode *root;
+    JSONPersistentNode *tail;
+    u_int32_t size;
+    u_int32_t shift;
+} JSONPersistentVector;
+
+extern JSONPersistentMap *JSONPersistentMapInit(void);
+extern JSONValue *JSONPersistentMapGet(JSONPersistentMap *, char *);
+extern JSONPersistentMap *JSONPersistentMapSet(JSONPersistentMap *, char *, JSONValue *);
+extern JSONPersistentMap *JSONPersistentMapRemove(JSONPersistentMap *, char *);
+extern JSONPersistentMap *JSONPersistentMapFromObject(HashMap *);
+extern HashMap *JSONPersistentMapToObject(JSONPersistentMap *);
+extern void FreeJSONPersistentMap(JSONPersistentMap *);
+extern void JSONPersistentMapIterInit(JSONPersistentMapIter *, JSONPersistentMap *);
+extern JSONValue *JSONPersistentMapIterNext(JSONPersistentMapIter *);
+
+extern JSONPersistentVector *JSONPersistentVectorInit(void);
+extern JSONValue *JSONPersistentVectorGet(JSONPersistentVector *, u_int32_t);
+extern JSONPersistentVector *JSONPersistentVectorSet(JSONPersistentVector *, u_int32_t, JSONValue *);
+extern JSONPersistentVector *JSONPersistentVectorPush(JSONPersistentVector *, JSONValue *);
+extern JSONPersistentVector *JSONPersistentVectorPop(JSONPersistentVector *);
+extern JSONPersistentVector *JSONPersistentVectorFromArray(DynamicArray *);
+extern DynamicArray *JSONPersistentVectorToArray(JSONPersistentVector *);
+extern void FreeJSONPersistentVector(JSONPersistentVector *);
+// ————————— PERSISTENT END —————————
+
+// ————————— EQUALITY START —————————
+#define JSON_HASH_FNV_OFFSET 0xcbf29ce484222325ULL
+#define JSON_HASH_FNV_PRIME 0x100000001b3ULL
+#define JSON_HASH_GOLDEN 0x9e3779b97f4a7c15ULL
+
+extern bool JSONValueEquals(JSONValue *, JSONValue *);
+extern u_int64_t JSONValueHash(JSONValue *);
+extern u_int64_t JSONValueHashCached(JSONValue *);
+// ————————— EQUALITY END —————————
+
+// ————————— PATCH START —————————
+#define JSON_PATCH_PATH_INITIAL_SIZE 64
+#define JSON_PATCH_OP "op"
+#define JSON_PATCH_PATH "path"
+#define JSON_PATCH_FROM "from"
+#define JSON_PATCH_VALUE "value"
+#define JSON_PATCH_ADD "add"
+#define JSON_PATCH_REMOVE "remove"
+#define JSON_PATCH_REPLACE "replace"
+#define JSON_PATCH_MOVE "move"
+#define JSON_PATCH_COPY "copy"
+#define JSON_PATCH_TEST "test"
+
+extern JSON *JSONPatchDiff(JSONValue *, JSONValue *);
+extern bool JSONPatchApply(JSON *, JSONValue *);
+extern bool JSONMergePatchApply(JSON *, JSONValue *);
+// ————————— PATCH END —————————
+
+// ————————— EXTRACT START —————————
+#define JSON_EXTRACT_CHUNK_SIZE 65536
+#define JSON_EXTRACT_NO_PIN UINT64_MAX
+
+// gets the text of one match and its length, false stops the extraction
+typedef bool(JSONExtractCallback)(void *, char *, u_int64_t);
+
+extern bool JSONExtractFromStream(FILE *, JSONPath *, JSONExtractCallback *, void *);
+extern bool JSONExtractFromFile(char *, JSONPath *, JSONExtractCallback *, void *);
+// ————————— EXTRACT END —————————
+
 // ————————— UTIL BEGIN —————————
 #include <standardloop/util.h>
 // ————————— UTIL END —————————
@@ -0,0 +1,1170 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <standardloop/util.h>
+
+#include "./json.h"
+
+typedef struct
+{
+    JSONPath *path;
+    JSONLexer *lexer;
+    JSONPathResults *results;
+} JSONPathStream;
+
+static inline void skipSpaces(char *, u_int32_t *);
+static char *compileQuoted(char *, u_int32_t *);
+static char *compileName(char *, u_int32_t *);
+static bool compileInt(char *, u_int32_t *, int64_t *);
+static bool compileFilter(char *, u_int32_t *, JSONPathFilter *);
+static bool compileFilterLiteral(char *, u_int32_t *, JSONPathFilter *);
+static bool compileBracket(char *, u_int32_t *, JSONPathInstruction *);
+static bool compileSegment(char *, u_int32_t *, JSONPathInstruction *);
+static void instructionInit(JSONPathInstruction *);
+static void freeInstruction(JSONPathInstruction *);
+
+static JSONPathResults *pathResultsInit(bool);
+static bool pathResultsAppend(JSONPathResults *, JSONValue *, u_int64_t);
+static bool filterCompare(JSONPathFilter *, enum JSONValueType, double, char *, bool);
+static bool filterMatchesValue(JSONPathFilter *, JSONValue *);
+static bool sliceBounds(JSONPathInstruction *, u_int32_t, int64_t *, int64_t *);
+static bool sliceContains(JSONPathInstruction *, u_int32_t);
+static bool pathRunChild(JSONPath *, u_int32_t, JSONValue *, JSONPathResults *);
+static bool pathStep(JSONPath *, u_int32_t, JSONValue *, JSONPathResults *);
+static bool pathRun(JSONPath *, u_int32_t, JSONValue *, JSONPathResults *);
+
+static void freeTokenLiteral(JSONToken *);
+static bool streamNextMember(JSONPathStream *, bool, bool, char **, JSONToken **, u_int64_t *);
+static bool tokenFilterCompare(JSONPathFilter *, JSONToken *);
+static bool streamScan(JSONPathStream *, enum JSONTokenType, u_int64_t, u_int32_t, u_int64_t *, u_int64_t *);
+static bool streamFilters(JSONPathStream *, u_int64_t, JSONToken *, u_int64_t *);
+static bool streamTransition(JSONPathStream *, u_int64_t, char *, u_int32_t, JSONToken *, u_int64_t *);
+static bool streamValue(JSONPathStream *, JSONToken *, u_int64_t);
+
+static inline void skipSpaces(char *expression, u_int32_t *position)
+{
+    while (expression[*position] == SPACE_CHAR)
+    {
+        (*position)++;
+    }
+}
+
+static void instructionInit(JSONPathInstruction *instruction)
+{
+    instruction->opcode = JSONPathOpWildcard;
+    instruction->descendant = false;
+    instruction->key = NULL;
+    instruction->key_len = 0;
+    instruction->hash = 0;
+    instruction->start = 0;
+    instruction->end = 0;
+    instruction->step = 1;
+    instruction->has_start = false;
+    instruction->has_end = false;
+    instruction->filter.compare = JSONPathCompareExists;
+    instruction->filter.key_count = 0;
+    instruction->filter.keys = NULL;
+    instruction->filter.literal_type = JSONNULL_t;
+    instruction->filter.number = 0;
+    instruction->filter.string = NULL;
+    instruction->filter.boolean = false;
+}
+
+static void freeInstruction(JSONPathInstruction *instruction)
+{
+    free(instruction->key);
+    for (u_int32_t i = 0; i < instruction->filter.key_count; i++)
+    {
+        free(instruction->filter.keys[i]);
+    }
+    free(instruction->filter.keys);
+    free(instruction->filter.string);
+}
+
+// 'name' or "name", only the quote itself and backslash can be escaped.
+static char *compileQuoted(char *expression, u_int32_t *position)
+{
+    char quote = expression[*position];
+    u_int32_t start = *position + 1;
+    u_int32_t end = start;
+    while (expression[end] != quote)
+    {
+        if (expression[end] == NULL_CHAR || (expression[end] == BACKSLASH_CHAR && expression[end + 1] == NULL_CHAR))
+        {
+            return NULL;
+        }
+        end += expression[end] == BACKSLASH_CHAR ? 2 : 1;
+    }
+    char *quoted = malloc(sizeof(char) * (end - start + 1));
+    if (quoted == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    u_int32_t written = 0;
+    for (u_int32_t i = start; i < end; i++)
+    {
+        if (expression[i] == BACKSLASH_CHAR)
+        {
+            i++;
+        }
+        quoted[written++] = expression[i];
+    }
+    quoted[written] = NULL_CHAR;
+    *position = end + 1;
+    return quoted;
+}
+
+// A dotted member name runs up to the next '.', '[', the end, or inside a
+// filter a space, ')' or comparison operator.
+static char *compileName(char *expression, u_int32_t *position)
+{
+    u_int32_t start = *position;
+    u_int32_t end = start;
+    while (expression[end] != NULL_CHAR && expression[end] != DOT_CHAR && expression[end] != BRACKET_OPEN_CHAR && expression[end] != SPACE_CHAR && expression[end] != ')' && expression[end] != '=' && expression[end] != '!' && expression[end] != '<' && expression[end] != '>')
+    {
+        end++;
+    }
+    if (end == start)
+    {
+        return NULL;
+    }
+    char *name = strndup(expression + start, end - start);
+    if (name == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    *position = end;
+    return name;
+}
+
+static bool compileInt(char *expression, u_int32_t *position, int64_t *value)
+{
+    char *end = NULL;
+    errno = 0;
+    long long parsed = strtoll(expression + *position, &end, 10);
+    if (end == expression + *position || errno == ERANGE)
+    {
+        return false;
+    }
+    *value = parsed;
+    *position = end - expression;
+    return true;
+}
+
+static bool compileFilterLiteral(char *expression, u_int32_t *position, JSONPathFilter *filter)
+{
+    char c = expression[*position];
+    if (c == '\'' || c == DOUBLE_QUOTES_CHAR)
+    {
+        filter->literal_type = JSONSTRING_t;
+        filter->string = compileQuoted(expression, position);
+        return filter->string != NULL;
+    }
+    if (strncmp(expression + *position, JSON_BOOL_TRUE, strlen(JSON_BOOL_TRUE)) == 0 || strncmp(expression + *position, JSON_BOOL_FALSE, strlen(JSON_BOOL_FALSE)) == 0)
+    {
+        filter->literal_type = JSONBOOL_t;
+        filter->boolean = c == 't';
+        *position += filter->boolean ? strlen(JSON_BOOL_TRUE) : strlen(JSON_BOOL_FALSE);
+        return true;
+    }
+    if (strncmp(expression + *position, JSON_NULL, strlen(JSON_NULL)) == 0)
+    {
+        filter->literal_type = JSONNULL_t;
+        *position += strlen(JSON_NULL);
+        return true;
+    }
+    char *end = NULL;
+    filter->number = strtod(expression + *position, &end);
+    if (end == expression + *position)
+    {
+        return false;
+    }
+    filter->literal_type = JSONNUMBER_DOUBLE_t;
+    *position = end - expression;
+    return true;
+}
+
+// ?(@.a.b op literal) or ?(@.a.b), position is on the '?'.
+static bool compileFilter(char *expression, u_int32_t *position, JSONPathFilter *filter)
+{
+    (*position)++;
+    skipSpaces(expression, position);
+    if (expression[*position] != '(')
+    {
+        return false;
+    }
+    (*position)++;
+    skipSpaces(expression, position);
+    if (expression[*position] != '@')
+    {
+        return false;
+    }
+    (*position)++;
+    while (expression[*position] == DOT_CHAR || expression[*position] == BRACKET_OPEN_CHAR)
+    {
+        char *key = NULL;
+        if (expression[*position] == DOT_CHAR)
+        {
+            (*position)++;
+            key = compileName(expression, position);
+        }
+        else
+        {
+            (*position)++;
+            skipSpaces(expression, position);
+            if (expression[*position] == '\'' || expression[*position] == DOUBLE_QUOTES_CHAR)
+            {
+                key = compileQuoted(expression, position);
+            }
+            skipSpaces(expression, position);
+            if (key != NULL && expression[*position] != BRACKET_CLOSE_CHAR)
+            {
+                free(key);
+                key = NULL;
+            }
+            (*position)++;
+        }
+        if (key == NULL)
+        {
+            return false;
+        }
+        char **keys = realloc(filter->keys, sizeof(char *) * (filter->key_count + 1));
+        if (keys == NULL)
+        {
+            free(key);
+            errno = ENOMEM;
+            return false;
+        }
+        filter->keys = keys;
+        filter->keys[filter->key_count++] = key;
+    }
+    skipSpaces(expression, position);
+    static const char *operators[] = {"==", "!=", "<=", ">=", "<", ">"};
+    static const enum JSONPathCompare compares[] = {JSONPathCompareEqual, JSONPathCompareNotEqual, JSONPathCompareLessEqual, JSONPathCompareGreaterEqual, JSONPathCompareLess, JSONPathCompareGreater};
+    for (u_int32_t i = 0; i < sizeof(operators) / sizeof(operators[0]); i++)
+    {
+        if (strncmp(expression + *position, operators[i], strlen(operators[i])) == 0)
+        {
+            filter->compare = compares[i];
+            *position += strlen(operators[i]);
+            skipSpaces(expression, position);
+            if (!compileFilterLiteral(expression, position, filter))
+            {
+                return false;
+            }
+            skipSpaces(expression, position);
+            break;
+        }
+    }
+    if (expression[*position] != ')')
+    {
+        return false;
+    }
+    (*position)++;
+    return true;
+}
+
+// [*], ['name'], [n], [start:end:step] or [?(...)], position is on the '['.
+static bool compileBracket(char *expression, u_int32_t *position, JSONPathInstruction *instruction)
+{
+    (*position)++;
+    skipSpaces(expression, position);
+    char c = expression[*position];
+    if (c == '*')
+    {
+        instruction->opcode = JSONPathOpWildcard;
+        (*position)++;
+    }
+    else if (c == '\'' || c == DOUBLE_QUOTES_CHAR)
+    {
+        instruction->opcode = JSONPathOpChild;
+        instruction->key = compileQuoted(expression, position);
+        if (instruction->key == NULL)
+        {
+            return false;
+        }
+    }
+    else if (c == '?')
+    {
+        instruction->opcode = JSONPathOpFilter;
+        if (!compileFilter(expression, position, &instruction->filter))
+        {
+            return false;
+        }
+    }
+    else
+    {
+        instruction->opcode = JSONPathOpIndex;
+        instruction->has_start = compileInt(expression, position, &instruction->start);
+        skipSpaces(expression, position);
+        if (expression[*position] == COLON_CHAR)
+        {
+            instruction->opcode = JSONPathOpSlice;
+            (*position)++;
+            skipSpaces(expression, position);
+            instruction->has_end = compileInt(expression, position, &instruction->end);
+            skipSpaces(expression, position);
+            if (expression[*position] == COLON_CHAR)
+            {
+                (*position)++;
+                skipSpaces(expression, position);
+                if (compileInt(expression, position, &instruction->step) && instruction->step == 0)
+                {
+                    return false;
+                }
+            }
+        }
+        else if (!instruction->has_start)
+        {
+            return false;
+        }
+    }
+    skipSpaces(expression, position);
+    if (expression[*position] != BRACKET_CLOSE_CHAR)
+    {
+        return false;
+    }
+    (*position)++;
+    return true;
+}
+
+// One step: .name, .*, ..name, ..*, ..[...] or [...].
+static bool compileSegment(char *expression, u_int32_t *position, JSONPathInstruction *instruction)
+{
+    if (expression[*position] == BRACKET_OPEN_CHAR)
+    {
+        return compileBracket(expression, position, instruction);
+    }
+    if (expression[*position] != DOT_CHAR)
+    {
+        return false;
+    }
+    (*position)++;
+    if (expression[*position] == DOT_CHAR)
+    {
+        instruction->descendant = true;
+        (*position)++;
+        if (expression[*position] == BRACKET_OPEN_CHAR)
+        {
+            return compileBracket(expression, position, instruction);
+        }
+    }
+    if (expression[*position] == '*')
+    {
+        instruction->opcode = JSONPathOpWildcard;
+        (*position)++;
+        return true;
+    }
+    instruction->opcode = JSONPathOpChild;
+    instruction->key = compileName(expression, position);
+    return instruction->key != NULL;
+}
+
+// Compiles a JSONPath expression: $ followed by child (.name, ['name']),
+// wildcard (.*, [*]), recursive descent (..), index ([n], negative counts
+// from the end), slice ([start:end:step]) and filter (?(@.a.b op literal),
+// ?(@.a.b) tests existence) steps. Each step becomes one instruction.
+extern JSONPath *JSONPathCompile(char *expression)
+{
+    if (expression == NULL || expression[0] != '$')
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    JSONPath *path = malloc(sizeof(JSONPath));
+    if (path == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    path->instruction_count = 0;
+    path->streamable = true;
+    path->instructions = malloc(sizeof(JSONPathInstruction) * JSON_PATH_MAX_INSTRUCTIONS);
+    if (path->instructions == NULL)
+    {
+        free(path);
+        errno = ENOMEM;
+        return NULL;
+    }
+    u_int32_t position = 1;
+    while (expression[position] != NULL_CHAR)
+    {
+        if (path->instruction_count == JSON_PATH_MAX_INSTRUCTIONS)
+        {
+            FreeJSONPath(path);
+            errno = EINVAL;
+            return NULL;
+        }
+        JSONPathInstruction *instruction = &path->instructions[path->instruction_count++];
+        instructionInit(instruction);
+        if (!compileSegment(expression, &position, instruction))
+        {
+            int saved_errno = errno == ENOMEM ? ENOMEM : EINVAL;
+            FreeJSONPath(path);
+            errno = saved_errno;
+            return NULL;
+        }
+        if (instruction->key != NULL)
+        {
+            instruction->key_len = strlen(instruction->key);
+            instruction->hash = HashMapKeyHash(instruction->key);
+        }
+        // the token stream never knows an array's length up front
+        if ((instruction->opcode == JSONPathOpIndex && instruction->start < 0) ||
+            (instruction->opcode == JSONPathOpSlice && (instruction->start < 0 || instruction->end < 0 || instruction->step < 0)))
+        {
+            path->streamable = false;
+        }
+    }
+    return path;
+}
+
+// A path of JSONPathOpSegment steps that selects what pointer refers to, so
+// pointers run on either engine.
+extern JSONPath *JSONPathFromPointer(JSONPointer *pointer)
+{
+    if (pointer == NULL || pointer->segment_count > JSON_PATH_MAX_INSTRUCTIONS)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    JSONPath *path = malloc(sizeof(JSONPath));
+    if (path == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    path->instruction_count = 0;
+    path->streamable = true;
+    path->instructions = malloc(sizeof(JSONPathInstruction) * JSON_PATH_MAX_INSTRUCTIONS);
+    if (path->instructions == NULL)
+    {
+        free(path);
+        errno = ENOMEM;
+        return NULL;
+    }
+    for (u_int32_t i = 0; i < pointer->segment_count; i++)
+    {
+        JSONPathInstruction *instruction = &path->instructions[path->instruction_count++];
+        instructionInit(instruction);
+        instruction->opcode = JSONPathOpSegment;
+        instruction->key = strdup(pointer->segments[i].key);
+        if (instruction->key == NULL)
+        {
+            FreeJSONPath(path);
+            errno = ENOMEM;
+            return NULL;
+        }
+        instruction->key_len = pointer->segments[i].key_len;
+        instruction->hash = pointer->segments[i].hash;
+        instruction->start = pointer->segments[i].index;
+    }
+    return path;
+}
+
+extern void FreeJSONPath(JSONPath *path)
+{
+    if (path == NULL)
+    {
+        errno = EINVAL;
+        return;
+    }
+    for (u_int32_t i = 0; i < path->instruction_count; i++)
+    {
+        freeInstruction(&path->instructions[i]);
+    }
+    free(path->instructions);
+    free(path);
+}
+
+static JSONPathResults *pathResultsInit(bool spans)
+{
+    JSONPathResults *results = malloc(sizeof(JSONPathResults));
+    if (results == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    results->count = 0;
+    results->capacity = JSON_PATH_RESULTS_INITIAL_SIZE;
+    results->values = NULL;
+    results->spans = NULL;
+    if (spans)
+    {
+        results->spans = malloc(sizeof(JSONSpan) * results->capacity);
+    }
+    else
+    {
+        results->values = malloc(sizeof(JSONValue *) * results->capacity);
+    }
+    if (results->values == NULL && results->spans == NULL)
+    {
+        free(results);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return results;
+}
+
+extern void FreeJSONPathResults(JSONPathResults *results)
+{
+    if (results == NULL)
+    {
+        errno = EINVAL;
+        return;
+    }
+    free(results->values);
+    free(results->spans);
+    free(results);
+}
+
+// Appends json_value, or a span starting at start for span results.
+static bool pathResultsAppend(JSONPathResults *results, JSONValue *json_value, u_int64_t start)
+{
+    if (results->count == results->capacity)
+    {
+        u_int32_t new_capacity = results->capacity * 2;
+        void *grown = results->spans != NULL ? realloc(results->spans, sizeof(JSONSpan) * new_capacity) : realloc(results->values, sizeof(JSONValue *) * new_capacity);
+        if (grown == NULL)
+        {
+            errno = ENOMEM;
+            return false;
+        }
+        if (results->spans != NULL)
+        {
+            results->spans = grown;
+        }
+        else
+        {
+            results->values = grown;
+        }
+        results->capacity = new_capacity;
+    }
+    if (results->spans != NULL)
+    {
+        results->spans[results->count].start = start;
+        results->spans[results->count].len = 0;
+    }
+    else
+    {
+        results->values[results->count] = json_value;
+    }
+    results->count++;
+    return true;
+}
+
+// Compares a filter target of type against the literal. Numbers and strings
+// are ordered, bools and null only compare equal; a target of another type
+// is unequal to the literal and unordered.
+static bool filterCompare(JSONPathFilter *filter, enum JSONValueType type, double number, char *string, bool boolean)
+{
+    bool comparable = false;
+    bool ordered = false;
+    int order = 0;
+    if (filter->literal_type == JSONNUMBER_DOUBLE_t && (type == JSONNUMBER_INT_t || type == JSONNUMBER_DOUBLE_t))
+    {
+        comparable = ordered = true;
+        order = number < filter->number ? -1 : (number > filter->number ? 1 : 0);
+    }
+    else if (filter->literal_type == JSONSTRING_t && type == JSONSTRING_t)
+    {
+        comparable = ordered = true;
+        order = strcmp(string, filter->string);
+    }
+    else if (filter->literal_type == type && (type == JSONBOOL_t || type == JSONNULL_t))
+    {
+        comparable = true;
+        order = type == JSONBOOL_t && boolean != filter->boolean ? 1 : 0;
+    }
+    bool equal = comparable && order == 0;
+    switch (filter->compare)
+    {
+    case JSONPathCompareExists:
+        return true;
+    case JSONPathCompareEqual:
+        return equal;
+    case JSONPathCompareNotEqual:
+        return !equal;
+    case JSONPathCompareLess:
+        return ordered && order < 0;
+    case JSONPathCompareLessEqual:
+        return equal || (ordered && order < 0);
+    case JSONPathCompareGreater:
+        return ordered && order > 0;
+    case JSONPathCompareGreaterEqual:
+        return equal || (ordered && order > 0);
+    default:
+        return false;
+    }
+}
+
+static bool filterMatchesValue(JSONPathFilter *filter, JSONValue *json_value)
+{
+    for (u_int32_t i = 0; i < filter->key_count && json_value != NULL; i++)
+    {
+        json_value = json_value->value_type == JSONOBJ_t ? HashMapGet(json_value->value, filter->keys[i]) : NULL;
+    }
+    if (json_value == NULL)
+    {
+        return false;
+    }
+    switch (json_value->value_type)
+    {
+    case JSONNUMBER_INT_t:
+        return filterCompare(filter, JSONNUMBER_INT_t, (double)*(int64_t *)json_value->value, NULL, false);
+    case JSONNUMBER_DOUBLE_t:
+        return filterCompare(filter, JSONNUMBER_DOUBLE_t, *(double *)json_value->value, NULL, false);
+    case JSONSTRING_t:
+        return filterCompare(filter, JSONSTRING_t, 0, json_value->value, false);
+    case JSONBOOL_t:
+        return filterCompare(filter, JSONBOOL_t, 0, NULL, *(bool *)json_value->value);
+    default:
+        return filterCompare(filter, json_value->value_type, 0, NULL, false);
+    }
+}
+
+// Python slice semantics over an array of size elements: *first is the
+// first index visited, iteration stops on reaching *stop.
+static bool sliceBounds(JSONPathInstruction *instruction, u_int32_t size, int64_t *first, int64_t *stop)
+{
+    int64_t length = size;
+    int64_t start = instruction->start;
+    int64_t end = instruction->end;
+    if (instruction->step > 0)
+    {
+        start = !instruction->has_start ? 0 : (start < 0 ? start + length : start);
+        end = !instruction->has_end ? length : (end < 0 ? end + length : end);
+        *first = start < 0 ? 0 : (start > length ? length : start);
+        *stop = end < 0 ? 0 : (end > length ? length : end);
+        return *first < *stop;
+    }
+    start = !instruction->has_start ? length - 1 : (start < 0 ? start + length : start);
+    end = !instruction->has_end ? -1 : (end < 0 ? end + length : end);
+    *first = start < -1 ? -1 : (start >= length ? length - 1 : start);
+    *stop = end < -1 ? -1 : (end >= length ? length - 1 : end);
+    return *first > *stop;
+}
+
+// Only for streamable slices, where start, end and step are not negative.
+static bool sliceContains(JSONPathInstruction *instruction, u_int32_t index)
+{
+    if (index < instruction->start || (instruction->has_end && index >= instruction->end))
+    {
+        return false;
+    }
+    return (index - instruction->start) % instruction->step == 0;
+}
+
+// Continues with the step after pc on a child the step at pc selected.
+static bool pathRunChild(JSONPath *path, u_int32_t pc, JSONValue *child, JSONPathResults *results)
+{
+    return child == NULL || pathRun(path, pc + 1, child, results);
+}
+
+static bool pathStep(JSONPath *path, u_int32_t pc, JSONValue *json_value, JSONPathResults *results)
+{
+    JSONPathInstruction *instruction = &path->instructions[pc];
+    bool ok = true;
+    if (json_value->value_type == JSONOBJ_t)
+    {
+        HashMap *map = json_value->value;
+        if (instruction->opcode == JSONPathOpChild || instruction->opcode == JSONPathOpSegment)
+        {
+            return pathRunChild(path, pc, HashMapGetHashed(map, instruction->key, instruction->key_len, instruction->hash), results);
+        }
+        if (instruction->opcode != JSONPathOpWildcard && instruction->opcode != JSONPathOpFilter)
+        {
+            return true;
+        }
+        JSONObjectIter iter;
+        JSONObjectIterInit(&iter, map);
+        for (JSONValue *map_entry = NULL; ok && (map_entry = JSONObjectIterNext(&iter)) != NULL;)
+        {
+            if (instruction->opcode == JSONPathOpWildcard || filterMatchesValue(&instruction->filter, map_entry))
+            {
+                ok = pathRunChild(path, pc, map_entry, results);
+            }
+        }
+        return ok;
+    }
+    if (json_value->value_type != JSONLIST_t)
+    {
+        return true;
+    }
+    DynamicArray *dynamic_array = json_value->value;
+    int64_t size = dynamic_array->size;
+    switch (instruction->opcode)
+    {
+    case JSONPathOpSegment:
+        return instruction->start < 0 || instruction->start >= size || pathRunChild(path, pc, DynamicArrayGetAtIndex(dynamic_array, (u_int32_t)instruction->start), results);
+    case JSONPathOpIndex:
+    {
+        int64_t index = instruction->start < 0 ? instruction->start + size : instruction->start;
+        return index < 0 || index >= size || pathRunChild(path, pc, DynamicArrayGetAtIndex(dynamic_array, (u_int32_t)index), results);
+    }
+    case JSONPathOpSlice:
+    {
+        int64_t first = 0;
+        int64_t stop = 0;
+        if (!sliceBounds(instruction, dynamic_array->size, &first, &stop))
+        {
+            return true;
+        }
+        for (int64_t i = first; ok && (instruction->step > 0 ? i < stop : i > stop); i += instruction->step)
+        {
+            ok = pathRunChild(path, pc, DynamicArrayGetAtIndex(dynamic_array, (u_int32_t)i), results);
+        }
+        return ok;
+    }
+    case JSONPathOpWildcard:
+    case JSONPathOpFilter:
+    {
+        // the results keep the elements
+        JSONArrayIter iter;
+        ok = DynamicArrayUnpack(dynamic_array) && JSONArrayIterInit(&iter, dynamic_array);
+        for (JSONValue *element = NULL; ok && (element = JSONArrayIterNext(&iter)) != NULL;)
+        {
+            if (instruction->opcode == JSONPathOpWildcard || filterMatchesValue(&instruction->filter, element))
+            {
+                ok = pathRunChild(path, pc, element, results);
+            }
+        }
+        return ok;
+    }
+    default:
+        return true;
+    }
+}
+
+// Runs the program from pc on json_value. Recursive descent applies the
+// step at pc again to every container below json_value.
+static bool pathRun(JSONPath *path, u_int32_t pc, JSONValue *json_value, JSONPathResults *results)
+{
+    if (pc == path->instruction_count)
+    {
+        return pathResultsAppend(results, json_value, 0);
+    }
+    if (!pathStep(path, pc, json_value, results))
+    {
+        return false;
+    }
+    if (!path->instructions[pc].descendant)
+    {
+        return true;
+    }
+    bool ok = true;
+    if (json_value->value_type == JSONOBJ_t)
+    {
+        JSONObjectIter iter;
+        JSONObjectIterInit(&iter, json_value->value);
+        for (JSONValue *map_entry = NULL; ok && (map_entry = JSONObjectIterNext(&iter)) != NULL;)
+        {
+            if (map_entry->value_type == JSONOBJ_t || map_entry->value_type == JSONLIST_t)
+            {
+                ok = pathRun(path, pc, map_entry, results);
+            }
+        }
+    }
+    else if (json_value->value_type == JSONLIST_t)
+    {
+        DynamicArray *dynamic_array = json_value->value;
+        // packed arrays hold no containers
+        if (dynamic_array->storage == DYN_ARR_PACKED_INT || dynamic_array->storage == DYN_ARR_PACKED_DOUBLE || dynamic_array->storage == DYN_ARR_PACKED_BOOL)
+        {
+            return true;
+        }
+        JSONArrayIter iter;
+        ok = JSONArrayIterInit(&iter, dynamic_array);
+        for (JSONValue *element = NULL; ok && (element = JSONArrayIterNext(&iter)) != NULL;)
+        {
+            if (element->value_type == JSONOBJ_t || element->value_type == JSONLIST_t)
+            {
+                ok = pathRun(path, pc, element, results);
+            }
+        }
+    }
+    return ok;
+}
+
+// Runs path over the DOM below json_value. The results borrow the matched
+// values, they stay valid until the document changes. Packed and columnar
+// arrays a step looks into become generic arrays.
+extern JSONPathResults *JSONPathQuery(JSONPath *path, JSONValue *json_value)
+{
+    if (path == NULL || json_value == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    JSONPathResults *results = pathResultsInit(false);
+    if (results == NULL)
+    {
+        return NULL;
+    }
+    if (!pathRun(path, 0, json_value, results))
+    {
+        FreeJSONPathResults(results);
+        return NULL;
+    }
+    return results;
+}
+
+static void freeTokenLiteral(JSONToken *token)
+{
+    if (token->type == JSONTokenString || token->type == JSONTokenNumber || token->type == JSONTokenBool || token->type == JSONTokenNULL)
+    {
+        free(token->literal);
+    }
+    FreeJSONToken(token);
+}
+
+// Reads up to the next member of an open container. *key gets an object
+// member's name (the caller frees it), *value the member's first token, or
+// NULL once the container closes, *end then being the offset past it.
+static bool streamNextMember(JSONPathStream *stream, bool is_object, bool first, char **key, JSONToken **value, u_int64_t *end)
+{
+    *key = NULL;
+    *value = NULL;
+    JSONToken *token = JSONLex(stream->lexer);
+    if (token == NULL)
+    {
+        return false;
+    }
+    if (token->type == (is_object ? JSONTokenCloseCurlyBrace : JSONTokenCloseBracket))
+    {
+        *end = token->end;
+        FreeJSONToken(token);
+        return true;
+    }
+    if (!first)
+    {
+        if (token->type != JSONTokenComma)
+        {
+            freeTokenLiteral(token);
+            return false;
+        }
+        FreeJSONToken(token);
+        if ((token = JSONLex(stream->lexer)) == NULL)
+        {
+            return false;
+        }
+    }
+    if (is_object)
+    {
+        if (token->type != JSONTokenString)
+        {
+            freeTokenLiteral(token);
+            return false;
+        }
+        *key = token->literal;
+        FreeJSONToken(token);
+        if ((token = JSONLex(stream->lexer)) == NULL || token->type != JSONTokenColon)
+        {
+            if (token != NULL)
+            {
+                freeTokenLiteral(token);
+            }
+            free(*key);
+            *key = NULL;
+            return false;
+        }
+        FreeJSONToken(token);
+        if ((token = JSONLex(stream->lexer)) == NULL)
+        {
+            free(*key);
+            *key = NULL;
+            return false;
+        }
+    }
+    if (!IsJSONTokenValueType(token, true))
+    {
+        freeTokenLiteral(token);
+        free(*key);
+        *key = NULL;
+        return false;
+    }
+    *value = token;
+    return true;
+}
+
+static bool tokenFilterCompare(JSONPathFilter *filter, JSONToken *token)
+{
+    switch (token->type)
+    {
+    case JSONTokenNumber:
+        return filterCompare(filter, JSONNUMBER_DOUBLE_t, strtod(token->literal, NULL), NULL, false);
+    case JSONTokenString:
+        return filterCompare(filter, JSONSTRING_t, 0, token->literal, false);
+    case JSONTokenBool:
+        return filterCompare(filter, JSONBOOL_t, 0, NULL, strcmp(token->literal, JSON_BOOL_TRUE) == 0);
+    case JSONTokenNULL:
+        return filterCompare(filter, JSONNULL_t, 0, NULL, false);
+    case JSONTokenOpenCurlyBrace:
+        return filterCompare(filter, JSONOBJ_t, 0, NULL, false);
+    default:
+        return filterCompare(filter, JSONLIST_t, 0, NULL, false);
+    }
+}
+
+// Consumes the container opened by open_type. alive holds the filters (by
+// pc) whose @.key path matched down to this container at depth; the ones
+// whose target is found are evaluated into passed. With alive empty this
+// just skips the container.
+static bool streamScan(JSONPathStream *stream, enum JSONTokenType open_type, u_int64_t alive, u_int32_t depth, u_int64_t *passed, u_int64_t *end)
+{
+    bool is_object = open_type == JSONTokenOpenCurlyBrace;
+    for (bool first = true;; first = false)
+    {
+        char *key = NULL;
+        JSONToken *value = NULL;
+        if (!streamNextMember(stream, is_object, first, &key, &value, end))
+        {
+            return false;
+        }
+        if (value == NULL)
+        {
+            return true;
+        }
+        u_int64_t member_alive = 0;
+        for (u_int32_t pc = 0; key != NULL && (alive >> pc) != 0; pc++)
+        {
+            JSONPathFilter *filter = &stream->path->instructions[pc].filter;
+            if (!(alive & (1ULL << pc)) || strcmp(filter->keys[depth], key) != 0)
+            {
+                continue;
+            }
+            if (filter->key_count == depth + 1)
+            {
+                *passed |= tokenFilterCompare(filter, value) ? (1ULL << pc) : 0;
+            }
+            else
+            {
+                member_alive |= 1ULL << pc;
+            }
+        }
+        free(key);
+        enum JSONTokenType value_type = value->type;
+        freeTokenLiteral(value);
+        u_int64_t member_end = 0;
+        if ((value_type == JSONTokenOpenCurlyBrace || value_type == JSONTokenOpenBracket) && !streamScan(stream, value_type, member_alive, depth + 1, passed, &member_end))
+        {
+            return false;
+        }
+    }
+}
+
+// Decides the filters (by pc) a member starting with token passes. For a
+// container that means reading ahead through it and rewinding the lexer.
+static bool streamFilters(JSONPathStream *stream, u_int64_t filters, JSONToken *token, u_int64_t *passed)
+{
+    u_int64_t alive = 0;
+    for (u_int32_t pc = 0; (filters >> pc) != 0; pc++)
+    {
+        JSONPathFilter *filter = &stream->path->instructions[pc].filter;
+        if (!(filters & (1ULL << pc)))
+        {
+            continue;
+        }
+        if (filter->key_count == 0)
+        {
+            *passed |= tokenFilterCompare(filter, token) ? (1ULL << pc) : 0;
+        }
+        else
+        {
+            alive |= 1ULL << pc;
+        }
+    }
+    if (alive == 0 || (token->type != JSONTokenOpenCurlyBrace && token->type != JSONTokenOpenBracket))
+    {
+        return true;
+    }
+    JSONLexer saved = *stream->lexer;
+    u_int64_t end = 0;
+    bool ok = streamScan(stream, token->type, alive, 0, passed, &end);
+    *stream->lexer = saved;
+    return ok;
+}
+
+// NFA step over the program states (by pc) of a container: the states of
+// its member named key, or of its element at index when key is NULL. Filter
+// steps cannot be decided from the name alone, their pcs go to *filters.
+extern u_int64_t JSONPathNextStates(JSONPath *path, u_int64_t states, char *key, u_int32_t index, u_int64_t *filters)
+{
+    u_int64_t next = 0;
+    *filters = 0;
+    for (u_int32_t pc = 0; pc < path->instruction_count; pc++)
+    {
+        if (!(states & (1ULL << pc)))
+        {
+            continue;
+        }
+        JSONPathInstruction *instruction = &path->instructions[pc];
+        if (instruction->descendant)
+        {
+            next |= 1ULL << pc;
+        }
+        bool matches = false;
+        switch (instruction->opcode)
+        {
+        case JSONPathOpChild:
+            matches = key != NULL && strcmp(key, instruction->key) == 0;
+            break;
+        case JSONPathOpWildcard:
+            matches = true;
+            break;
+        case JSONPathOpIndex:
+            matches = key == NULL && index == instruction->start;
+            break;
+        case JSONPathOpSlice:
+            matches = key == NULL && sliceContains(instruction, index);
+            break;
+        case JSONPathOpSegment:
+            matches = key != NULL ? strcmp(key, instruction->key) == 0 : index == instruction->start;
+            break;
+        case JSONPathOpFilter:
+            *filters |= 1ULL << pc;
+            break;
+        }
+        if (matches)
+        {
+            next |= 1ULL << (pc + 1);
+        }
+    }
+    return next;
+}
+
+// Member states including the filters the member passes.
+static bool streamTransition(JSONPathStream *stream, u_int64_t mask, char *key, u_int32_t index, JSONToken *token, u_int64_t *member_mask)
+{
+    u_int64_t filters = 0;
+    u_int64_t next = JSONPathNextStates(stream->path, mask, key, index, &filters);
+    u_int64_t passed = 0;
+    if (filters != 0 && !streamFilters(stream, filters, token, &passed))
+    {
+        return false;
+    }
+    *member_mask = next | (passed << 1);
+    return true;
+}
+
+// Consumes the value starting with token, mask holding the program states
+// (by pc) it is in; bit instruction_count marks a match.
+static bool streamValue(JSONPathStream *stream, JSONToken *token, u_int64_t mask)
+{
+    JSONPathResults *results = stream->results;
+    u_int32_t result_index = results->count;
+    bool is_result = mask & (1ULL << stream->path->instruction_count);
+    u_int64_t start = token->start;
+    u_int64_t end = token->end;
+    enum JSONTokenType type = token->type;
+    if (type == JSONTokenNumber)
+    {
+        end = start + strlen(token->literal);
+    }
+    freeTokenLiteral(token);
+    if (is_result && !pathResultsAppend(results, NULL, start))
+    {
+        return false;
+    }
+    // states that only ever match further down survive into members
+    u_int64_t member_states = mask & ~(1ULL << stream->path->instruction_count);
+    if (type == JSONTokenOpenCurlyBrace || type == JSONTokenOpenBracket)
+    {
+        if (member_states == 0)
+        {
+            u_int64_t passed = 0;
+            if (!streamScan(stream, type, 0, 0, &passed, &end))
+            {
+                return false;
+            }
+        }
+        else
+        {
+            bool is_object = type == JSONTokenOpenCurlyBrace;
+            for (u_int32_t index = 0;; index++)
+            {
+                char *key = NULL;
+                JSONToken *value = NULL;
+                u_int64_t member_mask = 0;
+                if (!streamNextMember(stream, is_object, index == 0, &key, &value, &end))
+                {
+                    return false;
+                }
+                if (value == NULL)
+                {
+                    break;
+                }
+                bool ok = streamTransition(stream, member_states, key, index, value, &member_mask);
+                free(key);
+                if (!ok)
+                {
+                    freeTokenLiteral(value);
+                    return false;
+                }
+                if (!streamValue(stream, value, member_mask))
+                {
+                    return false;
+                }
+            }
+        }
+    }
+    if (is_result)
+    {
+        results->spans[result_index].len = end - start;
+    }
+    return true;
+}
+
+// Runs path straight over the tokens of input without building a DOM. The
+// results are spans of input in document order. Filters read ahead through
+// the container they test. Paths with negative indices or slices need the
+// array length first and fail with EINVAL, as does invalid input.
+extern JSONPathResults *JSONPathQueryText(JSONPath *path, char *input)
+{
+    if (path == NULL || input == NULL || !path->streamable)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    JSONLexer *lexer = JSONLexerInit(input);
+    if (lexer == NULL)
+    {
+        return NULL;
+    }
+    JSONPathResults *results = pathResultsInit(true);
+    if (results == NULL)
+    {
+        FreeJSONLexer(lexer);
+        return NULL;
+    }
+    JSONPathStream stream = {.path = path, .lexer = lexer, .results = results};
+    JSONToken *token = JSONLex(lexer);
+    bool ok = token != NULL && IsJSONTokenValueType(token, true);
+    if (token != NULL && !ok)
+    {
+        freeTokenLiteral(token);
+    }
+    ok = ok && streamValue(&stream, token, 1ULL);
+    if (ok)
+    {
+        token = JSONLex(lexer);
+        ok = token != NULL && token->type == JSONTokenEOF;
+        if (token != NULL)
+        {
+            freeTokenLiteral(token);
+        }
+    }
+    FreeJSONLexer(lexer);
+    if (!ok)
+    {
+        FreeJSONPathResults(results);
+        errno = errno == ENOMEM ? ENOMEM : EINVAL;
+        return NULL;
+    }
+    return results;
+}
@@ -0,0 +1,199 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <errno.h>
+
+#include <standardloop/util.h>
+
+#include "./json.h"
+
+static JSONInternedKey **keyTableSlotsInit(u_int32_t);
+static u_int32_t keyTableFindSlot(JSONInternedKey **, u_int32_t, char *, u_int32_t, u_int32_t);
+static bool keyTableResize(JSONKeyTable *);
+static inline JSONInternedKey *internedKeyFromString(char *);
+
+static inline JSONInternedKey *internedKeyFromString(char *key)
+{
+    return (JSONInternedKey *)(key - offsetof(JSONInternedKey, key));
+}
+
+static JSONInternedKey **keyTableSlotsInit(u_int32_t capacity)
+{
+    JSONInternedKey **slots = malloc(sizeof(JSONInternedKey *) * capacity);
+    if (slots == NULL)
+    {
+        return NULL;
+    }
+    for (u_int32_t i = 0; i < capacity; i++)
+    {
+        slots[i] = NULL;
+    }
+    return slots;
+}
+
+extern JSONKeyTable *JSONKeyTableInit(u_int32_t initial_capacity)
+{
+    JSONKeyTable *key_table = malloc(sizeof(JSONKeyTable));
+    if (key_table == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    if (initial_capacity < HASHMAP_MIN_CAPACITY)
+    {
+        initial_capacity = HASHMAP_MIN_CAPACITY;
+    }
+    key_table->size = 0;
+    key_table->capacity = initial_capacity;
+    key_table->slots = keyTableSlotsInit(initial_capacity);
+    if (key_table->slots == NULL)
+    {
+        free(key_table);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return key_table;
+}
+
+extern JSONKeyTable *DefaultJSONKeyTableInit(void)
+{
+    return JSONKeyTableInit(DEFAULT_KEY_TABLE_SIZE);
+}
+
+extern void FreeJSONKeyTable(JSONKeyTable *key_table)
+{
+    if (key_table == NULL)
+    {
+        errno = EINVAL;
+        return;
+    }
+    if (key_table->slots != NULL)
+    {
+        for (u_int32_t i = 0; i < key_table->capacity; i++)
+        {
+            if (key_table->slots[i] != NULL)
+            {
+                free(key_table->slots[i]);
+            }
+        }
+        free(key_table->slots);
+    }
+    free(key_table);
+}
+
+static u_int32_t keyTableFindSlot(JSONInternedKey **slots, u_int32_t capacity, char *key, u_int32_t len, u_int32_t hash)
+{
+    u_int32_t slot = hash % capacity;
+    while (slots[slot] != NULL)
+    {
+        JSONInternedKey *interned = slots[slot];
+        if (interned->hash == hash && interned->len == len && memcmp(interned->key, key, len) == 0)
+        {
+            break;
+        }
+        slot++;
+        if (slot == capacity)
+        {
+            slot = 0;
+        }
+    }
+    return slot;
+}
+
+static bool keyTableResize(JSONKeyTable *key_table)
+{
+    u_int32_t new_capacity = key_table->capacity * DEFAULT_MAP_RESIZE_MULTIPLE;
+    JSONInternedKey **new_slots = keyTableSlotsInit(new_capacity);
+    if (new_slots == NULL)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+    for (u_int32_t i = 0; i < key_table->capacity; i++)
+    {
+        JSONInternedKey *interned = key_table->slots[i];
+        if (interned != NULL)
+        {
+            u_int32_t slot = interned->hash % new_capacity;
+            while (new_slots[slot] != NULL)
+            {
+                slot++;
+                if (slot == new_capacity)
+                {
+                    slot = 0;
+                }
+            }
+            new_slots[slot] = interned;
+        }
+    }
+    free(key_table->slots);
+    key_table->slots = new_slots;
+    key_table->capacity = new_capacity;
+    return true;
+}
+
+extern char *JSONKeyTableLookup(JSONKeyTable *key_table, char *key)
+{
+    if (key_table == NULL || key == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    u_int32_t len = strlen(key);
+    u_int32_t hash = HashMapKeyHash(key);
+    JSONInternedKey *interned = key_table->slots[keyTableFindSlot(key_table->slots, key_table->capacity, key, len, hash)];
+    if (interned == NULL)
+    {
+        return NULL;
+    }
+    return interned->key;
+}
+
+extern char *JSONKeyTableIntern(JSONKeyTable *key_table, char *key)
+{
+    if (key_table == NULL || key == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    // keep the table at most 2/3 full, like HashMap; one that cannot grow
+    // still hands out the keys it has, so probing always ends
+    bool full = (key_table->size + 1) * 3 > key_table->capacity * 2 && !keyTableResize(key_table);
+    u_int32_t len = strlen(key);
+    u_int32_t hash = HashMapKeyHash(key);
+    u_int32_t slot = keyTableFindSlot(key_table->slots, key_table->capacity, key, len, hash);
+    if (key_table->slots[slot] != NULL)
+    {
+        return key_table->slots[slot]->key;
+    }
+    if (full)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    JSONInternedKey *interned = malloc(sizeof(JSONInternedKey) + len + 1);
+    if (interned == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    interned->hash = hash;
+    interned->len = len;
+    memcpy(interned->key, key, len + 1);
+    key_table->slots[slot] = interned;
+    key_table->size++;
+    return interned->key;
+}
+
+extern u_int32_t JSONInternedKeyHash(char *key)
+{
+    return internedKeyFromString(key)->hash;
+}
+
+extern u_int32_t JSONInternedKeyLength(char *key)
+{
+    return internedKeyFromString(key)->len;
+}
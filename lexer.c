@@ -11,6 +11,10 @@ static void advanceChar(JSONLexer *);
 static void backtrackChar(JSONLexer *);
 static void skipWhitespace(JSONLexer *);
 static char *makeStringLiteral(JSONLexer *);
+static bool isValidUTF8(char *, u_int32_t);
+static int32_t parseHex4(char *);
+static u_int32_t encodeUTF8(u_int32_t, char *);
+static u_int32_t decodeEscape(char *, u_int32_t, char *, u_int32_t *);
 static char *makeNumberLiteral(JSONLexer *);
 static char *makeNULLLiteral(JSONLexer *);
 static char *makeBoolLiteral(JSONLexer *);
@@ -398,89 +402,261 @@ static char *makeNumberLiteral(JSONLexer *lexer)
     return number_literal;
 }
 
-static char *makeStringLiteral(JSONLexer *lexer)
+// Runs of ASCII are skipped eight bytes at a time. Overlong forms, surrogates
+// and code points past U+10FFFF are rejected.
+static bool isValidUTF8(char *str, u_int32_t len)
 {
-    u_int32_t start_position = lexer->position + 1; // move pass quotes
-    char prev_char = lexer->current_char;
-    advanceChar(lexer);
-    bool is_error = false;
-    while (ALWAYS)
+    u_int32_t i = 0;
+    while (i < len)
     {
-        // printf("%c\n", lexer->current_char);
-        if (lexer->current_char == BACKSLASH_CHAR)
+        if (len - i >= 8)
         {
-            prev_char = lexer->current_char;
-            advanceChar(lexer);
-            if (lexer->current_char == DOUBLE_QUOTES_CHAR)
+            u_int64_t chunk;
+            memcpy(&chunk, str + i, sizeof(chunk));
+            if ((chunk & 0x8080808080808080ULL) == 0)
             {
+                i += 8;
                 continue;
             }
-            else if (lexer->current_char == 'n')
-            {
-                continue;
-            }
-            else if (lexer->current_char == BACKSLASH_CHAR)
-            {
-                continue;
-            }
-            else if (lexer->current_char == FORWARDLASH_CHAR)
-            {
-                continue;
-            }
-            else if (lexer->current_char == 'f')
-            {
-                continue;
-            }
-            else if (lexer->current_char == 'r')
-            {
-                continue;
-            }
-            else if (lexer->current_char == 't')
-            {
-                continue;
-            }
-            else if (lexer->current_char == 'u')
-            {
-                prev_char = lexer->current_char;
-                advanceChar(lexer);
-                for (u_int8_t i = 0; i < 4; i++)
-                {
-                    if (!isxdigit(lexer->current_char))
-                    {
-                        is_error = true;
-                    }
-                    prev_char = lexer->current_char;
-                    advanceChar(lexer);
-                }
-            }
-            else
+        }
+        unsigned char lead = (unsigned char)str[i];
+        if (lead < 0x80)
+        {
+            i++;
+            continue;
+        }
+        u_int32_t continuation_count = 0;
+        u_int32_t code_point = 0;
+        u_int32_t min_code_point = 0;
+        if ((lead & 0xE0) == 0xC0)
+        {
+            continuation_count = 1;
+            code_point = lead & 0x1F;
+            min_code_point = 0x80;
+        }
+        else if ((lead & 0xF0) == 0xE0)
+        {
+            continuation_count = 2;
+            code_point = lead & 0x0F;
+            min_code_point = 0x800;
+        }
+        else if ((lead & 0xF8) == 0xF0)
+        {
+            continuation_count = 3;
+            code_point = lead & 0x07;
+            min_code_point = 0x10000;
+        }
+        else
+        {
+            return false;
+        }
+        if (len - i <= continuation_count)
+        {
+            return false;
+        }
+        for (u_int32_t k = 1; k <= continuation_count; k++)
+        {
+            unsigned char continuation = (unsigned char)str[i + k];
+            if ((continuation & 0xC0) != 0x80)
             {
-                is_error = true;
+                return false;
             }
+            code_point = (code_point << 6) | (continuation & 0x3F);
         }
-        if ((lexer->current_char == DOUBLE_QUOTES_CHAR && prev_char != BACKSLASH_CHAR) || lexer->current_char == NULL_CHAR)
+        if (code_point < min_code_point || code_point > 0x10FFFF || (code_point >= 0xD800 && code_point <= 0xDFFF))
         {
-            break;
+            return false;
         }
-        prev_char = lexer->current_char;
-        advanceChar(lexer);
+        i += continuation_count + 1;
     }
+    return true;
+}
 
-    if (is_error)
+// Returns -1 unless str starts with four hex digits.
+static int32_t parseHex4(char *str)
+{
+    int32_t value = 0;
+    for (u_int8_t i = 0; i < 4; i++)
+    {
+        char c = str[i];
+        if (!isxdigit((unsigned char)c))
+        {
+            return -1;
+        }
+        value = (value << 4) | (isdigit((unsigned char)c) ? c - '0' : (tolower((unsigned char)c) - 'a' + 10));
+    }
+    return value;
+}
+
+static u_int32_t encodeUTF8(u_int32_t code_point, char *out)
+{
+    if (code_point < 0x80)
+    {
+        out[0] = (char)code_point;
+        return 1;
+    }
+    if (code_point < 0x800)
+    {
+        out[0] = (char)(0xC0 | (code_point >> 6));
+        out[1] = (char)(0x80 | (code_point & 0x3F));
+        return 2;
+    }
+    if (code_point < 0x10000)
+    {
+        out[0] = (char)(0xE0 | (code_point >> 12));
+        out[1] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+        out[2] = (char)(0x80 | (code_point & 0x3F));
+        return 3;
+    }
+    out[0] = (char)(0xF0 | (code_point >> 18));
+    out[1] = (char)(0x80 | ((code_point >> 12) & 0x3F));
+    out[2] = (char)(0x80 | ((code_point >> 6) & 0x3F));
+    out[3] = (char)(0x80 | (code_point & 0x3F));
+    return 4;
+}
+
+// Decodes the escape sequence at str (just past the backslash) into out.
+// Sets consumed to the number of input bytes used and returns the number of
+// bytes written, 0 for an invalid escape. \u0000 is rejected: strings are
+// NUL terminated everywhere, and failing beats silently cutting the string
+// short. So is a lone surrogate, which UTF-8 cannot encode.
+static u_int32_t decodeEscape(char *str, u_int32_t available, char *out, u_int32_t *consumed)
+{
+    *consumed = 1;
+    switch (str[0])
+    {
+    case DOUBLE_QUOTES_CHAR:
+    case BACKSLASH_CHAR:
+    case FORWARDLASH_CHAR:
+        out[0] = str[0];
+        return 1;
+    case 'b':
+        out[0] = '\b';
+        return 1;
+    case 'f':
+        out[0] = '\f';
+        return 1;
+    case 'n':
+        out[0] = NEWLINE_CHAR;
+        return 1;
+    case 'r':
+        out[0] = CARRIAGE_CHAR;
+        return 1;
+    case 't':
+        out[0] = TAB_CHAR;
+        return 1;
+    case 'u':
+        break;
+    default:
+        return 0;
+    }
+    int32_t code_unit = available >= 5 ? parseHex4(str + 1) : -1;
+    if (code_unit <= 0 || (code_unit >= 0xDC00 && code_unit <= 0xDFFF))
+    {
+        return 0;
+    }
+    *consumed = 5;
+    u_int32_t code_point = (u_int32_t)code_unit;
+    if (code_unit >= 0xD800 && code_unit <= 0xDBFF)
+    {
+        if (available < 11 || str[5] != BACKSLASH_CHAR || str[6] != 'u')
+        {
+            return 0;
+        }
+        int32_t low_surrogate = parseHex4(str + 7);
+        if (low_surrogate < 0xDC00 || low_surrogate > 0xDFFF)
+        {
+            return 0;
+        }
+        *consumed = 11;
+        code_point = 0x10000 + (((u_int32_t)code_unit - 0xD800) << 10) + ((u_int32_t)low_surrogate - 0xDC00);
+    }
+    return encodeUTF8(code_point, out);
+}
+
+// Finds the closing quote first, so the literal is allocated once at the
+// size of the raw span; decoding only ever shrinks it. Without escapes the
+// span is copied with a single memcpy. Invalid UTF-8, invalid escapes, raw
+// control characters and unterminated strings return NULL. The lexer is left
+// on the closing quote.
+static char *makeStringLiteral(JSONLexer *lexer)
+{
+    char *input = lexer->input;
+    u_int32_t start_position = lexer->position + 1; // move pass quotes
+    u_int32_t end_position = start_position;
+    bool has_escapes = false;
+    bool has_control_chars = false;
+    while (end_position < lexer->input_len)
+    {
+        // stops at the same bytes the writer escapes
+        end_position += (u_int32_t)JSONEscapeScan(input + end_position, lexer->input_len - end_position);
+        if (end_position >= lexer->input_len || input[end_position] == DOUBLE_QUOTES_CHAR)
+        {
+            break;
+        }
+        if (input[end_position] != BACKSLASH_CHAR)
+        {
+            has_control_chars = true;
+            end_position++;
+            continue;
+        }
+        has_escapes = true;
+        end_position += 2;
+    }
+    if (end_position > lexer->input_len)
+    {
+        end_position = lexer->input_len;
+    }
+    lexer->position = end_position;
+    lexer->read_position = end_position + 1;
+    lexer->current_char = end_position < lexer->input_len ? input[end_position] : NULL_CHAR;
+    if (end_position == lexer->input_len || has_control_chars)
     {
         return NULL;
     }
 
-    u_int32_t string_literal_size = (lexer->position - start_position) + 1;
-    char *string_literal = malloc(sizeof(char) * string_literal_size);
+    u_int32_t span_len = end_position - start_position;
+    if (!isValidUTF8(input + start_position, span_len))
+    {
+        return NULL;
+    }
+    char *string_literal = malloc(sizeof(char) * (span_len + 1));
     if (string_literal == NULL)
     {
+        errno = ENOMEM;
         return NULL;
     }
-    copyString(lexer->input, string_literal, string_literal_size, start_position);
-    string_literal[string_literal_size - 1] = NULL_CHAR;
-    // printf("[JOSH]: %s\n", string_literal);
-    // printf("[JOSH]: %d\n", (int)strlen(string_literal));
+    if (!has_escapes)
+    {
+        memcpy(string_literal, input + start_position, span_len);
+        string_literal[span_len] = NULL_CHAR;
+        return string_literal;
+    }
+
+    u_int32_t written = 0;
+    u_int32_t position = start_position;
+    while (position < end_position)
+    {
+        char *backslash = memchr(input + position, BACKSLASH_CHAR, end_position - position);
+        u_int32_t clean_run = backslash == NULL ? end_position - position : (u_int32_t)(backslash - (input + position));
+        memcpy(string_literal + written, input + position, clean_run);
+        written += clean_run;
+        position += clean_run;
+        if (position == end_position)
+        {
+            break;
+        }
+        u_int32_t consumed = 0;
+        u_int32_t decoded = decodeEscape(input + position + 1, end_position - position - 1, string_literal + written, &consumed);
+        if (decoded == 0)
+        {
+            free(string_literal);
+            return NULL;
+        }
+        written += decoded;
+        position += consumed + 1;
+    }
+    string_literal[written] = NULL_CHAR;
     return string_literal;
 }
 
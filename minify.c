@@ -0,0 +1,238 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <standardloop/util.h>
+
+#include "./json.h"
+
+typedef struct
+{
+    bool expect_separator;
+    bool expect_colon;
+    bool after_comma;
+} JSONReformatState;
+
+static inline u_int64_t whitespaceOrQuoteMask(u_int64_t);
+static u_int64_t scanWhitespaceOrQuote(char *, u_int64_t);
+static inline bool isJSONWhitespace(char);
+static bool reformatToken(JSONWriter *, JSONToken *, JSONReformatState *);
+
+static inline bool isJSONWhitespace(char c)
+{
+    return c == SPACE_CHAR || c == TAB_CHAR || c == NEWLINE_CHAR || c == CARRIAGE_CHAR;
+}
+
+// SWAR: sets the high bit of every byte of chunk that is JSON whitespace or
+// a double quote, the lowest set bit is always exact.
+static inline u_int64_t whitespaceOrQuoteMask(u_int64_t chunk)
+{
+    u_int64_t spaces = chunk ^ 0x2020202020202020ULL;
+    u_int64_t tabs = chunk ^ 0x0909090909090909ULL;
+    u_int64_t newlines = chunk ^ 0x0A0A0A0A0A0A0A0AULL;
+    u_int64_t carriages = chunk ^ 0x0D0D0D0D0D0D0D0DULL;
+    u_int64_t quotes = chunk ^ 0x2222222222222222ULL;
+    spaces = (spaces - 0x0101010101010101ULL) & ~spaces;
+    tabs = (tabs - 0x0101010101010101ULL) & ~tabs;
+    newlines = (newlines - 0x0101010101010101ULL) & ~newlines;
+    carriages = (carriages - 0x0101010101010101ULL) & ~carriages;
+    quotes = (quotes - 0x0101010101010101ULL) & ~quotes;
+    return (spaces | tabs | newlines | carriages | quotes) & 0x8080808080808080ULL;
+}
+
+static u_int64_t scanWhitespaceOrQuote(char *str, u_int64_t len)
+{
+    u_int64_t i = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len - i >= 8)
+    {
+        u_int64_t chunk;
+        memcpy(&chunk, str + i, sizeof(chunk));
+        u_int64_t mask = whitespaceOrQuoteMask(chunk);
+        if (mask != 0)
+        {
+            return i + (u_int64_t)(__builtin_ctzll(mask) >> 3);
+        }
+        i += 8;
+    }
+#endif
+    for (; i < len; i++)
+    {
+        if (isJSONWhitespace(str[i]) || str[i] == DOUBLE_QUOTES_CHAR)
+        {
+            return i;
+        }
+    }
+    return len;
+}
+
+// Removes all whitespace outside of strings and NUL terminates out, which
+// needs len + 1 bytes. out may be input itself to minify in place. Runs
+// between whitespace and string bounds are moved in bulk. The input is not
+// validated, JSONReformat does that.
+extern u_int64_t JSONMinify(char *input, u_int64_t len, char *out)
+{
+    if (input == NULL || out == NULL)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+    u_int64_t read = 0;
+    u_int64_t written = 0;
+    while (read < len)
+    {
+        u_int64_t run = scanWhitespaceOrQuote(input + read, len - read);
+        memmove(out + written, input + read, run);
+        written += run;
+        read += run;
+        if (read == len)
+        {
+            break;
+        }
+        if (input[read] != DOUBLE_QUOTES_CHAR)
+        {
+            read++;
+            continue;
+        }
+        // copy the whole string, escapes included
+        u_int64_t string_end = read + 1;
+        while (string_end < len)
+        {
+            string_end += JSONScanQuoteOrBackslash(input + string_end, len - string_end);
+            if (string_end >= len || input[string_end] == DOUBLE_QUOTES_CHAR)
+            {
+                break;
+            }
+            string_end += 2;
+        }
+        string_end = string_end >= len ? len : string_end + 1;
+        memmove(out + written, input + read, string_end - read);
+        written += string_end - read;
+        read = string_end;
+    }
+    out[written] = NULL_CHAR;
+    return written;
+}
+
+// Tracks what the previous token allows next, the writer itself checks that
+// containers nest and that object members have keys.
+static bool reformatToken(JSONWriter *writer, JSONToken *token, JSONReformatState *state)
+{
+    bool is_value_start = IsJSONTokenValueType(token, true);
+    // a value needs a comma after the previous one and a colon after a key
+    if (is_value_start && (state->expect_separator || state->expect_colon))
+    {
+        return false;
+    }
+    if (is_value_start)
+    {
+        state->after_comma = false;
+    }
+    switch (token->type)
+    {
+    case JSONTokenOpenCurlyBrace:
+        return JSONWriterBeginObject(writer);
+    case JSONTokenOpenBracket:
+        return JSONWriterBeginArray(writer);
+    case JSONTokenCloseCurlyBrace:
+    case JSONTokenCloseBracket:
+        if (state->after_comma || state->expect_colon)
+        {
+            return false;
+        }
+        state->expect_separator = true;
+        return token->type == JSONTokenCloseCurlyBrace ? JSONWriterEndObject(writer) : JSONWriterEndArray(writer);
+    case JSONTokenComma:
+        if (!state->expect_separator || writer->depth == 0)
+        {
+            return false;
+        }
+        state->expect_separator = false;
+        state->after_comma = true;
+        return true;
+    case JSONTokenColon:
+        if (!state->expect_colon)
+        {
+            return false;
+        }
+        state->expect_colon = false;
+        return true;
+    case JSONTokenString:
+        if (writer->depth != 0 && writer->stack[writer->depth - 1] == JSONWriterContainerObject && !writer->after_key)
+        {
+            state->expect_colon = true;
+            return JSONWriterKey(writer, token->literal);
+        }
+        state->expect_separator = true;
+        return JSONWriterString(writer, token->literal);
+    case JSONTokenNumber:
+        // the lexer takes any run of number characters
+        if (!JSONIsNumberLiteral(token->literal))
+        {
+            return false;
+        }
+        state->expect_separator = true;
+        return JSONWriterNumberLiteral(writer, token->literal);
+    case JSONTokenBool:
+        state->expect_separator = true;
+        return JSONWriterBool(writer, strcmp(token->literal, JSON_BOOL_TRUE) == 0);
+    case JSONTokenNULL:
+        state->expect_separator = true;
+        return JSONWriterNull(writer);
+    default:
+        return false;
+    }
+}
+
+// Re-emits input through writer straight from the token stream, so the
+// writer's settings decide the layout (compact, or pretty without inline
+// containers). Strings are re-escaped, numbers are copied as written. No
+// JSONValue is built. Returns false with EINVAL on invalid input.
+extern bool JSONReformat(char *input, JSONWriter *writer)
+{
+    if (input == NULL || writer == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    JSONLexer *lexer = JSONLexerInit(input);
+    if (lexer == NULL)
+    {
+        return false;
+    }
+    JSONReformatState state = {.expect_separator = false, .expect_colon = false, .after_comma = false};
+    bool ok = true;
+    while (ok)
+    {
+        JSONToken *token = JSONLex(lexer);
+        if (token == NULL)
+        {
+            ok = false;
+            break;
+        }
+        if (token->type == JSONTokenEOF)
+        {
+            FreeJSONToken(token);
+            break;
+        }
+        ok = reformatToken(writer, token, &state);
+        if (token->type == JSONTokenString || token->type == JSONTokenNumber || token->type == JSONTokenBool || token->type == JSONTokenNULL)
+        {
+            free(token->literal);
+        }
+        FreeJSONToken(token);
+    }
+    FreeJSONLexer(lexer);
+    if (ok && (writer->depth != 0 || !writer->root_written))
+    {
+        ok = false;
+    }
+    if (!ok && errno != ENOMEM)
+    {
+        writer->error = true;
+        errno = EINVAL;
+    }
+    return ok;
+}
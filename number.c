@@ -0,0 +1,317 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <ctype.h>
+#include <errno.h>
+#include <math.h>
+#include <float.h>
+
+#include <standardloop/util.h>
+
+#include "./json.h"
+
+static inline bool isEightDigits(u_int64_t);
+static inline u_int32_t parseEightDigits(u_int64_t);
+static u_int32_t skipDigits(const char *);
+
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+// SWAR: checks and converts eight ASCII digits loaded as one little endian
+// word, three multiplies instead of eight multiply-adds.
+static inline bool isEightDigits(u_int64_t chunk)
+{
+    return ((chunk & 0xF0F0F0F0F0F0F0F0ULL) | (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL;
+}
+
+static inline u_int32_t parseEightDigits(u_int64_t chunk)
+{
+    chunk = ((chunk & 0x0F0F0F0F0F0F0F0FULL) * 2561) >> 8;
+    chunk = ((chunk & 0x00FF00FF00FF00FFULL) * 6553601) >> 16;
+    return (u_int32_t)(((chunk & 0x0000FFFF0000FFFFULL) * 42949672960001ULL) >> 32);
+}
+
+// Parses an optionally negative run of digits. Returns false on anything
+// else, including values that do not fit in an int64_t.
+extern bool JSONParseInt64(const char *literal, int64_t *out)
+{
+    if (literal == NULL || out == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    bool negative = false;
+    if (*literal == DASH_MINUS_CHAR)
+    {
+        negative = true;
+        literal++;
+    }
+    size_t len = strlen(literal);
+    if (len == 0 || len > JSON_INT64_MAX_DIGITS)
+    {
+        return false;
+    }
+
+    u_int64_t value = 0;
+    size_t i = 0;
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    while (len - i >= 8)
+    {
+        u_int64_t chunk;
+        memcpy(&chunk, literal + i, sizeof(chunk));
+        if (!isEightDigits(chunk))
+        {
+            break;
+        }
+        value = value * 100000000ULL + parseEightDigits(chunk);
+        i += 8;
+    }
+#endif
+    for (; i < len; i++)
+    {
+        if (!isdigit((unsigned char)literal[i]))
+        {
+            return false;
+        }
+        value = value * 10 + (u_int64_t)(literal[i] - '0');
+    }
+    // 19 digits cannot wrap a u_int64_t, only the int64_t range needs checking
+    if (negative)
+    {
+        if (value > (u_int64_t)INT64_MAX + 1)
+        {
+            return false;
+        }
+        *out = (int64_t)(0 - value);
+    }
+    else
+    {
+        if (value > (u_int64_t)INT64_MAX)
+        {
+            return false;
+        }
+        *out = (int64_t)value;
+    }
+    return true;
+}
+
+static u_int32_t skipDigits(const char *literal)
+{
+    u_int32_t i = 0;
+    while (isdigit((unsigned char)literal[i]))
+    {
+        i++;
+    }
+    return i;
+}
+
+// Whether literal is a number as RFC 8259 spells it: an optional minus, an
+// integer part without leading zeros, an optional fraction and an optional
+// exponent, and nothing else.
+extern bool JSONIsNumberLiteral(const char *literal)
+{
+    if (literal == NULL)
+    {
+        return false;
+    }
+    if (*literal == DASH_MINUS_CHAR)
+    {
+        literal++;
+    }
+    u_int32_t digits = skipDigits(literal);
+    if (digits == 0 || (digits > 1 && *literal == '0'))
+    {
+        return false;
+    }
+    literal += digits;
+    if (*literal == DOT_CHAR)
+    {
+        literal++;
+        digits = skipDigits(literal);
+        if (digits == 0)
+        {
+            return false;
+        }
+        literal += digits;
+    }
+    if (*literal == 'e' || *literal == 'E')
+    {
+        literal++;
+        if (*literal == PLUS_CHAR || *literal == DASH_MINUS_CHAR)
+        {
+            literal++;
+        }
+        digits = skipDigits(literal);
+        if (digits == 0)
+        {
+            return false;
+        }
+        literal += digits;
+    }
+    return *literal == NULL_CHAR;
+}
+
+// Writes value and a trailing NUL into buffer (at least JSON_NUMBER_CHAR_MAX
+// bytes), two digits at a time. Returns the length without the NUL.
+extern u_int32_t JSONFormatInt64(int64_t value, char *buffer)
+{
+    char digits[JSON_NUMBER_CHAR_MAX];
+    u_int32_t position = JSON_NUMBER_CHAR_MAX;
+    u_int64_t magnitude = value < 0 ? 0 - (u_int64_t)value : (u_int64_t)value;
+
+    while (magnitude >= 100)
+    {
+        u_int32_t pair = (u_int32_t)(magnitude % 100) * 2;
+        magnitude /= 100;
+        position -= 2;
+        digits[position] = digit_pairs[pair];
+        digits[position + 1] = digit_pairs[pair + 1];
+    }
+    if (magnitude >= 10)
+    {
+        u_int32_t pair = (u_int32_t)magnitude * 2;
+        position -= 2;
+        digits[position] = digit_pairs[pair];
+        digits[position + 1] = digit_pairs[pair + 1];
+    }
+    else
+    {
+        position--;
+        digits[position] = (char)('0' + magnitude);
+    }
+    if (value < 0)
+    {
+        position--;
+        digits[position] = DASH_MINUS_CHAR;
+    }
+    u_int32_t len = JSON_NUMBER_CHAR_MAX - position;
+    memcpy(buffer, digits + position, len);
+    buffer[len] = NULL_CHAR;
+    return len;
+}
+
+// Shortest digits that read back as value, so a double survives being
+// written and parsed again. The layout is the canonical one, except that -0
+// keeps its sign; returns 0 with EINVAL for NaN and infinities.
+extern u_int32_t JSONFormatDouble(double value, char *buffer)
+{
+    if (value == 0 && signbit(value))
+    {
+        buffer[0] = DASH_MINUS_CHAR;
+        buffer[1] = '0';
+        buffer[2] = NULL_CHAR;
+        return 2;
+    }
+    return JSONFormatDoubleCanonical(value, buffer);
+}
+
+// Shortest digits that read back as value, laid out like ECMAScript's
+// Number.prototype.toString as RFC 8785 requires. Same contract as
+// JSONFormatInt64; returns 0 for NaN and infinities, which JSON cannot hold.
+extern u_int32_t JSONFormatDoubleCanonical(double value, char *buffer)
+{
+    if (!isfinite(value))
+    {
+        errno = EINVAL;
+        return 0;
+    }
+    if (value == 0)
+    {
+        // covers -0 too
+        buffer[0] = '0';
+        buffer[1] = NULL_CHAR;
+        return 1;
+    }
+    // Any decimal of up to DBL_DIG digits survives the trip through a normal
+    // double, so if the shortest digits are that short they are the DBL_DIG
+    // digits without their trailing zeros. Past that the nearest 16 or 17
+    // digits are the ones that read back, if any do: three rounds at most.
+    // Subnormals hold fewer digits and are tried from one digit up.
+    char scientific[JSON_NUMBER_CHAR_MAX];
+    for (int precision = fabs(value) < DBL_MIN ? 1 : DBL_DIG; precision <= JSON_DOUBLE_ROUND_TRIP_DIGITS; precision++)
+    {
+        snprintf(scientific, sizeof(scientific), "%.*e", precision - 1, value);
+        if (strtod(scientific, NULL) == value)
+        {
+            break;
+        }
+    }
+
+    // scientific is [-]d[.ddd]e(+|-)xx
+    char *it = scientific;
+    u_int32_t len = 0;
+    if (*it == DASH_MINUS_CHAR)
+    {
+        buffer[len++] = DASH_MINUS_CHAR;
+        it++;
+    }
+    char digits[JSON_DOUBLE_ROUND_TRIP_DIGITS + 1];
+    int32_t digit_count = 0;
+    for (; *it != 'e'; it++)
+    {
+        if (*it != DOT_CHAR)
+        {
+            digits[digit_count++] = *it;
+        }
+    }
+    while (digit_count > 1 && digits[digit_count - 1] == '0')
+    {
+        digit_count--;
+    }
+    // value is 0.digits * 10^point
+    int32_t point = atoi(it + 1) + 1;
+
+    if (digit_count <= point && point <= 21)
+    {
+        memcpy(buffer + len, digits, digit_count);
+        len += digit_count;
+        for (int32_t i = digit_count; i < point; i++)
+        {
+            buffer[len++] = '0';
+        }
+    }
+    else if (0 < point && point <= 21)
+    {
+        memcpy(buffer + len, digits, point);
+        len += point;
+        buffer[len++] = DOT_CHAR;
+        memcpy(buffer + len, digits + point, digit_count - point);
+        len += digit_count - point;
+    }
+    else if (-6 < point && point <= 0)
+    {
+        buffer[len++] = '0';
+        buffer[len++] = DOT_CHAR;
+        for (int32_t i = point; i < 0; i++)
+        {
+            buffer[len++] = '0';
+        }
+        memcpy(buffer + len, digits, digit_count);
+        len += digit_count;
+    }
+    else
+    {
+        buffer[len++] = digits[0];
+        if (digit_count > 1)
+        {
+            buffer[len++] = DOT_CHAR;
+            memcpy(buffer + len, digits + 1, digit_count - 1);
+            len += digit_count - 1;
+        }
+        buffer[len++] = 'e';
+        buffer[len++] = point - 1 < 0 ? DASH_MINUS_CHAR : PLUS_CHAR;
+        len += JSONFormatInt64(point - 1 < 0 ? 1 - point : point - 1, buffer + len);
+    }
+    buffer[len] = NULL_CHAR;
+    return len;
+}
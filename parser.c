@@ -14,13 +14,26 @@ static bool parseListErrorHelper(JSONParser *);
 static bool parseListLoopChecker(JSONParser *);
 
 static JSONValue *parseObj(JSONParser *);
+static bool parseObjMembers(JSONParser *, HashMap *);
+static bool parseObjValue(JSONParser *, HashMap *, char *);
 static bool parseObjErrorHelper(JSONParser *);
 static bool parseObjLoopChecker(JSONParser *);
 
+static bool parserReserveRowCells(JSONParser *, u_int32_t);
+static bool parseRowCell(JSONParser *, JSONValue *, u_int64_t *);
+static bool parseRowCellInsert(HashMap *, JSONValue *, char *);
+static void freeRowCells(JSONParser *, u_int32_t, u_int32_t);
+static JSONValue *parseColumnarRow(JSONParser *, DynamicArray *);
+static JSONValue *parseColumnarRowRest(JSONParser *, JSONColumns *, u_int32_t, bool);
+
 static JSONValue *parseNumber(JSONParser *);
 static JSONValue *initQuickJSONValue(enum JSONValueType, void *);
 
 static bool isCharInString(const char *, char);
+static bool unpackRowView(JSONValue *);
+static bool containsValue(JSONValue *, JSONValue *);
+static bool swapMakesCycle(JSONValue *, JSONValue *, JSONTextCache *, JSONTextCache *);
+static bool rehomeValueKeys(JSONValue *, JSONKeyTable *);
 
 extern JSONParser *JSONParserInit(JSONLexer *lexer)
 {
@@ -45,6 +58,10 @@ extern JSONParser *JSONParserInit(JSONLexer *lexer)
     parser->obj_nested = 0;
     parser->current_token = NULL;
     parser->peek_token = NULL;
+    parser->key_table = NULL;
+    parser->row_cells = NULL;
+    parser->row_slots = NULL;
+    parser->row_cells_capacity = 0;
 
     nextJSONToken(parser);
 
@@ -66,8 +83,15 @@ extern void FreeJSONParser(JSONParser *parser)
         }
         if (parser->peek_token != NULL)
         {
+            // a parse that stopped early never got to the token's literal
+            if (IsJSONTokenValueType(parser->peek_token, false))
+            {
+                free(parser->peek_token->literal);
+            }
             FreeJSONToken(parser->peek_token);
         }
+        free(parser->row_cells);
+        free(parser->row_slots);
         free(parser);
     }
 }
@@ -175,8 +199,11 @@ static inline bool parseListLoopChecker(JSONParser *parser)
     {
         return true;
     }
+    // like objects, step onto the enclosing list's bracket so that list
+    // does not take ours for its own and stop early
     if (parser->current_token->type == JSONTokenCloseBracket && parser->peek_token->type == JSONTokenCloseBracket)
     {
+        nextJSONToken(parser);
         return true;
     }
     return false;
@@ -205,9 +232,18 @@ static JSONValue *parseList(JSONParser *parser)
     }
     while (ALWAYS)
     {
-        JSONValue *list_value = parse(parser);
+        JSONValue *list_value = NULL;
+        if (list->storage == DYN_ARR_COLUMNAR && parser->peek_token->type == JSONTokenOpenCurlyBrace)
+        {
+            list_value = parseColumnarRow(parser, list);
+        }
+        else
+        {
+            list_value = parse(parser);
+        }
         if (parseListErrorHelper(parser))
         {
+            FreeJSONValue(list_value, true);
             FreeDynamicArray(list);
             FreeJSONValue(json_value, false);
             // parser->input_error; // parseListErrorHelper writes this value
@@ -220,7 +256,7 @@ static JSONValue *parseList(JSONParser *parser)
         }
         else
         {
-            DynamicArrayAddLast(list, list_value);
+            DynamicArrayAddLastCompact(list, list_value);
         }
         if (parseListLoopChecker(parser))
         {
@@ -229,6 +265,7 @@ static JSONValue *parseList(JSONParser *parser)
     }
 
     json_value->value_type = JSONLIST_t;
+    json_value->pinned = false;
     json_value->value = list;
     return json_value;
 }
@@ -329,22 +366,44 @@ static JSONValue *parseObj(JSONParser *parser)
         return NULL;
     }
 
-    HashMap *map = DefaultHashMapInit();
+    HashMap *map = NULL;
+    if (parser->key_table != NULL)
+    {
+        map = HashMapInitWithKeyTable(DEFAULT_MAP_SIZE, parser->key_table);
+    }
+    else
+    {
+        map = DefaultHashMapInit();
+    }
     if (map == NULL)
     {
         parser->memory_error = true;
         parser->error_message = "[ERROR]: not enough memory for creating HashMap inside parseObj";
         return NULL;
     }
+    if (!parseObjMembers(parser, map))
+    {
+        FreeHashMap(map);
+        FreeJSONValue(json_value, false);
+        return NULL;
+    }
+    json_value->value_type = JSONOBJ_t;
+    json_value->pinned = false;
+    json_value->value = map;
+    return json_value;
+}
+
+// Parses members into map up to the closing brace. Also picks up an object
+// part of which parseColumnarRow already read.
+static bool parseObjMembers(JSONParser *parser, HashMap *map)
+{
     while (ALWAYS)
     {
         if (parseObjErrorHelper(parser))
         {
-            FreeHashMap(map);
-            FreeJSONValue(json_value, true);
             // parser->input_error; // parseObjErrorHelper writes this value
             // parser->error_message; // parseObjErrorHelper writes this value
-            return NULL;
+            return false;
         }
 
         if (parseObjLoopChecker(parser))
@@ -355,56 +414,281 @@ static JSONValue *parseObj(JSONParser *parser)
         JSONValue *obj_key = parse(parser);
         if (obj_key != NULL && (obj_key->value == NULL || obj_key->value_type != JSONSTRING_t))
         {
-            FreeHashMap(map);
             FreeJSONValue(obj_key, true);
-            FreeJSONValue(json_value, false);
             parser->input_error = true;
             parser->error_message = "Object key must be a string";
-            return NULL;
+            return false;
         }
         // FIXME, maybe just else?
         if (obj_key != NULL && obj_key->value != NULL)
         {
-            if (parser->peek_token->type == JSONTokenColon)
-            {
-                // printf("[JOSH]: %s\n", (char *)obj_key->value);
-                nextJSONToken(parser); // skip over colon
-                if (!IsJSONTokenValueType(parser->peek_token, true))
-                {
-                    FreeHashMap(map);
-                    FreeJSONValue(obj_key, true);
-                    FreeJSONValue(json_value, false);
-                    parser->input_error = true;
-                    parser->error_message = "Invalid JSONToken after colon, expecting value";
-                    return NULL;
-                }
-                JSONValue *obj_value = parse(parser);
-                if (obj_value == NULL)
-                {
-                    // PrintJSONToken(parser->current_token, false);
-                    // PrintJSONToken(parser->peek_token, false);
-                    printf("FIXME\n");
-                    printf("this should never be NULL\n");
-                }
-                else
-                {
-                    obj_value->key = obj_key->value;
-                    HashMapInsert(map, obj_value);
-                }
-            }
-            else
+            if (parser->peek_token->type != JSONTokenColon)
             {
-                FreeHashMap(map);
                 FreeJSONValue(obj_key, true);
-                FreeJSONValue(json_value, false);
                 parser->input_error = true;
                 parser->error_message = "Colon not found after key";
-                return NULL;
+                return false;
+            }
+            // printf("[JOSH]: %s\n", (char *)obj_key->value);
+            nextJSONToken(parser); // skip over colon
+            if (!parseObjValue(parser, map, obj_key->value))
+            {
+                FreeJSONValue(obj_key, true);
+                return false;
             }
             FreeJSONValue(obj_key, false);
         }
     }
+    return true;
+}
+
+// Parses the value after a key's colon into map under key, which the map
+// takes over unless this fails.
+static bool parseObjValue(JSONParser *parser, HashMap *map, char *key)
+{
+    if (!IsJSONTokenValueType(parser->peek_token, true))
+    {
+        parser->input_error = true;
+        parser->error_message = "Invalid JSONToken after colon, expecting value";
+        return false;
+    }
+    JSONValue *obj_value = parse(parser);
+    if (obj_value == NULL)
+    {
+        // PrintJSONToken(parser->current_token, false);
+        // PrintJSONToken(parser->peek_token, false);
+        printf("FIXME\n");
+        printf("this should never be NULL\n");
+        free(key);
+    }
+    else
+    {
+        obj_value->key = key;
+        HashMapInsert(map, obj_value);
+    }
+    return true;
+}
+
+static bool parserReserveRowCells(JSONParser *parser, u_int32_t count)
+{
+    if (count <= parser->row_cells_capacity)
+    {
+        return true;
+    }
+    JSONValue *row_cells = realloc(parser->row_cells, sizeof(JSONValue) * count);
+    if (row_cells == NULL)
+    {
+        return false;
+    }
+    parser->row_cells = row_cells;
+    u_int64_t *row_slots = realloc(parser->row_slots, sizeof(u_int64_t) * count);
+    if (row_slots == NULL)
+    {
+        return false;
+    }
+    parser->row_slots = row_slots;
+    parser->row_cells_capacity = count;
+    return true;
+}
+
+// Reads the scalar in the peek token into cell without consuming the token,
+// false when it is not a scalar. A string cell points at the token's
+// literal, the other values are kept in slot.
+static bool parseRowCell(JSONParser *parser, JSONValue *cell, u_int64_t *slot)
+{
+    JSONToken *token = parser->peek_token;
+    cell->key = NULL;
+    cell->value = slot;
+    switch (token->type)
+    {
+    case JSONTokenString:
+        cell->value_type = JSONSTRING_t;
+        cell->value = token->literal;
+        break;
+    case JSONTokenNULL:
+        cell->value_type = JSONNULL_t;
+        cell->value = NULL;
+        break;
+    case JSONTokenBool:
+        cell->value_type = JSONBOOL_t;
+        *(bool *)slot = token->literal[0] == 't';
+        break;
+    case JSONTokenNumber:
+        // same rules as parseNumber
+        if (!isCharInString(token->literal, DOT_CHAR) && !isCharInString(token->literal, 'e') && !isCharInString(token->literal, 'E') && JSONParseInt64(token->literal, (int64_t *)slot))
+        {
+            cell->value_type = JSONNUMBER_INT_t;
+        }
+        else
+        {
+            cell->value_type = JSONNUMBER_DOUBLE_t;
+            *(double *)slot = atof(token->literal);
+        }
+        break;
+    default:
+        return false;
+    }
+    return true;
+}
+
+// Moves cell into map under a copy of key. A string cell's literal is freed
+// when this fails.
+static bool parseRowCellInsert(HashMap *map, JSONValue *cell, char *key)
+{
+    void *value = cell->value;
+    if (cell->value_type != JSONSTRING_t && cell->value_type != JSONNULL_t)
+    {
+        value = malloc(sizeof(u_int64_t));
+        if (value == NULL)
+        {
+            return false;
+        }
+        memcpy(value, cell->value, sizeof(u_int64_t));
+    }
+    JSONValue *entry = JSONValueInit(cell->value_type, value, strdup(key));
+    if (entry == NULL || entry->key == NULL || !HashMapInsert(map, entry))
+    {
+        if (entry != NULL)
+        {
+            free(entry->key);
+        }
+        FreeJSONValue(entry, false);
+        free(value);
+        return false;
+    }
+    return true;
+}
+
+// Frees the strings of cells first up to end, which nothing took over.
+static void freeRowCells(JSONParser *parser, u_int32_t first, u_int32_t end)
+{
+    for (u_int32_t i = first; i < end; i++)
+    {
+        if (parser->row_cells[i].value_type == JSONSTRING_t)
+        {
+            free(parser->row_cells[i].value);
+        }
+    }
+}
+
+// An object in a columnar array is read straight into list's columns when
+// it has the columns' keys in order, each with a scalar that fits, so no
+// HashMap is built for it. Returns NULL once the row is in the columns, or
+// on error. Otherwise the members read so far move into a HashMap, the rest
+// of the object is parsed into it as usual and it is returned for
+// DynamicArrayAddLastCompact.
+static JSONValue *parseColumnarRow(JSONParser *parser, DynamicArray *list)
+{
+    JSONColumns *columns = list->columns;
+    if (!parserReserveRowCells(parser, columns->column_count))
+    {
+        parser->memory_error = true;
+        parser->error_message = "[ERROR]: not enough memory for a columnar row inside parseList";
+        return NULL;
+    }
+    nextJSONToken(parser); // skip over the opening brace
+    u_int32_t cell_count = 0;
+    while (cell_count < columns->column_count)
+    {
+        if (cell_count != 0)
+        {
+            if (parser->peek_token->type != JSONTokenComma)
+            {
+                return parseColumnarRowRest(parser, columns, cell_count, false);
+            }
+            nextJSONToken(parser); // skip over comma
+        }
+        JSONToken *key = parser->peek_token;
+        if (key->type != JSONTokenString || strcmp(key->literal, columns->columns[cell_count].key) != 0)
+        {
+            return parseColumnarRowRest(parser, columns, cell_count, false);
+        }
+        nextJSONToken(parser);
+        free(parser->current_token->literal);
+        if (parser->peek_token->type != JSONTokenColon)
+        {
+            freeRowCells(parser, 0, cell_count);
+            parser->input_error = true;
+            parser->error_message = "Colon not found after key";
+            return NULL;
+        }
+        nextJSONToken(parser); // skip over colon
+        JSONValue *cell = &parser->row_cells[cell_count];
+        if (!parseRowCell(parser, cell, &parser->row_slots[cell_count]) || !JSONColumnsCellFits(columns, cell_count, columns->columns[cell_count].key, cell->value_type))
+        {
+            return parseColumnarRowRest(parser, columns, cell_count, true);
+        }
+        nextJSONToken(parser);
+        if (cell->value_type != JSONSTRING_t)
+        {
+            free(parser->current_token->literal);
+        }
+        cell_count++;
+    }
+    if (parser->peek_token->type != JSONTokenCloseCurlyBrace)
+    {
+        return parseColumnarRowRest(parser, columns, cell_count, false);
+    }
+    nextJSONToken(parser);
+    bool added = DynamicArrayAddColumnarRow(list, parser->row_cells);
+    freeRowCells(parser, 0, cell_count);
+    if (!added)
+    {
+        parser->memory_error = true;
+        parser->error_message = "[ERROR]: not enough memory for a columnar row inside parseList";
+    }
+    return NULL;
+}
+
+// The rest of parseColumnarRow for an object that turned out not to fit:
+// the first cell_count cells become members and, with value_next, the
+// value after the next column's key and colon is parsed first.
+static JSONValue *parseColumnarRowRest(JSONParser *parser, JSONColumns *columns, u_int32_t cell_count, bool value_next)
+{
+    JSONValue *json_value = malloc(sizeof(JSONValue));
+    HashMap *map = NULL;
+    if (parser->key_table != NULL)
+    {
+        map = HashMapInitWithKeyTable(DEFAULT_MAP_SIZE, parser->key_table);
+    }
+    else
+    {
+        map = DefaultHashMapInit();
+    }
+    bool ok = json_value != NULL && map != NULL;
+    u_int32_t i = 0;
+    for (; ok && i < cell_count; i++)
+    {
+        ok = parseRowCellInsert(map, &parser->row_cells[i], columns->columns[i].key);
+    }
+    freeRowCells(parser, i, cell_count);
+    char *key = NULL;
+    if (ok && value_next)
+    {
+        key = strdup(columns->columns[cell_count].key);
+        ok = key != NULL;
+    }
+    if (!ok)
+    {
+        FreeHashMap(map);
+        FreeJSONValue(json_value, false);
+        parser->memory_error = true;
+        parser->error_message = "[ERROR]: not enough memory for creating HashMap inside parseList";
+        return NULL;
+    }
+    if (key != NULL && !parseObjValue(parser, map, key))
+    {
+        free(key);
+        ok = false;
+    }
+    if (!ok || !parseObjMembers(parser, map))
+    {
+        FreeHashMap(map);
+        FreeJSONValue(json_value, false);
+        return NULL;
+    }
     json_value->value_type = JSONOBJ_t;
+    json_value->pinned = false;
     json_value->value = map;
     return json_value;
 }
@@ -450,8 +734,19 @@ static JSONValue *initQuickJSONValue(enum JSONValueType value_type, void *value)
     else if (value_type == JSONNUMBER_INT_t)
     {
         int64_t *new_int = malloc(sizeof(int64_t));
-        *new_int = (int64_t)atof((char *)value);
-        json_value->value = new_int;
+        if (JSONParseInt64((char *)value, new_int))
+        {
+            json_value->value = new_int;
+        }
+        else
+        {
+            // too large for an int64_t, keep it as a double
+            free(new_int);
+            double *new_double = malloc(sizeof(double));
+            *new_double = atof((char *)value);
+            json_value->value = new_double;
+            value_type = JSONNUMBER_DOUBLE_t;
+        }
         free(value);
     }
     else
@@ -460,6 +755,7 @@ static JSONValue *initQuickJSONValue(enum JSONValueType value_type, void *value)
         // free(value); // FIXME
     }
     json_value->value_type = value_type;
+    json_value->pinned = false;
     return json_value;
 }
 
@@ -603,6 +899,9 @@ extern JSON *ParseJSON(JSONParser *parser)
         errno = ENOMEM;
         return NULL;
     }
+    json->key_table = parser->key_table;
+    json->owns_key_table = false;
+    json->cache_text = false;
     json->root = parse(parser);
     // probably want the error to be on JSON obj so it can be read before being freed
     // right now it just prints to stdout, but for cerver, we would want access to that error message
@@ -627,42 +926,294 @@ extern JSONValue *JSONValueInit(enum JSONValueType type, void *value, char *key)
     }
     json_value->key = key;
     json_value->value_type = type;
+    json_value->pinned = false;
     json_value->value = value;
-    json_value->next = NULL;
     return json_value;
 }
 
-// FIXME, object support
-extern JSONValue *JSONValueReplicate(JSONValue *json_value)
+// A row view becomes an element of its unpacked array before it changes, see
+// DynamicArrayGetAtIndex.
+static bool unpackRowView(JSONValue *json_value)
 {
-    if (json_value == NULL)
+    if (json_value->value_type != JSONOBJ_t || json_value->value == NULL)
     {
-        return NULL;
+        return true;
     }
-    void *value = NULL;
-    if (json_value->value_type == JSONNUMBER_DOUBLE_t)
+    HashMap *map = json_value->value;
+    return map->row_view_of == NULL || DynamicArrayUnpack(map->row_view_of);
+}
+
+// Whether json_value is container or sits somewhere below it. Frozen
+// containers only hold pinned values and packed ones only scalars, neither
+// is looked into; a columnar array is only reached through its row views,
+// which get unpacked before a swap.
+static bool containsValue(JSONValue *container, JSONValue *json_value)
+{
+    if (container == json_value)
+    {
+        return true;
+    }
+    if (JSONValueIsFrozen(container))
     {
-        value = (double *)malloc(sizeof(double) * 1);
-        memcpy(value, json_value->value, sizeof(double) * 1);
+        return false;
     }
-    else if (json_value->value_type == JSONNUMBER_INT_t)
+    if (container->value_type == JSONOBJ_t)
     {
-        value = (int *)malloc(sizeof(int) * 1);
-        memcpy(value, json_value->value, sizeof(int) * 1);
+        JSONObjectIter iter;
+        JSONObjectIterInit(&iter, container->value);
+        for (JSONValue *map_entry = NULL; (map_entry = JSONObjectIterNext(&iter)) != NULL;)
+        {
+            if (containsValue(map_entry, json_value))
+            {
+                return true;
+            }
+        }
+        return false;
     }
-    else if (json_value->value_type == JSONSTRING_t)
+    if (container->value_type != JSONLIST_t)
     {
-        size_t value_len = strlen((char *)json_value->value) + 1;
-        value = (char *)malloc(sizeof(char) * value_len);
-        memcpy(value, json_value->value, sizeof(char) * value_len);
+        return false;
     }
-    else if (json_value->value_type == JSONLIST_t)
+    DynamicArray *dynamic_array = container->value;
+    JSONArrayIter iter;
+    if (dynamic_array->storage != DYN_ARR_GENERIC && dynamic_array->storage != DYN_ARR_SEGMENTED)
     {
-        value = (DynamicArray *)DynamicArrayReplicate((DynamicArray *)json_value->value);
+        return false;
     }
-    else if (json_value->value_type == JSONOBJ_t)
+    (void)JSONArrayIterInit(&iter, dynamic_array);
+    for (JSONValue *element = NULL; (element = JSONArrayIterNext(&iter)) != NULL;)
     {
-        value = (HashMap *)HashMapReplicate((HashMap *)json_value->value); // WIP
+        if (containsValue(element, json_value))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Whether one of a and b sits below the other. Linked containers walk up
+// their text cache parents; a scalar or frozen side has no link upwards, so
+// the other side is searched for it instead.
+static bool swapMakesCycle(JSONValue *a, JSONValue *b, JSONTextCache *cache_a, JSONTextCache *cache_b)
+{
+    if (cache_a != NULL && cache_b != NULL)
+    {
+        for (JSONTextCache *cache = cache_a->parent; cache != NULL; cache = cache->parent)
+        {
+            if (cache == cache_b)
+            {
+                return true;
+            }
+        }
+        for (JSONTextCache *cache = cache_b->parent; cache != NULL; cache = cache->parent)
+        {
+            if (cache == cache_a)
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+    if (cache_a != NULL)
+    {
+        return containsValue(a, b);
+    }
+    if (cache_b != NULL)
+    {
+        return containsValue(b, a);
+    }
+    return false;
+}
+
+// Exchanges what a and b hold, each keeping its key, so two subtrees trade
+// places without anything being copied. Fails with EINVAL when one sits
+// below the other or either is pinned, i.e. a member of a frozen container
+// or of a columnar row view. The containers around a and b
+// are only known through a container being swapped; when a side is a
+// scalar, JSONTextCacheAttach and JSONTextCacheInvalidate its container
+// yourself. The same goes for a frozen container, which is not linked to
+// its parent. Keys below a and b stay in the tables they were in, see
+// JSONValueRehomeKeys for a swap between documents.
+extern bool JSONValueSwap(JSONValue *a, JSONValue *b)
+{
+    if (a == NULL || b == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    if (!unpackRowView(a) || !unpackRowView(b))
+    {
+        return false;
+    }
+    JSONTextCache *cache_a = JSONValueIsFrozen(a) ? NULL : JSONValueTextCache(a);
+    JSONTextCache *cache_b = JSONValueIsFrozen(b) ? NULL : JSONValueTextCache(b);
+    if (a->pinned || b->pinned || (a != b && swapMakesCycle(a, b, cache_a, cache_b)))
+    {
+        errno = EINVAL;
+        return false;
+    }
+    JSONTextCache *parent_a = cache_a == NULL ? NULL : cache_a->parent;
+    JSONTextCache *parent_b = cache_b == NULL ? NULL : cache_b->parent;
+    enum JSONValueType value_type = a->value_type;
+    void *value = a->value;
+    a->value_type = b->value_type;
+    a->value = b->value;
+    b->value_type = value_type;
+    b->value = value;
+    if (cache_a != NULL)
+    {
+        JSONTextCacheAttach(parent_a, a);
+    }
+    if (cache_b != NULL)
+    {
+        JSONTextCacheAttach(parent_b, b);
+    }
+    JSONTextCacheInvalidate(parent_a);
+    JSONTextCacheInvalidate(parent_b);
+    return true;
+}
+
+static bool rehomeValueKeys(JSONValue *json_value, JSONKeyTable *key_table)
+{
+    if (JSONValueIsFrozen(json_value))
+    {
+        return true;
+    }
+    if (json_value->value_type == JSONOBJ_t)
+    {
+        if (!HashMapRehomeKeys(json_value->value, key_table))
+        {
+            return false;
+        }
+        JSONObjectIter iter;
+        JSONObjectIterInit(&iter, json_value->value);
+        for (JSONValue *map_entry = NULL; (map_entry = JSONObjectIterNext(&iter)) != NULL;)
+        {
+            if (!rehomeValueKeys(map_entry, key_table))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    if (json_value->value_type != JSONLIST_t)
+    {
+        return true;
+    }
+    DynamicArray *dynamic_array = json_value->value;
+    if (dynamic_array->storage == DYN_ARR_COLUMNAR)
+    {
+        if (!JSONColumnsRehomeKeys(dynamic_array->columns, key_table))
+        {
+            return false;
+        }
+        // rows already built, see DynamicArrayGetAtIndex
+        for (u_int32_t i = 0; i < dynamic_array->views_capacity; i++)
+        {
+            if (dynamic_array->views[i] != NULL && !HashMapRehomeKeys(dynamic_array->views[i]->value, key_table))
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+    // packed arrays hold no keys
+    if (dynamic_array->storage == DYN_ARR_PACKED_INT || dynamic_array->storage == DYN_ARR_PACKED_DOUBLE || dynamic_array->storage == DYN_ARR_PACKED_BOOL)
+    {
+        return true;
+    }
+    JSONArrayIter iter;
+    if (!JSONArrayIterInit(&iter, dynamic_array))
+    {
+        return false;
+    }
+    for (JSONValue *element = NULL; (element = JSONArrayIterNext(&iter)) != NULL;)
+    {
+        if (!rehomeValueKeys(element, key_table))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Moves every key below json_value to key_table, NULL giving each map its
+// own copies, for a subtree headed into a document with another key table
+// (see HashMapRehomeKeys). Frozen containers own their keys already. On
+// failure the containers done so far keep their new keys.
+extern bool JSONValueRehomeKeys(JSONValue *json_value, JSONKeyTable *key_table)
+{
+    if (json_value == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    return rehomeValueKeys(json_value, key_table);
+}
+
+// Deep copy of json_value, without its key. Containers are copied in one
+// pass each (see HashMapReplicate and DynamicArrayReplicate), frozen ones
+// are shared. The copy uses the key tables json_value does, see
+// JSONValueReplicateInto for one that outlives them.
+extern JSONValue *JSONValueReplicate(JSONValue *json_value)
+{
+    if (json_value == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    JSONValue *replica = JSONValueInit(json_value->value_type, NULL, NULL);
+    if (replica == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    size_t value_size = 0;
+    switch (json_value->value_type)
+    {
+    case JSONNUMBER_INT_t:
+        value_size = sizeof(int64_t);
+        break;
+    case JSONNUMBER_DOUBLE_t:
+        value_size = sizeof(double);
+        break;
+    case JSONBOOL_t:
+        value_size = sizeof(bool);
+        break;
+    case JSONSTRING_t:
+        value_size = strlen(json_value->value) + 1;
+        break;
+    case JSONLIST_t:
+        replica->value = DynamicArrayReplicate(json_value->value);
+        break;
+    case JSONOBJ_t:
+        replica->value = HashMapReplicate(json_value->value);
+        break;
+    default:
+        return replica;
+    }
+    if (value_size != 0 && (replica->value = malloc(value_size)) != NULL)
+    {
+        memcpy(replica->value, json_value->value, value_size);
+    }
+    if (replica->value == NULL)
+    {
+        free(replica);
+        errno = ENOMEM;
+        return NULL;
+    }
+    return replica;
+}
+
+// JSONValueReplicate with the keys of the copy in key_table, or owned by the
+// copy when key_table is NULL, see JSONValueRehomeKeys.
+extern JSONValue *JSONValueReplicateInto(JSONValue *json_value, JSONKeyTable *key_table)
+{
+    JSONValue *replica = JSONValueReplicate(json_value);
+    if (replica != NULL && !JSONValueRehomeKeys(replica, key_table))
+    {
+        FreeJSONValue(replica, true);
+        return NULL;
     }
-    return JSONValueInit(json_value->value_type, value, NULL);
+    return replica;
 }
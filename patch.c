@@ -0,0 +1,600 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <standardloop/util.h>
+
+#include "./json.h"
+
+// path is the RFC 6901 pointer of the values being compared, ops the patch
+// being built.
+typedef struct
+{
+    char *path;
+    u_int32_t path_len;
+    u_int32_t path_capacity;
+    DynamicArray *ops;
+} JSONDiffState;
+
+static bool diffPathPush(JSONDiffState *, char *, u_int32_t);
+static bool diffPathPushIndex(JSONDiffState *, u_int32_t);
+static JSONValue *diffString(char *);
+static bool diffAddMember(HashMap *, char *, JSONValue *);
+static bool diffEmit(JSONDiffState *, char *, JSONValue *);
+static bool diffSame(JSONValue *, JSONValue *);
+static bool diffObjects(JSONDiffState *, HashMap *, HashMap *);
+static bool diffLists(JSONDiffState *, DynamicArray *, DynamicArray *);
+static bool diffValues(JSONDiffState *, JSONValue *, JSONValue *);
+
+static char *patchMemberString(HashMap *, char *);
+static JSONValue *patchParent(JSON *, JSONPointer *);
+static bool patchAdd(JSON *, JSONPointer *, JSONValue *);
+static bool patchRemove(JSON *, JSONPointer *, JSONValue **);
+static bool patchReplace(JSON *, JSONPointer *, JSONValue *);
+static bool patchOperation(JSON *, HashMap *);
+static bool patchInsert(HashMap *, char *, JSONValue *);
+static bool mergePatch(JSONValue **, JSONValue *, JSONKeyTable *);
+
+// Appends "/" and the escaped key to the path.
+static bool diffPathPush(JSONDiffState *state, char *key, u_int32_t key_len)
+{
+    // worst case every byte escapes to two
+    u_int64_t needed = (u_int64_t)state->path_len + 2 * (u_int64_t)key_len + 2;
+    if (needed > UINT32_MAX)
+    {
+        errno = ENOBUFS;
+        return false;
+    }
+    if (needed > state->path_capacity)
+    {
+        u_int32_t new_capacity = state->path_capacity;
+        while (new_capacity < needed)
+        {
+            new_capacity = new_capacity > UINT32_MAX / 2 ? UINT32_MAX : new_capacity * 2;
+        }
+        char *path = realloc(state->path, new_capacity);
+        if (path == NULL)
+        {
+            errno = ENOMEM;
+            return false;
+        }
+        state->path = path;
+        state->path_capacity = new_capacity;
+    }
+    state->path[state->path_len++] = FORWARDLASH_CHAR;
+    for (u_int32_t i = 0; i < key_len; i++)
+    {
+        if (key[i] == '~' || key[i] == FORWARDLASH_CHAR)
+        {
+            state->path[state->path_len++] = '~';
+            state->path[state->path_len++] = key[i] == '~' ? '0' : '1';
+        }
+        else
+        {
+            state->path[state->path_len++] = key[i];
+        }
+    }
+    state->path[state->path_len] = NULL_CHAR;
+    return true;
+}
+
+static bool diffPathPushIndex(JSONDiffState *state, u_int32_t index)
+{
+    char digits[JSON_NUMBER_CHAR_MAX];
+    u_int32_t len = JSONFormatInt64(index, digits);
+    return diffPathPush(state, digits, len);
+}
+
+static JSONValue *diffString(char *string)
+{
+    char *copy = strdup(string);
+    JSONValue *json_value = copy == NULL ? NULL : JSONValueInit(JSONSTRING_t, copy, NULL);
+    if (json_value == NULL)
+    {
+        free(copy);
+        errno = ENOMEM;
+    }
+    return json_value;
+}
+
+// Takes ownership of value, also when it fails.
+static bool diffAddMember(HashMap *op, char *key, JSONValue *value)
+{
+    if (value == NULL)
+    {
+        errno = ENOMEM;
+        return false;
+    }
+    return patchInsert(op, key, value);
+}
+
+// Adds {"op": name, "path": path} to the patch, with a copy of value as
+// "value" when it is not NULL.
+static bool diffEmit(JSONDiffState *state, char *name, JSONValue *value)
+{
+    HashMap *op = DefaultHashMapInit();
+    if (op == NULL)
+    {
+        return false;
+    }
+    JSONValue *op_value = JSONValueInit(JSONOBJ_t, op, NULL);
+    if (op_value == NULL)
+    {
+        FreeHashMap(op);
+        errno = ENOMEM;
+        return false;
+    }
+    bool ok = diffAddMember(op, JSON_PATCH_OP, diffString(name)) && diffAddMember(op, JSON_PATCH_PATH, diffString(state->path));
+    if (ok && value != NULL)
+    {
+        ok = diffAddMember(op, JSON_PATCH_VALUE, JSONValueReplicate(value));
+    }
+    if (!ok)
+    {
+        FreeJSONValue(op_value, true);
+        return false;
+    }
+    DynamicArrayAddLast(state->ops, op_value);
+    return true;
+}
+
+// Identical pointers are the same; otherwise the cached hashes filled in by
+// JSONPatchDiff rule out most unequal pairs before anything is walked.
+static bool diffSame(JSONValue *a, JSONValue *b)
+{
+    if (a == b || ((a->value_type == JSONOBJ_t || a->value_type == JSONLIST_t) && a->value_type == b->value_type && a->value == b->value))
+    {
+        return true;
+    }
+    return JSONValueHashCached(a) == JSONValueHashCached(b) && JSONValueEquals(a, b);
+}
+
+static bool diffObjects(JSONDiffState *state, HashMap *from, HashMap *to)
+{
+    u_int32_t path_len = state->path_len;
+    bool ok = true;
+    JSONObjectIter iter;
+    JSONObjectIterInit(&iter, from);
+    for (JSONValue *map_entry = NULL; ok && (map_entry = JSONObjectIterNext(&iter)) != NULL;)
+    {
+        JSONValue *target = HashMapGet(to, map_entry->key);
+        ok = diffPathPush(state, map_entry->key, strlen(map_entry->key));
+        ok = ok && (target == NULL ? diffEmit(state, JSON_PATCH_REMOVE, NULL) : diffValues(state, map_entry, target));
+        state->path_len = path_len;
+        state->path[path_len] = NULL_CHAR;
+    }
+    JSONObjectIterInit(&iter, to);
+    for (JSONValue *map_entry = NULL; ok && (map_entry = JSONObjectIterNext(&iter)) != NULL;)
+    {
+        if (HashMapGet(from, map_entry->key) != NULL)
+        {
+            continue;
+        }
+        ok = diffPathPush(state, map_entry->key, strlen(map_entry->key)) && diffEmit(state, JSON_PATCH_ADD, map_entry);
+        state->path_len = path_len;
+        state->path[path_len] = NULL_CHAR;
+    }
+    return ok;
+}
+
+// Skips the common prefix and suffix, diffs the elements left in the middle
+// pairwise and removes or adds the rest. A single insertion or removal
+// anywhere thus comes out as one operation.
+static bool diffLists(JSONDiffState *state, DynamicArray *from, DynamicArray *to)
+{
+    // GetAtIndex cannot fail on unpacked arrays
+    if (!DynamicArrayUnpack(from) || !DynamicArrayUnpack(to))
+    {
+        return false;
+    }
+    u_int32_t prefix = 0;
+    while (prefix < from->size && prefix < to->size && diffSame(DynamicArrayGetAtIndex(from, prefix), DynamicArrayGetAtIndex(to, prefix)))
+    {
+        prefix++;
+    }
+    u_int32_t suffix = 0;
+    while (suffix < from->size - prefix && suffix < to->size - prefix && diffSame(DynamicArrayGetAtIndex(from, from->size - 1 - suffix), DynamicArrayGetAtIndex(to, to->size - 1 - suffix)))
+    {
+        suffix++;
+    }
+    u_int32_t from_left = from->size - prefix - suffix;
+    u_int32_t to_left = to->size - prefix - suffix;
+    u_int32_t common = from_left < to_left ? from_left : to_left;
+    u_int32_t path_len = state->path_len;
+    bool ok = true;
+    for (u_int32_t i = prefix; ok && i < prefix + common; i++)
+    {
+        ok = diffPathPushIndex(state, i) && diffValues(state, DynamicArrayGetAtIndex(from, i), DynamicArrayGetAtIndex(to, i));
+        state->path_len = path_len;
+        state->path[path_len] = NULL_CHAR;
+    }
+    // removing at the same index again and again takes out a run
+    for (u_int32_t i = common; ok && i < from_left; i++)
+    {
+        ok = diffPathPushIndex(state, prefix + common) && diffEmit(state, JSON_PATCH_REMOVE, NULL);
+        state->path_len = path_len;
+        state->path[path_len] = NULL_CHAR;
+    }
+    for (u_int32_t i = prefix + common; ok && i < prefix + to_left; i++)
+    {
+        ok = diffPathPushIndex(state, i) && diffEmit(state, JSON_PATCH_ADD, DynamicArrayGetAtIndex(to, i));
+        state->path_len = path_len;
+        state->path[path_len] = NULL_CHAR;
+    }
+    return ok;
+}
+
+static bool diffValues(JSONDiffState *state, JSONValue *from, JSONValue *to)
+{
+    if (diffSame(from, to))
+    {
+        return true;
+    }
+    if (from->value_type == JSONOBJ_t && to->value_type == JSONOBJ_t)
+    {
+        return diffObjects(state, from->value, to->value);
+    }
+    if (from->value_type == JSONLIST_t && to->value_type == JSONLIST_t)
+    {
+        return diffLists(state, from->value, to->value);
+    }
+    return diffEmit(state, JSON_PATCH_REPLACE, to);
+}
+
+// RFC 6902 patch turning from into to, as a document holding the array of
+// operations. Unchanged subtrees are skipped by pointer or by structural
+// hash, so the cost follows the size of the change; the hashes are kept in
+// the containers of both sides (see JSONValueHashCached). Arrays are
+// matched by common prefix and suffix, not by a full edit distance. Values
+// in the patch are copies that own their keys, the patch outlives both
+// sides.
+extern JSON *JSONPatchDiff(JSONValue *from, JSONValue *to)
+{
+    if (from == NULL || to == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    JSON *patch = JSONInit();
+    if (patch == NULL)
+    {
+        return NULL;
+    }
+    DynamicArray *ops = DefaultDynamicArrayInit();
+    if (ops == NULL || (patch->root = JSONValueInit(JSONLIST_t, ops, NULL)) == NULL)
+    {
+        FreeDynamicArray(ops);
+        FreeJSON(patch);
+        errno = ENOMEM;
+        return NULL;
+    }
+    JSONDiffState state = {
+        .path = malloc(sizeof(char) * JSON_PATCH_PATH_INITIAL_SIZE),
+        .path_len = 0,
+        .path_capacity = JSON_PATCH_PATH_INITIAL_SIZE,
+        .ops = ops,
+    };
+    if (state.path == NULL)
+    {
+        FreeJSON(patch);
+        errno = ENOMEM;
+        return NULL;
+    }
+    state.path[0] = NULL_CHAR;
+    JSONValueHashCached(from);
+    JSONValueHashCached(to);
+    bool ok = diffValues(&state, from, to);
+    free(state.path);
+    if (!ok)
+    {
+        FreeJSON(patch);
+        return NULL;
+    }
+    return patch;
+}
+
+static char *patchMemberString(HashMap *op, char *key)
+{
+    JSONValue *member = HashMapGet(op, key);
+    return member == NULL || member->value_type != JSONSTRING_t ? NULL : member->value;
+}
+
+// The container holding what pointer refers to, NULL when there is none.
+static JSONValue *patchParent(JSON *json, JSONPointer *pointer)
+{
+    JSONPointer parent = *pointer;
+    parent.segment_count--;
+    JSONValue *json_value = JSONPointerGetFrom(json->root, &parent);
+    if (json_value == NULL || (json_value->value_type != JSONOBJ_t && json_value->value_type != JSONLIST_t))
+    {
+        return NULL;
+    }
+    return json_value;
+}
+
+// JSONObjectSet that takes ownership of value also when it fails.
+static bool patchInsert(HashMap *map, char *key, JSONValue *value)
+{
+    if (!JSONObjectSet(map, key, value))
+    {
+        FreeJSONValue(value, true);
+        return false;
+    }
+    return true;
+}
+
+// Takes ownership of value, also when it fails.
+static bool patchAdd(JSON *json, JSONPointer *pointer, JSONValue *value)
+{
+    if (value == NULL)
+    {
+        return false;
+    }
+    if (pointer->segment_count == 0)
+    {
+        FreeJSONValue(json->root, true);
+        json->root = value;
+        return true;
+    }
+    JSONValue *parent = patchParent(json, pointer);
+    JSONPointerSegment *segment = &pointer->segments[pointer->segment_count - 1];
+    if (parent != NULL && parent->value_type == JSONOBJ_t)
+    {
+        return patchInsert(parent->value, segment->key, value);
+    }
+    if (parent != NULL)
+    {
+        DynamicArray *dynamic_array = parent->value;
+        u_int32_t size = dynamic_array->size;
+        if (segment->index == JSON_POINTER_END_INDEX || segment->index == size)
+        {
+            DynamicArrayAddLast(dynamic_array, value);
+            return dynamic_array->size == size + 1;
+        }
+        if (segment->index >= 0 && segment->index < size)
+        {
+            DynamicArrayAdd(dynamic_array, value, (u_int32_t)segment->index);
+            return dynamic_array->size == size + 1;
+        }
+    }
+    FreeJSONValue(value, true);
+    return false;
+}
+
+// Removes what pointer refers to. With taken it is handed over instead of
+// freed, without a key and without being copied.
+static bool patchRemove(JSON *json, JSONPointer *pointer, JSONValue **taken)
+{
+    JSONValue *parent = pointer->segment_count == 0 ? NULL : patchParent(json, pointer);
+    if (parent == NULL)
+    {
+        return false;
+    }
+    JSONPointerSegment *segment = &pointer->segments[pointer->segment_count - 1];
+    if (parent->value_type == JSONOBJ_t)
+    {
+        JSONValue *member = JSONObjectTake(parent->value, segment->key);
+        if (taken != NULL)
+        {
+            *taken = member;
+        }
+        else
+        {
+            FreeJSONValue(member, true);
+        }
+        return member != NULL;
+    }
+    DynamicArray *dynamic_array = parent->value;
+    if (segment->index < 0 || segment->index >= dynamic_array->size)
+    {
+        return false;
+    }
+    if (taken != NULL)
+    {
+        return (*taken = DynamicArrayTake(dynamic_array, (u_int32_t)segment->index)) != NULL;
+    }
+    DynamicArrayRemove(dynamic_array, (u_int32_t)segment->index);
+    return true;
+}
+
+// Takes ownership of value, also when it fails.
+static bool patchReplace(JSON *json, JSONPointer *pointer, JSONValue *value)
+{
+    if (value == NULL || JSONPointerGetFrom(json->root, pointer) == NULL)
+    {
+        FreeJSONValue(value, true);
+        return false;
+    }
+    if (pointer->segment_count == 0)
+    {
+        return patchAdd(json, pointer, value);
+    }
+    // the target exists, so its parent does too; it is swapped in where it
+    // was, an object member keeping its position
+    JSONValue *parent = patchParent(json, pointer);
+    JSONPointerSegment *segment = &pointer->segments[pointer->segment_count - 1];
+    if (parent->value_type == JSONOBJ_t)
+    {
+        return patchInsert(parent->value, segment->key, value);
+    }
+    if (!JSONArraySet(parent->value, (u_int32_t)segment->index, value))
+    {
+        FreeJSONValue(value, true);
+        return false;
+    }
+    return true;
+}
+
+static bool patchOperation(JSON *json, HashMap *op)
+{
+    char *name = patchMemberString(op, JSON_PATCH_OP);
+    char *path = patchMemberString(op, JSON_PATCH_PATH);
+    char *from = patchMemberString(op, JSON_PATCH_FROM);
+    JSONValue *value = HashMapGet(op, JSON_PATCH_VALUE);
+    JSONPointer *pointer = path == NULL ? NULL : JSONPointerCompile(path);
+    if (name == NULL || pointer == NULL)
+    {
+        if (pointer != NULL)
+        {
+            FreeJSONPointer(pointer);
+        }
+        return false;
+    }
+    bool ok = false;
+    if (strcmp(name, JSON_PATCH_TEST) == 0)
+    {
+        ok = value != NULL && JSONValueEquals(JSONPointerGetFrom(json->root, pointer), value);
+    }
+    else if (strcmp(name, JSON_PATCH_ADD) == 0)
+    {
+        ok = value != NULL && patchAdd(json, pointer, JSONValueReplicate(value));
+    }
+    else if (strcmp(name, JSON_PATCH_REMOVE) == 0)
+    {
+        ok = patchRemove(json, pointer, NULL);
+    }
+    else if (strcmp(name, JSON_PATCH_REPLACE) == 0)
+    {
+        ok = value != NULL && patchReplace(json, pointer, JSONValueReplicate(value));
+    }
+    else if (from != NULL && (strcmp(name, JSON_PATCH_MOVE) == 0 || strcmp(name, JSON_PATCH_COPY) == 0))
+    {
+        JSONPointer *from_pointer = JSONPointerCompile(from);
+        u_int32_t from_len = strlen(from);
+        bool is_move = strcmp(name, JSON_PATCH_MOVE) == 0;
+        JSONValue *moved = NULL;
+        if (from_pointer == NULL)
+        {
+            ok = false;
+        }
+        else if (is_move && strcmp(from, path) == 0)
+        {
+            ok = JSONPointerGetFrom(json->root, from_pointer) != NULL;
+        }
+        // a value cannot be moved into one of its own children
+        else if (is_move && strncmp(from, path, from_len) == 0 && path[from_len] == FORWARDLASH_CHAR)
+        {
+            ok = false;
+        }
+        else if (is_move)
+        {
+            ok = patchRemove(json, from_pointer, &moved) && patchAdd(json, pointer, moved);
+        }
+        else
+        {
+            ok = patchAdd(json, pointer, JSONValueReplicate(JSONPointerGetFrom(json->root, from_pointer)));
+        }
+        if (from_pointer != NULL)
+        {
+            FreeJSONPointer(from_pointer);
+        }
+    }
+    FreeJSONPointer(pointer);
+    return ok;
+}
+
+// Applies the RFC 6902 patch, an array of operations, to json in place.
+// Operations run in order and the ones before a failing operation stay
+// applied, so callers needing all or nothing patch a JSONValueReplicate.
+// Fails with EINVAL on a malformed patch, a missing target or a failed
+// "test".
+extern bool JSONPatchApply(JSON *json, JSONValue *patch)
+{
+    if (json == NULL || json->root == NULL || patch == NULL || patch->value_type != JSONLIST_t)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    JSONArrayIter iter;
+    if (!JSONArrayIterInit(&iter, patch->value))
+    {
+        return false;
+    }
+    errno = 0;
+    for (JSONValue *op = NULL; (op = JSONArrayIterNext(&iter)) != NULL;)
+    {
+        if (op->value_type != JSONOBJ_t || !patchOperation(json, op->value))
+        {
+            errno = errno == ENOMEM ? ENOMEM : EINVAL;
+            return false;
+        }
+    }
+    return true;
+}
+
+// RFC 7386 MergePatch(*target, patch), *target being owned and possibly
+// NULL. Objects are merged in place, anything else is replaced by a copy.
+// On failure *target is left partly patched but whole.
+static bool mergePatch(JSONValue **target, JSONValue *patch, JSONKeyTable *key_table)
+{
+    if (patch->value_type != JSONOBJ_t)
+    {
+        JSONValue *copy = JSONValueReplicate(patch);
+        if (copy == NULL)
+        {
+            return false;
+        }
+        FreeJSONValue(*target, true);
+        *target = copy;
+        return true;
+    }
+    if (*target == NULL || (*target)->value_type != JSONOBJ_t)
+    {
+        HashMap *map = key_table == NULL ? DefaultHashMapInit() : HashMapInitWithKeyTable(DEFAULT_MAP_SIZE, key_table);
+        JSONValue *object = map == NULL ? NULL : JSONValueInit(JSONOBJ_t, map, NULL);
+        if (object == NULL)
+        {
+            FreeHashMap(map);
+            errno = ENOMEM;
+            return false;
+        }
+        FreeJSONValue(*target, true);
+        *target = object;
+    }
+    HashMap *map = (*target)->value;
+    JSONObjectIter iter;
+    JSONObjectIterInit(&iter, patch->value);
+    for (JSONValue *member = NULL; (member = JSONObjectIterNext(&iter)) != NULL;)
+    {
+        if (member->value_type == JSONNULL_t)
+        {
+            HashMapRemove(map, member->key);
+            continue;
+        }
+        JSONValue *existing = HashMapGet(map, member->key);
+        if (existing != NULL && existing->value_type == JSONOBJ_t && member->value_type == JSONOBJ_t)
+        {
+            if (!mergePatch(&existing, member, key_table))
+            {
+                return false;
+            }
+            continue;
+        }
+        JSONValue *merged = NULL;
+        if (!mergePatch(&merged, member, key_table))
+        {
+            FreeJSONValue(merged, true);
+            return false;
+        }
+        if (!patchInsert(map, member->key, merged))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Applies the RFC 7386 merge patch to json in place: members set to null
+// are removed, objects are merged recursively and any other value replaces
+// what was there.
+extern bool JSONMergePatchApply(JSON *json, JSONValue *patch)
+{
+    if (json == NULL || patch == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    return mergePatch(&json->root, patch, json->key_table);
+}
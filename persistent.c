@@ -0,0 +1,943 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <standardloop/util.h>
+
+#include "./json.h"
+
+static JSONPersistentNode *persistentNodeInit(u_int32_t);
+static JSONPersistentNode *persistentLeafInit(JSONValue *, u_int32_t);
+static inline JSONPersistentNode *persistentRetain(JSONPersistentNode *);
+static void persistentRelease(JSONPersistentNode *);
+static inline u_int32_t hamtIndex(u_int32_t, u_int32_t);
+static inline bool hamtLeafMatches(JSONPersistentNode *, char *, u_int32_t);
+static JSONPersistentNode *hamtWith(JSONPersistentNode *, u_int32_t, u_int32_t, JSONPersistentNode *, bool);
+static JSONPersistentNode *hamtWithout(JSONPersistentNode *, u_int32_t, u_int32_t);
+static JSONPersistentNode *hamtMerge(JSONPersistentNode *, JSONPersistentNode *, u_int32_t);
+static JSONPersistentNode *hamtSet(JSONPersistentNode *, u_int32_t, JSONPersistentNode *, bool *);
+static JSONPersistentNode *hamtRemove(JSONPersistentNode *, u_int32_t, char *, u_int32_t, bool *);
+static JSONPersistentMap *persistentMapVersion(JSONPersistentNode *, u_int32_t);
+static inline u_int32_t vectorTailOffset(u_int32_t);
+static JSONPersistentNode *vectorChunkFor(JSONPersistentVector *, u_int32_t);
+static JSONPersistentNode *vectorCopy(JSONPersistentNode *, u_int32_t);
+static JSONPersistentNode *vectorWith(JSONPersistentNode *, u_int32_t, JSONPersistentNode *);
+static JSONPersistentNode *vectorNewPath(u_int32_t, JSONPersistentNode *);
+static JSONPersistentNode *vectorPushTail(u_int32_t, u_int32_t, JSONPersistentNode *, JSONPersistentNode *);
+static JSONPersistentNode *vectorAssoc(u_int32_t, JSONPersistentNode *, u_int32_t, JSONPersistentNode *);
+static JSONPersistentNode *vectorRootWithTail(JSONPersistentVector *, u_int32_t *);
+static bool vectorPopTail(u_int32_t, u_int32_t, JSONPersistentNode *, JSONPersistentNode **);
+static JSONPersistentVector *persistentVectorVersion(JSONPersistentNode *, JSONPersistentNode *, u_int32_t, u_int32_t);
+
+// The functions building nodes below consume the references they are
+// handed: what they return owns them, and when they fail they release them.
+
+static JSONPersistentNode *persistentNodeInit(u_int32_t capacity)
+{
+    JSONPersistentNode *node = malloc(sizeof(JSONPersistentNode) + sizeof(JSONPersistentNode *) * capacity);
+    if (node == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    node->ref_count = 1;
+    node->hash = 0;
+    node->bitmap = 0;
+    node->count = 0;
+    node->value = NULL;
+    return node;
+}
+
+static JSONPersistentNode *persistentLeafInit(JSONValue *json_value, u_int32_t hash)
+{
+    JSONPersistentNode *leaf = persistentNodeInit(0);
+    if (leaf == NULL)
+    {
+        return NULL;
+    }
+    leaf->hash = hash;
+    leaf->value = json_value;
+    return leaf;
+}
+
+static inline JSONPersistentNode *persistentRetain(JSONPersistentNode *node)
+{
+    __atomic_add_fetch(&node->ref_count, 1, __ATOMIC_RELAXED);
+    return node;
+}
+
+static void persistentRelease(JSONPersistentNode *node)
+{
+    if (__atomic_sub_fetch(&node->ref_count, 1, __ATOMIC_ACQ_REL) != 0)
+    {
+        return;
+    }
+    if (node->value != NULL)
+    {
+        free(node->value->key);
+        node->value->key = NULL;
+        FreeJSONValue(node->value, true);
+    }
+    for (u_int32_t i = 0; i < node->count; i++)
+    {
+        persistentRelease(node->children[i]);
+    }
+    free(node);
+}
+
+// Position among the children of the one for bit.
+static inline u_int32_t hamtIndex(u_int32_t bitmap, u_int32_t bit)
+{
+    return __builtin_popcount(bitmap & (bit - 1));
+}
+
+static inline bool hamtLeafMatches(JSONPersistentNode *leaf, char *key, u_int32_t hash)
+{
+    return leaf->hash == hash && strcmp(leaf->value->key, key) == 0;
+}
+
+// Copy of node with bitmap and child at index, inserted before the child
+// there or replacing it.
+static JSONPersistentNode *hamtWith(JSONPersistentNode *node, u_int32_t bitmap, u_int32_t index, JSONPersistentNode *child, bool insert)
+{
+    u_int32_t count = node->count + (insert ? 1 : 0);
+    JSONPersistentNode *copy = persistentNodeInit(count);
+    if (copy == NULL)
+    {
+        persistentRelease(child);
+        return NULL;
+    }
+    copy->bitmap = bitmap;
+    copy->count = count;
+    for (u_int32_t i = 0, from = 0; i < count; i++)
+    {
+        if (i == index)
+        {
+            copy->children[i] = child;
+            from += insert ? 0 : 1;
+            continue;
+        }
+        copy->children[i] = persistentRetain(node->children[from++]);
+    }
+    return copy;
+}
+
+// Copy of node with bitmap and without the child at index.
+static JSONPersistentNode *hamtWithout(JSONPersistentNode *node, u_int32_t bitmap, u_int32_t index)
+{
+    JSONPersistentNode *copy = persistentNodeInit(node->count - 1);
+    if (copy == NULL)
+    {
+        return NULL;
+    }
+    copy->bitmap = bitmap;
+    copy->count = node->count - 1;
+    for (u_int32_t i = 0, from = 0; i < copy->count; i++, from++)
+    {
+        from += from == index ? 1 : 0;
+        copy->children[i] = persistentRetain(node->children[from]);
+    }
+    return copy;
+}
+
+// Node at shift holding the leaves a and b, whose keys differ. Once the
+// hash bits run out it is a collision node, an unordered list of leaves.
+static JSONPersistentNode *hamtMerge(JSONPersistentNode *a, JSONPersistentNode *b, u_int32_t shift)
+{
+    JSONPersistentNode *node = persistentNodeInit(2);
+    if (node == NULL)
+    {
+        persistentRelease(a);
+        persistentRelease(b);
+        return NULL;
+    }
+    if (shift >= 32)
+    {
+        node->count = 2;
+        node->children[0] = a;
+        node->children[1] = b;
+        return node;
+    }
+    u_int32_t bit_a = 1U << ((a->hash >> shift) & JSON_PERSISTENT_MASK);
+    u_int32_t bit_b = 1U << ((b->hash >> shift) & JSON_PERSISTENT_MASK);
+    if (bit_a == bit_b)
+    {
+        JSONPersistentNode *child = hamtMerge(a, b, shift + JSON_PERSISTENT_BITS);
+        if (child == NULL)
+        {
+            free(node);
+            return NULL;
+        }
+        node->bitmap = bit_a;
+        node->count = 1;
+        node->children[0] = child;
+        return node;
+    }
+    node->bitmap = bit_a | bit_b;
+    node->count = 2;
+    node->children[0] = bit_a < bit_b ? a : b;
+    node->children[1] = bit_a < bit_b ? b : a;
+    return node;
+}
+
+// Copy of the map node at shift with leaf in it, replacing the leaf of the
+// same key if there is one.
+static JSONPersistentNode *hamtSet(JSONPersistentNode *node, u_int32_t shift, JSONPersistentNode *leaf, bool *replaced)
+{
+    char *key = leaf->value->key;
+    if (shift >= 32)
+    {
+        for (u_int32_t i = 0; i < node->count; i++)
+        {
+            if (strcmp(node->children[i]->value->key, key) == 0)
+            {
+                *replaced = true;
+                return hamtWith(node, 0, i, leaf, false);
+            }
+        }
+        return hamtWith(node, 0, node->count, leaf, true);
+    }
+    u_int32_t bit = 1U << ((leaf->hash >> shift) & JSON_PERSISTENT_MASK);
+    u_int32_t index = hamtIndex(node->bitmap, bit);
+    if ((node->bitmap & bit) == 0)
+    {
+        return hamtWith(node, node->bitmap | bit, index, leaf, true);
+    }
+    JSONPersistentNode *child = node->children[index];
+    if (child->value == NULL)
+    {
+        child = hamtSet(child, shift + JSON_PERSISTENT_BITS, leaf, replaced);
+    }
+    else if (hamtLeafMatches(child, key, leaf->hash))
+    {
+        *replaced = true;
+        child = leaf;
+    }
+    else
+    {
+        child = hamtMerge(persistentRetain(child), leaf, shift + JSON_PERSISTENT_BITS);
+    }
+    if (child == NULL)
+    {
+        return NULL;
+    }
+    return hamtWith(node, node->bitmap, index, child, false);
+}
+
+// Reference to the map node at shift without key: node itself when key is
+// not there. A node left with a single leaf gives it to its parent.
+static JSONPersistentNode *hamtRemove(JSONPersistentNode *node, u_int32_t shift, char *key, u_int32_t hash, bool *removed)
+{
+    if (shift >= 32)
+    {
+        for (u_int32_t i = 0; i < node->count; i++)
+        {
+            if (strcmp(node->children[i]->value->key, key) == 0)
+            {
+                *removed = true;
+                return hamtWithout(node, 0, i);
+            }
+        }
+        return persistentRetain(node);
+    }
+    u_int32_t bit = 1U << ((hash >> shift) & JSON_PERSISTENT_MASK);
+    if ((node->bitmap & bit) == 0)
+    {
+        return persistentRetain(node);
+    }
+    u_int32_t index = hamtIndex(node->bitmap, bit);
+    JSONPersistentNode *child = node->children[index];
+    if (child->value != NULL)
+    {
+        if (!hamtLeafMatches(child, key, hash))
+        {
+            return persistentRetain(node);
+        }
+        *removed = true;
+        return hamtWithout(node, node->bitmap & ~bit, index);
+    }
+    child = hamtRemove(child, shift + JSON_PERSISTENT_BITS, key, hash, removed);
+    if (child == NULL)
+    {
+        return NULL;
+    }
+    if (!*removed)
+    {
+        persistentRelease(child);
+        return persistentRetain(node);
+    }
+    if (child->count == 1 && child->children[0]->value != NULL)
+    {
+        JSONPersistentNode *only = persistentRetain(child->children[0]);
+        persistentRelease(child);
+        child = only;
+    }
+    return hamtWith(node, node->bitmap, index, child, false);
+}
+
+static JSONPersistentMap *persistentMapVersion(JSONPersistentNode *root, u_int32_t size)
+{
+    JSONPersistentMap *map = malloc(sizeof(JSONPersistentMap));
+    if (map == NULL)
+    {
+        persistentRelease(root);
+        errno = ENOMEM;
+        return NULL;
+    }
+    map->root = root;
+    map->size = size;
+    return map;
+}
+
+extern JSONPersistentMap *JSONPersistentMapInit(void)
+{
+    JSONPersistentNode *root = persistentNodeInit(0);
+    if (root == NULL)
+    {
+        return NULL;
+    }
+    return persistentMapVersion(root, 0);
+}
+
+extern JSONValue *JSONPersistentMapGet(JSONPersistentMap *map, char *key)
+{
+    if (map == NULL || key == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    u_int32_t hash = HashMapKeyHash(key);
+    JSONPersistentNode *node = map->root;
+    for (u_int32_t shift = 0; node->value == NULL; shift += JSON_PERSISTENT_BITS)
+    {
+        if (shift >= 32)
+        {
+            for (u_int32_t i = 0; i < node->count; i++)
+            {
+                if (strcmp(node->children[i]->value->key, key) == 0)
+                {
+                    return node->children[i]->value;
+                }
+            }
+            return NULL;
+        }
+        u_int32_t bit = 1U << ((hash >> shift) & JSON_PERSISTENT_MASK);
+        if ((node->bitmap & bit) == 0)
+        {
+            return NULL;
+        }
+        node = node->children[hamtIndex(node->bitmap, bit)];
+    }
+    return hamtLeafMatches(node, key, hash) ? node->value : NULL;
+}
+
+// New version of map with json_value under a copy of key. json_value must
+// not have a key and is frozen, then owned by the versions holding it. When
+// this fails it still belongs to the caller.
+extern JSONPersistentMap *JSONPersistentMapSet(JSONPersistentMap *map, char *key, JSONValue *json_value)
+{
+    if (map == NULL || key == NULL || json_value == NULL || json_value->key != NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (!JSONValueFreeze(json_value))
+    {
+        return NULL;
+    }
+    if ((json_value->key = strdup(key)) == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    JSONPersistentNode *leaf = persistentLeafInit(json_value, HashMapKeyHash(key));
+    if (leaf == NULL)
+    {
+        free(json_value->key);
+        json_value->key = NULL;
+        return NULL;
+    }
+    // keep a reference so json_value can be handed back on failure
+    persistentRetain(leaf);
+    bool replaced = false;
+    JSONPersistentNode *root = hamtSet(map->root, 0, leaf, &replaced);
+    JSONPersistentMap *version = root == NULL ? NULL : persistentMapVersion(root, map->size + (replaced ? 0 : 1));
+    if (version == NULL)
+    {
+        free(json_value->key);
+        json_value->key = NULL;
+        free(leaf);
+        return NULL;
+    }
+    persistentRelease(leaf);
+    return version;
+}
+
+// New version of map without key, sharing the whole of map when key is not
+// in it.
+extern JSONPersistentMap *JSONPersistentMapRemove(JSONPersistentMap *map, char *key)
+{
+    if (map == NULL || key == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    bool removed = false;
+    JSONPersistentNode *root = hamtRemove(map->root, 0, key, HashMapKeyHash(key), &removed);
+    if (root == NULL)
+    {
+        return NULL;
+    }
+    return persistentMapVersion(root, map->size - (removed ? 1 : 0));
+}
+
+// First version of a persistent map holding replicas of the members of map.
+extern JSONPersistentMap *JSONPersistentMapFromObject(HashMap *map)
+{
+    if (map == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    JSONPersistentMap *version = JSONPersistentMapInit();
+    JSONObjectIter iter;
+    JSONObjectIterInit(&iter, map);
+    for (JSONValue *map_entry = NULL; version != NULL && (map_entry = JSONObjectIterNext(&iter)) != NULL;)
+    {
+        JSONValue *replica = JSONValueReplicate(map_entry);
+        JSONPersistentMap *next = replica == NULL ? NULL : JSONPersistentMapSet(version, map_entry->key, replica);
+        if (next == NULL)
+        {
+            FreeJSONValue(replica, true);
+        }
+        FreeJSONPersistentMap(version);
+        version = next;
+    }
+    return version;
+}
+
+// Mutable object with the members of map. Containers in it stay frozen and
+// shared with map, see FREEZE.
+extern HashMap *JSONPersistentMapToObject(JSONPersistentMap *map)
+{
+    if (map == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    HashMap *object = HashMapInit(map->size * 2, NULL, false);
+    if (object == NULL)
+    {
+        return NULL;
+    }
+    JSONPersistentMapIter iter;
+    JSONPersistentMapIterInit(&iter, map);
+    for (JSONValue *map_entry = NULL; (map_entry = JSONPersistentMapIterNext(&iter)) != NULL;)
+    {
+        JSONValue *replica = JSONValueReplicate(map_entry);
+        if (replica == NULL || !JSONObjectSet(object, map_entry->key, replica))
+        {
+            FreeJSONValue(replica, true);
+            FreeHashMap(object);
+            return NULL;
+        }
+    }
+    return object;
+}
+
+extern void FreeJSONPersistentMap(JSONPersistentMap *map)
+{
+    if (map == NULL)
+    {
+        errno = EINVAL;
+        return;
+    }
+    persistentRelease(map->root);
+    free(map);
+}
+
+extern void JSONPersistentMapIterInit(JSONPersistentMapIter *iter, JSONPersistentMap *map)
+{
+    iter->nodes[0] = map == NULL ? NULL : map->root;
+    iter->positions[0] = 0;
+    iter->depth = map == NULL ? 0 : 1;
+}
+
+// Members in no particular order, NULL after the last.
+extern JSONValue *JSONPersistentMapIterNext(JSONPersistentMapIter *iter)
+{
+    while (iter->depth > 0)
+    {
+        JSONPersistentNode *node = iter->nodes[iter->depth - 1];
+        u_int32_t *position = &iter->positions[iter->depth - 1];
+        if (*position == node->count)
+        {
+            iter->depth--;
+            continue;
+        }
+        JSONPersistentNode *child = node->children[(*position)++];
+        if (child->value != NULL)
+        {
+            return child->value;
+        }
+        iter->nodes[iter->depth] = child;
+        iter->positions[iter->depth] = 0;
+        iter->depth++;
+    }
+    return NULL;
+}
+
+// Index of the first element in the tail.
+static inline u_int32_t vectorTailOffset(u_int32_t size)
+{
+    return size < JSON_PERSISTENT_WIDTH ? 0 : ((size - 1) >> JSON_PERSISTENT_BITS) << JSON_PERSISTENT_BITS;
+}
+
+// Chunk of leaves holding index.
+static JSONPersistentNode *vectorChunkFor(JSONPersistentVector *vector, u_int32_t index)
+{
+    if (index >= vectorTailOffset(vector->size))
+    {
+        return vector->tail;
+    }
+    JSONPersistentNode *node = vector->root;
+    for (u_int32_t level = vector->shift; level > 0; level -= JSON_PERSISTENT_BITS)
+    {
+        node = node->children[(index >> level) & JSON_PERSISTENT_MASK];
+    }
+    return node;
+}
+
+// Copy of the first count children of node. Vector nodes always have room
+// for JSON_PERSISTENT_WIDTH.
+static JSONPersistentNode *vectorCopy(JSONPersistentNode *node, u_int32_t count)
+{
+    JSONPersistentNode *copy = persistentNodeInit(JSON_PERSISTENT_WIDTH);
+    if (copy == NULL)
+    {
+        return NULL;
+    }
+    copy->count = count;
+    for (u_int32_t i = 0; i < count; i++)
+    {
+        copy->children[i] = persistentRetain(node->children[i]);
+    }
+    return copy;
+}
+
+// Copy of node with child at index, which is at most one past the last.
+static JSONPersistentNode *vectorWith(JSONPersistentNode *node, u_int32_t index, JSONPersistentNode *child)
+{
+    JSONPersistentNode *copy = vectorCopy(node, node->count);
+    if (copy == NULL)
+    {
+        persistentRelease(child);
+        return NULL;
+    }
+    if (index < copy->count)
+    {
+        persistentRelease(copy->children[index]);
+    }
+    else
+    {
+        copy->count = index + 1;
+    }
+    copy->children[index] = child;
+    return copy;
+}
+
+// chunk below level - JSON_PERSISTENT_BITS single child nodes.
+static JSONPersistentNode *vectorNewPath(u_int32_t level, JSONPersistentNode *chunk)
+{
+    if (level == 0)
+    {
+        return chunk;
+    }
+    JSONPersistentNode *child = vectorNewPath(level - JSON_PERSISTENT_BITS, chunk);
+    if (child == NULL)
+    {
+        return NULL;
+    }
+    JSONPersistentNode *node = persistentNodeInit(JSON_PERSISTENT_WIDTH);
+    if (node == NULL)
+    {
+        persistentRelease(child);
+        return NULL;
+    }
+    node->count = 1;
+    node->children[0] = child;
+    return node;
+}
+
+// Copy of the node at level with the full tail of a vector of size elements
+// appended as its last chunk.
+static JSONPersistentNode *vectorPushTail(u_int32_t size, u_int32_t level, JSONPersistentNode *node, JSONPersistentNode *tail)
+{
+    u_int32_t index = ((size - 1) >> level) & JSON_PERSISTENT_MASK;
+    JSONPersistentNode *child = NULL;
+    if (level == JSON_PERSISTENT_BITS)
+    {
+        child = tail;
+    }
+    else if (index < node->count)
+    {
+        child = vectorPushTail(size, level - JSON_PERSISTENT_BITS, node->children[index], tail);
+    }
+    else
+    {
+        child = vectorNewPath(level - JSON_PERSISTENT_BITS, tail);
+    }
+    if (child == NULL)
+    {
+        return NULL;
+    }
+    return vectorWith(node, index, child);
+}
+
+// Copy of the node at level with leaf at index.
+static JSONPersistentNode *vectorAssoc(u_int32_t level, JSONPersistentNode *node, u_int32_t index, JSONPersistentNode *leaf)
+{
+    if (level == 0)
+    {
+        return vectorWith(node, index & JSON_PERSISTENT_MASK, leaf);
+    }
+    u_int32_t child_index = (index >> level) & JSON_PERSISTENT_MASK;
+    JSONPersistentNode *child = vectorAssoc(level - JSON_PERSISTENT_BITS, node->children[child_index], index, leaf);
+    if (child == NULL)
+    {
+        return NULL;
+    }
+    return vectorWith(node, child_index, child);
+}
+
+// Root of vector with its full tail moved into the trie, which grows a level
+// once the root is full.
+static JSONPersistentNode *vectorRootWithTail(JSONPersistentVector *vector, u_int32_t *shift)
+{
+    *shift = vector->shift;
+    JSONPersistentNode *tail = persistentRetain(vector->tail);
+    if ((u_int64_t)(vector->size >> JSON_PERSISTENT_BITS) <= (1ULL << vector->shift))
+    {
+        return vectorPushTail(vector->size, vector->shift, vector->root, tail);
+    }
+    JSONPersistentNode *path = vectorNewPath(vector->shift, tail);
+    if (path == NULL)
+    {
+        return NULL;
+    }
+    JSONPersistentNode *root = persistentNodeInit(JSON_PERSISTENT_WIDTH);
+    if (root == NULL)
+    {
+        persistentRelease(path);
+        return NULL;
+    }
+    root->count = 2;
+    root->children[0] = persistentRetain(vector->root);
+    root->children[1] = path;
+    *shift += JSON_PERSISTENT_BITS;
+    return root;
+}
+
+// Copy of the node at level without the last chunk of a vector of size
+// elements, *popped left NULL when nothing remains of it.
+static bool vectorPopTail(u_int32_t size, u_int32_t level, JSONPersistentNode *node, JSONPersistentNode **popped)
+{
+    u_int32_t index = ((size - 2) >> level) & JSON_PERSISTENT_MASK;
+    JSONPersistentNode *child = NULL;
+    if (level > JSON_PERSISTENT_BITS && !vectorPopTail(size, level - JSON_PERSISTENT_BITS, node->children[index], &child))
+    {
+        return false;
+    }
+    *popped = NULL;
+    if (child == NULL && index == 0)
+    {
+        return true;
+    }
+    *popped = vectorCopy(node, index);
+    if (*popped == NULL)
+    {
+        if (child != NULL)
+        {
+            persistentRelease(child);
+        }
+        return false;
+    }
+    if (child != NULL)
+    {
+        (*popped)->children[index] = child;
+        (*popped)->count = index + 1;
+    }
+    return true;
+}
+
+static JSONPersistentVector *persistentVectorVersion(JSONPersistentNode *root, JSONPersistentNode *tail, u_int32_t size, u_int32_t shift)
+{
+    JSONPersistentVector *vector = malloc(sizeof(JSONPersistentVector));
+    if (vector == NULL)
+    {
+        persistentRelease(root);
+        persistentRelease(tail);
+        errno = ENOMEM;
+        return NULL;
+    }
+    vector->root = root;
+    vector->tail = tail;
+    vector->size = size;
+    vector->shift = shift;
+    return vector;
+}
+
+extern JSONPersistentVector *JSONPersistentVectorInit(void)
+{
+    JSONPersistentNode *root = persistentNodeInit(JSON_PERSISTENT_WIDTH);
+    JSONPersistentNode *tail = persistentNodeInit(JSON_PERSISTENT_WIDTH);
+    if (root == NULL || tail == NULL)
+    {
+        free(root);
+        free(tail);
+        return NULL;
+    }
+    return persistentVectorVersion(root, tail, 0, JSON_PERSISTENT_BITS);
+}
+
+extern JSONValue *JSONPersistentVectorGet(JSONPersistentVector *vector, u_int32_t index)
+{
+    if (vector == NULL || index >= vector->size)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    return vectorChunkFor(vector, index)->children[index & JSON_PERSISTENT_MASK]->value;
+}
+
+// New version of vector with json_value at index. json_value must not have
+// a key and is frozen, then owned by the versions holding it. When this
+// fails it still belongs to the caller.
+extern JSONPersistentVector *JSONPersistentVectorSet(JSONPersistentVector *vector, u_int32_t index, JSONValue *json_value)
+{
+    if (vector == NULL || index >= vector->size || json_value == NULL || json_value->key != NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (!JSONValueFreeze(json_value))
+    {
+        return NULL;
+    }
+    JSONPersistentNode *leaf = persistentLeafInit(json_value, 0);
+    if (leaf == NULL)
+    {
+        return NULL;
+    }
+    // keep a reference so json_value can be handed back on failure
+    persistentRetain(leaf);
+    JSONPersistentVector *version = NULL;
+    if (index >= vectorTailOffset(vector->size))
+    {
+        JSONPersistentNode *tail = vectorWith(vector->tail, index & JSON_PERSISTENT_MASK, leaf);
+        if (tail != NULL)
+        {
+            version = persistentVectorVersion(persistentRetain(vector->root), tail, vector->size, vector->shift);
+        }
+    }
+    else
+    {
+        JSONPersistentNode *root = vectorAssoc(vector->shift, vector->root, index, leaf);
+        if (root != NULL)
+        {
+            version = persistentVectorVersion(root, persistentRetain(vector->tail), vector->size, vector->shift);
+        }
+    }
+    if (version == NULL)
+    {
+        free(leaf);
+        return NULL;
+    }
+    persistentRelease(leaf);
+    return version;
+}
+
+// New version of vector with json_value appended, taken like in
+// JSONPersistentVectorSet.
+extern JSONPersistentVector *JSONPersistentVectorPush(JSONPersistentVector *vector, JSONValue *json_value)
+{
+    if (vector == NULL || json_value == NULL || json_value->key != NULL || vector->size == UINT32_MAX)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (!JSONValueFreeze(json_value))
+    {
+        return NULL;
+    }
+    JSONPersistentNode *leaf = persistentLeafInit(json_value, 0);
+    if (leaf == NULL)
+    {
+        return NULL;
+    }
+    // keep a reference so json_value can be handed back on failure
+    persistentRetain(leaf);
+    JSONPersistentVector *version = NULL;
+    u_int32_t tail_len = vector->size - vectorTailOffset(vector->size);
+    if (tail_len < JSON_PERSISTENT_WIDTH)
+    {
+        JSONPersistentNode *tail = vectorWith(vector->tail, tail_len, leaf);
+        if (tail != NULL)
+        {
+            version = persistentVectorVersion(persistentRetain(vector->root), tail, vector->size + 1, vector->shift);
+        }
+    }
+    else
+    {
+        u_int32_t shift = 0;
+        JSONPersistentNode *tail = persistentNodeInit(JSON_PERSISTENT_WIDTH);
+        JSONPersistentNode *root = tail == NULL ? NULL : vectorRootWithTail(vector, &shift);
+        if (root == NULL)
+        {
+            free(tail);
+            persistentRelease(leaf);
+        }
+        else
+        {
+            tail->count = 1;
+            tail->children[0] = leaf;
+            version = persistentVectorVersion(root, tail, vector->size + 1, shift);
+        }
+    }
+    if (version == NULL)
+    {
+        free(leaf);
+        return NULL;
+    }
+    persistentRelease(leaf);
+    return version;
+}
+
+// New version of vector without its last element.
+extern JSONPersistentVector *JSONPersistentVectorPop(JSONPersistentVector *vector)
+{
+    if (vector == NULL || vector->size == 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    if (vector->size == 1)
+    {
+        return JSONPersistentVectorInit();
+    }
+    if (vector->size - vectorTailOffset(vector->size) > 1)
+    {
+        JSONPersistentNode *tail = vectorCopy(vector->tail, vector->tail->count - 1);
+        if (tail == NULL)
+        {
+            return NULL;
+        }
+        return persistentVectorVersion(persistentRetain(vector->root), tail, vector->size - 1, vector->shift);
+    }
+    // the last chunk of the trie becomes the tail
+    JSONPersistentNode *root = NULL;
+    if (!vectorPopTail(vector->size, vector->shift, vector->root, &root))
+    {
+        return NULL;
+    }
+    if (root == NULL && (root = persistentNodeInit(JSON_PERSISTENT_WIDTH)) == NULL)
+    {
+        return NULL;
+    }
+    u_int32_t shift = vector->shift;
+    if (shift > JSON_PERSISTENT_BITS && root->count == 1)
+    {
+        JSONPersistentNode *only = persistentRetain(root->children[0]);
+        persistentRelease(root);
+        root = only;
+        shift -= JSON_PERSISTENT_BITS;
+    }
+    JSONPersistentNode *tail = persistentRetain(vectorChunkFor(vector, vector->size - 2));
+    return persistentVectorVersion(root, tail, vector->size - 1, shift);
+}
+
+// First version of a persistent vector holding replicas of the elements of
+// dynamic_array.
+extern JSONPersistentVector *JSONPersistentVectorFromArray(DynamicArray *dynamic_array)
+{
+    if (dynamic_array == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    JSONArrayIter iter;
+    if (!JSONArrayIterInit(&iter, dynamic_array))
+    {
+        return NULL;
+    }
+    JSONPersistentVector *version = JSONPersistentVectorInit();
+    for (JSONValue *element = NULL; version != NULL && (element = JSONArrayIterNext(&iter)) != NULL;)
+    {
+        JSONValue *replica = JSONValueReplicate(element);
+        JSONPersistentVector *next = replica == NULL ? NULL : JSONPersistentVectorPush(version, replica);
+        if (next == NULL)
+        {
+            FreeJSONValue(replica, true);
+        }
+        FreeJSONPersistentVector(version);
+        version = next;
+    }
+    return version;
+}
+
+// Mutable array with the elements of vector, walked a chunk at a time.
+// Containers in it stay frozen and shared with vector, see FREEZE.
+extern DynamicArray *JSONPersistentVectorToArray(JSONPersistentVector *vector)
+{
+    if (vector == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    // reserved like any growing array, so a large one ends up in segments
+    DynamicArray *dynamic_array = DefaultDynamicArrayInit();
+    if (dynamic_array == NULL)
+    {
+        return NULL;
+    }
+    if (!DynamicArrayReserve(dynamic_array, vector->size))
+    {
+        FreeDynamicArray(dynamic_array);
+        return NULL;
+    }
+    for (u_int32_t index = 0; index < vector->size; index += JSON_PERSISTENT_WIDTH)
+    {
+        JSONPersistentNode *chunk = vectorChunkFor(vector, index);
+        for (u_int32_t i = 0; i < chunk->count; i++)
+        {
+            JSONValue *replica = JSONValueReplicate(chunk->children[i]->value);
+            u_int32_t size = dynamic_array->size;
+            if (replica != NULL)
+            {
+                DynamicArrayAddLast(dynamic_array, replica);
+            }
+            if (replica == NULL || dynamic_array->size == size)
+            {
+                FreeJSONValue(replica, true);
+                FreeDynamicArray(dynamic_array);
+                errno = ENOMEM;
+                return NULL;
+            }
+        }
+    }
+    return dynamic_array;
+}
+
+extern void FreeJSONPersistentVector(JSONPersistentVector *vector)
+{
+    if (vector == NULL)
+    {
+        errno = EINVAL;
+        return;
+    }
+    persistentRelease(vector->root);
+    persistentRelease(vector->tail);
+    free(vector);
+}
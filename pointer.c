@@ -0,0 +1,168 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <standardloop/util.h>
+
+#include "./json.h"
+
+static bool pointerUnescape(char *, u_int32_t, char *, u_int32_t *);
+static int64_t pointerSegmentIndex(char *, u_int32_t);
+
+// Decodes ~0 and ~1 of the raw_len bytes at raw into out, any other ~ is
+// invalid.
+static bool pointerUnescape(char *raw, u_int32_t raw_len, char *out, u_int32_t *out_len)
+{
+    u_int32_t written = 0;
+    for (u_int32_t i = 0; i < raw_len; i++)
+    {
+        if (raw[i] != '~')
+        {
+            out[written++] = raw[i];
+            continue;
+        }
+        if (i + 1 == raw_len || (raw[i + 1] != '0' && raw[i + 1] != '1'))
+        {
+            return false;
+        }
+        out[written++] = raw[i + 1] == '0' ? '~' : FORWARDLASH_CHAR;
+        i++;
+    }
+    out[written] = NULL_CHAR;
+    *out_len = written;
+    return true;
+}
+
+// Array index of a segment: digits without a leading zero, or "-" for the
+// position past the last element.
+static int64_t pointerSegmentIndex(char *key, u_int32_t key_len)
+{
+    if (key_len == 1 && key[0] == DASH_MINUS_CHAR)
+    {
+        return JSON_POINTER_END_INDEX;
+    }
+    if (key_len == 0 || key_len > JSON_POINTER_INDEX_MAX_DIGITS || (key[0] == '0' && key_len > 1))
+    {
+        return JSON_POINTER_NO_INDEX;
+    }
+    int64_t index = 0;
+    for (u_int32_t i = 0; i < key_len; i++)
+    {
+        if (key[i] < '0' || key[i] > '9')
+        {
+            return JSON_POINTER_NO_INDEX;
+        }
+        index = index * 10 + (key[i] - '0');
+    }
+    return index <= UINT32_MAX ? index : JSON_POINTER_NO_INDEX;
+}
+
+// Parses an RFC 6901 pointer once so that JSONPointerGet never hashes or
+// allocates. "" refers to the whole document.
+extern JSONPointer *JSONPointerCompile(char *pointer)
+{
+    if (pointer == NULL || (pointer[0] != NULL_CHAR && pointer[0] != FORWARDLASH_CHAR))
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    u_int32_t pointer_len = strlen(pointer);
+    u_int32_t segment_count = 0;
+    for (u_int32_t i = 0; i < pointer_len; i++)
+    {
+        if (pointer[i] == FORWARDLASH_CHAR)
+        {
+            segment_count++;
+        }
+    }
+    JSONPointer *compiled = malloc(sizeof(JSONPointer));
+    if (compiled == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    compiled->segment_count = segment_count;
+    // every key is NUL terminated in keys, unescaping only shrinks them
+    compiled->keys = malloc(sizeof(char) * (pointer_len + 1));
+    compiled->segments = malloc(sizeof(JSONPointerSegment) * (segment_count == 0 ? 1 : segment_count));
+    if (compiled->keys == NULL || compiled->segments == NULL)
+    {
+        FreeJSONPointer(compiled);
+        errno = ENOMEM;
+        return NULL;
+    }
+    char *key = compiled->keys;
+    u_int32_t position = 1;
+    for (u_int32_t i = 0; i < segment_count; i++)
+    {
+        char *raw = pointer + position;
+        char *raw_end = strchr(raw, FORWARDLASH_CHAR);
+        u_int32_t raw_len = raw_end == NULL ? pointer_len - position : (u_int32_t)(raw_end - raw);
+        JSONPointerSegment *segment = &compiled->segments[i];
+        if (!pointerUnescape(raw, raw_len, key, &segment->key_len))
+        {
+            FreeJSONPointer(compiled);
+            errno = EINVAL;
+            return NULL;
+        }
+        segment->key = key;
+        segment->hash = HashMapKeyHash(key);
+        segment->index = pointerSegmentIndex(key, segment->key_len);
+        key += segment->key_len + 1;
+        position += raw_len + 1;
+    }
+    return compiled;
+}
+
+extern void FreeJSONPointer(JSONPointer *pointer)
+{
+    if (pointer == NULL)
+    {
+        errno = EINVAL;
+        return;
+    }
+    free(pointer->keys);
+    free(pointer->segments);
+    free(pointer);
+}
+
+// Resolves pointer below json_value, NULL when it does not exist. Packed
+// and columnar arrays are turned into generic ones on the first lookup that
+// passes through them, later lookups do not allocate.
+extern JSONValue *JSONPointerGetFrom(JSONValue *json_value, JSONPointer *pointer)
+{
+    if (json_value == NULL || pointer == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    for (u_int32_t i = 0; i < pointer->segment_count && json_value != NULL; i++)
+    {
+        JSONPointerSegment *segment = &pointer->segments[i];
+        if (json_value->value_type == JSONOBJ_t)
+        {
+            json_value = HashMapGetHashed(json_value->value, segment->key, segment->key_len, segment->hash);
+        }
+        else if (json_value->value_type == JSONLIST_t && segment->index >= 0)
+        {
+            json_value = DynamicArrayGetAtIndex(json_value->value, (u_int32_t)segment->index);
+        }
+        else
+        {
+            return NULL;
+        }
+    }
+    return json_value;
+}
+
+extern JSONValue *JSONPointerGet(JSON *json, JSONPointer *pointer)
+{
+    if (json == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    return JSONPointerGetFrom(json->root, pointer);
+}
@@ -0,0 +1,1206 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+
+#include "./json.h"
+
+// Behavioural checks, run with `task test`. Every check prints what failed
+// and the run exits with EXIT_FAILURE if any did.
+
+static u_int32_t failures = 0;
+
+static void expect(bool ok, char *what);
+static void testKeyTable(void);
+static char *rowsText(u_int32_t, u_int32_t, char *);
+static void testColumnarRows(void);
+static void testDoubleRoundTrip(void);
+static void testLargeUnpack(void);
+static void testStringLiterals(void);
+static char *prettyText(char *, u_int32_t);
+static void testInlineWidth(void);
+static void testReformat(void);
+static void testCanonicalToggle(void);
+static void testTextCache(void);
+static void testLowercaseLookup(void);
+static void testPackedIteration(void);
+static void testKeysAcrossDocuments(void);
+static void testValueSwap(void);
+static void testRoundTrip(void);
+static void testPointer(void);
+static char *pathResultsText(JSONPathResults *, char *);
+static void testPath(void);
+static void testPatch(void);
+static void testReplicate(void);
+static JSONValue *intValue(int64_t);
+static bool mapHolds(JSONPersistentMap *, u_int32_t, u_int32_t, int64_t);
+static void testPersistentMap(void);
+static bool vectorHolds(JSONPersistentVector *, u_int32_t, int64_t);
+static void testPersistentVector(void);
+static bool collectMatch(void *, char *, u_int64_t);
+static bool stopAtMatch(void *, char *, u_int64_t);
+static void testExtract(void);
+static void onAlarm(int);
+static char *readAll(int, u_int64_t *, bool);
+static void testWriteToFd(void);
+static bool arrayHolds(DynamicArray *, int64_t *, u_int32_t);
+static void testRingBuffer(void);
+static void testFreeze(void);
+static void testSerializedLength(void);
+static void testEscapeBounds(void);
+
+static void expect(bool ok, char *what)
+{
+    if (!ok)
+    {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static void testKeyTable(void)
+{
+    JSONKeyTable *key_table = JSONKeyTableInit(HASHMAP_MIN_CAPACITY);
+    char key[32];
+    char *first = NULL;
+    for (u_int32_t i = 0; i < 1000; i++)
+    {
+        snprintf(key, sizeof(key), "key%u", i);
+        char *interned = JSONKeyTableIntern(key_table, key);
+        expect(interned != NULL && strcmp(interned, key) == 0, "key table interns while it grows");
+        first = i == 0 ? interned : first;
+    }
+    expect(JSONKeyTableIntern(key_table, "key0") == first, "key table hands out one pointer per key");
+    expect(key_table->size == 1000, "key table counts distinct keys");
+    FreeJSONKeyTable(key_table);
+}
+
+// count rows of the same shape, row odd_row replaced by odd
+static char *rowsText(u_int32_t count, u_int32_t odd_row, char *odd)
+{
+    char *text = malloc((size_t)count * 96 + strlen(odd) + 2);
+    u_int64_t len = 0;
+    text[len++] = '[';
+    for (u_int32_t i = 0; i < count; i++)
+    {
+        if (i == odd_row)
+        {
+            len += sprintf(text + len, "%s", odd);
+        }
+        else
+        {
+            len += sprintf(text + len, "{\"id\":%u,\"name\":\"n%u\",\"score\":1.5,\"ok\":true,\"note\":null}", i, i);
+        }
+        text[len++] = i + 1 == count ? ']' : ',';
+    }
+    text[len] = '\0';
+    return text;
+}
+
+static void testColumnarRows(void)
+{
+    char *text = rowsText(3000, UINT32_MAX, "");
+    JSON *json = StringToJSON(text);
+    DynamicArray *rows = json->root->value;
+    expect(rows->storage == DYN_ARR_COLUMNAR && rows->size == 3000, "uniform rows are stored in columns");
+    char *written = JSONToString(json, false);
+    expect(strcmp(written, text) == 0, "columnar rows write back as parsed");
+    free(written);
+    JSONValue *row = DynamicArrayGetAtIndex(rows, 2500);
+    JSONValue *id = row == NULL ? NULL : HashMapGet(row->value, "id");
+    expect(id != NULL && *(int64_t *)id->value == 2500, "a columnar row is built on its own");
+    expect(rows->storage == DYN_ARR_COLUMNAR && DynamicArrayGetAtIndex(rows, 2500) == row, "building a row leaves the columns alone");
+    expect(JSONObjectSet(row->value, "extra", JSONValueInit(JSONNULL_t, NULL, NULL)), "a row view can be changed");
+    expect(rows->storage == DYN_ARR_GENERIC && DynamicArrayGetAtIndex(rows, 2500) == row, "changing a row view unpacks around it");
+    written = JSONToString(json, false);
+    expect(strstr(written, "\"note\":null,\"extra\":null}") != NULL, "the changed row is written");
+    free(written);
+    FreeJSON(json);
+    free(text);
+
+    // rows past the columnar threshold that do not fit, each part way through
+    char *odd_rows[] = {
+        "{\"id\":\"x\",\"name\":\"n\",\"score\":1.5,\"ok\":true,\"note\":null}",
+        "{\"id\":1,\"name\":\"n\"}",
+        "{\"id\":1,\"name\":\"n\",\"score\":1.5,\"ok\":true,\"note\":null,\"more\":[1,{\"k\":2}]}",
+        "{\"name\":\"n\",\"id\":1,\"score\":1.5,\"ok\":true,\"note\":null}",
+        "{\"id\":1,\"name\":{\"deep\":[true]},\"score\":2,\"ok\":false,\"note\":\"s\"}",
+        "{}",
+    };
+    for (u_int32_t i = 0; i < sizeof(odd_rows) / sizeof(odd_rows[0]); i++)
+    {
+        text = rowsText(2048, 2000, odd_rows[i]);
+        json = StringToJSON(text);
+        written = json == NULL ? NULL : JSONToString(json, false);
+        expect(written != NULL && strcmp(written, text) == 0, "a row that does not fit the columns is parsed as usual");
+        free(written);
+        FreeJSON(json);
+        free(text);
+    }
+    text = rowsText(2048, 2000, "{\"id\":1,\"name\" \"n\"}");
+    json = StringToJSON(text);
+    expect(json == NULL, "a missing colon in a columnar row is an error");
+    FreeJSON(json);
+    free(text);
+}
+
+static void testDoubleRoundTrip(void)
+{
+    // a packed array and doubles inside an object take different paths
+    char *texts[] = {
+        "[0.1,0.3333333333333333,1e+300,5e-324,-2.5,123456789.12345679]",
+        "{\"a\":0.1,\"b\":[1.7976931348623157e+308,\"x\",2.5e-7]}",
+    };
+    for (u_int32_t i = 0; i < sizeof(texts) / sizeof(texts[0]); i++)
+    {
+        JSON *json = StringToJSON(texts[i]);
+        char *written = json == NULL ? NULL : JSONToString(json, false);
+        expect(written != NULL && strcmp(written, texts[i]) == 0, "doubles are written with every digit they need");
+        free(written);
+        FreeJSON(json);
+    }
+    char number[JSON_NUMBER_CHAR_MAX];
+    errno = 0;
+    expect(JSONFormatDouble(NAN, number) == 0 && errno == EINVAL, "NaN has no JSON form");
+    expect(JSONFormatDouble(-0.0, number) == 2 && strcmp(number, "-0") == 0, "negative zero keeps its sign");
+    expect(JSONFormatDoubleCanonical(-0.0, number) == 1 && strcmp(number, "0") == 0, "canonical negative zero is 0");
+    expect(JSONFormatDouble(1e-310, number) != 0 && strcmp(number, "1e-310") == 0, "subnormals get their shortest digits");
+    JSONWriter *writer = JSONWriterInitMemory();
+    expect(!JSONWriterDouble(writer, INFINITY), "the writer refuses infinities");
+    FreeJSONWriter(writer);
+}
+
+static void testLargeUnpack(void)
+{
+    u_int32_t count = DYN_ARR_SEGMENT_THRESHOLD * 2;
+    char *text = malloc((size_t)count * 8 + 2);
+    u_int64_t len = 0;
+    text[len++] = '[';
+    for (u_int32_t i = 0; i < count; i++)
+    {
+        len += sprintf(text + len, "%u%c", i, i + 1 == count ? ']' : ',');
+    }
+    JSON *json = StringToJSON(text);
+    DynamicArray *numbers = json->root->value;
+    expect(numbers->storage == DYN_ARR_PACKED_INT, "integers are packed");
+    JSONValue *last = DynamicArrayGetAtIndex(numbers, count - 1);
+    DynamicArrayRemoveFirst(numbers);
+    expect(numbers->storage == DYN_ARR_SEGMENTED && numbers->size == count - 1, "a large packed array unpacks into segments");
+    expect(DynamicArrayGetAtIndex(numbers, count - 2) == last && *(int64_t *)last->value == count - 1, "unpacking keeps elements handed out");
+    JSONValue *middle = DynamicArrayGetAtIndex(numbers, count / 2);
+    expect(middle != NULL && *(int64_t *)middle->value == count / 2 + 1, "unpacked elements keep their order");
+    JSONValue *copy = JSONValueReplicate(json->root);
+    DynamicArray *copied = copy->value;
+    expect(copied->storage == DYN_ARR_SEGMENTED && copied->capacity < count + DYN_ARR_SEGMENT_SIZE, "a copy of a segmented array is segmented");
+    expect(JSONValueEquals(copy, json->root), "a copy of a segmented array has its elements");
+    FreeJSONValue(copy, true);
+    FreeJSON(json);
+    free(text);
+}
+
+static void testStringLiterals(void)
+{
+    char *rejected[] = {"[\"a\tb\"]", "[\"a\nb\"]", "[\"\x1f\"]", "[\"\\u0000\"]", "[\"\\ud800\"]"};
+    for (u_int32_t i = 0; i < sizeof(rejected) / sizeof(rejected[0]); i++)
+    {
+        JSON *json = StringToJSON(rejected[i]);
+        expect(json == NULL, "raw control characters, \\u0000 and lone surrogates are rejected");
+        FreeJSON(json);
+    }
+    JSON *json = StringToJSON("[\"a\\tb\\u0041\x7f\"]");
+    JSONValue *string = json == NULL ? NULL : DynamicArrayGetAtIndex(json->root->value, 0);
+    expect(string != NULL && strcmp(string->value, "a\tbA\x7f") == 0, "escapes decode, DEL needs none");
+    FreeJSON(json);
+}
+
+static char *prettyText(char *text, u_int32_t max_inline_width)
+{
+    JSON *json = StringToJSON(text);
+    JSONWriter *writer = JSONWriterInitMemory();
+    JSONWriterSetPretty(writer, 2, false, max_inline_width);
+    char *written = json != NULL && JSONWriterValue(writer, json->root) ? JSONWriterTakeString(writer) : NULL;
+    FreeJSONWriter(writer);
+    FreeJSON(json);
+    return written;
+}
+
+static void testInlineWidth(void)
+{
+    // "  \"a_long_key_name\": [1, 2, 3]" is 30 columns
+    char *text = "{\"a_long_key_name\":[1,2,3]}";
+    char *written = prettyText(text, 29);
+    expect(written != NULL && strstr(written, "[1, 2, 3]") == NULL, "the key and indentation count against the inline width");
+    free(written);
+    written = prettyText(text, 30);
+    expect(written != NULL && strstr(written, "\"a_long_key_name\": [1, 2, 3]") != NULL, "a member that fits stays on one line");
+    free(written);
+}
+
+static void testReformat(void)
+{
+    char *invalid[] = {"{\"a\" 1}", "{\"a\" \"b\"}", "{\"a\" {}}", "[1 2]", "{\"a\":1 \"b\":2}", "[1,]", "{\"a\"}", "[\"a\":1]"};
+    for (u_int32_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++)
+    {
+        JSONWriter *writer = JSONWriterInitMemory();
+        expect(!JSONReformat(invalid[i], writer) && errno == EINVAL, "reformatting rejects a missing colon or comma");
+        FreeJSONWriter(writer);
+    }
+    char *numbers[] = {"-1-23", "[1-2]", "[01]", "[-]", "[1.]", "[.5]", "[1e]", "[1e+]", "[-01.5]", "[1.5.2]", "[+1]"};
+    for (u_int32_t i = 0; i < sizeof(numbers) / sizeof(numbers[0]); i++)
+    {
+        JSONWriter *writer = JSONWriterInitMemory();
+        expect(!JSONReformat(numbers[i], writer) && errno == EINVAL, "reformatting rejects a malformed number");
+        FreeJSONWriter(writer);
+    }
+    JSONWriter *writer = JSONWriterInitMemory();
+    bool ok = JSONReformat(" { \"a\" : [ 1 , true , null , -0 , 0.5 , 1E+2 , -3e-07 ] , \"b\" : { } } ", writer);
+    char *written = ok ? JSONWriterTakeString(writer) : NULL;
+    expect(written != NULL && strcmp(written, "{\"a\":[1,true,null,-0,0.5,1E+2,-3e-07],\"b\":{}}") == 0, "reformatting keeps valid input");
+    free(written);
+    FreeJSONWriter(writer);
+}
+
+static void testCanonicalToggle(void)
+{
+    JSONWriter *writer = JSONWriterInitMemory();
+    JSONWriterSetPretty(writer, 4, false, 0);
+    JSONWriterSetCanonical(writer, true);
+    expect(writer->indent_width == 0 && writer->sort_keys, "canonical output is compact and sorted");
+    JSONWriterSetCanonical(writer, true);
+    JSONWriterSetCanonical(writer, false);
+    expect(writer->indent_width == 4 && !writer->sort_keys, "turning canonical off restores the layout");
+    FreeJSONWriter(writer);
+}
+
+static void testTextCache(void)
+{
+    char *text = "{\"outer\":{\"inner\":[\"aaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaaa\",1]},\"n\":2}";
+    JSON *json = StringToJSON(text);
+    json->cache_text = true;
+    free(JSONToString(json, false));
+    HashMap *root = json->root->value;
+    JSONValue *outer = HashMapGet(root, "outer");
+    JSONValue *inner = HashMapGet(outer->value, "inner");
+    JSONTextCache *root_cache = JSONValueTextCache(json->root);
+    JSONTextCache *inner_cache = JSONValueTextCache(inner);
+    expect(!inner_cache->dirty && inner_cache->buffer == root_cache->buffer && root_cache->buffer != NULL, "nested containers share the text of the document");
+    expect(memcmp(inner_cache->text, "[\"aaa", 5) == 0 && inner_cache->text[inner_cache->text_len - 1] == ']', "a nested container points at its own text");
+    expect(JSONArraySet(inner->value, 1, JSONValueInit(JSONNULL_t, NULL, NULL)), "a cached array can be changed");
+    expect(root_cache->dirty && JSONValueTextCache(outer)->dirty, "a change reaches every ancestor");
+    char *written = JSONToString(json, false);
+    expect(strstr(written, "\",null]},\"n\":2}") != NULL, "the changed array is written again");
+    free(written);
+    expect(inner_cache->buffer == root_cache->buffer, "writing again shares one text again");
+    written = JSONToString(json, false);
+    expect(strstr(written, "\",null]},\"n\":2}") != NULL, "clean containers are copied from the cache");
+    free(written);
+    FreeJSON(json);
+}
+
+static void testLowercaseLookup(void)
+{
+    HashMap *map = HashMapInit(DEFAULT_MAP_SIZE, NULL, true);
+    expect(JSONObjectSet(map, "Name", JSONValueInit(JSONNULL_t, NULL, NULL)), "a force_lowercase map takes a mixed case key");
+    JSONValue *by_key = HashMapGet(map, "NAME");
+    expect(by_key != NULL && strcmp(by_key->key, "name") == 0, "force_lowercase lookups ignore case");
+    JSONPointer *pointer = JSONPointerCompile("/nAmE");
+    JSONValue *root = JSONValueInit(JSONOBJ_t, map, NULL);
+    expect(pointer != NULL && JSONPointerGetFrom(root, pointer) == by_key, "hashed lookups honour force_lowercase");
+    FreeJSONPointer(pointer);
+    JSONValue *taken = JSONObjectTake(map, "nAME");
+    expect(taken == by_key && HashMapGet(map, "name") == NULL, "taking from a force_lowercase map ignores case");
+    expect(taken != NULL && JSONObjectSet(map, "OTHER", taken), "a taken member goes back in");
+    HashMapRemove(map, "Other");
+    expect(map->size == 0, "removing from a force_lowercase map ignores case");
+    FreeJSONValue(root, true);
+}
+
+static void testPackedIteration(void)
+{
+    JSON *json = StringToJSON("[[1,2,3],[0.5,1.5],[true,false,true]]");
+    JSONArrayIter rows;
+    expect(JSONArrayIterInit(&rows, json->root->value), "a generic array can be iterated");
+    double sum = 0;
+    u_int32_t trues = 0;
+    for (JSONValue *row = NULL; (row = JSONArrayIterNext(&rows)) != NULL;)
+    {
+        DynamicArray *dynamic_array = row->value;
+        enum DynamicArrayStorage storage = dynamic_array->storage;
+        JSONArrayIter iter;
+        expect(JSONArrayIterInit(&iter, dynamic_array), "a packed array can be iterated");
+        for (JSONValue *element = NULL; (element = JSONArrayIterNext(&iter)) != NULL;)
+        {
+            sum += element->value_type == JSONNUMBER_INT_t ? *(int64_t *)element->value : element->value_type == JSONNUMBER_DOUBLE_t ? *(double *)element->value : 0;
+            trues += element->value_type == JSONBOOL_t && *(bool *)element->value;
+        }
+        expect(dynamic_array->storage == storage && dynamic_array->views == NULL, "iterating a packed array leaves it packed");
+    }
+    expect(sum == 8 && trues == 2, "packed elements are read in place");
+    DynamicArray *ints = DynamicArrayGetAtIndex(json->root->value, 0)->value;
+    JSONValue *element = DynamicArrayGetAtIndex(ints, 0);
+    expect(element != NULL && ints->storage == DYN_ARR_GENERIC && DynamicArrayGetAtIndex(ints, 0) == element, "looking up a packed element unpacks the array");
+    *(int64_t *)element->value = 42;
+    JSONTextCacheInvalidate(&ints->text_cache);
+    char *written = JSONToString(json, false);
+    expect(strcmp(written, "[[42,2,3],[0.5,1.5],[true,false,true]]") == 0, "a looked up packed element is edited in place");
+    free(written);
+    FreeJSON(json);
+}
+
+static void testKeysAcrossDocuments(void)
+{
+    JSON *source = StringToJSONWithKeyTable("{\"moved\":{\"inner\":{\"k\":1},\"list\":[{\"a\":true}]}}", NULL);
+    JSON *target = StringToJSONWithKeyTable("{\"x\":1}", NULL);
+    JSONValue *moved = JSONObjectTake(source->root->value, "moved");
+    expect(moved != NULL && JSONObjectSet(target->root->value, "moved", moved), "a value moves to a document with another key table");
+    FreeJSON(source);
+    JSONValue *inner = HashMapGet(moved->value, "inner");
+    expect(inner != NULL && HashMapGet(inner->value, "k") != NULL, "moved keys outlive the source document");
+    char *written = JSONToString(target, false);
+    expect(strcmp(written, "{\"x\":1,\"moved\":{\"inner\":{\"k\":1},\"list\":[{\"a\":true}]}}") == 0, "a moved value is written with its keys");
+    free(written);
+    HashMap *plain = DefaultHashMapInit();
+    moved = JSONObjectTake(target->root->value, "moved");
+    expect(JSONObjectSet(plain, "moved", moved), "a value moves to a map without a key table");
+    FreeJSON(target);
+    JSONValue *list = HashMapGet(moved->value, "list");
+    JSONValue *row = list == NULL ? NULL : DynamicArrayGetAtIndex(list->value, 0);
+    expect(row != NULL && HashMapGet(row->value, "a") != NULL, "keys below an array are copied too");
+    FreeHashMap(plain);
+
+    source = StringToJSONWithKeyTable("{\"a\":{\"b\":[{\"c\":1}]}}", NULL);
+    JSON *replica = JSONReplicate(source);
+    JSONValue *copy = JSONValueReplicateInto(source->root, NULL);
+    FreeJSON(source);
+    written = JSONToString(replica, false);
+    expect(strcmp(written, "{\"a\":{\"b\":[{\"c\":1}]}}") == 0, "a document copy outlives the key table of the original");
+    free(written);
+    JSONValue *a = HashMapGet(replica->root->value, "a");
+    expect(a != NULL && HashMapGet(a->value, "b") != NULL, "a document copy looks keys up in its own table");
+    written = JSONValueToString(copy);
+    expect(strcmp(written, "{\"a\":{\"b\":[{\"c\":1}]}}") == 0, "a value copied into no key table owns its keys");
+    free(written);
+    FreeJSON(replica);
+    FreeJSONValue(copy, true);
+}
+
+static void testValueSwap(void)
+{
+    JSON *json = StringToJSON("{\"a\":{\"b\":{\"c\":1}},\"x\":[true,\"s\"],\"n\":[1,2,3],\"f\":[null,\"t\"]}");
+    HashMap *root = json->root->value;
+    JSONValue *a = HashMapGet(root, "a");
+    JSONValue *b = HashMapGet(a->value, "b");
+    JSONValue *c = HashMapGet(b->value, "c");
+    JSONValue *x = HashMapGet(root, "x");
+    expect(!JSONValueSwap(a, b) && errno == EINVAL, "a container does not swap with one below it");
+    expect(!JSONValueSwap(c, a) && errno == EINVAL, "a container does not swap with a scalar below it");
+    expect(!JSONValueSwap(json->root, x) && errno == EINVAL, "the root does not swap with its member");
+    JSONValue *f = HashMapGet(root, "f");
+    expect(JSONValueFreeze(f), "an array can be frozen");
+    expect(!JSONValueSwap(DynamicArrayGetAtIndex(f->value, 0), c) && errno == EINVAL, "a member of a frozen array does not swap");
+    expect(JSONValueSwap(f, c), "a frozen array held by a plain object swaps");
+    expect(JSONValueSwap(a, x), "unrelated values swap");
+    char *written = JSONToString(json, false);
+    expect(strcmp(written, "{\"a\":[true,\"s\"],\"x\":{\"b\":{\"c\":[null,\"t\"]}},\"n\":[1,2,3],\"f\":1}") == 0, "swapped values are written in their new places");
+    free(written);
+    FreeJSON(json);
+}
+
+static void testRoundTrip(void)
+{
+    char *texts[] = {
+        "{}",
+        "[]",
+        "{\"a\":[1,-2,3.5,\"x\\\"y\\\\z\\n\",true,false,null],\"b\":{\"c\":{\"d\":[]},\"e\":{}}}",
+        "[[[[1]]],{\"k\":[{\"k\":[{}]}]},\"\xc3\xa9\\u0001\"]",
+        "{\"ints\":[9007199254740993,-9223372036854775808],\"doubles\":[0.5,-1e-7,1e+21]}",
+    };
+    for (u_int32_t i = 0; i < sizeof(texts) / sizeof(texts[0]); i++)
+    {
+        JSON *json = StringToJSON(texts[i]);
+        char *written = json == NULL ? NULL : JSONToString(json, false);
+        expect(written != NULL && strcmp(written, texts[i]) == 0, "compact output writes back the text it was parsed from");
+        free(written);
+        char *pretty = prettyText(texts[i], 0);
+        JSON *reparsed = pretty == NULL ? NULL : StringToJSON(pretty);
+        expect(reparsed != NULL && JSONValueEquals(json->root, reparsed->root), "pretty output parses back to the same value");
+        free(pretty);
+        FreeJSON(reparsed);
+        FreeJSON(json);
+    }
+}
+
+static void testPointer(void)
+{
+    JSON *json = StringToJSON("{\"a/b\":{\"m~n\":[10,{\"\":true}]},\"list\":[1,2,3],\"rows\":[{\"id\":7}]}");
+    char *found[] = {"/a~1b/m~0n/0", "/a~1b/m~0n/1/", "/list/2", "/rows/0/id", ""};
+    char *expected[] = {"10", "true", "3", "7", NULL};
+    for (u_int32_t i = 0; i < sizeof(found) / sizeof(found[0]); i++)
+    {
+        JSONPointer *pointer = JSONPointerCompile(found[i]);
+        JSONValue *json_value = pointer == NULL ? NULL : JSONPointerGet(json, pointer);
+        char *written = json_value == NULL ? NULL : JSONValueToString(json_value);
+        expect(written != NULL && (expected[i] == NULL ? json_value == json->root : strcmp(written, expected[i]) == 0), "a pointer finds what it names");
+        free(written);
+        FreeJSONPointer(pointer);
+    }
+    char *missing[] = {"/list/3", "/list/-", "/list/01", "/nope", "/list/0/x"};
+    for (u_int32_t i = 0; i < sizeof(missing) / sizeof(missing[0]); i++)
+    {
+        JSONPointer *pointer = JSONPointerCompile(missing[i]);
+        expect(pointer != NULL && JSONPointerGet(json, pointer) == NULL, "a pointer to nothing finds nothing");
+        FreeJSONPointer(pointer);
+    }
+    expect(JSONPointerCompile("no/slash") == NULL && JSONPointerCompile("/bad~2") == NULL, "malformed pointers do not compile");
+    FreeJSON(json);
+}
+
+// the results comma separated, from the DOM or as spans into text
+static char *pathResultsText(JSONPathResults *results, char *text)
+{
+    char *joined = calloc(1024, sizeof(char));
+    for (u_int32_t i = 0; results != NULL && i < results->count; i++)
+    {
+        if (i != 0)
+        {
+            strcat(joined, ",");
+        }
+        if (text != NULL)
+        {
+            strncat(joined, text + results->spans[i].start, results->spans[i].len);
+            continue;
+        }
+        char *written = JSONValueToString(results->values[i]);
+        strcat(joined, written);
+        free(written);
+    }
+    return joined;
+}
+
+static void testPath(void)
+{
+    char *text = "{\"store\":{\"book\":[{\"title\":\"A\",\"price\":8},{\"title\":\"B\",\"price\":12.5},{\"title\":\"C\",\"price\":5,\"isbn\":\"x\"}],\"bike\":{\"price\":20}}}";
+    char *queries[][2] = {
+        {"$.store.book[*].title", "\"A\",\"B\",\"C\""},
+        {"$..price", "8,12.5,5,20"},
+        {"$.store.book[?(@.price < 10)].title", "\"A\",\"C\""},
+        {"$.store.book[?(@.isbn)].title", "\"C\""},
+        {"$.store.book[-1].price", "5"},
+        {"$.store.book[0:3:2].title", "\"A\",\"C\""},
+        {"$['store']['bike'].price", "20"},
+        {"$.store.nothing", ""},
+    };
+    JSON *json = StringToJSON(text);
+    for (u_int32_t i = 0; i < sizeof(queries) / sizeof(queries[0]); i++)
+    {
+        JSONPath *path = JSONPathCompile(queries[i][0]);
+        expect(path != NULL, "a JSONPath compiles");
+        JSONPathResults *results = path == NULL ? NULL : JSONPathQuery(path, json->root);
+        char *found = pathResultsText(results, NULL);
+        expect(strcmp(found, queries[i][1]) == 0, "a JSONPath query finds its matches in document order");
+        free(found);
+        FreeJSONPathResults(results);
+        if (path != NULL && path->streamable)
+        {
+            results = JSONPathQueryText(path, text);
+            found = pathResultsText(results, text);
+            expect(strcmp(found, queries[i][1]) == 0, "a streamed JSONPath query finds what the DOM query does");
+            free(found);
+            FreeJSONPathResults(results);
+        }
+        FreeJSONPath(path);
+    }
+    expect(JSONPathCompile("store.book") == NULL && JSONPathCompile("$.book[") == NULL, "malformed JSONPaths do not compile");
+    FreeJSON(json);
+}
+
+static void testPatch(void)
+{
+    char *from_text = "{\"a\":1,\"b\":{\"c\":[1,2,3],\"d\":\"x\"},\"gone\":null,\"list\":[{\"k\":1},{\"k\":2}]}";
+    char *to_text = "{\"a\":2,\"b\":{\"c\":[1,3],\"e\":{\"f\":true}},\"list\":[{\"k\":1},{\"k\":5},{\"n\":[]}]}";
+    JSON *from = StringToJSON(from_text);
+    JSON *to = StringToJSONWithKeyTable(to_text, NULL);
+    JSON *patch = JSONPatchDiff(from->root, to->root);
+    FreeJSON(to);
+    expect(patch != NULL && JSONPatchApply(from, patch->root), "a diff applies to the value it was taken from");
+    to = StringToJSON(to_text);
+    expect(JSONValueEquals(from->root, to->root), "an applied diff turns one value into the other");
+    FreeJSON(patch);
+    FreeJSON(to);
+    FreeJSON(from);
+
+    JSON *json = StringToJSON("{\"a\":{\"b\":1},\"list\":[1,2]}");
+    patch = StringToJSON("[{\"op\":\"add\",\"path\":\"/list/-\",\"value\":3},"
+                         "{\"op\":\"add\",\"path\":\"/list/0\",\"value\":0},"
+                         "{\"op\":\"replace\",\"path\":\"/a/b\",\"value\":{\"z\":null}},"
+                         "{\"op\":\"copy\",\"from\":\"/a\",\"path\":\"/c\"},"
+                         "{\"op\":\"move\",\"from\":\"/list/1\",\"path\":\"/m\"},"
+                         "{\"op\":\"remove\",\"path\":\"/a\"},"
+                         "{\"op\":\"test\",\"path\":\"/c/b/z\",\"value\":null}]");
+    expect(JSONPatchApply(json, patch->root), "a patch applies its operations in order");
+    char *written = JSONToString(json, false);
+    expect(strcmp(written, "{\"list\":[0,2,3],\"c\":{\"b\":{\"z\":null}},\"m\":1}") == 0, "each patch operation changes what it names");
+    free(written);
+    FreeJSON(patch);
+    patch = StringToJSON("[{\"op\":\"test\",\"path\":\"/m\",\"value\":2}]");
+    expect(!JSONPatchApply(json, patch->root) && errno == EINVAL, "a failed test stops the patch");
+    FreeJSON(patch);
+    patch = StringToJSON("[{\"op\":\"remove\",\"path\":\"/nope\"}]");
+    expect(!JSONPatchApply(json, patch->root) && errno == EINVAL, "removing a missing member fails");
+    FreeJSON(patch);
+    FreeJSON(json);
+
+    json = StringToJSON("{\"a\":\"b\",\"c\":{\"d\":\"e\",\"f\":\"g\"},\"l\":[1]}");
+    patch = StringToJSON("{\"a\":\"z\",\"c\":{\"f\":null,\"h\":1},\"l\":{\"x\":[]}}");
+    expect(JSONMergePatchApply(json, patch->root), "a merge patch applies");
+    written = JSONToString(json, false);
+    expect(strcmp(written, "{\"a\":\"z\",\"c\":{\"d\":\"e\",\"h\":1},\"l\":{\"x\":[]}}") == 0, "a merge patch replaces members and null removes them");
+    free(written);
+    FreeJSON(patch);
+    FreeJSON(json);
+}
+
+static void testReplicate(void)
+{
+    char *text = "{\"a\":{\"b\":[1,{\"c\":\"d\"}]},\"n\":[1,2,3]}";
+    JSON *json = StringToJSONWithKeyTable(text, NULL);
+    JSON *replica = JSONReplicate(json);
+    expect(replica != NULL && JSONValueEquals(json->root, replica->root), "a document copy equals the original");
+    JSONValue *a = HashMapGet(replica->root->value, "a");
+    JSONValue *row = DynamicArrayGetAtIndex(HashMapGet(a->value, "b")->value, 1);
+    JSONValue *value = JSONValueReplicate(HashMapGet(replica->root->value, "n"));
+    expect(JSONObjectSet(row->value, "e", value), "a document copy takes new members");
+    FreeJSONValue(JSONObjectTake(replica->root->value, "n"), true);
+    expect(!JSONValueEquals(json->root, replica->root), "a changed copy no longer equals the original");
+    char *written = JSONToString(json, false);
+    expect(strcmp(written, text) == 0, "changing a document copy leaves the original as it was");
+    free(written);
+    written = JSONToString(replica, false);
+    expect(strcmp(written, "{\"a\":{\"b\":[1,{\"c\":\"d\",\"e\":[1,2,3]}]}}") == 0, "a document copy is written with its changes");
+    free(written);
+    FreeJSON(replica);
+    FreeJSON(json);
+}
+
+static JSONValue *intValue(int64_t number)
+{
+    int64_t *value = malloc(sizeof(int64_t));
+    *value = number;
+    return JSONValueInit(JSONNUMBER_INT_t, value, NULL);
+}
+
+// whether map has exactly the keys k<from> up to k<to - 1>, k<i> holding i
+// plus offset
+static bool mapHolds(JSONPersistentMap *map, u_int32_t from, u_int32_t to, int64_t offset)
+{
+    if (map == NULL || map->size != to - from)
+    {
+        return false;
+    }
+    char key[16];
+    for (u_int32_t i = 0; i < to + 64; i++)
+    {
+        sprintf(key, "k%u", i);
+        JSONValue *json_value = JSONPersistentMapGet(map, key);
+        bool wanted = from <= i && i < to;
+        if (wanted != (json_value != NULL) || (wanted && *(int64_t *)json_value->value != (int64_t)i + offset))
+        {
+            return false;
+        }
+    }
+    u_int32_t count = 0;
+    JSONPersistentMapIter iter;
+    JSONPersistentMapIterInit(&iter, map);
+    while (JSONPersistentMapIterNext(&iter) != NULL)
+    {
+        count++;
+    }
+    return count == map->size;
+}
+
+static void testPersistentMap(void)
+{
+    JSONPersistentMap *map = JSONPersistentMapInit();
+    JSONPersistentMap *small = NULL;
+    JSONPersistentMap *medium = NULL;
+    char key[16];
+    for (u_int32_t i = 0; i < 2000; i++)
+    {
+        sprintf(key, "k%u", i);
+        JSONPersistentMap *next = JSONPersistentMapSet(map, key, intValue(i));
+        if (map->size == 20 || map->size == 1100)
+        {
+            *(map->size == 20 ? &small : &medium) = map;
+        }
+        else
+        {
+            FreeJSONPersistentMap(map);
+        }
+        map = next;
+    }
+    expect(mapHolds(map, 0, 2000, 0), "a persistent map grows past a thousand members");
+    expect(mapHolds(small, 0, 20, 0) && mapHolds(medium, 0, 1100, 0), "older map versions keep their members");
+    JSONPersistentMap *replaced = JSONPersistentMapSet(map, "k5", intValue(500));
+    expect(replaced != NULL && replaced->size == 2000 && *(int64_t *)JSONPersistentMapGet(replaced, "k5")->value == 500, "setting a present key replaces it");
+    expect(*(int64_t *)JSONPersistentMapGet(map, "k5")->value == 5, "replacing leaves the older version alone");
+    FreeJSONPersistentMap(replaced);
+    JSONPersistentMap *shrunk = JSONPersistentMapRemove(map, "nope");
+    expect(shrunk != NULL && shrunk->size == 2000, "removing a missing key keeps every member");
+    for (u_int32_t i = 0; i < 1990 && shrunk != NULL; i++)
+    {
+        sprintf(key, "k%u", i);
+        JSONPersistentMap *next = JSONPersistentMapRemove(shrunk, key);
+        FreeJSONPersistentMap(shrunk);
+        shrunk = next;
+    }
+    expect(mapHolds(shrunk, 1990, 2000, 0), "a persistent map shrinks back below a thousand members");
+    expect(mapHolds(map, 0, 2000, 0), "removing leaves the older version alone");
+    FreeJSONPersistentMap(shrunk);
+    FreeJSONPersistentMap(medium);
+    FreeJSONPersistentMap(small);
+    FreeJSONPersistentMap(map);
+
+    JSON *json = StringToJSON("{\"a\":1,\"b\":{\"c\":[1,2,{\"d\":null}]},\"e\":\"s\",\"f\":[true,false]}");
+    map = JSONPersistentMapFromObject(json->root->value);
+    HashMap *object = map == NULL ? NULL : JSONPersistentMapToObject(map);
+    JSONValue *object_value = object == NULL ? NULL : JSONValueInit(JSONOBJ_t, object, NULL);
+    expect(map != NULL && map->size == 4 && object_value != NULL && JSONValueEquals(object_value, json->root), "an object survives the trip through a persistent map");
+    FreeJSON(json);
+    JSONValue *b = JSONPersistentMapGet(map, "b");
+    expect(b != NULL && JSONValueIsFrozen(b) && JSONValueEquals(HashMapGet(object, "b"), b), "persistent members outlive the object they came from");
+    FreeJSONValue(object_value, true);
+    FreeJSONPersistentMap(map);
+}
+
+// whether vector holds size elements, element i holding i plus offset
+static bool vectorHolds(JSONPersistentVector *vector, u_int32_t size, int64_t offset)
+{
+    if (vector == NULL || vector->size != size || JSONPersistentVectorGet(vector, size) != NULL)
+    {
+        return false;
+    }
+    for (u_int32_t i = 0; i < size; i++)
+    {
+        JSONValue *json_value = JSONPersistentVectorGet(vector, i);
+        if (json_value == NULL || *(int64_t *)json_value->value != (int64_t)i + offset)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void testPersistentVector(void)
+{
+    u_int32_t kept_sizes[] = {1, 32, 33, 1024, 1025, 1056, 1057};
+    JSONPersistentVector *kept[sizeof(kept_sizes) / sizeof(kept_sizes[0])] = {NULL};
+    JSONPersistentVector *vector = JSONPersistentVectorInit();
+    for (u_int32_t i = 0; i < 40000; i++)
+    {
+        JSONPersistentVector *next = JSONPersistentVectorPush(vector, intValue(i));
+        bool keep = false;
+        for (u_int32_t k = 0; k < sizeof(kept_sizes) / sizeof(kept_sizes[0]); k++)
+        {
+            if (vector->size == kept_sizes[k])
+            {
+                kept[k] = vector;
+                keep = true;
+            }
+        }
+        if (!keep)
+        {
+            FreeJSONPersistentVector(vector);
+        }
+        vector = next;
+    }
+    expect(vectorHolds(vector, 40000, 0), "a persistent vector grows past a thousand elements");
+    for (u_int32_t k = 0; k < sizeof(kept_sizes) / sizeof(kept_sizes[0]); k++)
+    {
+        expect(vectorHolds(kept[k], kept_sizes[k], 0), "older vector versions keep their elements around chunk bounds");
+    }
+    JSONPersistentVector *changed = JSONPersistentVectorSet(vector, 1030, intValue(-1));
+    expect(changed != NULL && *(int64_t *)JSONPersistentVectorGet(changed, 1030)->value == -1, "setting an element replaces it");
+    expect(vectorHolds(vector, 40000, 0), "setting leaves the older version alone");
+    FreeJSONPersistentVector(changed);
+    JSONValue *outside = intValue(0);
+    expect(JSONPersistentVectorSet(vector, 40000, outside) == NULL, "setting past the end fails");
+    FreeJSONValue(outside, true);
+    JSONPersistentVector *popped = JSONPersistentVectorPop(vector);
+    for (u_int32_t size = 39999; size > 1000 && popped != NULL; size--)
+    {
+        if (size == 1057 || size == 1025)
+        {
+            expect(vectorHolds(popped, size, 0), "popping back across chunk bounds keeps the rest");
+        }
+        JSONPersistentVector *next = JSONPersistentVectorPop(popped);
+        FreeJSONPersistentVector(popped);
+        popped = next;
+    }
+    expect(vectorHolds(popped, 1000, 0), "a persistent vector shrinks back below a thousand elements");
+    expect(vectorHolds(vector, 40000, 0), "popping leaves the older version alone");
+    FreeJSONPersistentVector(popped);
+    for (u_int32_t k = 0; k < sizeof(kept_sizes) / sizeof(kept_sizes[0]); k++)
+    {
+        FreeJSONPersistentVector(kept[k]);
+    }
+
+    DynamicArray *dynamic_array = JSONPersistentVectorToArray(vector);
+    expect(dynamic_array != NULL && dynamic_array->size == 40000, "a persistent vector becomes an array");
+    JSONPersistentVector *back = JSONPersistentVectorFromArray(dynamic_array);
+    expect(vectorHolds(back, 40000, 0), "an array survives the trip through a persistent vector");
+    FreeJSONPersistentVector(back);
+    FreeDynamicArray(dynamic_array);
+    FreeJSONPersistentVector(vector);
+}
+
+// appends the match and a NUL to the buffer in context
+static bool collectMatch(void *context, char *text, u_int64_t len)
+{
+    char **joined = context;
+    u_int64_t used = strlen(*joined);
+    char *grown = realloc(*joined, used + len + 2);
+    if (grown == NULL)
+    {
+        return false;
+    }
+    memcpy(grown + used, text, len);
+    grown[used + len] = '|';
+    grown[used + len + 1] = NULL_CHAR;
+    *joined = grown;
+    return true;
+}
+
+static bool stopAtMatch(void *context, char *text, u_int64_t len)
+{
+    (void)text;
+    (void)len;
+    (*(u_int32_t *)context)++;
+    return false;
+}
+
+static void testExtract(void)
+{
+    // a string longer than a chunk, then matches open across the next bounds
+    u_int64_t pad_len = JSON_EXTRACT_CHUNK_SIZE + 1000;
+    u_int32_t item_count = 4000;
+    char *text = malloc(pad_len + (u_int64_t)item_count * 64 + 128);
+    u_int64_t len = (u_int64_t)sprintf(text, "{\"pad\":\"");
+    memset(text + len, 'x', pad_len);
+    len += pad_len;
+    len += (u_int64_t)sprintf(text + len, "\",\"items\":[");
+    for (u_int32_t i = 0; i < item_count; i++)
+    {
+        len += (u_int64_t)sprintf(text + len, "%s{\"id\":%u,\"tags\":[\"t%u\",{\"deep\":%u}]}", i == 0 ? "" : ",", i, i, i);
+    }
+    sprintf(text + len, "],\"tail\":{\"deep\":[1,2]}}");
+    char filename[] = "/tmp/json-extract-XXXXXX";
+    int fd = mkstemp(filename);
+    FILE *file = fd < 0 ? NULL : fdopen(fd, "w+");
+    expect(file != NULL && fputs(text, file) >= 0 && fflush(file) == 0, "the extraction input is written");
+
+    char *queries[] = {"$.pad", "$.items", "$.items[*].id", "$.items[3999].tags", "$.tail.deep[1]", "$.nothing"};
+    for (u_int32_t i = 0; i < sizeof(queries) / sizeof(queries[0]) && file != NULL; i++)
+    {
+        JSONPath *path = JSONPathCompile(queries[i]);
+        JSONPathResults *results = JSONPathQueryText(path, text);
+        char *expected = calloc(1, 1);
+        for (u_int32_t r = 0; results != NULL && r < results->count; r++)
+        {
+            collectMatch(&expected, text + results->spans[r].start, results->spans[r].len);
+        }
+        char *streamed = calloc(1, 1);
+        rewind(file);
+        expect(JSONExtractFromStream(file, path, collectMatch, &streamed), "a path is extracted from a stream");
+        expect(strcmp(streamed, expected) == 0, "streamed matches are the text a query on the whole input finds");
+        free(streamed);
+        streamed = calloc(1, 1);
+        expect(JSONExtractFromFile(filename, path, collectMatch, &streamed) && strcmp(streamed, expected) == 0, "a path is extracted from a file");
+        free(streamed);
+        free(expected);
+        FreeJSONPathResults(results);
+        FreeJSONPath(path);
+    }
+    JSONPath *path = JSONPathCompile("$.items[*].id");
+    u_int32_t calls = 0;
+    rewind(file);
+    expect(!JSONExtractFromStream(file, path, stopAtMatch, &calls) && errno == ECANCELED && calls == 1, "a callback returning false cancels the extraction");
+    FreeJSONPath(path);
+    fclose(file);
+    unlink(filename);
+    free(text);
+}
+
+static void onAlarm(int signal_number)
+{
+    (void)signal_number;
+}
+
+// everything up to end of file, slowly when asked to
+static char *readAll(int fd, u_int64_t *len, bool slowly)
+{
+    u_int64_t capacity = 4096;
+    char *text = malloc(capacity + 1);
+    *len = 0;
+    while (ALWAYS)
+    {
+        if (*len + 4096 > capacity)
+        {
+            capacity *= 2;
+            text = realloc(text, capacity + 1);
+        }
+        ssize_t chunk = read(fd, text + *len, 4096);
+        if (chunk < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (chunk <= 0)
+        {
+            break;
+        }
+        *len += (u_int64_t)chunk;
+        if (slowly)
+        {
+            usleep(200);
+        }
+    }
+    text[*len] = NULL_CHAR;
+    return text;
+}
+
+static void testWriteToFd(void)
+{
+    // enough long strings to fill the iovecs several times, some escaped
+    u_int32_t string_count = JSON_WRITER_MAX_IOVECS * 4;
+    u_int64_t string_len = JSON_WRITER_REFERENCE_MIN + 100;
+    char *text = malloc((u_int64_t)string_count * (string_len + 32) + 16);
+    u_int64_t len = (u_int64_t)sprintf(text, "[");
+    for (u_int32_t i = 0; i < string_count; i++)
+    {
+        len += (u_int64_t)sprintf(text + len, "%s%u,\"", i == 0 ? "" : ",", i);
+        memset(text + len, 'a' + i % 26, string_len);
+        if (i % 5 == 0)
+        {
+            memcpy(text + len + string_len / 2, "\\n", 2);
+        }
+        len += string_len;
+        len += (u_int64_t)sprintf(text + len, "\"");
+    }
+    sprintf(text + len, "]");
+    JSON *json = StringToJSON(text);
+    char *expected = json == NULL ? NULL : JSONToString(json, false);
+    expect(expected != NULL && strcmp(expected, text) == 0, "long strings are written back as parsed");
+
+    char filename[] = "/tmp/json-write-XXXXXX";
+    int fd = mkstemp(filename);
+    expect(fd >= 0 && JSONWriteToFd(json, fd, JSON_WRITE_DEFAULT), "a document is written to a file");
+    u_int64_t written_len = 0;
+    char *written = lseek(fd, 0, SEEK_SET) == 0 ? readAll(fd, &written_len, false) : NULL;
+    expect(written != NULL && written_len == strlen(expected) && strcmp(written, expected) == 0, "a document written to a file is what JSONToString gives");
+    free(written);
+    close(fd);
+    unlink(filename);
+
+    // a slow reader and a ticking timer make writev stop part way
+    int pipe_fds[2];
+    expect(pipe(pipe_fds) == 0, "a pipe opens");
+    pid_t child = fork();
+    if (child == 0)
+    {
+        close(pipe_fds[0]);
+        struct sigaction action = {0};
+        action.sa_handler = onAlarm;
+        sigaction(SIGALRM, &action, NULL);
+        struct itimerval timer = {.it_interval = {.tv_sec = 0, .tv_usec = 500}, .it_value = {.tv_sec = 0, .tv_usec = 500}};
+        setitimer(ITIMER_REAL, &timer, NULL);
+        bool ok = JSONWriteToFd(json, pipe_fds[1], JSON_WRITE_NEWLINE);
+        _exit(ok ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+    close(pipe_fds[1]);
+    written = readAll(pipe_fds[0], &written_len, true);
+    close(pipe_fds[0]);
+    int status = 0;
+    expect(child > 0 && waitpid(child, &status, 0) == child && WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS, "a document is written to a pipe");
+    expect(written_len == strlen(expected) + 1 && strncmp(written, expected, written_len - 1) == 0 && written[written_len - 1] == NEWLINE_CHAR, "interrupted writes resume where they stopped");
+    free(written);
+    free(expected);
+    FreeJSON(json);
+    free(text);
+}
+
+static bool arrayHolds(DynamicArray *dynamic_array, int64_t *model, u_int32_t size)
+{
+    if (dynamic_array->size != size)
+    {
+        return false;
+    }
+    for (u_int32_t i = 0; i < size; i++)
+    {
+        JSONValue *element = DynamicArrayGetAtIndex(dynamic_array, i);
+        if (element == NULL || *(int64_t *)element->value != model[i])
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Every change is made to the array and to a plain model of it, small
+// enough that the ring buffer wraps; then the same for a segmented array.
+static void testRingBuffer(void)
+{
+    DynamicArray *dynamic_array = DynamicArrayInit(8);
+    int64_t model[512];
+    u_int32_t size = 0;
+    int64_t next = 0;
+    u_int32_t seed = 7;
+    bool wrapped = false;
+    bool matches = true;
+    for (u_int32_t step = 0; step < 4000 && matches; step++)
+    {
+        seed = seed * 1103515245 + 12345;
+        u_int32_t choice = (seed >> 16) % 8;
+        u_int32_t index = size == 0 ? 0 : (seed >> 8) % (size + 1);
+        if (size > 200)
+        {
+            choice = 3 + choice % 3;
+        }
+        if (choice == 0)
+        {
+            DynamicArrayAddFirst(dynamic_array, intValue(next));
+            memmove(model + 1, model, sizeof(int64_t) * size);
+            model[0] = next++;
+            size++;
+        }
+        else if (choice == 1)
+        {
+            DynamicArrayAddLast(dynamic_array, intValue(next));
+            model[size++] = next++;
+        }
+        else if (choice == 2)
+        {
+            DynamicArrayAdd(dynamic_array, intValue(next), index);
+            memmove(model + index + 1, model + index, sizeof(int64_t) * (size - index));
+            model[index] = next++;
+            size++;
+        }
+        else if (choice == 3 && size > 0)
+        {
+            DynamicArrayRemoveFirst(dynamic_array);
+            memmove(model, model + 1, sizeof(int64_t) * --size);
+        }
+        else if (choice == 4 && size > 0)
+        {
+            DynamicArrayRemoveLast(dynamic_array);
+            size--;
+        }
+        else if (choice == 5 && index < size)
+        {
+            DynamicArrayRemove(dynamic_array, index);
+            memmove(model + index, model + index + 1, sizeof(int64_t) * (--size - index));
+        }
+        else if (choice == 6)
+        {
+            u_int32_t remove_count = (seed >> 4) % 4;
+            u_int32_t insert_count = (seed >> 12) % 5;
+            remove_count = remove_count > size - index ? size - index : remove_count;
+            JSONValue *elements[4];
+            int64_t inserted[4];
+            for (u_int32_t i = 0; i < insert_count; i++)
+            {
+                inserted[i] = next++;
+                elements[i] = intValue(inserted[i]);
+            }
+            DynamicArraySplice(dynamic_array, index, remove_count, elements, insert_count);
+            memmove(model + index + insert_count, model + index + remove_count, sizeof(int64_t) * (size - index - remove_count));
+            memcpy(model + index, inserted, sizeof(int64_t) * insert_count);
+            size = size - remove_count + insert_count;
+        }
+        else if (choice == 7)
+        {
+            JSONValue *elements[3] = {intValue(next), intValue(next + 1), intValue(next + 2)};
+            DynamicArrayExtend(dynamic_array, elements, 3);
+            for (u_int32_t i = 0; i < 3; i++)
+            {
+                model[size++] = next++;
+            }
+        }
+        wrapped = wrapped || dynamic_array->head + dynamic_array->size > dynamic_array->capacity;
+        matches = arrayHolds(dynamic_array, model, size);
+    }
+    expect(matches, "inserts and removes at both ends keep the elements in order");
+    expect(wrapped, "the ring buffer wraps around");
+    FreeDynamicArray(dynamic_array);
+
+    u_int32_t count = DYN_ARR_SEGMENT_THRESHOLD + 1000;
+    dynamic_array = DefaultDynamicArrayInit();
+    for (u_int32_t i = 0; i < count; i++)
+    {
+        DynamicArrayAddLast(dynamic_array, intValue(i));
+    }
+    expect(dynamic_array->storage == DYN_ARR_SEGMENTED, "a large array is segmented");
+    JSONValue *elements[DYN_ARR_SEGMENT_SIZE + 1];
+    for (u_int32_t i = 0; i < DYN_ARR_SEGMENT_SIZE + 1; i++)
+    {
+        elements[i] = intValue(-1);
+    }
+    DynamicArraySplice(dynamic_array, 10, 1, elements, DYN_ARR_SEGMENT_SIZE + 1);
+    JSONValue *after = DynamicArrayGetAtIndex(dynamic_array, 10 + DYN_ARR_SEGMENT_SIZE + 1);
+    expect(dynamic_array->size == count + DYN_ARR_SEGMENT_SIZE && after != NULL && *(int64_t *)after->value == 11, "splicing in more than it removes grows a segmented array");
+    DynamicArraySplice(dynamic_array, 5, DYN_ARR_SEGMENT_SIZE * 2, NULL, 0);
+    after = DynamicArrayGetAtIndex(dynamic_array, 5);
+    JSONValue *last = DynamicArrayGetAtIndex(dynamic_array, dynamic_array->size - 1);
+    expect(dynamic_array->size == count - DYN_ARR_SEGMENT_SIZE && after != NULL && *(int64_t *)after->value == DYN_ARR_SEGMENT_SIZE + 5 && *(int64_t *)last->value == count - 1, "splicing out more than it adds shrinks a segmented array");
+    expect(dynamic_array->capacity < dynamic_array->size + 2 * DYN_ARR_SEGMENT_SIZE, "segments emptied by a splice are freed");
+    FreeDynamicArray(dynamic_array);
+}
+
+static void testFreeze(void)
+{
+    JSON *json = StringToJSONWithKeyTable("{\"a\":{\"b\":[1,2,{\"c\":\"d\"}],\"e\":true},\"x\":1}", NULL);
+    JSONValue *a = HashMapGet(json->root->value, "a");
+    expect(JSONValueFreeze(a) && JSONValueIsFrozen(a), "a subtree can be frozen");
+    HashMap *frozen_map = a->value;
+    JSONValue *b = HashMapGet(frozen_map, "b");
+    DynamicArray *frozen_list = b->value;
+    JSONValue *row = DynamicArrayGetAtIndex(frozen_list, 2);
+    expect(JSONValueIsFrozen(b) && JSONValueIsFrozen(row), "freezing reaches every container below");
+
+    JSONValue *outside = intValue(1);
+    errno = 0;
+    expect(!JSONObjectSet(frozen_map, "new", outside) && errno == EPERM, "a frozen object takes no members");
+    errno = 0;
+    expect(!JSONObjectSet(row->value, "new", outside) && errno == EPERM, "an object below a frozen one takes no members");
+    errno = 0;
+    expect(JSONObjectTake(frozen_map, "e") == NULL && errno == EPERM, "nothing is taken from a frozen object");
+    HashMapRemove(frozen_map, "e");
+    expect(HashMapGet(frozen_map, "e") != NULL, "nothing is removed from a frozen object");
+    DynamicArrayAddLast(frozen_list, outside);
+    DynamicArrayRemoveFirst(frozen_list);
+    expect(frozen_list->size == 3, "a frozen array keeps its elements");
+    errno = 0;
+    expect(!JSONArraySet(frozen_list, 0, outside) && errno == EPERM, "no element of a frozen array is replaced");
+    JSONValue *x = HashMapGet(json->root->value, "x");
+    expect(!JSONValueSwap(b, x) && errno == EINVAL, "a member of a frozen object does not swap");
+    FreeJSONValue(outside, true);
+
+    JSON *replica = JSONReplicate(json);
+    JSONValue *replica_a = replica == NULL ? NULL : HashMapGet(replica->root->value, "a");
+    expect(replica_a != NULL && replica_a->value == frozen_map && frozen_map->ref_count == 2, "a copy shares a frozen subtree");
+    JSONValue *shared = JSONValueReplicate(b);
+    expect(shared != NULL && shared->value == frozen_list && frozen_list->ref_count == 2, "a copy of a frozen array shares it");
+    expect(JSONObjectSet(replica->root->value, "y", intValue(2)), "the rest of a copy stays writable");
+    FreeJSON(json);
+    expect(frozen_map->ref_count == 1, "freeing one holder drops its reference");
+    char *written = JSONToString(replica, false);
+    expect(strcmp(written, "{\"a\":{\"b\":[1,2,{\"c\":\"d\"}],\"e\":true},\"x\":1,\"y\":2}") == 0, "a frozen subtree outlives the document it was frozen in");
+    free(written);
+    FreeJSON(replica);
+    expect(frozen_list->ref_count == 1 && HashMapGet(DynamicArrayGetAtIndex(frozen_list, 2)->value, "c") != NULL, "a frozen array outlives the object it was in");
+    FreeJSONValue(shared, true);
+}
+
+static void testSerializedLength(void)
+{
+    JSON *json = StringToJSON("{\"b\":[1,2.5,\"x\\ny\",{\"\\u00e9\":null}],\"a\":{\"k\":[true,false]},\"c\":\"\\u0001\"}");
+    u_int32_t flags[] = {JSON_WRITE_DEFAULT, JSON_WRITE_NEWLINE, JSON_WRITE_PRETTY, JSON_WRITE_SORT_KEYS, JSON_WRITE_CANONICAL};
+    char *compact = JSONToString(json, false);
+    for (u_int32_t i = 0; i < sizeof(flags) / sizeof(flags[0]); i++)
+    {
+        u_int64_t len = JSONValueSerializedLength(json->root, flags[i]);
+        char *buffer = malloc(len + 1);
+        expect(len != 0 && JSONValueToStringInto(json->root, buffer, len + 1, flags[i]) == len && strlen(buffer) == len, "the measured length is the written length");
+        expect(flags[i] != JSON_WRITE_DEFAULT || strcmp(buffer, compact) == 0, "writing into a buffer gives what JSONToString does");
+        errno = 0;
+        expect(JSONValueToStringInto(json->root, buffer, len, flags[i]) == 0 && errno == ENOBUFS, "a buffer without room for the NUL is too small");
+        errno = 0;
+        expect(JSONValueToStringInto(json->root, buffer, 1, flags[i]) == 0 && errno == ENOBUFS, "a tiny buffer is too small");
+        free(buffer);
+    }
+    expect(JSONSerializedLength(json, JSON_WRITE_DEFAULT) == strlen(compact), "a document measures like its root");
+    free(compact);
+    FreeJSON(json);
+}
+
+// a byte to escape, or a neighbour that is not escaped, on each side of the
+// 8 byte words the scans read and in the bytewise tail after them
+static void testEscapeBounds(void)
+{
+    char *specials[][2] = {
+        {"\"", "\\\""},
+        {"\\", "\\\\"},
+        {"\n", "\\n"},
+        {"\x01", "\\u0001"},
+        {"\x1f", "\\u001f"},
+        {"#", "#"},
+        {"]", "]"},
+        {" ", " "},
+        {"\x7f", "\x7f"},
+        {"\xc3", "\xc3"},
+    };
+    u_int32_t offsets[] = {0, 7, 8, 15, 16, 23, 25};
+    for (u_int32_t s = 0; s < sizeof(specials) / sizeof(specials[0]); s++)
+    {
+        for (u_int32_t o = 0; o < sizeof(offsets) / sizeof(offsets[0]); o++)
+        {
+            char str[27];
+            memset(str, 'a', sizeof(str));
+            str[offsets[o]] = specials[s][0][0];
+            char expected[48];
+            memset(expected, 'a', offsets[o]);
+            u_int64_t sequence_len = strlen(specials[s][1]);
+            memcpy(expected + offsets[o], specials[s][1], sequence_len);
+            memset(expected + offsets[o] + sequence_len, 'a', sizeof(str) - offsets[o] - 1);
+            u_int64_t expected_len = sizeof(str) - 1 + sequence_len;
+            bool escaped = sequence_len > 1;
+            char dest[48];
+            expect(JSONEscapeScan(str, sizeof(str)) == (escaped ? offsets[o] : sizeof(str)), "the scan stops at the first byte to escape");
+            expect(JSONEscapedLength(str, sizeof(str)) == expected_len, "the escaped length counts every sequence");
+            expect(JSONEscapeInto(dest, str, sizeof(str)) == expected_len && memcmp(dest, expected, expected_len) == 0, "escaping writes the sequence in place of the byte");
+            bool ends_string = specials[s][0][0] == DOUBLE_QUOTES_CHAR || specials[s][0][0] == BACKSLASH_CHAR;
+            expect(JSONScanQuoteOrBackslash(str, sizeof(str)) == (ends_string ? offsets[o] : sizeof(str)), "the string end scan stops at a quote or backslash");
+        }
+    }
+}
+
+int main(void)
+{
+    testKeyTable();
+    testColumnarRows();
+    testDoubleRoundTrip();
+    testLargeUnpack();
+    testStringLiterals();
+    testInlineWidth();
+    testReformat();
+    testCanonicalToggle();
+    testTextCache();
+    testLowercaseLookup();
+    testPackedIteration();
+    testKeysAcrossDocuments();
+    testValueSwap();
+    testRoundTrip();
+    testPointer();
+    testPath();
+    testPatch();
+    testReplicate();
+    testPersistentMap();
+    testPersistentVector();
+    testExtract();
+    testWriteToFd();
+    testRingBuffer();
+    testFreeze();
+    testSerializedLength();
+    testEscapeBounds();
+    if (failures != 0)
+    {
+        printf("%u checks failed\n", failures);
+        return EXIT_FAILURE;
+    }
+    printf("all checks passed\n");
+    return EXIT_SUCCESS;
+}
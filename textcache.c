@@ -0,0 +1,118 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+
+#include <standardloop/util.h>
+
+#include "./json.h"
+
+static void releaseTextBuffer(JSONTextBuffer *);
+
+static void releaseTextBuffer(JSONTextBuffer *buffer)
+{
+    if (buffer != NULL && --buffer->ref_count == 0)
+    {
+        free(buffer);
+    }
+}
+
+extern void JSONTextCacheInit(JSONTextCache *cache)
+{
+    cache->text = NULL;
+    cache->text_len = 0;
+    cache->buffer = NULL;
+    cache->dirty = true;
+    cache->hash_valid = false;
+    cache->hash = 0;
+    cache->parent = NULL;
+}
+
+extern void FreeJSONTextCache(JSONTextCache *cache)
+{
+    releaseTextBuffer(cache->buffer);
+    cache->buffer = NULL;
+    cache->text = NULL;
+    cache->text_len = 0;
+}
+
+// The cache of the object or array json_value holds, NULL for scalars.
+extern JSONTextCache *JSONValueTextCache(JSONValue *json_value)
+{
+    if (json_value == NULL || json_value->value == NULL)
+    {
+        return NULL;
+    }
+    if (json_value->value_type == JSONOBJ_t)
+    {
+        return &((HashMap *)json_value->value)->text_cache;
+    }
+    if (json_value->value_type == JSONLIST_t)
+    {
+        return &((DynamicArray *)json_value->value)->text_cache;
+    }
+    return NULL;
+}
+
+// Links the container held by child below parent, NULL detaches it. A frozen
+// container may sit in several documents and is never linked.
+extern void JSONTextCacheAttach(JSONTextCache *parent, JSONValue *child)
+{
+    JSONTextCache *child_cache = JSONValueTextCache(child);
+    if (child_cache != NULL && !JSONValueIsFrozen(child))
+    {
+        child_cache->parent = parent;
+    }
+}
+
+// Marks cache and every container above it dirty and drops their text and
+// hash. A container with neither only has such ancestors, so the walk stops
+// at the first one. Whoever edits a scalar in place has to call this on its
+// container.
+extern void JSONTextCacheInvalidate(JSONTextCache *cache)
+{
+    while (cache != NULL && (!cache->dirty || cache->hash_valid))
+    {
+        cache->dirty = true;
+        cache->hash_valid = false;
+        FreeJSONTextCache(cache);
+        cache = cache->parent;
+    }
+}
+
+// A copy of the len bytes of text that no cache refers to yet.
+extern JSONTextBuffer *JSONTextBufferInit(char *text, u_int64_t len)
+{
+    JSONTextBuffer *buffer = malloc(sizeof(JSONTextBuffer) + sizeof(char) * len);
+    if (buffer == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    buffer->ref_count = 0;
+    memcpy(buffer->text, text, len);
+    return buffer;
+}
+
+// Makes the len bytes at offset in buffer the container's serialization.
+extern void JSONTextCacheShare(JSONTextCache *cache, JSONTextBuffer *buffer, u_int64_t offset, u_int64_t len)
+{
+    buffer->ref_count++;
+    FreeJSONTextCache(cache);
+    cache->buffer = buffer;
+    cache->text = buffer->text + offset;
+    cache->text_len = len;
+}
+
+// Takes a copy of the len bytes of text as the container's serialization.
+extern bool JSONTextCacheStore(JSONTextCache *cache, char *text, u_int64_t len)
+{
+    JSONTextBuffer *buffer = JSONTextBufferInit(text, len);
+    if (buffer == NULL)
+    {
+        return false;
+    }
+    JSONTextCacheShare(cache, buffer, 0, len);
+    return true;
+}
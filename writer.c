@@ -0,0 +1,1419 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include <standardloop/util.h>
+
+#include "./json.h"
+
+static JSONWriter *jsonWriterInit(enum JSONWriterSinkType, u_int64_t);
+static bool writerSinkWrite(JSONWriter *, char *, u_int64_t);
+static bool writerPut(JSONWriter *, char *, u_int64_t);
+static bool writerPutReference(JSONWriter *, char *, u_int64_t);
+static void writerCloseRun(JSONWriter *);
+static bool writerWritev(JSONWriter *);
+static inline bool writerPutChar(JSONWriter *, char);
+static bool writerFail(JSONWriter *, int);
+static bool writerBeforeValue(JSONWriter *);
+static void writerAfterValue(JSONWriter *);
+static bool writerPush(JSONWriter *, enum JSONWriterContainer);
+static bool writerPop(JSONWriter *, enum JSONWriterContainer);
+static bool writerQuoted(JSONWriter *, char *);
+static bool writerList(JSONWriter *, DynamicArray *);
+static bool writerColumnarRows(JSONWriter *, JSONColumns *, u_int32_t);
+static bool writerDocument(JSONWriter *, JSONValue *, u_int32_t);
+static bool writerNewline(JSONWriter *, u_int32_t);
+static inline bool writerIsInline(JSONWriter *);
+static bool writerBeforeMember(JSONWriter *);
+static u_int64_t inlineWidth(JSONValue *, u_int64_t);
+static u_int32_t utf16LeadUnit(char *);
+static int compareKeysUTF16(char *, char *);
+static inline int writerCompareKeys(JSONWriter *, char *, char *);
+static void sortEntries(JSONWriter *, JSONValue **, JSONValue **, u_int32_t);
+static u_int32_t *sortedColumnOrder(JSONWriter *, JSONColumns *);
+static u_int64_t columnarRowWidth(JSONColumns *, u_int32_t, u_int64_t);
+static inline u_int64_t writerInlineLimit(JSONWriter *);
+static bool writerObject(JSONWriter *, HashMap *);
+static inline bool writerUsesTextCache(JSONWriter *);
+static bool writerRecordCachedText(JSONWriter *, JSONTextCache *, u_int64_t, u_int64_t);
+static void writerShareCachedTexts(JSONWriter *, u_int64_t, u_int64_t);
+static bool writerCachedContainer(JSONWriter *, JSONValue *, JSONTextCache *);
+
+static const char indent_spaces[65] = "                                                                ";
+
+static JSONWriter *jsonWriterInit(enum JSONWriterSinkType sink_type, u_int64_t buffer_capacity)
+{
+    JSONWriter *writer = malloc(sizeof(JSONWriter));
+    if (writer == NULL)
+    {
+        errno = ENOMEM;
+        return NULL;
+    }
+    // counting and caller buffer sinks have no buffer of their own
+    writer->buffer = buffer_capacity == 0 ? NULL : malloc(sizeof(char) * buffer_capacity);
+    writer->stack = malloc(sizeof(enum JSONWriterContainer) * JSON_WRITER_DEFAULT_DEPTH);
+    if ((writer->buffer == NULL && buffer_capacity != 0) || writer->stack == NULL)
+    {
+        free(writer->buffer);
+        free(writer->stack);
+        free(writer);
+        errno = ENOMEM;
+        return NULL;
+    }
+    writer->sink_type = sink_type;
+    writer->file = NULL;
+    writer->fd = -1;
+    writer->callback = NULL;
+    writer->callback_context = NULL;
+    writer->buffer_len = 0;
+    writer->buffer_capacity = buffer_capacity;
+    writer->iovecs = NULL;
+    writer->iovec_count = 0;
+    writer->run_start = 0;
+    writer->bytes_written = 0;
+    writer->depth = 0;
+    writer->stack_capacity = JSON_WRITER_DEFAULT_DEPTH;
+    writer->needs_comma = false;
+    writer->after_key = false;
+    writer->root_written = false;
+    writer->error = false;
+    writer->indent_width = 0;
+    writer->max_inline_width = 0;
+    writer->key_width = 0;
+    writer->sort_keys = false;
+    writer->inline_depth = 0;
+    writer->pending_inline = false;
+    writer->canonical = false;
+    writer->saved_indent_width = 0;
+    writer->saved_sort_keys = false;
+    writer->cache_text = false;
+    writer->cached_texts = NULL;
+    writer->cached_text_count = 0;
+    writer->cached_text_capacity = 0;
+    writer->cache_depth = 0;
+    return writer;
+}
+
+// RFC 8785 (JCS) output: no whitespace, keys in UTF-16 order, numbers as
+// ECMAScript prints them. Keys are only reordered by JSONWriterValue, a
+// caller streaming members has to emit them in order itself. Turning it off
+// brings back the indentation and key order from before it was turned on.
+extern bool JSONWriterSetCanonical(JSONWriter *writer, bool canonical)
+{
+    if (writer == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    if (canonical && !writer->canonical)
+    {
+        writer->saved_indent_width = writer->indent_width;
+        writer->saved_sort_keys = writer->sort_keys;
+        writer->indent_width = 0;
+        writer->sort_keys = true;
+    }
+    else if (!canonical && writer->canonical)
+    {
+        writer->indent_width = writer->saved_indent_width;
+        writer->sort_keys = writer->saved_sort_keys;
+    }
+    writer->canonical = canonical;
+    return true;
+}
+
+// indent_width 0 keeps the output compact. A container written through
+// JSONWriterValue that fits in max_inline_width columns (0 for never) stays
+// on one line. sort_keys orders object members by key bytes.
+extern bool JSONWriterSetPretty(JSONWriter *writer, u_int32_t indent_width, bool sort_keys, u_int32_t max_inline_width)
+{
+    if (writer == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    writer->indent_width = indent_width;
+    writer->sort_keys = sort_keys;
+    writer->max_inline_width = max_inline_width;
+    return true;
+}
+
+extern JSONWriter *JSONWriterInitFile(FILE *file)
+{
+    if (file == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    JSONWriter *writer = jsonWriterInit(JSONWriterSinkFile, JSON_WRITER_BUFFER_SIZE);
+    if (writer != NULL)
+    {
+        writer->file = file;
+    }
+    return writer;
+}
+
+extern JSONWriter *JSONWriterInitFd(int fd)
+{
+    if (fd < 0)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    JSONWriter *writer = jsonWriterInit(JSONWriterSinkFd, JSON_WRITER_BUFFER_SIZE);
+    if (writer != NULL)
+    {
+        writer->fd = fd;
+    }
+    return writer;
+}
+
+// The whole output is kept in memory, see JSONWriterTakeString.
+extern JSONWriter *JSONWriterInitMemory(void)
+{
+    return jsonWriterInit(JSONWriterSinkMemory, JSON_WRITER_MEMORY_INITIAL_SIZE);
+}
+
+// Produces nothing, bytes_written ends up as the exact output size.
+extern JSONWriter *JSONWriterInitCount(void)
+{
+    return jsonWriterInit(JSONWriterSinkCount, 0);
+}
+
+// Writes into caller memory, running out of it fails with ENOBUFS.
+extern JSONWriter *JSONWriterInitBuffer(char *buffer, u_int64_t buffer_capacity)
+{
+    if (buffer == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    JSONWriter *writer = jsonWriterInit(JSONWriterSinkBuffer, 0);
+    if (writer != NULL)
+    {
+        writer->buffer = buffer;
+        writer->buffer_capacity = buffer_capacity;
+    }
+    return writer;
+}
+
+extern JSONWriter *JSONWriterInitCallback(JSONWriterCallback *callback, void *callback_context)
+{
+    if (callback == NULL)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    JSONWriter *writer = jsonWriterInit(JSONWriterSinkCallback, JSON_WRITER_BUFFER_SIZE);
+    if (writer != NULL)
+    {
+        writer->callback = callback;
+        writer->callback_context = callback_context;
+    }
+    return writer;
+}
+
+// Flushes whatever is still buffered; the FILE* or fd is not closed.
+extern void FreeJSONWriter(JSONWriter *writer)
+{
+    if (writer == NULL)
+    {
+        errno = EINVAL;
+        return;
+    }
+    (void)JSONWriterFlush(writer);
+    if (writer->sink_type != JSONWriterSinkBuffer)
+    {
+        free(writer->buffer);
+    }
+    free(writer->stack);
+    free(writer->iovecs);
+    free(writer->cached_texts);
+    free(writer);
+}
+
+static bool writerFail(JSONWriter *writer, int error_number)
+{
+    writer->error = true;
+    errno = error_number;
+    return false;
+}
+
+static bool writerSinkWrite(JSONWriter *writer, char *bytes, u_int64_t len)
+{
+    switch (writer->sink_type)
+    {
+    case JSONWriterSinkFile:
+        if (fwrite(bytes, 1, len, writer->file) != len)
+        {
+            return writerFail(writer, EIO);
+        }
+        break;
+    case JSONWriterSinkFd:
+    case JSONWriterSinkVectoredFd:
+        while (len > 0)
+        {
+            ssize_t chunk = write(writer->fd, bytes, len);
+            if (chunk < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                return writerFail(writer, errno);
+            }
+            bytes += chunk;
+            len -= (u_int64_t)chunk;
+        }
+        break;
+    case JSONWriterSinkCallback:
+        if (!writer->callback(writer->callback_context, bytes, len))
+        {
+            return writerFail(writer, EIO);
+        }
+        break;
+    default:
+        break;
+    }
+    return true;
+}
+
+// Buffered sinks pass anything at least as large as the buffer straight
+// through, so a huge string is never copied.
+static bool writerPut(JSONWriter *writer, char *bytes, u_int64_t len)
+{
+    if (writer->error)
+    {
+        return false;
+    }
+    if (writer->sink_type == JSONWriterSinkCount)
+    {
+        writer->bytes_written += len;
+        return true;
+    }
+    if (writer->buffer_capacity - writer->buffer_len >= len)
+    {
+        memcpy(writer->buffer + writer->buffer_len, bytes, len);
+        writer->buffer_len += len;
+        writer->bytes_written += len;
+        return true;
+    }
+    if (writer->sink_type == JSONWriterSinkBuffer)
+    {
+        return writerFail(writer, ENOBUFS);
+    }
+    if (writer->sink_type == JSONWriterSinkMemory)
+    {
+        u_int64_t new_capacity = writer->buffer_capacity * 2;
+        while (new_capacity - writer->buffer_len < len)
+        {
+            new_capacity *= 2;
+        }
+        char *buffer = realloc(writer->buffer, new_capacity);
+        if (buffer == NULL)
+        {
+            return writerFail(writer, ENOMEM);
+        }
+        writer->buffer = buffer;
+        writer->buffer_capacity = new_capacity;
+        return writerPut(writer, bytes, len);
+    }
+    if (!JSONWriterFlush(writer))
+    {
+        return false;
+    }
+    if (len >= writer->buffer_capacity)
+    {
+        writer->bytes_written += len;
+        return writerSinkWrite(writer, bytes, len);
+    }
+    return writerPut(writer, bytes, len);
+}
+
+// For the vectored fd sink the bytes copied into buffer since run_start
+// become one iovec.
+static void writerCloseRun(JSONWriter *writer)
+{
+    if (writer->buffer_len > writer->run_start)
+    {
+        writer->iovecs[writer->iovec_count].iov_base = writer->buffer + writer->run_start;
+        writer->iovecs[writer->iovec_count].iov_len = writer->buffer_len - writer->run_start;
+        writer->iovec_count++;
+        writer->run_start = writer->buffer_len;
+    }
+}
+
+// Long strings are not copied into a vectored fd writer's buffer, an iovec
+// points at them instead. They have to stay alive until the next flush,
+// which is why only JSONWriteToFd creates such a writer.
+static bool writerPutReference(JSONWriter *writer, char *bytes, u_int64_t len)
+{
+    if (writer->sink_type != JSONWriterSinkVectoredFd || len < JSON_WRITER_REFERENCE_MIN)
+    {
+        return writerPut(writer, bytes, len);
+    }
+    if (writer->error)
+    {
+        return false;
+    }
+    writerCloseRun(writer);
+    writer->iovecs[writer->iovec_count].iov_base = bytes;
+    writer->iovecs[writer->iovec_count].iov_len = len;
+    writer->iovec_count++;
+    writer->bytes_written += len;
+    // keep room for the next run and reference
+    if (writer->iovec_count + 2 > JSON_WRITER_MAX_IOVECS)
+    {
+        return writerWritev(writer);
+    }
+    return true;
+}
+
+static bool writerWritev(JSONWriter *writer)
+{
+    writerCloseRun(writer);
+    struct iovec *iovecs = writer->iovecs;
+    u_int32_t iovec_count = writer->iovec_count;
+    while (iovec_count > 0)
+    {
+        ssize_t chunk = writev(writer->fd, iovecs, (int)iovec_count);
+        if (chunk < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            return writerFail(writer, errno);
+        }
+        // skip what was written, a partial iovec is resumed where it stopped
+        while (iovec_count > 0 && (size_t)chunk >= iovecs->iov_len)
+        {
+            chunk -= (ssize_t)iovecs->iov_len;
+            iovecs++;
+            iovec_count--;
+        }
+        if (iovec_count > 0)
+        {
+            iovecs->iov_base = (char *)iovecs->iov_base + chunk;
+            iovecs->iov_len -= (size_t)chunk;
+        }
+    }
+    writer->iovec_count = 0;
+    writer->buffer_len = 0;
+    writer->run_start = 0;
+    return true;
+}
+
+static inline bool writerPutChar(JSONWriter *writer, char c)
+{
+    if (writer->buffer_len < writer->buffer_capacity && !writer->error)
+    {
+        writer->buffer[writer->buffer_len++] = c;
+        writer->bytes_written++;
+        return true;
+    }
+    return writerPut(writer, &c, 1);
+}
+
+extern bool JSONWriterFlush(JSONWriter *writer)
+{
+    if (writer == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    if (writer->error)
+    {
+        return false;
+    }
+    if (writer->sink_type == JSONWriterSinkMemory || writer->sink_type == JSONWriterSinkCount || writer->sink_type == JSONWriterSinkBuffer || (writer->buffer_len == 0 && writer->iovec_count == 0))
+    {
+        return true;
+    }
+    if (writer->sink_type == JSONWriterSinkVectoredFd)
+    {
+        return writerWritev(writer);
+    }
+    u_int64_t len = writer->buffer_len;
+    writer->buffer_len = 0;
+    if (!writerSinkWrite(writer, writer->buffer, len))
+    {
+        return false;
+    }
+    if (writer->sink_type == JSONWriterSinkFile && fflush(writer->file) != 0)
+    {
+        return writerFail(writer, EIO);
+    }
+    return true;
+}
+
+// Hands the caller the NUL terminated output of a memory writer and starts
+// the writer over with an empty buffer.
+extern char *JSONWriterTakeString(JSONWriter *writer)
+{
+    if (writer == NULL || writer->sink_type != JSONWriterSinkMemory || writer->error)
+    {
+        errno = EINVAL;
+        return NULL;
+    }
+    char *fresh_buffer = malloc(sizeof(char) * JSON_WRITER_MEMORY_INITIAL_SIZE);
+    if (fresh_buffer == NULL || !writerPutChar(writer, NULL_CHAR))
+    {
+        free(fresh_buffer);
+        errno = ENOMEM;
+        return NULL;
+    }
+    char *output = realloc(writer->buffer, writer->buffer_len);
+    if (output == NULL)
+    {
+        output = writer->buffer;
+    }
+    writer->buffer = fresh_buffer;
+    writer->buffer_len = 0;
+    writer->buffer_capacity = JSON_WRITER_MEMORY_INITIAL_SIZE;
+    writer->bytes_written = 0;
+    writer->depth = 0;
+    writer->needs_comma = false;
+    writer->after_key = false;
+    writer->root_written = false;
+    return output;
+}
+
+// Inside an object a value has to follow a key; at the top level only a
+// single value may be written.
+static bool writerBeforeValue(JSONWriter *writer)
+{
+    if (writer->error)
+    {
+        return false;
+    }
+    if (writer->depth == 0)
+    {
+        return writer->root_written ? writerFail(writer, EINVAL) : true;
+    }
+    if (writer->stack[writer->depth - 1] == JSONWriterContainerObject)
+    {
+        if (!writer->after_key)
+        {
+            return writerFail(writer, EINVAL);
+        }
+        writer->after_key = false;
+        return true;
+    }
+    return writerBeforeMember(writer);
+}
+
+// Separator and line break in front of an array element or an object key.
+static bool writerBeforeMember(JSONWriter *writer)
+{
+    if (writer->needs_comma && !writerPutChar(writer, COMMA_CHAR))
+    {
+        return false;
+    }
+    if (writer->indent_width == 0)
+    {
+        return true;
+    }
+    if (writerIsInline(writer))
+    {
+        return !writer->needs_comma || writerPutChar(writer, SPACE_CHAR);
+    }
+    return writerNewline(writer, writer->depth);
+}
+
+static inline bool writerIsInline(JSONWriter *writer)
+{
+    return writer->inline_depth != 0 && writer->depth >= writer->inline_depth;
+}
+
+static bool writerNewline(JSONWriter *writer, u_int32_t depth)
+{
+    if (!writerPutChar(writer, NEWLINE_CHAR))
+    {
+        return false;
+    }
+    u_int64_t spaces = (u_int64_t)depth * writer->indent_width;
+    while (spaces > 0)
+    {
+        u_int64_t chunk = spaces < sizeof(indent_spaces) - 1 ? spaces : sizeof(indent_spaces) - 1;
+        if (!writerPut(writer, (char *)indent_spaces, chunk))
+        {
+            return false;
+        }
+        spaces -= chunk;
+    }
+    return true;
+}
+
+static void writerAfterValue(JSONWriter *writer)
+{
+    if (writer->depth == 0)
+    {
+        writer->root_written = true;
+    }
+    writer->needs_comma = true;
+}
+
+static bool writerPush(JSONWriter *writer, enum JSONWriterContainer container)
+{
+    if (!writerBeforeValue(writer))
+    {
+        return false;
+    }
+    if (writer->depth == writer->stack_capacity)
+    {
+        u_int32_t new_capacity = writer->stack_capacity * 2;
+        enum JSONWriterContainer *stack = realloc(writer->stack, sizeof(enum JSONWriterContainer) * new_capacity);
+        if (stack == NULL)
+        {
+            return writerFail(writer, ENOMEM);
+        }
+        writer->stack = stack;
+        writer->stack_capacity = new_capacity;
+    }
+    writer->stack[writer->depth++] = container;
+    writer->needs_comma = false;
+    if (writer->pending_inline && writer->inline_depth == 0)
+    {
+        writer->inline_depth = writer->depth;
+    }
+    writer->pending_inline = false;
+    return writerPutChar(writer, container == JSONWriterContainerObject ? CURLY_OPEN_CHAR : BRACKET_OPEN_CHAR);
+}
+
+static bool writerPop(JSONWriter *writer, enum JSONWriterContainer container)
+{
+    if (writer->error)
+    {
+        return false;
+    }
+    if (writer->depth == 0 || writer->stack[writer->depth - 1] != container || writer->after_key)
+    {
+        return writerFail(writer, EINVAL);
+    }
+    bool break_line = writer->indent_width != 0 && writer->needs_comma && !writerIsInline(writer);
+    writer->depth--;
+    if (writer->depth < writer->inline_depth)
+    {
+        writer->inline_depth = 0;
+    }
+    writerAfterValue(writer);
+    if (break_line && !writerNewline(writer, writer->depth))
+    {
+        return false;
+    }
+    return writerPutChar(writer, container == JSONWriterContainerObject ? CURLY_CLOSE_CHAR : BRACKET_CLOSE_CHAR);
+}
+
+extern bool JSONWriterBeginObject(JSONWriter *writer)
+{
+    if (writer == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    return writerPush(writer, JSONWriterContainerObject);
+}
+
+extern bool JSONWriterEndObject(JSONWriter *writer)
+{
+    if (writer == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    return writerPop(writer, JSONWriterContainerObject);
+}
+
+extern bool JSONWriterBeginArray(JSONWriter *writer)
+{
+    if (writer == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    return writerPush(writer, JSONWriterContainerArray);
+}
+
+extern bool JSONWriterEndArray(JSONWriter *writer)
+{
+    if (writer == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    return writerPop(writer, JSONWriterContainerArray);
+}
+
+// Clean runs between characters that need escaping are copied (or
+// referenced) in bulk.
+static bool writerQuoted(JSONWriter *writer, char *str)
+{
+    if (!writerPutChar(writer, DOUBLE_QUOTES_CHAR))
+    {
+        return false;
+    }
+    u_int64_t len = strlen(str);
+    char sequence[JSON_ESCAPE_SEQUENCE_MAX];
+    while (ALWAYS)
+    {
+        u_int64_t clean_run = JSONEscapeScan(str, len);
+        if (!writerPutReference(writer, str, clean_run))
+        {
+            return false;
+        }
+        if (clean_run == len)
+        {
+            break;
+        }
+        if (!writerPut(writer, sequence, JSONEscapeChar(str[clean_run], sequence)))
+        {
+            return false;
+        }
+        str += clean_run + 1;
+        len -= clean_run + 1;
+    }
+    return writerPutChar(writer, DOUBLE_QUOTES_CHAR);
+}
+
+extern bool JSONWriterKey(JSONWriter *writer, char *key)
+{
+    if (writer == NULL || key == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    if (writer->error)
+    {
+        return false;
+    }
+    if (writer->depth == 0 || writer->stack[writer->depth - 1] != JSONWriterContainerObject || writer->after_key)
+    {
+        return writerFail(writer, EINVAL);
+    }
+    if (!writerBeforeMember(writer))
+    {
+        return false;
+    }
+    writer->after_key = true;
+    if (writer->indent_width != 0)
+    {
+        // quotes, colon and space
+        writer->key_width = JSONEscapedLength(key, strlen(key)) + 4;
+    }
+    if (!writerQuoted(writer, key) || !writerPutChar(writer, COLON_CHAR))
+    {
+        return false;
+    }
+    return writer->indent_width == 0 || writerPutChar(writer, SPACE_CHAR);
+}
+
+extern bool JSONWriterString(JSONWriter *writer, char *value)
+{
+    if (writer == NULL || value == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    if (!writerBeforeValue(writer))
+    {
+        return false;
+    }
+    writerAfterValue(writer);
+    return writerQuoted(writer, value);
+}
+
+extern bool JSONWriterInt(JSONWriter *writer, int64_t value)
+{
+    if (writer == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    if (!writerBeforeValue(writer))
+    {
+        return false;
+    }
+    writerAfterValue(writer);
+    char number[JSON_NUMBER_CHAR_MAX];
+    if (writer->canonical && (value > JSON_CANONICAL_INT_MAX || value < -JSON_CANONICAL_INT_MAX))
+    {
+        return writerPut(writer, number, JSONFormatDoubleCanonical((double)value, number));
+    }
+    return writerPut(writer, number, JSONFormatInt64(value, number));
+}
+
+extern bool JSONWriterDouble(JSONWriter *writer, double value)
+{
+    if (writer == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    if (!writerBeforeValue(writer))
+    {
+        return false;
+    }
+    writerAfterValue(writer);
+    // NaN and infinities have no JSON form, canonical or not
+    char number[JSON_NUMBER_CHAR_MAX];
+    u_int32_t number_len = writer->canonical ? JSONFormatDoubleCanonical(value, number) : JSONFormatDouble(value, number);
+    return number_len == 0 ? writerFail(writer, EINVAL) : writerPut(writer, number, number_len);
+}
+
+// literal is written as is, it has to be a valid JSON number. Canonical
+// writers normalize it like any other double.
+extern bool JSONWriterNumberLiteral(JSONWriter *writer, char *literal)
+{
+    if (writer == NULL || literal == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    if (writer->canonical)
+    {
+        return JSONWriterDouble(writer, strtod(literal, NULL));
+    }
+    if (!writerBeforeValue(writer))
+    {
+        return false;
+    }
+    writerAfterValue(writer);
+    return writerPut(writer, literal, strlen(literal));
+}
+
+extern bool JSONWriterBool(JSONWriter *writer, bool value)
+{
+    if (writer == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    if (!writerBeforeValue(writer))
+    {
+        return false;
+    }
+    writerAfterValue(writer);
+    char *literal = value ? JSON_BOOL_TRUE : JSON_BOOL_FALSE;
+    return writerPut(writer, literal, strlen(literal));
+}
+
+extern bool JSONWriterNull(JSONWriter *writer)
+{
+    if (writer == NULL)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    if (!writerBeforeValue(writer))
+    {
+        return false;
+    }
+    writerAfterValue(writer);
+    return writerPut(writer, JSON_NULL, strlen(JSON_NULL));
+}
+
+// Columnar rows are written straight from the columns, packed lists straight
+// from their unboxed values, neither is converted back to JSONValues.
+static bool writerColumnarRows(JSONWriter *writer, JSONColumns *columns, u_int32_t row_count)
+{
+    u_int32_t *column_order = NULL;
+    if (writer->sort_keys && (column_order = sortedColumnOrder(writer, columns)) == NULL)
+    {
+        return writerFail(writer, ENOMEM);
+    }
+    bool ok = true;
+    for (u_int32_t row = 0; ok && row < row_count; row++)
+    {
+        writer->pending_inline = writer->indent_width != 0 && writer->max_inline_width != 0 && columnarRowWidth(columns, row, writerInlineLimit(writer)) <= writerInlineLimit(writer);
+        ok = JSONWriterBeginObject(writer);
+        for (u_int32_t i = 0; ok && i < columns->column_count; i++)
+        {
+            JSONColumn *column = &columns->columns[column_order == NULL ? i : column_order[i]];
+            if (!JSONWriterKey(writer, column->key))
+            {
+                ok = false;
+                break;
+            }
+            if (JSONColumnIsNull(column, row))
+            {
+                ok = JSONWriterNull(writer);
+            }
+            else if (column->value_type == JSONNUMBER_INT_t)
+            {
+                ok = JSONWriterInt(writer, column->ints[row]);
+            }
+            else if (column->value_type == JSONNUMBER_DOUBLE_t)
+            {
+                ok = JSONWriterDouble(writer, column->doubles[row]);
+            }
+            else if (column->value_type == JSONBOOL_t)
+            {
+                ok = JSONWriterBool(writer, JSONColumnGetBool(column, row));
+            }
+            else
+            {
+                ok = JSONWriterString(writer, JSONColumnGetString(column, row));
+            }
+        }
+        ok = ok && JSONWriterEndObject(writer);
+    }
+    free(column_order);
+    return ok;
+}
+
+static u_int64_t columnarRowWidth(JSONColumns *columns, u_int32_t row, u_int64_t limit)
+{
+    char number[JSON_NUMBER_CHAR_MAX];
+    u_int64_t width = 0;
+    for (u_int32_t i = 0; i < columns->column_count && width <= limit; i++)
+    {
+        JSONColumn *column = &columns->columns[i];
+        // braces or ", ", quotes and ": "
+        width += 2 + JSONEscapedLength(column->key, strlen(column->key)) + 4;
+        if (JSONColumnIsNull(column, row))
+        {
+            width += strlen(JSON_NULL);
+        }
+        else if (column->value_type == JSONNUMBER_INT_t)
+        {
+            width += JSONFormatInt64(column->ints[row], number);
+        }
+        else if (column->value_type == JSONNUMBER_DOUBLE_t)
+        {
+            width += JSONFormatDouble(column->doubles[row], number);
+        }
+        else if (column->value_type == JSONBOOL_t)
+        {
+            width += JSONColumnGetBool(column, row) ? strlen(JSON_BOOL_TRUE) : strlen(JSON_BOOL_FALSE);
+        }
+        else
+        {
+            char *str = JSONColumnGetString(column, row);
+            width += JSONEscapedLength(str, strlen(str)) + 2;
+        }
+    }
+    return width;
+}
+
+// Columns left on the current line for an inline container, after the
+// indentation and, for an object member, its `"key": `.
+static inline u_int64_t writerInlineLimit(JSONWriter *writer)
+{
+    u_int64_t used = (u_int64_t)writer->depth * writer->indent_width + (writer->after_key ? writer->key_width : 0);
+    return writer->max_inline_width > used ? writer->max_inline_width - used : 0;
+}
+
+static u_int32_t *sortedColumnOrder(JSONWriter *writer, JSONColumns *columns)
+{
+    u_int32_t *column_order = malloc(sizeof(u_int32_t) * columns->column_count);
+    if (column_order == NULL)
+    {
+        return NULL;
+    }
+    // insertion sort, rows are narrow
+    for (u_int32_t i = 0; i < columns->column_count; i++)
+    {
+        u_int32_t j = i;
+        while (j > 0 && writerCompareKeys(writer, columns->columns[column_order[j - 1]].key, columns->columns[i].key) > 0)
+        {
+            column_order[j] = column_order[j - 1];
+            j--;
+        }
+        column_order[j] = i;
+    }
+    return column_order;
+}
+
+// First UTF-16 code unit of the code point starting at str.
+static u_int32_t utf16LeadUnit(char *str)
+{
+    unsigned char lead = (unsigned char)str[0];
+    u_int32_t continuation_count = lead >= 0xF0 ? 3 : lead >= 0xE0 ? 2 : lead >= 0xC0 ? 1 : 0;
+    u_int32_t code_point = continuation_count == 0 ? lead : lead & (0x3F >> continuation_count);
+    for (u_int32_t i = 1; i <= continuation_count && str[i] != NULL_CHAR; i++)
+    {
+        code_point = (code_point << 6) | ((unsigned char)str[i] & 0x3F);
+    }
+    return code_point < 0x10000 ? code_point : 0xD800 + ((code_point - 0x10000) >> 10);
+}
+
+// RFC 8785 orders keys by UTF-16 code units. That only differs from UTF-8
+// byte order where a code point past U+FFFF meets one in U+E000..U+FFFF, so
+// bytes are compared first and only the code points where they part are
+// decoded.
+static int compareKeysUTF16(char *a, char *b)
+{
+    u_int64_t i = 0;
+    while (a[i] == b[i])
+    {
+        if (a[i] == NULL_CHAR)
+        {
+            return 0;
+        }
+        i++;
+    }
+    u_int64_t code_point_start = i;
+    while (code_point_start > 0 && ((unsigned char)a[code_point_start] & 0xC0) == 0x80)
+    {
+        code_point_start--;
+    }
+    u_int32_t unit_a = utf16LeadUnit(a + code_point_start);
+    u_int32_t unit_b = utf16LeadUnit(b + code_point_start);
+    if (unit_a != unit_b)
+    {
+        return unit_a < unit_b ? -1 : 1;
+    }
+    // same high surrogate, low surrogates follow byte order
+    return (unsigned char)a[i] < (unsigned char)b[i] ? -1 : 1;
+}
+
+static inline int writerCompareKeys(JSONWriter *writer, char *a, char *b)
+{
+    return writer->canonical ? compareKeysUTF16(a, b) : strcmp(a, b);
+}
+
+// Bottom-up merge sort over entries, scratch holds entry_count pointers.
+// Stable, and never more than n log n key comparisons.
+static void sortEntries(JSONWriter *writer, JSONValue **entries, JSONValue **scratch, u_int32_t entry_count)
+{
+    JSONValue **from = entries;
+    JSONValue **to = scratch;
+    for (u_int32_t width = 1; width < entry_count; width *= 2)
+    {
+        for (u_int32_t left = 0; left < entry_count; left += 2 * width)
+        {
+            u_int32_t middle = left + width < entry_count ? left + width : entry_count;
+            u_int32_t right = middle + width < entry_count ? middle + width : entry_count;
+            u_int32_t i = left;
+            u_int32_t j = middle;
+            u_int32_t k = left;
+            while (i < middle && j < right)
+            {
+                to[k++] = writerCompareKeys(writer, from[j]->key, from[i]->key) < 0 ? from[j++] : from[i++];
+            }
+            while (i < middle)
+            {
+                to[k++] = from[i++];
+            }
+            while (j < right)
+            {
+                to[k++] = from[j++];
+            }
+        }
+        JSONValue **swap = from;
+        from = to;
+        to = swap;
+    }
+    if (from != entries)
+    {
+        memcpy(entries, from, sizeof(JSONValue *) * entry_count);
+    }
+}
+
+static bool writerObject(JSONWriter *writer, HashMap *map)
+{
+    if (!JSONWriterBeginObject(writer))
+    {
+        return false;
+    }
+    JSONValue **entries = map->entries;
+    u_int32_t entry_count = map->entries_used;
+    if (writer->sort_keys && map->size > 1)
+    {
+        // second half is the merge sort's scratch space
+        entries = malloc(sizeof(JSONValue *) * map->size * 2);
+        if (entries == NULL)
+        {
+            return writerFail(writer, ENOMEM);
+        }
+        entry_count = 0;
+        for (u_int32_t i = 0; i < map->entries_used; i++)
+        {
+            if (map->entries[i] != NULL)
+            {
+                entries[entry_count++] = map->entries[i];
+            }
+        }
+        sortEntries(writer, entries, entries + map->size, entry_count);
+    }
+    bool ok = true;
+    for (u_int32_t i = 0; ok && i < entry_count; i++)
+    {
+        if (entries[i] != NULL)
+        {
+            ok = JSONWriterKey(writer, entries[i]->key) && JSONWriterValue(writer, entries[i]);
+        }
+    }
+    if (entries != map->entries)
+    {
+        free(entries);
+    }
+    return ok && JSONWriterEndObject(writer);
+}
+
+// Width of json_value written on a single line, counting stops once it
+// passes limit.
+static u_int64_t inlineWidth(JSONValue *json_value, u_int64_t limit)
+{
+    char number[JSON_NUMBER_CHAR_MAX];
+    switch (json_value->value_type)
+    {
+    case JSONOBJ_t:
+    {
+        HashMap *map = json_value->value;
+        u_int64_t width = 2;
+        for (u_int32_t i = 0; i < map->entries_used && width <= limit; i++)
+        {
+            JSONValue *map_entry = map->entries[i];
+            if (map_entry != NULL)
+            {
+                // ", " after the first member, quotes and ": "
+                width += (width > 2 ? 2 : 0) + JSONEscapedLength(map_entry->key, strlen(map_entry->key)) + 4 + inlineWidth(map_entry, limit);
+            }
+        }
+        return width;
+    }
+    case JSONLIST_t:
+    {
+        DynamicArray *dynamic_array = json_value->value;
+        u_int64_t width = 2;
+        if (dynamic_array->storage == DYN_ARR_COLUMNAR)
+        {
+            return dynamic_array->size == 0 ? width : limit + 1;
+        }
+        for (u_int32_t i = 0; i < dynamic_array->size && width <= limit; i++)
+        {
+            width += i == 0 ? 0 : 2; // ", "
+            switch (dynamic_array->storage)
+            {
+            case DYN_ARR_PACKED_INT:
+                width += JSONFormatInt64(dynamic_array->ints[i], number);
+                break;
+            case DYN_ARR_PACKED_DOUBLE:
+                width += JSONFormatDouble(dynamic_array->doubles[i], number);
+                break;
+            case DYN_ARR_PACKED_BOOL:
+                width += JSONBitsetGet(dynamic_array->bools, i) ? strlen(JSON_BOOL_TRUE) : strlen(JSON_BOOL_FALSE);
+                break;
+            default:
+                width += inlineWidth(DynamicArrayGetAtIndex(dynamic_array, i), limit);
+                break;
+            }
+        }
+        return width;
+    }
+    case JSONNUMBER_INT_t:
+        return JSONFormatInt64(*(int64_t *)json_value->value, number);
+    case JSONNUMBER_DOUBLE_t:
+        return JSONFormatDouble(*(double *)json_value->value, number);
+    case JSONSTRING_t:
+        return JSONEscapedLength(json_value->value, strlen(json_value->value)) + 2;
+    case JSONBOOL_t:
+        return *(bool *)json_value->value ? strlen(JSON_BOOL_TRUE) : strlen(JSON_BOOL_FALSE);
+    default:
+        return strlen(JSON_NULL);
+    }
+}
+
+static bool writerList(JSONWriter *writer, DynamicArray *dynamic_array)
+{
+    if (!JSONWriterBeginArray(writer))
+    {
+        return false;
+    }
+    bool ok = true;
+    switch (dynamic_array->storage)
+    {
+    case DYN_ARR_COLUMNAR:
+        ok = writerColumnarRows(writer, dynamic_array->columns, dynamic_array->size);
+        break;
+    case DYN_ARR_PACKED_INT:
+        for (u_int32_t i = 0; ok && i < dynamic_array->size; i++)
+        {
+            ok = JSONWriterInt(writer, dynamic_array->ints[i]);
+        }
+        break;
+    case DYN_ARR_PACKED_DOUBLE:
+        for (u_int32_t i = 0; ok && i < dynamic_array->size; i++)
+        {
+            ok = JSONWriterDouble(writer, dynamic_array->doubles[i]);
+        }
+        break;
+    case DYN_ARR_PACKED_BOOL:
+        for (u_int32_t i = 0; ok && i < dynamic_array->size; i++)
+        {
+            ok = JSONWriterBool(writer, JSONBitsetGet(dynamic_array->bools, i));
+        }
+        break;
+    default:
+    {
+        JSONArrayIter iter;
+        ok = JSONArrayIterInit(&iter, dynamic_array);
+        for (JSONValue *element = NULL; ok && (element = JSONArrayIterNext(&iter)) != NULL;)
+        {
+            ok = JSONWriterValue(writer, element);
+        }
+        break;
+    }
+    }
+    return ok && JSONWriterEndArray(writer);
+}
+
+// Cached text is compact and in insertion order, any other layout ignores it.
+static inline bool writerUsesTextCache(JSONWriter *writer)
+{
+    return writer->cache_text && writer->indent_width == 0 && !writer->sort_keys && !writer->canonical;
+}
+
+static bool writerRecordCachedText(JSONWriter *writer, JSONTextCache *cache, u_int64_t start, u_int64_t len)
+{
+    if (writer->cached_text_count == writer->cached_text_capacity)
+    {
+        u_int32_t capacity = writer->cached_text_capacity == 0 ? JSON_WRITER_DEFAULT_DEPTH : writer->cached_text_capacity * 2;
+        JSONWriterCachedText *cached_texts = realloc(writer->cached_texts, sizeof(JSONWriterCachedText) * capacity);
+        if (cached_texts == NULL)
+        {
+            errno = ENOMEM;
+            return false;
+        }
+        writer->cached_texts = cached_texts;
+        writer->cached_text_capacity = capacity;
+    }
+    writer->cached_texts[writer->cached_text_count++] = (JSONWriterCachedText){cache, start, len};
+    return true;
+}
+
+// The outermost cached container, len bytes at start, was just written: it
+// and every container recorded inside it share one copy of its text. Without
+// that copy the containers still written out get no text but are clean
+// anyway, so a later change inside them still reaches their ancestors.
+static void writerShareCachedTexts(JSONWriter *writer, u_int64_t start, u_int64_t len)
+{
+    JSONTextBuffer *buffer = JSONTextBufferInit(writer->buffer + start, len);
+    for (u_int32_t i = 0; i < writer->cached_text_count; i++)
+    {
+        JSONWriterCachedText *cached_text = &writer->cached_texts[i];
+        if (buffer != NULL)
+        {
+            JSONTextCacheShare(cached_text->cache, buffer, cached_text->start - start, cached_text->len);
+        }
+        else if (cached_text->cache->dirty)
+        {
+            FreeJSONTextCache(cached_text->cache);
+        }
+        cached_text->cache->dirty = false;
+    }
+    writer->cached_text_count = 0;
+}
+
+// A clean container is copied from its cache. Otherwise it is written out
+// and, when the sink keeps the whole output in buffer, what was written
+// becomes the new cache. Containers inside it only record where their text
+// is, so a document takes one copy of its text instead of one per level.
+static bool writerCachedContainer(JSONWriter *writer, JSONValue *json_value, JSONTextCache *cache)
+{
+    // frozen containers can be read from several threads at once
+    bool keeps_text = !JSONValueIsFrozen(json_value) && (writer->sink_type == JSONWriterSinkMemory || writer->sink_type == JSONWriterSinkBuffer);
+    if (!cache->dirty && cache->text != NULL)
+    {
+        if (!writerBeforeValue(writer))
+        {
+            return false;
+        }
+        writerAfterValue(writer);
+        u_int64_t start = writer->buffer_len;
+        if (!writerPutReference(writer, cache->text, cache->text_len))
+        {
+            return false;
+        }
+        // moved into the enclosing text, which frees the one it had
+        if (keeps_text && writer->cache_depth != 0)
+        {
+            (void)writerRecordCachedText(writer, cache, start, cache->text_len);
+        }
+        return true;
+    }
+    u_int64_t start = writer->buffer_len;
+    writer->cache_depth++;
+    bool ok = json_value->value_type == JSONOBJ_t ? writerObject(writer, json_value->value) : writerList(writer, json_value->value);
+    writer->cache_depth--;
+    if (ok && keeps_text)
+    {
+        // skip the separator written in front of the container
+        if (writer->buffer[start] == COMMA_CHAR)
+        {
+            start++;
+        }
+        u_int64_t len = writer->buffer_len - start;
+        if (len < JSON_TEXT_CACHE_MIN_LEN || !writerRecordCachedText(writer, cache, start, len))
+        {
+            FreeJSONTextCache(cache);
+            cache->dirty = false;
+        }
+    }
+    if (writer->cache_depth == 0)
+    {
+        if (ok && writer->cached_text_count != 0)
+        {
+            writerShareCachedTexts(writer, start, writer->buffer_len - start);
+        }
+        writer->cached_text_count = 0;
+    }
+    return ok;
+}
+
+// Writes json_value and everything below it; inside an object the key has
+// to be written first, the key stored on json_value is ignored.
+extern bool JSONWriterValue(JSONWriter *writer, JSONValue *json_value)
+{
+    if (writer == NULL || json_value == NULL || (json_value->value == NULL && json_value->value_type != JSONNULL_t))
+    {
+        errno = EINVAL;
+        return false;
+    }
+    JSONTextCache *cache = JSONValueTextCache(json_value);
+    if (cache != NULL && writerUsesTextCache(writer))
+    {
+        return writerCachedContainer(writer, json_value, cache);
+    }
+    switch (json_value->value_type)
+    {
+    case JSONOBJ_t:
+        writer->pending_inline = writer->indent_width != 0 && writer->max_inline_width != 0 && inlineWidth(json_value, writerInlineLimit(writer)) <= writerInlineLimit(writer);
+        return writerObject(writer, json_value->value);
+    case JSONLIST_t:
+        writer->pending_inline = writer->indent_width != 0 && writer->max_inline_width != 0 && inlineWidth(json_value, writerInlineLimit(writer)) <= writerInlineLimit(writer);
+        return writerList(writer, json_value->value);
+    case JSONNUMBER_INT_t:
+        return JSONWriterInt(writer, *(int64_t *)json_value->value);
+    case JSONNUMBER_DOUBLE_t:
+        return JSONWriterDouble(writer, *(double *)json_value->value);
+    case JSONSTRING_t:
+        return JSONWriterString(writer, json_value->value);
+    case JSONBOOL_t:
+        return JSONWriterBool(writer, *(bool *)json_value->value);
+    case JSONNULL_t:
+        return JSONWriterNull(writer);
+    default:
+        errno = EINVAL;
+        return false;
+    }
+}
+
+static bool writerDocument(JSONWriter *writer, JSONValue *json_value, u_int32_t flags)
+{
+    if (flags & (JSON_WRITE_PRETTY | JSON_WRITE_SORT_KEYS))
+    {
+        (void)JSONWriterSetPretty(writer, (flags & JSON_WRITE_PRETTY) ? JSON_PRETTY_DEFAULT_INDENT : 0, flags & JSON_WRITE_SORT_KEYS, JSON_PRETTY_DEFAULT_INLINE_WIDTH);
+    }
+    if (flags & JSON_WRITE_CANONICAL)
+    {
+        (void)JSONWriterSetCanonical(writer, true);
+    }
+    writer->cache_text = flags & JSON_WRITE_CACHE;
+    bool ok = JSONWriterValue(writer, json_value);
+    if (ok && (flags & JSON_WRITE_NEWLINE))
+    {
+        ok = writerPutChar(writer, NEWLINE_CHAR);
+    }
+    return ok;
+}
+
+// Exact number of bytes JSONValueToStringInto or JSONWriteToFd produce for
+// json_value with flags, not counting a terminating NUL. 0 on failure.
+extern u_int64_t JSONValueSerializedLength(JSONValue *json_value, u_int32_t flags)
+{
+    if (json_value == NULL)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+    JSONWriter *writer = JSONWriterInitCount();
+    if (writer == NULL)
+    {
+        return 0;
+    }
+    u_int64_t length = writerDocument(writer, json_value, flags) ? writer->bytes_written : 0;
+    FreeJSONWriter(writer);
+    return length;
+}
+
+extern u_int64_t JSONSerializedLength(JSON *json, u_int32_t flags)
+{
+    if (json == NULL)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+    return JSONValueSerializedLength(json->root, flags);
+}
+
+// Writes json_value and a NUL into buffer, returns the length without the
+// NUL. Returns 0 with errno ENOBUFS when buffer_capacity is too small, use
+// JSONValueSerializedLength + 1 to size it.
+extern u_int64_t JSONValueToStringInto(JSONValue *json_value, char *buffer, u_int64_t buffer_capacity, u_int32_t flags)
+{
+    if (json_value == NULL || buffer == NULL)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+    JSONWriter *writer = JSONWriterInitBuffer(buffer, buffer_capacity);
+    if (writer == NULL)
+    {
+        return 0;
+    }
+    bool ok = writerDocument(writer, json_value, flags) && writerPutChar(writer, NULL_CHAR);
+    u_int64_t length = ok ? writer->bytes_written - 1 : 0;
+    int saved_errno = errno;
+    FreeJSONWriter(writer);
+    errno = saved_errno;
+    return length;
+}
+
+extern u_int64_t JSONToStringInto(JSON *json, char *buffer, u_int64_t buffer_capacity)
+{
+    if (json == NULL)
+    {
+        errno = EINVAL;
+        return 0;
+    }
+    return JSONValueToStringInto(json->root, buffer, buffer_capacity, JSON_WRITE_DEFAULT);
+}
+
+// Serializes json to fd through a vectored writer: copied bytes and
+// references to long strings are handed to writev together.
+extern bool JSONWriteToFd(JSON *json, int fd, u_int32_t flags)
+{
+    if (json == NULL || json->root == NULL || fd < 0)
+    {
+        errno = EINVAL;
+        return false;
+    }
+    JSONWriter *writer = jsonWriterInit(JSONWriterSinkVectoredFd, JSON_WRITER_BUFFER_SIZE);
+    if (writer == NULL)
+    {
+        return false;
+    }
+    writer->fd = fd;
+    writer->iovecs = malloc(sizeof(struct iovec) * JSON_WRITER_MAX_IOVECS);
+    if (writer->iovecs == NULL)
+    {
+        FreeJSONWriter(writer);
+        errno = ENOMEM;
+        return false;
+    }
+    bool ok = writerDocument(writer, json->root, flags) && JSONWriterFlush(writer);
+    if (ok && (flags & JSON_WRITE_FSYNC) && fsync(fd) != 0)
+    {
+        ok = false;
+    }
+    int saved_errno = errno;
+    FreeJSONWriter(writer);
+    errno = saved_errno;
+    return ok;
+}